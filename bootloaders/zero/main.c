@@ -28,6 +28,7 @@
 #include "board_driver_jtag.h"
 #include "sam_ba_usb.h"
 #include "sam_ba_cdc.h"
+#include "sam_ba_dfu.h"
 
 extern uint32_t __sketch_vectors_ptr; // Exported value from linker script
 extern void board_init(void);
@@ -106,6 +107,15 @@ static void check_start_application(void)
       return;
     }
 
+#ifdef SAM_BA_DFU
+    if (BOOT_DOUBLE_TAP_DATA == DFU_MAGIC)
+    {
+      /* The sketch detached for a DFU download, stay in bootloader */
+      BOOT_DOUBLE_TAP_DATA = 0;
+      return;
+    }
+#endif
+
 #ifdef HAS_EZ6301QI
     // wait a tiny bit for the EZ6301QI to settle,
     // as it's connected to RESETN and might reset
@@ -277,4 +287,8 @@ void SysTick_Handler(void)
   LED_pulse();
 
   sam_ba_monitor_sys_tick();
+
+#ifdef SAM_BA_DFU
+  sam_ba_dfu_sys_tick();
+#endif
 }
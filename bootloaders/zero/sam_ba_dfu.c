@@ -0,0 +1,319 @@
+/*
+  Copyright (c) 2015 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <string.h>
+#include "sam_ba_dfu.h"
+#include "sam_ba_usb.h"
+#include "board_driver_usb.h"
+
+#ifdef SAM_BA_DFU
+
+extern uint32_t __sketch_vectors_ptr; // Exported value from linker script
+
+/* Time given to the DETACH control transfer before the reset (ms) */
+#define DFU_DETACH_DELAY        (50u)
+
+/* Longest wait for the data stage of a DNLOAD (ms) */
+#define DFU_RECEIVE_TIMEOUT     (500u)
+
+static uint8_t dfu_state = DFU_STATE_IDLE;
+static uint8_t dfu_status = DFU_STATUS_OK;
+
+static uint32_t dfu_address;    /* flash address of the next block */
+static uint32_t dfu_erased;     /* flash is erased up to this address */
+static uint32_t dfu_pending;    /* bytes of dfu_block not programmed yet */
+static uint16_t dfu_block_num;  /* wBlockNum of the next DNLOAD */
+static volatile uint32_t dfu_reset_ticks;
+static volatile uint32_t dfu_receive_ticks;
+
+static __attribute__((__aligned__(4))) uint8_t dfu_block[DFU_TRANSFER_SIZE];
+
+static uint32_t page_size(void)
+{
+  return 8u << NVMCTRL->PARAM.bit.PSZ;
+}
+
+static uint32_t flash_size(void)
+{
+  return page_size() * NVMCTRL->PARAM.bit.NVMP;
+}
+
+/*
+ * Erase the rows up to end. The rows are erased just ahead of the write
+ * pointer, as far as the image goes, instead of the whole sketch area.
+ */
+static void dfu_erase(uint32_t end)
+{
+  uint32_t row_size = page_size() * 4;
+
+  while (dfu_erased < end)
+  {
+    // Execute "ER" Erase Row
+    NVMCTRL->ADDR.reg = dfu_erased / 2;
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_ER;
+    while (NVMCTRL->INTFLAG.bit.READY == 0)
+      ;
+    dfu_erased += row_size;
+  }
+}
+
+static void dfu_start(void)
+{
+  dfu_address = (uint32_t)&__sketch_vectors_ptr;
+  dfu_erased = dfu_address;
+  dfu_block_num = 0;
+
+#ifndef SECURE_BY_DEFAULT
+  if (NVMCTRL->STATUS.bit.SB != 0)
+#endif
+  {
+    // Like the SAM-BA monitor does when secured: never leave parts of the
+    // previous sketch around for a new one to read
+    dfu_erase(flash_size());
+  }
+}
+
+/*
+ * Program the pending block, then read it back. The block starts on a page,
+ * see sam_ba_dfu_request().
+ */
+static uint8_t dfu_program(void)
+{
+  uint32_t page_words = page_size() / 4;
+  uint32_t *src_addr = (uint32_t *)dfu_block;
+  uint32_t *dst_addr = (uint32_t *)dfu_address;
+  uint32_t size = (dfu_pending + 3) / 4;
+  uint32_t i;
+
+  dfu_erase(dfu_address + dfu_pending);
+
+  // Set automatic page write
+  NVMCTRL->CTRLB.bit.MANW = 0;
+
+  // Do writes in pages
+  while (size)
+  {
+    // Execute "PBC" Page Buffer Clear
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_PBC;
+    while (NVMCTRL->INTFLAG.bit.READY == 0)
+      ;
+
+    // Fill page buffer
+    for (i = 0; i < page_words && i < size; i++)
+    {
+      dst_addr[i] = src_addr[i];
+    }
+
+    // Execute "WP" Write Page
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_WP;
+    while (NVMCTRL->INTFLAG.bit.READY == 0)
+      ;
+
+    // Advance to next page
+    dst_addr += i;
+    src_addr += i;
+    size     -= i;
+  }
+
+  if (memcmp((void *)dfu_address, dfu_block, dfu_pending) != 0)
+  {
+    return DFU_STATUS_ERR_VERIFY;
+  }
+
+  dfu_address += dfu_pending;
+  dfu_pending = 0;
+  return DFU_STATUS_OK;
+}
+
+/*
+ * Receive the data stage of a DNLOAD straight into dfu_block, as a single
+ * multi-packet transfer on the control endpoint. False if the host did not
+ * send the whole of it in time.
+ */
+static bool dfu_receive(Usb *pUsb, uint16_t length)
+{
+  UsbDeviceDescBank *bank = &usb_endpoint_table[0].DeviceDescBank[0];
+  bool received = true;
+
+  bank->ADDR.reg = (uint32_t)dfu_block;
+  bank->PCKSIZE.bit.MULTI_PACKET_SIZE = (length + USB_EP_OUT_SIZE - 1) & ~(USB_EP_OUT_SIZE - 1);
+  bank->PCKSIZE.bit.BYTE_COUNT = 0;
+  pUsb->DEVICE.DeviceEndpoint[0].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
+  pUsb->DEVICE.DeviceEndpoint[0].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK0RDY;
+
+  /* Wait for the last packet, or a short one */
+  dfu_receive_ticks = DFU_RECEIVE_TIMEOUT;
+  while (!(pUsb->DEVICE.DeviceEndpoint[0].EPINTFLAG.bit.TRCPT0))
+  {
+    if (dfu_receive_ticks == 0)
+    {
+      received = false;
+      break;
+    }
+  }
+  if (bank->PCKSIZE.bit.BYTE_COUNT != length)
+  {
+    received = false;
+  }
+
+  /* Back to the control buffer for the status stage and the next SETUP */
+  bank->ADDR.reg = (uint32_t)&udd_ep_out_cache_buffer[0];
+  bank->PCKSIZE.bit.MULTI_PACKET_SIZE = 8;
+  bank->PCKSIZE.bit.BYTE_COUNT = 0;
+  pUsb->DEVICE.DeviceEndpoint[0].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
+  pUsb->DEVICE.DeviceEndpoint[0].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK0RDY;
+
+  /* Pad the last word with erased flash */
+  memset(dfu_block + length, 0xFF, (4 - (length & 3)) & 3);
+  return received;
+}
+
+/*----------------------------------------------------------------------------
+ * \brief Handle a DFU class request. Called before the Bank 0 of the control
+ * endpoint is released, so that a DNLOAD can receive in place.
+ */
+void sam_ba_dfu_request(Usb *pUsb, uint16_t request, uint16_t wValue, uint16_t wLength)
+{
+  uint8_t status[6];
+
+  if ((request == DFU_DNLOAD) && wLength)
+  {
+    if ((dfu_state == DFU_STATE_IDLE) || (dfu_state == DFU_STATE_DNLOAD_IDLE))
+    {
+      if (dfu_state == DFU_STATE_IDLE)
+      {
+        dfu_start();
+      }
+
+      /* Blocks come in order and each one starts on a page: only the last
+       * one may be shorter than a whole number of pages */
+      if ((wValue != dfu_block_num) || (wLength > DFU_TRANSFER_SIZE) ||
+          (dfu_address & (page_size() - 1)) || (dfu_address + wLength > flash_size()))
+      {
+        dfu_status = DFU_STATUS_ERR_ADDRESS;
+      }
+      else if (dfu_receive(pUsb, wLength))
+      {
+        dfu_pending = wLength;
+        dfu_block_num++;
+        dfu_state = DFU_STATE_DNLOAD_SYNC;
+        USB_SendZlp(pUsb);
+        return;
+      }
+    }
+    /* Refused: the data stage is stalled */
+    pUsb->DEVICE.DeviceEndpoint[0].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK0RDY;
+    goto stall;
+  }
+
+  /* No data stage to receive */
+  pUsb->DEVICE.DeviceEndpoint[0].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK0RDY;
+
+  switch (request)
+  {
+    case DFU_DNLOAD:
+      /* Zero length: end of the image, every block is already in flash */
+      if (dfu_state != DFU_STATE_DNLOAD_IDLE)
+      {
+        dfu_status = DFU_STATUS_ERR_NOTDONE;
+        goto stall;
+      }
+      dfu_state = DFU_STATE_MANIFEST_SYNC;
+      USB_SendZlp(pUsb);
+    return;
+
+    case DFU_GETSTATUS:
+      /* The block is reported done before it is programmed: the host sends
+       * the next DNLOAD while the flash is written, and its data stage is
+       * NAKed until then. A failure shows up in the next GETSTATUS. */
+      if (dfu_state == DFU_STATE_DNLOAD_SYNC)
+      {
+        dfu_state = DFU_STATE_DNLOAD_IDLE;
+      }
+      else if (dfu_state == DFU_STATE_MANIFEST_SYNC)
+      {
+        dfu_state = DFU_STATE_IDLE;
+      }
+
+      status[0] = dfu_status;
+      status[1] = 0;    // bwPollTimeout
+      status[2] = 0;
+      status[3] = 0;
+      status[4] = dfu_state;
+      status[5] = 0;    // iString
+      USB_Write(pUsb, (const char *)status, SAM_BA_MIN(sizeof(status), wLength), USB_EP_CTRL);
+
+      if (dfu_pending)
+      {
+        dfu_status = dfu_program();
+        if (dfu_status != DFU_STATUS_OK)
+        {
+          dfu_state = DFU_STATE_ERROR;
+        }
+      }
+    return;
+
+    case DFU_GETSTATE:
+      USB_Write(pUsb, (const char *)&dfu_state, 1, USB_EP_CTRL);
+    return;
+
+    case DFU_CLRSTATUS:
+    case DFU_ABORT:
+      dfu_state = DFU_STATE_IDLE;
+      dfu_status = DFU_STATUS_OK;
+      dfu_pending = 0;
+      USB_SendZlp(pUsb);
+    return;
+
+    case DFU_DETACH:
+      /* Start the new sketch once the request is acknowledged */
+      dfu_reset_ticks = DFU_DETACH_DELAY;
+      USB_SendZlp(pUsb);
+    return;
+
+    default:
+    break;
+  }
+
+stall:
+  if (dfu_status == DFU_STATUS_OK)
+  {
+    dfu_status = DFU_STATUS_ERR_STALLEDPKT;
+  }
+  dfu_state = DFU_STATE_ERROR;
+  USB_SendStall(pUsb, false);
+  USB_SendStall(pUsb, true);
+}
+
+void sam_ba_dfu_sys_tick(void)
+{
+  if (dfu_receive_ticks)
+  {
+    dfu_receive_ticks--;
+  }
+
+  if (dfu_reset_ticks && !(--dfu_reset_ticks))
+  {
+#if defined(BOOT_DOUBLE_TAP_ADDRESS)
+    BOOT_DOUBLE_TAP_DATA = 0;
+#endif
+    NVIC_SystemReset();
+  }
+}
+
+#endif // SAM_BA_DFU
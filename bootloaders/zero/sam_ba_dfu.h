@@ -0,0 +1,87 @@
+/*
+  Copyright (c) 2015 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _SAM_BA_DFU_H_
+#define _SAM_BA_DFU_H_
+
+#include <sam.h>
+#include <stdbool.h>
+#include "board_definitions.h"
+
+/*
+ * USB DFU 1.1 interface, next to the CDC one. It is left out of the
+ * UART only builds, and of the boards where it does not fit in the 8KB.
+ */
+#if (defined(SAM_BA_USBCDC_ONLY) || defined(SAM_BA_BOTH_INTERFACES)) && \
+    !defined(SAM_BA_NO_DFU) && !defined(ENABLE_JTAG_LOAD)
+#define SAM_BA_DFU
+#endif
+
+#define DFU_INTERFACE_NUMBER    (2u)
+
+/* Bytes taken by one DNLOAD request, a multiple of the flash row size */
+#define DFU_TRANSFER_SIZE       (4096u)
+
+/* Left in BOOT_DOUBLE_TAP_ADDRESS by the sketch's DFU runtime interface to
+ * restart in the bootloader (see cores/arduino/Reset.cpp) */
+#define DFU_MAGIC               (0xDF0B007Ful)
+
+/* DFU class requests, (bRequest << 8) | bmRequestType */
+#define DFU_DETACH              (0x0021u)
+#define DFU_DNLOAD              (0x0121u)
+#define DFU_UPLOAD              (0x02A1u)
+#define DFU_GETSTATUS           (0x03A1u)
+#define DFU_CLRSTATUS           (0x0421u)
+#define DFU_GETSTATE            (0x05A1u)
+#define DFU_ABORT               (0x0621u)
+
+/* bmAttributes of the functional descriptor */
+#define DFU_CAN_DNLOAD                (0x01u)
+#define DFU_MANIFESTATION_TOLERANT    (0x04u)
+#define DFU_WILL_DETACH               (0x08u)
+
+/* bState */
+#define DFU_STATE_IDLE                (2u)
+#define DFU_STATE_DNLOAD_SYNC         (3u)
+#define DFU_STATE_DNLOAD_IDLE         (5u)
+#define DFU_STATE_MANIFEST_SYNC       (6u)
+#define DFU_STATE_ERROR               (10u)
+
+/* bStatus */
+#define DFU_STATUS_OK                 (0x00u)
+#define DFU_STATUS_ERR_WRITE          (0x03u)
+#define DFU_STATUS_ERR_VERIFY         (0x07u)
+#define DFU_STATUS_ERR_ADDRESS        (0x08u)
+#define DFU_STATUS_ERR_NOTDONE        (0x09u)
+#define DFU_STATUS_ERR_STALLEDPKT     (0x0Fu)
+
+/**
+ * \brief Handles a DFU class request received on endpoint 0
+ *
+ * \param request (bRequest << 8) | bmRequestType
+ * \param wValue wBlockNum of a DNLOAD
+ */
+void sam_ba_dfu_request(Usb *pUsb, uint16_t request, uint16_t wValue, uint16_t wLength);
+
+/**
+ * \brief System tick function of the DFU interface, times the DNLOAD data
+ * stages and restarts the board once the host asked for the detach
+ */
+void sam_ba_dfu_sys_tick(void);
+
+#endif // _SAM_BA_DFU_H_
@@ -23,12 +23,21 @@
 #include "sam_ba_usb.h"
 #include "board_driver_usb.h"
 #include "sam_ba_cdc.h"
+#include "sam_ba_dfu.h"
 
 #ifndef USB_CURRENT_MA
 // default USB current, report using 100mA, enough for a bootloader
 #define USB_CURRENT_MA 100
 #endif
 
+#ifdef SAM_BA_DFU
+#define CFG_TOTAL_LENGTH    (0x43 + 0x12)  // + DFU interface and functional descriptors
+#define CFG_NUM_INTERFACES  (0x03)
+#else
+#define CFG_TOTAL_LENGTH    (0x43)
+#define CFG_NUM_INTERFACES  (0x02)
+#endif
+
 /* This data array will be copied into SRAM as its length is inferior to 64 bytes,
  * and so can stay in flash.
  */
@@ -58,6 +67,10 @@ const char devDescriptor[] =
 
 /* This data array will be consumed directly by USB_Write() and must be in SRAM.
  * We cannot send data from product internal flash.
+ * It holds the SAM-BA CDC ACM function: a communication interface (interrupt
+ * IN endpoint 3) and a data interface (bulk endpoints 1 IN and 2 OUT). With
+ * SAM_BA_DFU, the DFU mode interface follows, with no endpoint of its own
+ * (DFU runs on the control endpoint), and its DFU functional descriptor.
  */
 static __attribute__((__aligned__(4)))
 char cfgDescriptor[] =
@@ -66,9 +79,9 @@ char cfgDescriptor[] =
   /* Configuration 1 descriptor */
   0x09,   // CbLength
   0x02,   // CbDescriptorType
-  0x43,   // CwTotalLength 2 EP + Control
+  CFG_TOTAL_LENGTH,   // CwTotalLength, all the descriptors below
   0x00,
-  0x02,   // CbNumInterfaces
+  CFG_NUM_INTERFACES, // CbNumInterfaces
   0x01,   // CbConfigurationValue
   0x00,   // CiConfiguration
   0x80,   // CbmAttributes Bus powered without remote wakeup: 0x80, Self powered without remote wakeup: 0xc0
@@ -149,7 +162,31 @@ char cfgDescriptor[] =
   0x02,   // bmAttributes      BULK
   USB_EP_OUT_SIZE,   // wMaxPacketSize
   0x00,
-  0x00    // bInterval
+  0x00,   // bInterval
+
+#ifdef SAM_BA_DFU
+  /* DFU Interface Descriptor, DFU mode */
+  0x09, // bLength
+  0x04, // bDescriptorType
+  DFU_INTERFACE_NUMBER, // bInterfaceNumber
+  0x00, // bAlternateSetting
+  0x00, // bNumEndpoints
+  0xFE, // bInterfaceClass: Application Specific
+  0x01, // bInterfaceSubclass: DFU
+  0x02, // bInterfaceProtocol: DFU mode
+  0x00, // iInterface
+
+  /* DFU Functional Descriptor */
+  0x09, // bLength
+  0x21, // bDescriptorType: DFU FUNCTIONAL
+  DFU_CAN_DNLOAD | DFU_MANIFESTATION_TOLERANT | DFU_WILL_DETACH, // bmAttributes
+  0xE8, // wDetachTimeOut: 1000 ms
+  0x03,
+  DFU_TRANSFER_SIZE & 0xFF, // wTransferSize
+  DFU_TRANSFER_SIZE >> 8,
+  0x10, // bcdDFUVersion: 1.1
+  0x01,
+#endif
 };
 
 #ifndef STRING_MANUFACTURER
@@ -184,6 +221,15 @@ void sam_ba_usb_CDC_Enumerate(P_USB_CDC pCdc)
   wLength       = (udd_ep_out_cache_buffer[0][6] & 0xFF);
   wLength      |= (udd_ep_out_cache_buffer[0][7] << 8);
 
+#ifdef SAM_BA_DFU
+  /* DFU requests release the Bank 0 themselves, a DNLOAD receives its data in place */
+  if (((bmRequestType & 0x7F) == 0x21) && (wIndex == DFU_INTERFACE_NUMBER))
+  {
+    sam_ba_dfu_request(pUsb, (bRequest << 8) | bmRequestType, wValue, wLength);
+    return;
+  }
+#endif
+
   /* Clear the Bank 0 ready flag on Control OUT */
   pUsb->DEVICE.DeviceEndpoint[0].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK0RDY;
 
@@ -325,6 +371,19 @@ void sam_ba_usb_CDC_Enumerate(P_USB_CDC pCdc)
     break;
 
     case STD_SET_INTERFACE:
+      /* Only the default alternate setting exists */
+      if (wValue == 0)
+      {
+        /* Send ZLP */
+        USB_SendZlp(pUsb);
+      }
+      else
+      {
+        /* Stall the request */
+        USB_SendStall(pUsb, true);
+      }
+    break;
+
     case STD_CLEAR_FEATURE_ZERO:
       /* Stall the request */
       USB_SendStall(pUsb, true);
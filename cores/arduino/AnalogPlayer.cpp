@@ -0,0 +1,173 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <Arduino.h>
+
+#include "AnalogPlayer.h"
+#include "DMA.h"
+#include "wiring_private.h"
+
+// Wait for synchronization of registers between the clock domains
+static inline void syncDAC()
+{
+  while (DAC->STATUS.bit.SYNCBUSY == 1)
+    ;
+}
+
+// The DAC output, VOUT on PA02
+static void dacPinPeripheral()
+{
+  for (uint32_t pin = 0; pin < PINS_COUNT; pin++) {
+    if (g_APinDescription[pin].ulPort == PORTA && g_APinDescription[pin].ulPin == 2) {
+      pinPeripheral(pin, PIO_ANALOG);
+      return;
+    }
+  }
+}
+
+AnalogPlayerClass::AnalogPlayerClass() :
+  _channel(-1),
+  _buffer(NULL),
+  _half(0),
+  _playing(false),
+  _streaming(false),
+  _callback(NULL)
+{
+  _timer.setTimer(TC3);
+}
+
+void AnalogPlayerClass::setTimer(Tc* tc)
+{
+  _timer.setTimer(tc);
+}
+
+void AnalogPlayerClass::setTimer(Tcc* tcc)
+{
+  _timer.setTimer(tcc);
+}
+
+bool AnalogPlayerClass::start(uint32_t rate)
+{
+  stop();
+
+  // each overflow moves the buffered value to the output
+  if (!_timer.begin(rate) || !_timer.connect(EVSYS_ID_USER_DAC_START)) {
+    _timer.end();
+    return false;
+  }
+
+  DMA.begin();
+  _channel = DMA.allocateChannel();
+  if (_channel < 0) {
+    DMA.end();
+    _timer.end();
+    return false;
+  }
+
+  dacPinPeripheral();
+
+  syncDAC();
+  DAC->CTRLA.bit.ENABLE = 0x00;
+  syncDAC();
+  DAC->EVCTRL.reg = DAC_EVCTRL_STARTEI;
+  DAC->CTRLA.bit.ENABLE = 0x01;
+  syncDAC();
+
+  // the next value is written as soon as the buffer is empty
+  DMA.setTriggerSource(_channel, DAC_DMAC_ID_EMPTY);
+  DMA.setTransferWidth(_channel, 16);
+  DMA.incSrc(_channel);
+  DMA.onTransferComplete(_channel, transferDone);
+
+  return true;
+}
+
+bool AnalogPlayerClass::play(const uint16_t* samples, size_t count, uint32_t rate, bool loop)
+{
+  if (samples == NULL || count == 0 || count > 32767 || !start(rate)) {
+    return false;
+  }
+
+  _streaming = false;
+  _playing = true;
+  if (loop) {
+    DMA.transferLoop(_channel, (void*)samples, (void*)&DAC->DATABUF.reg, count * sizeof(uint16_t));
+  } else {
+    DMA.transfer(_channel, (void*)samples, (void*)&DAC->DATABUF.reg, count * sizeof(uint16_t));
+  }
+  _timer.start();
+
+  return true;
+}
+
+bool AnalogPlayerClass::stream(uint16_t* buffer, size_t samples, uint32_t rate, AnalogPlayerCallback callback)
+{
+  if (buffer == NULL || samples < 2 || (samples & 1) || samples > 65534 || !start(rate)) {
+    return false;
+  }
+
+  _buffer = buffer;
+  _half = samples / 2;
+  _callback = callback;
+  _streaming = true;
+  _playing = true;
+  DMA.transferPingPong(_channel, buffer, (void*)&DAC->DATABUF.reg, _half * sizeof(uint16_t));
+  _timer.start();
+
+  return true;
+}
+
+void AnalogPlayerClass::stop()
+{
+  if (_channel < 0) {
+    return;
+  }
+
+  _timer.end();
+  DMA.freeChannel(_channel);
+  DMA.end();
+  _channel = -1;
+  _playing = false;
+
+  // the DAC back to analogWrite(), holding the last value
+  syncDAC();
+  DAC->CTRLA.bit.ENABLE = 0x00;
+  syncDAC();
+  DAC->EVCTRL.reg = 0;
+  DAC->CTRLA.bit.ENABLE = 0x01;
+  syncDAC();
+}
+
+void AnalogPlayerClass::transferDone(int channel)
+{
+  AnalogPlayerClass& player = AnalogPlayer;
+
+  if (!player._streaming) {
+    // the last value is in the buffer, out at the next overflow
+    player._playing = false;
+    return;
+  }
+
+  if (player._callback) {
+    // the half not in progress was just played
+    size_t done = DMA.activeBlock(channel) ? 0 : 1;
+    player._callback(player._buffer + done * player._half, player._half);
+  }
+}
+
+AnalogPlayerClass AnalogPlayer;
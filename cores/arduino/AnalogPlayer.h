@@ -0,0 +1,74 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+#include <Arduino.h>
+#include "SampleTimer.h"
+
+// Called from the DMA interrupt with the half of the buffer just played, to refill
+typedef void (*AnalogPlayerCallback)(uint16_t* samples, size_t count);
+
+/*
+  Waveform output on the DAC, without the CPU: a timer starts the DAC at
+  each sample through the event system, which moves the buffered value to
+  the output at once, and a DMA channel writes the next value to the buffer
+  as soon as it is empty. Sample times are exact, with no jitter.
+
+  The samples are 10 bit DAC values. Playing, from memory:
+  - play(): the samples once, or over and over
+  - stream(): two halves of a buffer one after the other, forever. The
+    callback refills the half just played while the other one plays.
+
+  The timer is TC3 unless set otherwise, and is taken over, see SampleTimer.
+  analogWrite() and analogRead() must not be used on the DAC pin meanwhile.
+  The output stays at the last value after the end.
+*/
+class AnalogPlayerClass
+{
+  public:
+    AnalogPlayerClass();
+
+    void setTimer(Tc* tc);
+    void setTimer(Tcc* tcc);
+
+    // Up to 32767 samples
+    bool play(const uint16_t* samples, size_t count, uint32_t rate, bool loop = false);
+    // 'samples' is even, up to 65534
+    bool stream(uint16_t* buffer, size_t samples, uint32_t rate, AnalogPlayerCallback callback);
+    void stop();
+
+    // False once a play() without loop is over
+    bool playing() { return _playing; }
+
+    // Rate the timer was set to
+    uint32_t sampleRate() { return _timer.rate(); }
+
+  private:
+    bool start(uint32_t rate);
+    static void transferDone(int channel);
+
+    SampleTimer _timer;
+    int _channel;
+    uint16_t* _buffer;
+    size_t _half;
+    volatile bool _playing;
+    bool _streaming;
+    AnalogPlayerCallback _callback;
+};
+
+extern AnalogPlayerClass AnalogPlayer;
@@ -0,0 +1,430 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <Arduino.h>
+
+#include "AnalogSampler.h"
+#include "DMA.h"
+#include "wiring_private.h"
+
+// Wait for synchronization of registers between the clock domains
+static inline void syncADC()
+{
+  while (ADC->STATUS.bit.SYNCBUSY == 1)
+    ;
+}
+
+// Bits converted, which is also the conversion time in ADC clock half cycles
+static uint32_t conversionBits()
+{
+  switch (ADC->CTRLB.bit.RESSEL) {
+    case ADC_CTRLB_RESSEL_8BIT_Val:
+      return 8;
+
+    case ADC_CTRLB_RESSEL_10BIT_Val:
+      return 10;
+
+    default:
+      return 12;
+  }
+}
+
+// Conversions accumulated by the ADC for each result, see analogReadAveraging()
+static uint32_t accumulated()
+{
+  if (ADC->CTRLB.bit.RESSEL != ADC_CTRLB_RESSEL_16BIT_Val) {
+    return 1;
+  }
+  return 1ul << ADC->AVGCTRL.bit.SAMPLENUM;
+}
+
+// ADC clock half cycles per sample at 'rate', with the prescaler
+static uint32_t halfCycles(uint32_t prescaler, uint32_t rate)
+{
+  return (2 * (SystemCoreClock >> (prescaler + 2)) + rate / 2) / rate;
+}
+
+// Fastest samples per second, with the fastest ADC clock within the rated
+// 2.1MHz (48MHz/32) and the shortest sampling time
+static uint32_t maxRate(uint32_t minSampleLength)
+{
+  uint32_t clock = SystemCoreClock >> (ADC_CTRLB_PRESCALER_DIV32_Val + 2);
+
+  return 2 * clock / (minSampleLength + 1 + conversionBits()) / accumulated();
+}
+
+// Free running, a sample takes SAMPLEN + 1 half cycles of sampling and then
+// the conversion, for each accumulated conversion: the prescaler and sampling
+// time nearest to the rate. Past maxRate(), the ADC runs at that rate.
+static void setRate(uint32_t rate, uint32_t minSampleLength)
+{
+  uint32_t bits = conversionBits();
+  rate *= accumulated();
+  uint32_t prescaler = ADC_CTRLB_PRESCALER_DIV32_Val;
+  uint32_t cycles = halfCycles(prescaler, rate);
+
+  while (cycles > bits + 64 && prescaler < ADC_CTRLB_PRESCALER_DIV512_Val) {
+    prescaler++;
+    cycles = halfCycles(prescaler, rate);
+  }
+
+  uint32_t sampleLength = (cycles > bits + 1) ? cycles - bits - 1 : 0;
+  if (sampleLength > 63) {
+    sampleLength = 63;
+  }
+  if (sampleLength < minSampleLength) {
+    sampleLength = minSampleLength;
+  }
+
+  ADC->CTRLB.bit.PRESCALER = prescaler;
+  syncADC();
+  ADC->SAMPCTRL.reg = ADC_SAMPCTRL_SAMPLEN(sampleLength);
+  syncADC();
+}
+
+AnalogSamplerClass::AnalogSamplerClass() :
+  _timed(false),
+  _channel(-1),
+  _muxChannel(-1),
+  _channels(0),
+  _buffer(NULL),
+  _samples(0),
+  _half(0),
+  _blocks(0),
+  _readBlock(0),
+  _readOffset(0),
+  _overrun(false),
+  _callback(NULL)
+{
+}
+
+bool AnalogSamplerClass::begin(pin_size_t pin, uint32_t rate, uint16_t* buffer, size_t samples)
+{
+  return begin(&pin, 1, rate, buffer, samples);
+}
+
+bool AnalogSamplerClass::begin(const pin_size_t* pins, size_t count, uint32_t rate, uint16_t* buffer, size_t samples)
+{
+  if (_channel >= 0 || buffer == NULL || rate == 0 || count == 0 || count > ANALOG_SAMPLER_MAX_PINS ||
+      samples == 0 || samples % (2 * count) != 0 || samples > 65534) {
+    return false;
+  }
+
+  // ADC inputs, and whether they follow each other
+  uint8_t mux[ANALOG_SAMPLER_MAX_PINS];
+  bool consecutive = true;
+  for (size_t i = 0; i < count; i++) {
+    pin_size_t pin = pins[i];
+    if (pin < A0) {
+      pin += A0;
+    }
+    if (g_APinDescription[pin].ulADCChannelNumber == No_ADC_Channel) {
+      return false;
+    }
+    mux[i] = g_APinDescription[pin].ulADCChannelNumber;
+    consecutive = consecutive && (mux[i] == mux[0] + i);
+  }
+
+  // timed, each conversion has to be over before the next overflow
+  if (_timer.valid() && rate * count > maxRate(consecutive ? 0 : 7)) {
+    return false;
+  }
+
+  // a sample per timer overflow, the event starts the ADC
+  _timed = _timer.valid();
+  if (_timed && (!_timer.begin(rate * count) || !_timer.connect(EVSYS_ID_USER_ADC_START))) {
+    _timer.end();
+    return false;
+  }
+
+  DMA.begin();
+  _channel = DMA.allocateChannel();
+  _muxChannel = consecutive ? -1 : DMA.allocateChannel();
+  if (_channel < 0 || (!consecutive && _muxChannel < 0)) {
+    if (_channel >= 0) {
+      DMA.freeChannel(_channel);
+    }
+    DMA.end();
+    _channel = -1;
+    _muxChannel = -1;
+    if (_timed) {
+      _timer.end();
+    }
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    pin_size_t pin = (pins[i] < A0) ? pins[i] + A0 : pins[i];
+    pinPeripheral(pin, PIO_ANALOG);
+
+    // Disable DAC, if analogWrite() was used previously to enable the DAC
+    if ((mux[i] == ADC_Channel0) || (mux[i] == DAC_Channel0)) {
+      while (DAC->STATUS.bit.SYNCBUSY == 1);
+      DAC->CTRLA.bit.ENABLE = 0x00;
+      while (DAC->STATUS.bit.SYNCBUSY == 1);
+    }
+  }
+
+  _channels = count;
+  _buffer = buffer;
+  _samples = samples;
+  _half = samples / 2;
+  _blocks = 0;
+  _readBlock = 0;
+  _readOffset = 0;
+  _overrun = false;
+
+  // each result is moved to the buffer, which is filled half by half
+  DMA.setTriggerSource(_channel, ADC_DMAC_ID_RESRDY);
+  DMA.setTransferWidth(_channel, 16);
+  DMA.incDst(_channel);
+  DMA.onTransferComplete(_channel, blockDone);
+
+  syncADC();
+  ADC->CTRLA.bit.ENABLE = 0x00;
+  syncADC();
+
+  // keep what analogRead() set for end()
+  _ctrlB = ADC->CTRLB.reg;
+  _sampCtrl = ADC->SAMPCTRL.reg;
+  _inputCtrl = ADC->INPUTCTRL.reg;
+
+  // timed, the conversions end well within the period
+  uint32_t conversionRate = _timed ? _timer.rate() + _timer.rate() / 4 : rate * count;
+
+  ADC->INPUTCTRL.bit.MUXPOS = mux[0];
+  syncADC();
+  if (consecutive) {
+    // the ADC moves to the next input after each conversion, and back to the first
+    ADC->INPUTCTRL.bit.INPUTOFFSET = 0;
+    syncADC();
+    ADC->INPUTCTRL.bit.INPUTSCAN = count - 1;
+    syncADC();
+    setRate(conversionRate, 0);
+  } else {
+    // At each result, the next conversion has already started sampling the
+    // same input: it is switched to the following one, ahead of the result
+    // being read. The table is one step ahead.
+    for (size_t i = 0; i < count; i++) {
+      _muxTable[i] = mux[(i + 1) % count];
+    }
+    ADC->INPUTCTRL.bit.INPUTSCAN = 0;
+    syncADC();
+    setRate(conversionRate, 7);
+
+    DMA.setTriggerSource(_muxChannel, ADC_DMAC_ID_RESRDY);
+    DMA.setPriorityLevel(_muxChannel, 1);
+    DMA.setTransferWidth(_muxChannel, 8);
+    DMA.incSrc(_muxChannel);
+    // MUXPOS is the first byte of INPUTCTRL
+    DMA.transferLoop(_muxChannel, _muxTable, (void*)&ADC->INPUTCTRL.reg, count);
+  }
+  if (_timed) {
+    ADC->EVCTRL.reg = ADC_EVCTRL_STARTEI;
+  } else {
+    ADC->CTRLB.bit.FREERUN = 1;
+  }
+  syncADC();
+  ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY | ADC_INTFLAG_OVERRUN;
+
+  DMA.transferPingPong(_channel, (void*)&ADC->RESULT.reg, buffer, _half * sizeof(uint16_t));
+
+  ADC->CTRLA.bit.ENABLE = 0x01;
+  syncADC();
+  if (_timed) {
+    _timer.start();
+  } else {
+    // one start, the ADC then converts forever
+    ADC->SWTRIG.bit.START = 1;
+  }
+
+  return true;
+}
+
+void AnalogSamplerClass::end()
+{
+  if (_channel < 0) {
+    return;
+  }
+
+  if (_timed) {
+    _timer.end();
+    ADC->EVCTRL.reg = 0;
+  }
+
+  syncADC();
+  ADC->CTRLA.bit.ENABLE = 0x00;
+  syncADC();
+
+  DMA.freeChannel(_channel);
+  if (_muxChannel >= 0) {
+    DMA.freeChannel(_muxChannel);
+  }
+  DMA.end();
+  _channel = -1;
+  _muxChannel = -1;
+
+  // analogRead() settings back, it starts over on its next call
+  ADC->CTRLB.reg = _ctrlB;
+  syncADC();
+  ADC->SAMPCTRL.reg = _sampCtrl;
+  syncADC();
+  ADC->INPUTCTRL.reg = _inputCtrl;
+  syncADC();
+  ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY | ADC_INTFLAG_OVERRUN;
+  analogReadReset();
+}
+
+void AnalogSamplerClass::setTimer(Tc* tc)
+{
+  _timer.setTimer(tc);
+}
+
+void AnalogSamplerClass::setTimer(Tcc* tcc)
+{
+  _timer.setTimer(tcc);
+}
+
+void AnalogSamplerClass::clearTimer()
+{
+  _timer.setTimer((Tc*)NULL);
+}
+
+uint32_t AnalogSamplerClass::sampleRate()
+{
+  if (_timed && _channel >= 0) {
+    return _timer.rate();
+  }
+
+  uint32_t clock = SystemCoreClock >> (ADC->CTRLB.bit.PRESCALER + 2);
+
+  return 2 * clock / (ADC->SAMPCTRL.bit.SAMPLEN + 1 + conversionBits()) / accumulated();
+}
+
+uint8_t AnalogSamplerClass::resolution()
+{
+  if (ADC->CTRLB.bit.RESSEL != ADC_CTRLB_RESSEL_16BIT_Val) {
+    return conversionBits();
+  }
+
+  // the sum, shifted down to 16 bits by the ADC, then by ADJRES
+  uint32_t bits = 12 + ADC->AVGCTRL.bit.SAMPLENUM;
+  if (bits > 16) {
+    bits = 16;
+  }
+  return bits - ADC->AVGCTRL.bit.ADJRES;
+}
+
+void AnalogSamplerClass::onBlock(AnalogSamplerCallback callback)
+{
+  _callback = callback;
+}
+
+void AnalogSamplerClass::blockDone(int channel)
+{
+  AnalogSamplerClass& sampler = AnalogSampler;
+
+  // a late interrupt may stand for two halves: the one in progress tells
+  uint32_t blocks = sampler._blocks + 1;
+  if ((uint32_t)DMA.activeBlock(channel) != (blocks & 1)) {
+    blocks++;
+  }
+  sampler._blocks = blocks;
+
+  if (sampler._callback) {
+    sampler._callback(sampler._buffer + ((blocks - 1) & 1) * sampler._half, sampler._half);
+  }
+}
+
+// Half being filled, counted like _blocks, and the samples already in it
+void AnalogSamplerClass::position(uint32_t& block, uint32_t& offset)
+{
+  // first the count, which may be behind the DMA if its interrupt is pending
+  block = _blocks;
+
+  int active;
+  uint32_t remaining;
+  do {
+    active = DMA.activeBlock(_channel);
+    remaining = DMA.remaining(_channel) / sizeof(uint16_t);
+  } while (active != DMA.activeBlock(_channel));
+
+  if ((block & 1) != (uint32_t)active) {
+    block++;
+  }
+  offset = _half - remaining;
+}
+
+size_t AnalogSamplerClass::available()
+{
+  if (_channel < 0) {
+    return 0;
+  }
+
+  uint32_t block, offset;
+  position(block, offset);
+
+  // the half before the one being filled is whole, older ones are overwritten
+  if ((int32_t)(block - _readBlock) > 1) {
+    _overrun = true;
+    _readBlock = block - 1;
+    _readOffset = 0;
+  }
+
+  return (block - _readBlock) * _half + offset - _readOffset;
+}
+
+const uint16_t* AnalogSamplerClass::peek(size_t& count)
+{
+  count = available();
+  if (count == 0) {
+    return NULL;
+  }
+
+  size_t index = (_readBlock & 1) * _half + _readOffset;
+  if (count > _samples - index) {
+    count = _samples - index;
+  }
+  return _buffer + index;
+}
+
+void AnalogSamplerClass::consume(size_t count)
+{
+  size_t ready = available();
+  if (count > ready) {
+    count = ready;
+  }
+
+  _readOffset += count;
+  while (_readOffset >= _half) {
+    _readOffset -= _half;
+    _readBlock++;
+  }
+}
+
+bool AnalogSamplerClass::overrun()
+{
+  available();
+
+  bool lost = _overrun || ADC->INTFLAG.bit.OVERRUN;
+  _overrun = false;
+  ADC->INTFLAG.reg = ADC_INTFLAG_OVERRUN;
+  return lost;
+}
+
+AnalogSamplerClass AnalogSampler;
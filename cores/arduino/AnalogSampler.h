@@ -0,0 +1,130 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+#include <Arduino.h>
+#include "SampleTimer.h"
+
+// Most pins scanned, as many as the ADC INPUTSCAN reaches
+#define ANALOG_SAMPLER_MAX_PINS 16
+
+// Called from the DMA interrupt each time half of the buffer is filled
+typedef void (*AnalogSamplerCallback)(const uint16_t* samples, size_t count);
+
+/*
+  Continuous sampling of analog pins into a ring buffer, without the CPU:
+  the ADC runs free, or is started by a timer through the event system, and
+  a DMA channel, triggered by each result, writes the two halves of the
+  buffer one after the other, forever.
+
+  Free running, the rate comes from the ADC clock and sampling time and is
+  approximate. With a timer (setTimer()), each conversion starts on its
+  overflow: the rate is exact to the 48MHz clock, without jitter.
+
+  The samples are the raw ADC results, at the resolution set by
+  analogReadResolution() (8, 10 or 12 bits) or, with analogReadAveraging(),
+  averaged by the ADC up to 16 bits: see resolution(). Either take each half
+  from the callback, or read the buffer as a ring:
+
+    size_t count;
+    const uint16_t* samples = AnalogSampler.peek(count);
+    ...
+    AnalogSampler.consume(count);
+
+  What is not consumed in time is overwritten: overrun() tells.
+  analogRead() must not be used while sampling.
+
+  Several pins are scanned in turn, and the buffer holds frames of one
+  sample per pin, in the order given. Pins on consecutive ADC inputs are
+  scanned by the ADC itself (INPUTSCAN). For other lists, a second DMA
+  channel writes the input of the next conversion from a table at each
+  result: it takes effect during the sampling time, which is then kept to
+  4 ADC clocks or more.
+*/
+class AnalogSamplerClass
+{
+  public:
+    AnalogSamplerClass();
+
+    // 'samples' is even, up to 65534. Free running, the rate is approximate,
+    // from about 2.5ksps up to what the rated ADC clock allows (about
+    // 230ksps at 12 bits), see sampleRate(). With a timer, begin() fails
+    // past that.
+    bool begin(pin_size_t pin, uint32_t rate, uint16_t* buffer, size_t samples);
+    // 'count' pins at 'rate' frames per second. Each half of the buffer holds
+    // whole frames: 'samples' is a multiple of twice 'count'.
+    bool begin(const pin_size_t* pins, size_t count, uint32_t rate, uint16_t* buffer, size_t samples);
+    void end();
+
+    // Conversions started by a TC or TCC, from the next begin(). The timer
+    // is taken over, see SampleTimer.
+    void setTimer(Tc* tc);
+    void setTimer(Tcc* tcc);
+    // Back to free running
+    void clearTimer();
+
+    // Samples per frame
+    size_t channels() { return _channels; }
+    // Rate the ADC was set to, in samples per second: frames come 'channels()'
+    // times slower
+    uint32_t sampleRate();
+    // Bits of the samples
+    uint8_t resolution();
+
+    void onBlock(AnalogSamplerCallback callback);
+
+    // Samples not consumed yet
+    size_t available();
+    // The oldest samples not consumed, as many as are contiguous in the buffer
+    const uint16_t* peek(size_t& count);
+    void consume(size_t count);
+
+    // True if samples were lost since the last call: either overwritten before
+    // they were consumed (reading starts over from the last whole half), or
+    // missed by the DMA
+    bool overrun();
+
+  private:
+    static void blockDone(int channel);
+    void position(uint32_t& block, uint32_t& offset);
+
+    SampleTimer _timer;
+    bool _timed;
+    int _channel;
+    int _muxChannel;            // -1 when the ADC scans by itself
+    uint8_t _muxTable[ANALOG_SAMPLER_MAX_PINS];
+    size_t _channels;
+    uint16_t* _buffer;
+    size_t _samples;
+    size_t _half;
+
+    volatile uint32_t _blocks;  // halves filled
+    // next sample to consume: half number, counted like _blocks, and offset in it
+    uint32_t _readBlock;
+    uint32_t _readOffset;
+    bool _overrun;
+
+    AnalogSamplerCallback _callback;
+
+    // analogRead() settings, back at end()
+    uint16_t _ctrlB;
+    uint8_t _sampCtrl;
+    uint32_t _inputCtrl;
+};
+
+extern AnalogSamplerClass AnalogSampler;
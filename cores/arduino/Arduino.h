@@ -47,6 +47,8 @@ extern "C"{
 // Include board variant
 #include "variant.h"
 
+#include "SystemClock.h"
+
 #define interrupts()    __enable_irq()
 #define noInterrupts()  __disable_irq()
 
@@ -90,6 +92,14 @@ typedef enum _eAnalogReference
  */
 extern void analogReadResolution(int res);
 
+/*
+ * \brief Set the number of ADC conversions behind each analogRead() value, averaged by the ADC.
+ * With 4^n samples, a resolution up to 12 + n bits is converted, rather than scaled from 12 bits.
+ *
+ * \param samples 1 (default) to 1024, rounded down to a power of 2
+ */
+extern void analogReadAveraging(uint32_t samples);
+
 /*
  * \brief Set the resolution of analogWrite parameters. Default is 8 bits (range from 0 to 255).
  *
@@ -97,6 +107,66 @@ extern void analogReadResolution(int res);
  */
 extern void analogWriteResolution(int res);
 
+/*
+ * \brief analogRead() timing presets
+ */
+typedef enum _eAnalogReadMode
+{
+  AR_MODE_PRECISE,  // Default: slow ADC clock, longest sampling time, ADC disabled between reads
+  AR_MODE_FAST      // About 175ksps: fastest rated ADC clock, short sampling time, ADC kept enabled
+} eAnalogReadMode ;
+
+/*
+ * \brief Set the analogRead() timing to one of the presets.
+ *
+ * \param mode
+ */
+extern void analogReadMode(eAnalogReadMode mode);
+
+/*
+ * \brief Set the analogRead() timing.
+ *
+ * \param prescaler ADC clock divider, from ADC_CTRLB_PRESCALER_DIV4_Val to ADC_CTRLB_PRESCALER_DIV512_Val;
+ *        below DIV32 the ADC clock is over its rated 2.1MHz
+ * \param sampleLength Additional sampling time in half ADC clock cycles, 0 to 63
+ * \param keepEnabled Leave the ADC enabled between reads: a read of the same input then takes a single conversion
+ */
+extern void analogReadConfig(uint32_t prescaler, uint32_t sampleLength, bool keepEnabled);
+
+#ifndef ANALOG_READ_QUEUE_SIZE
+#define ANALOG_READ_QUEUE_SIZE 8
+#endif
+
+typedef void (*analogReadCallback)(pin_size_t pin, int value);
+
+/*
+ * \brief Queue a read of the pin, done by the ADC interrupt: the callback gets the value, from the interrupt.
+ * Up to ANALOG_READ_QUEUE_SIZE reads are queued, and carried out in turn. Not to be mixed with analogRead().
+ *
+ * \param pin
+ * \param callback
+ * \return false if the queue is full
+ */
+extern bool analogReadAsync(pin_size_t pin, analogReadCallback callback);
+
+/*
+ * \brief Start a read of the pin, like analogReadAsync() with the value kept for analogReadResult().
+ * One at a time.
+ *
+ * \return false if a read started is not over, or the queue is full
+ */
+extern bool analogReadStart(pin_size_t pin);
+
+/*
+ * \brief True once the read started with analogReadStart() is over.
+ */
+extern bool analogReadPoll(void);
+
+/*
+ * \brief Value of the read started with analogReadStart(), waiting for it if needed.
+ */
+extern int analogReadResult(void);
+
 extern void analogOutputInit( void ) ;
 
 #ifdef __cplusplus
@@ -30,6 +30,7 @@ DMAClass::DMAClass() :
 
   memset(_descriptors, 0x00, sizeof(_descriptors));
   memset(_descriptorsWriteBack, 0x00, sizeof(_descriptorsWriteBack));
+  memset(_descriptorsPong, 0x00, sizeof(_descriptorsPong));
 }
 
 DMAClass::~DMAClass()
@@ -113,7 +114,9 @@ void DMAClass::freeChannel(int channel)
   // select the channel and disable it
   DMAC->CHID.bit.ID = channel;
   DMAC->CHCTRLA.bit.ENABLE = 0;
+  DMAC->CHINTENCLR.reg = DMAC_CHINTENCLR_TERR | DMAC_CHINTENCLR_TCMPL;
 
+  _descriptors[channel].BTCTRL.bit.VALID = 0;
   _channelMask &= ~(1 << channel);
 }
 
@@ -171,43 +174,76 @@ void DMAClass::incDst(int channel)
   _descriptors[channel].BTCTRL.bit.DSTINC = 1;
 }
 
+int DMAClass::beatBytes(int channel)
+{
+  switch (_descriptors[channel].BTCTRL.bit.BEATSIZE) {
+    case DMAC_BTCTRL_BEATSIZE_BYTE_Val:
+    default:
+      return 1;
+
+    case DMAC_BTCTRL_BEATSIZE_HWORD_Val:
+      return 2;
+
+    case DMAC_BTCTRL_BEATSIZE_WORD_Val:
+      return 4;
+  }
+}
+
 int DMAClass::transfer(int channel, void* src, void* dst, uint16_t size)
+{
+  return start(channel, src, dst, size, START_ONCE);
+}
+
+int DMAClass::transferLoop(int channel, void* src, void* dst, uint16_t size)
+{
+  return start(channel, src, dst, size, START_LOOP);
+}
+
+int DMAClass::transferPingPong(int channel, void* src, void* dst, uint16_t size)
+{
+  return start(channel, src, dst, size, START_PINGPONG);
+}
+
+int DMAClass::activeBlock(int channel)
+{
+  // the second block links back to the first one
+  return _descriptorsWriteBack[channel].DESCADDR.bit.DESCADDR == (uint32_t)&_descriptors[channel];
+}
+
+uint16_t DMAClass::remaining(int channel)
+{
+  // the write-back descriptor holds the count of the block in progress
+  return _descriptorsWriteBack[channel].BTCNT.bit.BTCNT * beatBytes(channel);
+}
+
+int DMAClass::start(int channel, void* src, void* dst, uint16_t size, int mode)
 {
   if (_descriptors[channel].BTCTRL.bit.VALID) {
     // transfer in progress, fail
     return 1;
   }
 
+  // this may run from an interrupt (a completion callback) while the
+  // interrupted code has another channel selected: select it back below
+  uint8_t selected = DMAC->CHID.reg;
+
   // select the channel
   DMAC->CHID.bit.ID = channel;
 
   // disable event output generation and block actions
   _descriptors[channel].BTCTRL.bit.EVOSEL = DMAC_BTCTRL_EVOSEL_DISABLE_Val;
-  _descriptors[channel].BTCTRL.bit.BLOCKACT = DMAC_BTCTRL_BLOCKACT_NOACT_Val;
+  // ping-pong blocks interrupt at their end
+  _descriptors[channel].BTCTRL.bit.BLOCKACT = (mode == START_PINGPONG) ? DMAC_BTCTRL_BLOCKACT_INT_Val : DMAC_BTCTRL_BLOCKACT_NOACT_Val;
 
   // map beat size to transfer width in bytes
-  int transferWidth;
-
-  switch (_descriptors[channel].BTCTRL.bit.BEATSIZE) {
-    case DMAC_BTCTRL_BEATSIZE_BYTE_Val:
-    default:
-      transferWidth = 1;
-      break;
-
-    case DMAC_BTCTRL_BEATSIZE_HWORD_Val:
-      transferWidth = 2;
-      break;
-
-    case DMAC_BTCTRL_BEATSIZE_WORD_Val:
-      transferWidth = 4;
-      break;
-  }
+  int transferWidth = beatBytes(channel);
 
-  // set step size to 1, source + destination addresses, no next descriptor block count
+  // set step size to 1, source + destination addresses, next descriptor, block count
   _descriptors[channel].BTCTRL.bit.STEPSIZE = DMAC_BTCTRL_STEPSIZE_X1_Val;
   _descriptors[channel].SRCADDR.bit.SRCADDR = (uint32_t)src;
   _descriptors[channel].DSTADDR.bit.DSTADDR = (uint32_t)dst;
-  _descriptors[channel].DESCADDR.bit.DESCADDR = 0;
+  // a loop links the descriptor to itself
+  _descriptors[channel].DESCADDR.bit.DESCADDR = (mode == START_LOOP) ? (uint32_t)&_descriptors[channel] : 0;
   _descriptors[channel].BTCNT.bit.BTCNT = size / transferWidth;
 
   if (_descriptors[channel].BTCTRL.bit.SRCINC) {
@@ -223,9 +259,34 @@ int DMAClass::transfer(int channel, void* src, void* dst, uint16_t size)
   // validate the descriptor
   _descriptors[channel].BTCTRL.bit.VALID = 1;
 
-  // enable channel and transfer error + complete interrupts
-  DMAC->CHINTENSET.bit.TERR = 1;
-  DMAC->CHINTENSET.bit.TCMPL = 1;
+  if (mode == START_PINGPONG) {
+    // the second block follows the first one in memory, and links back to it
+    DmacDescriptor* pong = &_descriptorsPong[channel];
+
+    memcpy(pong, &_descriptors[channel], sizeof(DmacDescriptor));
+    if (pong->BTCTRL.bit.SRCINC) {
+      pong->SRCADDR.bit.SRCADDR += size;
+    }
+    if (pong->BTCTRL.bit.DSTINC) {
+      pong->DSTADDR.bit.DSTADDR += size;
+    }
+    pong->DESCADDR.bit.DESCADDR = (uint32_t)&_descriptors[channel];
+    _descriptors[channel].DESCADDR.bit.DESCADDR = (uint32_t)pong;
+  }
+
+  // until the first beat, the write-back descriptor tells the whole first block remains
+  memcpy(&_descriptorsWriteBack[channel], &_descriptors[channel], sizeof(DmacDescriptor));
+
+  if (mode == START_LOOP) {
+    // nothing to report at the end of each block
+    DMAC->CHINTENCLR.reg = DMAC_CHINTENCLR_TERR | DMAC_CHINTENCLR_TCMPL;
+  } else {
+    // transfer error + complete interrupts
+    DMAC->CHINTENSET.bit.TERR = 1;
+    DMAC->CHINTENSET.bit.TCMPL = 1;
+  }
+
+  // enable channel
   DMAC->CHCTRLA.bit.ENABLE = 1;
 
 
@@ -234,6 +295,8 @@ int DMAClass::transfer(int channel, void* src, void* dst, uint16_t size)
     DMAC->SWTRIGCTRL.reg |= (1 << channel);
   }
 
+  DMAC->CHID.reg = selected;
+
   return 0;
 }
 
@@ -253,8 +316,10 @@ void DMAClass::onService()
   int channel = DMAC->INTPEND.bit.ID;
   DMAC->CHID.bit.ID = channel;
 
-  // invalidate the channel
-  _descriptors[channel].BTCTRL.bit.VALID = 0;
+  if (_descriptors[channel].DESCADDR.bit.DESCADDR == 0) {
+    // invalidate the channel, a loop fetches its descriptor again
+    _descriptors[channel].BTCTRL.bit.VALID = 0;
+  }
 
   if (DMAC->CHINTFLAG.bit.TERR) {
     // clear the error interrupt and call the error callback if there is one
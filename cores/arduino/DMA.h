@@ -17,9 +17,13 @@
 */
 #pragma once
 
-#define NUM_DMA_CHANNELS 1
+#include <samd.h>
+
+#define NUM_DMA_CHANNELS DMAC_CH_NUM
 
 /*
+  Shared by the core and the libraries: each user allocates its own channels.
+
   WARNING: The API for this class may change and it's not intended for public use!
 */
 class DMAClass
@@ -40,6 +44,16 @@ class DMAClass
     void incSrc(int channel);
     void incDst(int channel);
     int transfer(int channel, void* src, void* dst, uint16_t size);
+    // Repeats the same block until the channel is freed, without interrupts
+    int transferLoop(int channel, void* src, void* dst, uint16_t size);
+    // Two blocks of 'size' bytes, the second one right after the first on the
+    // incrementing side, one after the other until the channel is freed.
+    // The transfer complete callback is called at the end of each block.
+    int transferPingPong(int channel, void* src, void* dst, uint16_t size);
+    // Block of a ping-pong transfer in progress: 0 or 1
+    int activeBlock(int channel);
+    // Bytes not transferred yet in the current block
+    uint16_t remaining(int channel);
 
     void onTransferComplete(int channel, void(*function)(int));
     void onTransferError(int channel, void(*function)(int));
@@ -47,6 +61,10 @@ class DMAClass
     void onService();
 
   private:
+    int beatBytes(int channel);
+    enum { START_ONCE, START_LOOP, START_PINGPONG };
+    int start(int channel, void* src, void* dst, uint16_t size, int mode);
+
     static int _beginCount;
     uint32_t _channelMask;
 
@@ -55,6 +73,8 @@ class DMAClass
 
     DmacDescriptor _descriptors[NUM_DMA_CHANNELS] __attribute__ ((aligned (16)));
     DmacDescriptor _descriptorsWriteBack[NUM_DMA_CHANNELS]  __attribute__ ((aligned (16)));
+    // second block of ping-pong transfers
+    DmacDescriptor _descriptorsPong[NUM_DMA_CHANNELS] __attribute__ ((aligned (16)));
 };
 
 extern DMAClass DMA;
@@ -25,6 +25,11 @@ extern "C" {
 
 #define NVM_MEMORY ((volatile uint16_t *)0x000000)
 
+// Last word of RAM, checked by the bootloader at startup (its
+// BOOT_DOUBLE_TAP_ADDRESS). BOOT_DFU_MAGIC must match the bootloader's.
+#define BOOT_DOUBLE_TAP_DATA (*((volatile uint32_t *)(HMCRAMC0_ADDR + HMCRAMC0_SIZE - 4)))
+#define BOOT_DFU_MAGIC       0xDF0B007Ful
+
 #if (ARDUINO_SAMD_VARIANT_COMPLIANCE >= 10610)
 
 extern const uint32_t __text_start__;
@@ -66,10 +71,26 @@ reset:
 	while (true);
 }
 
+// Restart in the bootloader's DFU mode, the sketch is left in place
+static void dfuReset() {
+	__disable_irq();
+	BOOT_DOUBLE_TAP_DATA = BOOT_DFU_MAGIC;
+	NVIC_SystemReset();
+
+	while (true);
+}
+
 static int ticks = -1;
+static bool toDFU = false;
 
 void initiateReset(int _ticks) {
 	resetExternalChip();
+	toDFU = false;
+	ticks = _ticks;
+}
+
+void initiateDFUReset(int _ticks) {
+	toDFU = true;
 	ticks = _ticks;
 }
 
@@ -81,8 +102,11 @@ void tickReset() {
 	if (ticks == -1)
 		return;
 	ticks--;
-	if (ticks == 0)
+	if (ticks == 0) {
+		if (toDFU)
+			dfuReset();
 		banzai();
+	}
 }
 
 #ifdef __cplusplus
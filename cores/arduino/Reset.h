@@ -23,6 +23,7 @@ extern "C" {
 #endif
 
 void initiateReset(int ms);
+void initiateDFUReset(int ms);
 void tickReset();
 void cancelReset();
 
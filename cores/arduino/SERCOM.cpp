@@ -196,6 +196,26 @@ void SERCOM::disableDataRegisterEmptyInterruptUART()
   sercom->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_DRE;
 }
 
+void SERCOM::enableInterruptsUART()
+{
+  // Same as initUART()
+  sercom->USART.INTENSET.reg = SERCOM_USART_INTENSET_RXC |
+                               SERCOM_USART_INTENSET_ERROR;
+}
+
+void SERCOM::disableInterruptsUART()
+{
+  // The DMA moves the data, reading DATA here would steal bytes from it
+  sercom->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_RXC |
+                               SERCOM_USART_INTENCLR_DRE |
+                               SERCOM_USART_INTENCLR_ERROR;
+}
+
+void* SERCOM::dataRegisterUART()
+{
+  return (void*)&sercom->USART.DATA.reg;
+}
+
 /*	=========================
  *	===== Sercom SPI
  *	=========================
@@ -679,6 +699,26 @@ uint8_t SERCOM::readDataWIRE( void )
 }
 
 
+/*	=========================
+ *	===== Sercom DMA
+ *	=========================
+*/
+// The SERCOMs are laid out every 0x400 bytes, with their RX and TX
+// triggers in the same order (SERCOM0 RX = 1, SERCOM0 TX = 2, ...)
+int SERCOM::dmaTriggerSourceRX()
+{
+  uint32_t index = ((uint32_t)sercom - (uint32_t)SERCOM0) / 0x400;
+
+  return SERCOM0_DMAC_ID_RX + 2 * index;
+}
+
+int SERCOM::dmaTriggerSourceTX()
+{
+  uint32_t index = ((uint32_t)sercom - (uint32_t)SERCOM0) / 0x400;
+
+  return SERCOM0_DMAC_ID_TX + 2 * index;
+}
+
 void SERCOM::initClockNVIC( void )
 {
   uint8_t clockId = 0;
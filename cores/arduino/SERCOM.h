@@ -167,6 +167,13 @@ class SERCOM
 		void acknowledgeUARTError() ;
 		void enableDataRegisterEmptyInterruptUART();
 		void disableDataRegisterEmptyInterruptUART();
+		void enableInterruptsUART();
+		void disableInterruptsUART();
+		void* dataRegisterUART( void ) ;
+
+		/* ========== DMA ========== */
+		int dmaTriggerSourceRX( void ) ;
+		int dmaTriggerSourceTX( void ) ;
 
 		/* ========== SPI ========== */
 		void initSPI(SercomSpiTXPad mosi, SercomRXPad miso, SercomSpiCharSize charSize, SercomDataOrder dataOrder) ;
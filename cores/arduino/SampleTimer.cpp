@@ -0,0 +1,234 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <Arduino.h>
+
+#include "SampleTimer.h"
+
+// event system channels in use, by all timers
+uint32_t SampleTimer::_eventChannels = 0;
+
+// clock divider of each PRESCALER value, as a shift
+static const uint8_t prescalerShifts[] = { 0, 1, 2, 3, 4, 6, 8, 10 };
+
+// GCLK id, event generator and DMA trigger of each timer
+struct TimerInfo {
+  void* timer;
+  uint8_t clockId;
+  uint8_t eventGenerator;
+  uint8_t dmaTrigger;
+};
+
+static const TimerInfo timers[] = {
+  { TCC0, GCM_TCC0_TCC1, EVSYS_ID_GEN_TCC0_OVF, TCC0_DMAC_ID_OVF },
+  { TCC1, GCM_TCC0_TCC1, EVSYS_ID_GEN_TCC1_OVF, TCC1_DMAC_ID_OVF },
+  { TCC2, GCM_TCC2_TC3,  EVSYS_ID_GEN_TCC2_OVF, TCC2_DMAC_ID_OVF },
+  { TC3,  GCM_TCC2_TC3,  EVSYS_ID_GEN_TC3_OVF,  TC3_DMAC_ID_OVF },
+  { TC4,  GCM_TC4_TC5,   EVSYS_ID_GEN_TC4_OVF,  TC4_DMAC_ID_OVF },
+  { TC5,  GCM_TC4_TC5,   EVSYS_ID_GEN_TC5_OVF,  TC5_DMAC_ID_OVF },
+#if defined(TC6)
+  { TC6,  GCM_TC6_TC7,   EVSYS_ID_GEN_TC6_OVF,  TC6_DMAC_ID_OVF },
+#endif
+#if defined(TC7)
+  { TC7,  GCM_TC6_TC7,   EVSYS_ID_GEN_TC7_OVF,  TC7_DMAC_ID_OVF },
+#endif
+};
+
+static const TimerInfo* timerInfo(void* timer)
+{
+  for (size_t i = 0; i < sizeof(timers) / sizeof(timers[0]); i++) {
+    if (timers[i].timer == timer) {
+      return &timers[i];
+    }
+  }
+  return NULL;
+}
+
+SampleTimer::SampleTimer() :
+  _tc(NULL),
+  _tcc(NULL),
+  _ticks(0),
+  _eventChannel(-1),
+  _eventUser(0)
+{
+}
+
+void SampleTimer::setTimer(Tc* tc)
+{
+  _tc = tc;
+  _tcc = NULL;
+}
+
+void SampleTimer::setTimer(Tcc* tcc)
+{
+  _tc = NULL;
+  _tcc = tcc;
+}
+
+// Wait for synchronization of registers between the clock domains
+void SampleTimer::sync()
+{
+  if (_tc) {
+    while (_tc->COUNT16.STATUS.bit.SYNCBUSY);
+  } else {
+    while (_tcc->SYNCBUSY.reg & TCC_SYNCBUSY_MASK);
+  }
+}
+
+bool SampleTimer::begin(uint32_t rate)
+{
+  const TimerInfo* info = timerInfo(_tc ? (void*)_tc : (void*)_tcc);
+  if (info == NULL || rate == 0 || rate > SystemCoreClock) {
+    return false;
+  }
+
+  GCLK->CLKCTRL.reg = (uint16_t) (GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_ID(info->clockId));
+  while (GCLK->STATUS.bit.SYNCBUSY);
+
+  // The smallest prescaler that fits the period in 16 bits
+  uint32_t ticks = (SystemCoreClock + rate / 2) / rate;
+  uint32_t prescaler = 0;
+  uint32_t period = ticks;
+  while (period > 0x10000 && prescaler < sizeof(prescalerShifts) - 1) {
+    prescaler++;
+    period = (ticks + (1ul << (prescalerShifts[prescaler] - 1))) >> prescalerShifts[prescaler];
+  }
+  if (period > 0x10000) {
+    period = 0x10000;
+  }
+  if (period < 2) {
+    period = 2;
+  }
+  _ticks = period << prescalerShifts[prescaler];
+
+  if (_tc) {
+    _tc->COUNT16.CTRLA.bit.ENABLE = 0;
+    sync();
+    _tc->COUNT16.CTRLA.bit.SWRST = 1;
+    while (_tc->COUNT16.CTRLA.bit.SWRST);
+
+    // Match frequency: counts up to CC0 and starts over
+    _tc->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ | TC_CTRLA_PRESCALER(prescaler);
+    sync();
+    _tc->COUNT16.CC[0].reg = period - 1;
+    sync();
+    _tc->COUNT16.EVCTRL.reg = TC_EVCTRL_OVFEO;
+  } else {
+    _tcc->CTRLA.bit.ENABLE = 0;
+    sync();
+    _tcc->CTRLA.bit.SWRST = 1;
+    while (_tcc->SYNCBUSY.bit.SWRST);
+
+    _tcc->CTRLA.reg = TCC_CTRLA_PRESCALER(prescaler);
+    _tcc->WAVE.reg = TCC_WAVE_WAVEGEN_NFRQ;
+    sync();
+    _tcc->PER.reg = period - 1;
+    sync();
+    _tcc->EVCTRL.reg = TCC_EVCTRL_OVFEO;
+  }
+
+  return true;
+}
+
+void SampleTimer::end()
+{
+  if (!valid()) {
+    return;
+  }
+
+  stop();
+
+  if (_eventChannel >= 0) {
+    // detach the user, then free the channel
+    EVSYS->USER.reg = EVSYS_USER_USER(_eventUser) | EVSYS_USER_CHANNEL(0);
+    EVSYS->CHANNEL.reg = EVSYS_CHANNEL_CHANNEL(_eventChannel);
+    _eventChannels &= ~(1ul << _eventChannel);
+    _eventChannel = -1;
+  }
+
+  if (_tc) {
+    _tc->COUNT16.EVCTRL.reg = 0;
+  } else {
+    _tcc->EVCTRL.reg = 0;
+  }
+}
+
+void SampleTimer::start()
+{
+  if (_tc) {
+    _tc->COUNT16.CTRLA.bit.ENABLE = 1;
+  } else if (_tcc) {
+    _tcc->CTRLA.bit.ENABLE = 1;
+  }
+  if (valid()) {
+    sync();
+  }
+}
+
+void SampleTimer::stop()
+{
+  if (_tc) {
+    _tc->COUNT16.CTRLA.bit.ENABLE = 0;
+  } else if (_tcc) {
+    _tcc->CTRLA.bit.ENABLE = 0;
+  }
+  if (valid()) {
+    sync();
+  }
+}
+
+uint32_t SampleTimer::rate()
+{
+  return _ticks ? SystemCoreClock / _ticks : 0;
+}
+
+bool SampleTimer::connect(uint8_t user)
+{
+  const TimerInfo* info = timerInfo(_tc ? (void*)_tc : (void*)_tcc);
+  if (info == NULL || _eventChannel >= 0) {
+    return false;
+  }
+
+  int channel = -1;
+  for (int i = 0; i < EVSYS_CHANNELS; i++) {
+    if ((_eventChannels & (1ul << i)) == 0) {
+      channel = i;
+      break;
+    }
+  }
+  if (channel < 0) {
+    return false;
+  }
+  _eventChannels |= (1ul << channel);
+  _eventChannel = channel;
+  _eventUser = user;
+
+  PM->APBCMASK.reg |= PM_APBCMASK_EVSYS;
+
+  // the asynchronous path needs no clock, and the users here take it
+  EVSYS->USER.reg = EVSYS_USER_USER(user) | EVSYS_USER_CHANNEL(channel + 1);
+  EVSYS->CHANNEL.reg = EVSYS_CHANNEL_CHANNEL(channel) | EVSYS_CHANNEL_EVGEN(info->eventGenerator) |
+                       EVSYS_CHANNEL_PATH_ASYNCHRONOUS;
+  return true;
+}
+
+int SampleTimer::dmaTrigger()
+{
+  const TimerInfo* info = timerInfo(_tc ? (void*)_tc : (void*)_tcc);
+  return info ? info->dmaTrigger : 0;
+}
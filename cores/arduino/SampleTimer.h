@@ -0,0 +1,65 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+#include <Arduino.h>
+
+/*
+  A TC or TCC overflowing at a sample rate, from the 48MHz clock. Each
+  overflow is an event, routed by the event system to a peripheral (ADC or
+  DAC start), and a DMA trigger: sampling is paced by hardware, without
+  interrupt latency.
+
+  The timer is taken over: meanwhile it must not be used by analogWrite() on
+  its pins, tone() (TC5) or servos (TC4).
+*/
+class SampleTimer
+{
+  public:
+    SampleTimer();
+
+    void setTimer(Tc* tc);
+    void setTimer(Tcc* tcc);
+    bool valid() { return _tc != NULL || _tcc != NULL; }
+
+    // Set up stopped, at the nearest rate the clock divides to
+    bool begin(uint32_t rate);
+    void end();
+    void start();
+    void stop();
+
+    // Rate it was set to
+    uint32_t rate();
+
+    // Overflow event to an event user (EVSYS_ID_USER_...), while begun.
+    // False if all event channels are taken.
+    bool connect(uint8_t user);
+    // DMA trigger source of the overflow
+    int dmaTrigger();
+
+  private:
+    void sync();
+
+    Tc* _tc;
+    Tcc* _tcc;
+    uint32_t _ticks;        // clock cycles per overflow
+    int _eventChannel;
+    uint8_t _eventUser;
+
+    static uint32_t _eventChannels;
+};
@@ -0,0 +1,73 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Boot phases, in microseconds since reset. A phase that has not been
+ * reached yet reads 0.
+ *
+ * When SystemInit() finds the DFLL values saved by a previous boot, the
+ * CPU runs at 48MHz at once and the 32kHz reference and the DFLL lock come
+ * later, in the background: 'reference' and 'locked' are then greater
+ * than 'init'.
+ */
+typedef struct {
+  uint32_t clock;      // CPU running at 48MHz
+  uint32_t init;       // end of SystemInit()
+  uint32_t reference;  // 32kHz oscillator running
+  uint32_t locked;     // DFLL locked on its reference
+  uint32_t setup;      // setup() called
+} BootTime;
+
+extern BootTime bootTime;
+
+// Microseconds since reset
+uint32_t bootMicros(void);
+
+// True once the DFLL is locked on its reference. Under CRYSTALLESS the
+// reference is the USB Start-Of-Frame, so this needs a USB host.
+bool clockLocked(void);
+
+// Waits for clockLocked(). Under CRYSTALLESS it only waits for the 32kHz
+// oscillator, the lock needs USB frames that may never come.
+void waitClockLock(void);
+
+// Called from the SysTick handler: watches the 32kHz oscillator and the
+// DFLL lock, without writing any clock register
+void tickClock(void);
+
+// Called from delay() and the main loop, does nothing from an interrupt:
+// switches the DFLL to its reference once the 32kHz oscillator runs, and
+// reads its values once locked
+void updateClock(void);
+
+// Called from the main loop: updateClock(), then saves the locked DFLL
+// values for the next boot
+void serviceClock(void);
+
+#ifdef __cplusplus
+}
+#endif
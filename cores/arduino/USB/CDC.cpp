@@ -19,6 +19,7 @@
 #include <Arduino.h>
 #include <Reset.h> // Needed for auto-reset with 1200bps port touch
 #include "CDC.h"
+#include "CDCBridge.h"
 #include "USBAPI.h"
 #include "SAMD21_USBDevice.h"
 
@@ -40,15 +41,7 @@ extern USBDevice_SAMD21G18x usbd;
 
 extern USBDeviceClass USBDevice;
 
-typedef struct {
-	uint32_t dwDTERate;
-	uint8_t bCharFormat;
-	uint8_t bParityType;
-	uint8_t bDataBits;
-	uint8_t lineState;
-} LineInfo;
-
-static volatile LineInfo _usbLineInfo = {
+static const LineInfo defaultLineInfo = {
 	115200, // dWDTERate
 	0x00,   // bCharFormat
 	0x00,   // bParityType
@@ -56,14 +49,14 @@ static volatile LineInfo _usbLineInfo = {
 	0x00    // lineState
 };
 
-static volatile int32_t breakValue = -1;
+Serial_ *Serial_::rootSerial = NULL;
 
 // CDC
 #define CDC_ACM_INTERFACE  pluggedInterface              // CDC ACM
 #define CDC_DATA_INTERFACE uint8_t(pluggedInterface + 1) // CDC Data
 #define CDC_ENDPOINT_ACM   pluggedEndpoint
-#define CDC_ENDPOINT_OUT   pluggedEndpoint + 1
-#define CDC_ENDPOINT_IN    pluggedEndpoint + 2
+#define CDC_ENDPOINT_OUT   uint8_t(pluggedEndpoint + 1) // OUT and IN share the
+#define CDC_ENDPOINT_IN    uint8_t(pluggedEndpoint + 1) // number (bank 0 / bank 1)
 
 #define CDC_RX CDC_ENDPOINT_OUT
 #define CDC_TX CDC_ENDPOINT_IN
@@ -107,6 +100,12 @@ static void utox8(uint32_t val, char* s) {
 }
 
 uint8_t Serial_::getShortName(char* name) {
+	// Only the first port contributes the chip serial number, otherwise
+	// the iSerial string would overflow with 3 ports
+	if (this != rootSerial) {
+		return 0;
+	}
+
 	// from section 9.3.3 of the datasheet
 	#define SERIAL_NUMBER_WORD_0	*(volatile uint32_t*)(0x0080A00C)
 	#define SERIAL_NUMBER_WORD_1	*(volatile uint32_t*)(0x0080A040)
@@ -123,6 +122,15 @@ uint8_t Serial_::getShortName(char* name) {
 void Serial_::handleEndpoint(int /* ep */) {
 }
 
+void Serial_::handleEndpoints(int ep) {
+	for (Serial_ *s = rootSerial; s; s = s->nextSerial) {
+		if (ep >= s->pluggedEndpoint && ep < s->pluggedEndpoint + s->numEndpoints) {
+			s->handleEndpoint(ep);
+			return;
+		}
+	}
+}
+
 bool Serial_::setup(USBSetup& setup)
 {
 	uint8_t requestType = setup.bmRequestType;
@@ -148,11 +156,17 @@ bool Serial_::setup(USBSetup& setup)
 		if (r == CDC_SET_LINE_CODING)
 		{
 			USBDevice.recvControl((void*)&_usbLineInfo, 7);
+			if (_bridge) {
+				_bridge->lineCodingChanged();
+			}
 		}
 
 		if (r == CDC_SET_CONTROL_LINE_STATE)
 		{
 			_usbLineInfo.lineState = setup.wValueL;
+			if (_bridge) {
+				_bridge->lineStateChanged();
+			}
 		}
 
 		if (r == CDC_SET_LINE_CODING || r == CDC_SET_CONTROL_LINE_STATE)
@@ -181,12 +195,28 @@ bool Serial_::setup(USBSetup& setup)
 	return false;
 }
 
-Serial_::Serial_(USBDeviceClass &_usb) : PluggableUSBModule(3, 2, epType), usb(_usb), stalled(false)
+Serial_::Serial_(USBDeviceClass &_usb) : PluggableUSBModule(2, 2, epType), usb(_usb), stalled(false),
+	breakValue(-1), _serialPeek(-1), _bridge(NULL), nextSerial(NULL)
 {
+  memcpy((void*)&_usbLineInfo, &defaultLineInfo, sizeof(_usbLineInfo));
+
   epType[0] = USB_ENDPOINT_TYPE_INTERRUPT | USB_ENDPOINT_IN(0);
-  epType[1] = USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_OUT(0);
-  epType[2] = USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_IN(0);
-  PluggableUSB().plug(this);
+  epType[1] = USB_ENDPOINT_PAIR(USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_OUT(0),
+                                USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_IN(0));
+  if (!PluggableUSB().plug(this)) {
+    // Out of endpoints: leave this port out of the CDC list
+    return;
+  }
+
+  if (!rootSerial) {
+    rootSerial = this;
+  } else {
+    Serial_ *current = rootSerial;
+    while (current->nextSerial) {
+      current = current->nextSerial;
+    }
+    current->nextSerial = this;
+  }
 }
 
 void Serial_::enableInterrupt() {
@@ -194,6 +224,12 @@ void Serial_::enableInterrupt() {
 	usbd.epBank0EnableTransferComplete(CDC_ENDPOINT_OUT);
 }
 
+void Serial_::enableInterrupts() {
+	for (Serial_ *s = rootSerial; s; s = s->nextSerial) {
+		s->enableInterrupt();
+	}
+}
+
 void Serial_::begin(uint32_t /* baud_count */)
 {
 	// uart config is ignored in USB-CDC
@@ -209,8 +245,6 @@ void Serial_::end(void)
 	memset((void*)&_usbLineInfo, 0, sizeof(_usbLineInfo));
 }
 
-int _serialPeek = -1;
-
 int Serial_::available(void)
 {
 	return usb.available(CDC_ENDPOINT_OUT) + (_serialPeek != -1);
@@ -266,6 +300,12 @@ void Serial_::clear(void) {
 
 size_t Serial_::write(const uint8_t *buffer, size_t size)
 {
+	if (_bridge) {
+		// the bridge owns the IN endpoint
+		setWriteError();
+		return 0;
+	}
+
 	uint32_t r = usb.send(CDC_ENDPOINT_IN, buffer, size);
 
 	if (r > 0) {
@@ -324,7 +364,7 @@ int32_t Serial_::readBreak() {
 	return ret;
 }
 
-unsigned long Serial_::baud() {
+uint32_t Serial_::baud() {
 	return _usbLineInfo.dwDTERate;
 }
 
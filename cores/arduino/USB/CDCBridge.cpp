@@ -0,0 +1,343 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <Arduino.h>
+#include <DMA.h>
+#include "CDCBridge.h"
+#include "USBAPI.h"
+
+#ifdef CDC_ENABLED
+
+extern USBDevice_SAMD21G18x usbd;
+extern USBDeviceClass USBDevice;
+
+// Free space left in the ring when the Uart's RTS pin stops the sender,
+// about 1.3 ms at 1 Mbps: the ring is checked every Start-Of-Frame
+#define CDC_BRIDGE_RTS_THRESHOLD 128
+
+// The owner of each TX channel, for the DMA callback
+static CDCBridge *txBridges[NUM_DMA_CHANNELS];
+
+CDCBridge::CDCBridge(Serial_ &_serial, Uart &_uart, uint32_t endPoint, int _dtrPin, int _rtsPin) :
+	serial(_serial), uart(_uart), ep(endPoint),
+	dtrPin(_dtrPin), rtsPin(_rtsPin),
+	rxChannel(-1), txChannel(-1),
+	armed(0), queued(-1), queuedLength(0), txBusy(false),
+	tail(0), inFlight(0)
+{
+}
+
+CDCBridge::~CDCBridge()
+{
+}
+
+bool CDCBridge::begin()
+{
+	DMA.begin();
+	rxChannel = DMA.allocateChannel();
+	txChannel = DMA.allocateChannel();
+	if (rxChannel < 0 || txChannel < 0) {
+		if (rxChannel >= 0) {
+			DMA.freeChannel(rxChannel);
+		}
+		if (txChannel >= 0) {
+			DMA.freeChannel(txChannel);
+		}
+		DMA.end();
+		return false;
+	}
+
+	lineCodingChanged();
+
+	SERCOM *sercom = uart.sercom;
+
+	// UART to ring, forever
+	DMA.setTriggerSource(rxChannel, sercom->dmaTriggerSourceRX());
+	DMA.setTransferWidth(rxChannel, 8);
+	DMA.incDst(rxChannel);
+	DMA.transferLoop(rxChannel, sercom->dataRegisterUART(), rxRing, sizeof(rxRing));
+
+	// OUT buffers to UART, one packet at a time
+	DMA.setTriggerSource(txChannel, sercom->dmaTriggerSourceTX());
+	DMA.setTransferWidth(txChannel, 8);
+	DMA.incSrc(txChannel);
+	DMA.onTransferComplete(txChannel, onTxComplete);
+	txBridges[txChannel] = this;
+
+	if (dtrPin >= 0) {
+		pinMode(dtrPin, OUTPUT);
+	}
+	if (rtsPin >= 0) {
+		pinMode(rtsPin, OUTPUT);
+	}
+	lineStateChanged();
+
+	synchronized {
+		// Whatever the default handler still buffers is dropped
+		USBDevice.setHandler(ep, this);
+		if (USBDevice.configured()) {
+			init();
+		}
+	}
+	return true;
+}
+
+void CDCBridge::end()
+{
+	synchronized {
+		// Abort a pending IN transfer, it may point into the ring
+		usbd.epBank1DisableTransferComplete(ep);
+		usbd.epBank1ResetReady(ep);
+		USBDevice.setHandler(ep, NULL);
+	}
+
+	txBridges[txChannel] = NULL;
+	DMA.freeChannel(rxChannel);
+	DMA.freeChannel(txChannel);
+	DMA.end();
+
+	// Back to IrqHandler()
+	uart.rxBuffer.clear();
+	uart.txBuffer.clear();
+	uart.sercom->enableInterruptsUART();
+}
+
+void CDCBridge::lineCodingChanged()
+{
+	uint32_t baud = serial.baud();
+	uint16_t config;
+
+	if (baud == 0) {
+		return;
+	}
+
+	switch (serial.numbits()) {
+		case 5:  config = SERIAL_DATA_5; break;
+		case 6:  config = SERIAL_DATA_6; break;
+		case 7:  config = SERIAL_DATA_7; break;
+		default: config = SERIAL_DATA_8; break;
+	}
+
+	switch (serial.paritytype()) {
+		case Serial_::ODD_PARITY:   config |= SERIAL_PARITY_ODD;   break;
+		case Serial_::EVEN_PARITY:  config |= SERIAL_PARITY_EVEN;  break;
+		case Serial_::MARK_PARITY:  config |= SERIAL_PARITY_MARK;  break;
+		case Serial_::SPACE_PARITY: config |= SERIAL_PARITY_SPACE; break;
+		default:                    config |= SERIAL_PARITY_NONE;  break;
+	}
+
+	switch (serial.stopbits()) {
+		case Serial_::ONE_AND_HALF_STOP_BIT: config |= SERIAL_STOP_BIT_1_5; break;
+		case Serial_::TWO_STOP_BITS:         config |= SERIAL_STOP_BIT_2;   break;
+		default:                             config |= SERIAL_STOP_BIT_1;   break;
+	}
+
+	// The DMA channels keep running across the SERCOM reset: a transfer
+	// to the UART goes on at the new settings
+	uart.begin(baud, config);
+	uart.sercom->disableInterruptsUART();
+}
+
+void CDCBridge::lineStateChanged()
+{
+	// Modem control lines are active low
+	if (dtrPin >= 0) {
+		digitalWrite(dtrPin, serial.dtr() ? LOW : HIGH);
+	}
+	if (rtsPin >= 0) {
+		digitalWrite(rtsPin, serial.rts() ? LOW : HIGH);
+	}
+}
+
+void CDCBridge::init()
+{
+	// Host to UART
+	usbd.epBank0SetSize(ep, 64);
+	usbd.epBank0SetType(ep, 3); // BULK OUT
+	usbd.epBank0EnableTransferComplete(ep);
+	synchronized {
+		// A packet waiting for the DMA is dropped, the buffer being
+		// sent to the UART is left alone
+		queued = -1;
+		arm();
+	}
+
+	// UART to host: a bus reset aborted the IN transfer
+	inFlight = 0;
+	usbd.epBank1AckTransferComplete(ep);
+	usbd.epBank1EnableTransferComplete(ep);
+}
+
+void CDCBridge::arm()
+{
+	// One packet per transfer: without a short packet or a ZLP from the
+	// host, a longer transfer would hold data back
+	usbd.epBank0SetAddress(ep, outBuffer[armed]);
+	usbd.epReleaseOutBank0(ep, EPX_SIZE);
+}
+
+void CDCBridge::startTx(uint8_t buffer, uint16_t length)
+{
+	txBusy = true;
+	DMA.transfer(txChannel, outBuffer[buffer], uart.sercom->dataRegisterUART(), length);
+}
+
+void CDCBridge::onTxComplete(int channel)
+{
+	if (txBridges[channel]) {
+		txBridges[channel]->txComplete();
+	}
+}
+
+void CDCBridge::txComplete()
+{
+	synchronized {
+		if (queued >= 0) {
+			// The host was NAKed, take the next packet
+			startTx(queued, queuedLength);
+			armed = queued ^ 1;
+			queued = -1;
+			arm();
+		} else {
+			txBusy = false;
+		}
+	}
+}
+
+uint32_t CDCBridge::rxHead()
+{
+	// The block count goes down from the ring size, then reloads
+	return (CDC_BRIDGE_RX_SIZE - DMA.remaining(rxChannel)) & (CDC_BRIDGE_RX_SIZE - 1);
+}
+
+void CDCBridge::sendIn()
+{
+	if (inFlight) {
+		return;
+	}
+
+	uint32_t count = (rxHead() - tail) & (CDC_BRIDGE_RX_SIZE - 1);
+	if (count == 0) {
+		return;
+	}
+	if (count > CDC_BRIDGE_RX_SIZE - tail) {
+		// up to the end of the ring, the next transfer starts over at 0
+		count = CDC_BRIDGE_RX_SIZE - tail;
+	}
+
+	uint8_t *data;
+	if ((tail & 3) == 0) {
+		// The USB DMA reads the ring in place. Whole packets only, when
+		// there are several: the rest keeps the next transfer aligned.
+		if (count > EPX_SIZE) {
+			count -= count % EPX_SIZE;
+		}
+		data = rxRing + tail;
+	} else {
+		// The USB DMA needs a word aligned address: copy at most one
+		// packet, cut so that the next transfer is aligned again
+		uint32_t aligned = ((tail + EPX_SIZE) & ~3ul) - tail;
+		if (count > aligned) {
+			count = aligned;
+		}
+		memcpy(inPacket, rxRing + tail, count);
+		data = inPacket;
+	}
+
+	inFlight = count;
+	usbd.epBank1SetAddress(ep, data);
+	usbd.epBank1SetMultiPacketSize(ep, 0);
+	usbd.epBank1SetByteCount(ep, count);
+	// End a transfer of whole packets for the host
+	usbd.epBank1EnableAutoZLP(ep);
+	usbd.epBank1SetReady(ep);
+}
+
+void CDCBridge::startOfFrame()
+{
+	sendIn();
+
+	if (uart.uc_pinRTS != NO_RTS_PIN) {
+		uint32_t used = (rxHead() - tail) & (CDC_BRIDGE_RX_SIZE - 1);
+
+		if (CDC_BRIDGE_RX_SIZE - used < CDC_BRIDGE_RTS_THRESHOLD) {
+			*uart.pul_outsetRTS = uart.ul_pinMaskRTS;
+		} else {
+			*uart.pul_outclrRTS = uart.ul_pinMaskRTS;
+		}
+	}
+}
+
+void CDCBridge::handleEndpoint()
+{
+	// Host to UART
+	if (usbd.epBank0IsTransferComplete(ep)) {
+		usbd.epBank0AckTransferComplete(ep);
+
+		uint16_t received = usbd.epBank0ByteCount(ep);
+		synchronized {
+			if (received == 0) {
+				arm();
+			} else if (!txBusy) {
+				startTx(armed, received);
+				armed ^= 1;
+				arm();
+			} else {
+				// Both buffers are busy: NAK the host until the DMA is done
+				queued = armed;
+				queuedLength = received;
+			}
+		}
+	}
+
+	// UART to host
+	if (usbd.epBank1IsTransferComplete(ep)) {
+		usbd.epBank1AckTransferComplete(ep);
+
+		tail = (tail + inFlight) & (CDC_BRIDGE_RX_SIZE - 1);
+		inFlight = 0;
+		sendIn();
+	}
+}
+
+bool Serial_::bridge(Uart &uart, int dtrPin, int rtsPin)
+{
+	unbridge();
+
+	// pluggedEndpoint + 1 is the data endpoint, see CDC.cpp
+	CDCBridge *b = new CDCBridge(*this, uart, pluggedEndpoint + 1, dtrPin, rtsPin);
+	if (!b->begin()) {
+		delete b;
+		return false;
+	}
+	_bridge = b;
+	return true;
+}
+
+void Serial_::unbridge()
+{
+	CDCBridge *b = _bridge;
+
+	if (b) {
+		_bridge = NULL;
+		b->end();
+		delete b;
+	}
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "SAMD21_USBDevice.h"
+
+#ifdef CDC_ENABLED
+
+class Serial_;
+class Uart;
+
+// Size of the UART to USB ring, a power of 2
+#define CDC_BRIDGE_RX_SIZE 512
+
+// Connects a CDC port to a Uart, see Serial_::bridge(). The bridge takes
+// the data endpoint over from the default handler:
+//
+// - Host to UART: each OUT packet lands in one of two buffers and a DMA
+//   channel, triggered by the SERCOM's data register empty flag, writes
+//   it to the UART. The endpoint is NAKed while both buffers are busy.
+// - UART to host: a DMA channel, triggered by receive complete, fills a
+//   ring forever. The IN endpoint sends from the ring in place, every
+//   Start-Of-Frame and as soon as the previous transfer completes. What
+//   the host does not read in time is overwritten, unless the Uart has
+//   an RTS pin: it stops the sender while the ring is nearly full.
+//
+// The CPU only runs once per packet, never per byte.
+class CDCBridge : public EPHandler {
+public:
+	CDCBridge(Serial_ &serial, Uart &uart, uint32_t endPoint, int dtrPin, int rtsPin);
+	virtual ~CDCBridge();
+
+	bool begin();
+	void end();
+
+	// Called by Serial_ on SET_LINE_CODING and SET_CONTROL_LINE_STATE.
+	// Virtual, so that CDC.cpp does not pull the bridge into every sketch.
+	virtual void lineCodingChanged();
+	virtual void lineStateChanged();
+
+	// EPHandler
+	virtual void init();
+	virtual void startOfFrame();
+	virtual void handleEndpoint();
+	// The host's data goes to the UART, nothing to read here
+	virtual uint32_t recv(void * /* data */, uint32_t /* len */) { return 0; }
+	virtual uint32_t available() { return 0; }
+	virtual int peek() { return -1; }
+
+private:
+	void arm();
+	void startTx(uint8_t buffer, uint16_t length);
+	void txComplete();
+	void sendIn();
+	uint32_t rxHead();
+
+	static void onTxComplete(int channel);
+
+	Serial_ &serial;
+	Uart &uart;
+	const uint32_t ep;
+	const int dtrPin;
+	const int rtsPin;
+	int rxChannel;
+	int txChannel;
+
+	// Host to UART
+	__attribute__((__aligned__(4))) uint8_t outBuffer[2][EPX_SIZE];
+	volatile uint8_t armed;       // receiving from the host
+	volatile int8_t queued;       // full, waiting for the DMA
+	volatile uint16_t queuedLength;
+	volatile bool txBusy;
+
+	// UART to host
+	__attribute__((__aligned__(4))) uint8_t rxRing[CDC_BRIDGE_RX_SIZE];
+	__attribute__((__aligned__(4))) uint8_t inPacket[EPX_SIZE];
+	uint32_t tail;
+	uint32_t inFlight;            // bytes in the IN transfer, 0 when idle
+};
+
+#endif
@@ -28,6 +28,11 @@
 
 typedef uint8_t ep_t;
 
+#if defined(USB_DEVICE_SIMULATION)
+// Host build: a software model of the peripheral with the same interface
+#include <USBDeviceSim.h>
+#else
+
 class USBDevice_SAMD21G18x {
 public:
 	USBDevice_SAMD21G18x() : usb(USB->DEVICE) {
@@ -40,6 +45,9 @@ public:
 	// Reset USB Device
 	inline void reset();
 
+	// Clock the peripheral and route the DM/DP pins to it
+	inline void initClockAndPins();
+
 	// Enable
 	inline void enable()  { usb.CTRLA.bit.ENABLE = 1; }
 	inline void disable() { usb.CTRLA.bit.ENABLE = 0; }
@@ -144,6 +152,9 @@ public:
 	inline void epBank0ResetStallReq(ep_t ep) { usb.DeviceEndpoint[ep].EPSTATUSCLR.bit.STALLRQ0 = 1; }
 	inline void epBank1ResetStallReq(ep_t ep) { usb.DeviceEndpoint[ep].EPSTATUSCLR.bit.STALLRQ1 = 1; }
 
+	inline void epBank0ResetDataToggle(ep_t ep) { usb.DeviceEndpoint[ep].EPSTATUSCLR.bit.DTGLOUT = 1; }
+	inline void epBank1ResetDataToggle(ep_t ep) { usb.DeviceEndpoint[ep].EPSTATUSCLR.bit.DTGLIN = 1; }
+
 	// Packet
 	inline uint16_t epBank0ByteCount(ep_t ep) { return EP[ep].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT; }
 	inline uint16_t epBank1ByteCount(ep_t ep) { return EP[ep].DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT; }
@@ -199,6 +210,26 @@ void USBDevice_SAMD21G18x::reset() {
 	usb.DESCADD.reg = (uint32_t)(&EP);
 }
 
+void USBDevice_SAMD21G18x::initClockAndPins() {
+	// Enable USB clock
+	PM->APBBMASK.reg |= PM_APBBMASK_USB;
+
+	// Set up the USB DP/DN pins
+	PORT->Group[0].PINCFG[PIN_PA24G_USB_DM].bit.PMUXEN = 1;
+	PORT->Group[0].PMUX[PIN_PA24G_USB_DM/2].reg &= ~(0xF << (4 * (PIN_PA24G_USB_DM & 0x01u)));
+	PORT->Group[0].PMUX[PIN_PA24G_USB_DM/2].reg |= MUX_PA24G_USB_DM << (4 * (PIN_PA24G_USB_DM & 0x01u));
+	PORT->Group[0].PINCFG[PIN_PA25G_USB_DP].bit.PMUXEN = 1;
+	PORT->Group[0].PMUX[PIN_PA25G_USB_DP/2].reg &= ~(0xF << (4 * (PIN_PA25G_USB_DP & 0x01u)));
+	PORT->Group[0].PMUX[PIN_PA25G_USB_DP/2].reg |= MUX_PA25G_USB_DP << (4 * (PIN_PA25G_USB_DP & 0x01u));
+
+	// Put Generic Clock Generator 0 as source for Generic Clock Multiplexer 6 (USB reference)
+	GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID(6)     | // Generic Clock Multiplexer 6
+	                    GCLK_CLKCTRL_GEN_GCLK0 | // Generic Clock Generator 0 is source
+	                    GCLK_CLKCTRL_CLKEN;
+	while (GCLK->STATUS.bit.SYNCBUSY)
+		;
+}
+
 void USBDevice_SAMD21G18x::calibrate() {
 	// Load Pad Calibration data from non-volatile memory
 	uint32_t *pad_transn_p = (uint32_t *) USB_FUSES_TRANSN_ADDR;
@@ -221,12 +252,18 @@ void USBDevice_SAMD21G18x::calibrate() {
 	usb.PADCAL.bit.TRIM   = pad_trim;
 }
 
+#endif /* USB_DEVICE_SIMULATION */
+
 /*
  * USB EP generic handlers.
  */
 
 class EPHandler {
 public:
+	// Called when the host selects a configuration (SET_CONFIGURATION)
+	virtual void init() { }
+	// Called on every Start-Of-Frame (1 ms), e.g. to pace isochronous streams
+	virtual void startOfFrame() { }
 	virtual void handleEndpoint() = 0;
 	virtual uint32_t recv(void *_data, uint32_t len) = 0;
 	virtual uint32_t available() = 0;
@@ -374,7 +411,8 @@ public:
 					}
 				}
 			}
-			usbd.epAckPendingInterrupts(ep);
+			// Only ack bank 0: bank 1 may be an IN endpoint sharing this number
+			usbd.epBank0AckTransferComplete(ep);
 		}
 	}
 
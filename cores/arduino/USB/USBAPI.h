@@ -27,6 +27,10 @@
 #define EP0      0
 #define EPX_SIZE 64 // 64 for Full Speed, EPT size max is 1024
 
+#ifndef USB_SOF_HANDLERS
+#define USB_SOF_HANDLERS 4 // see USBDeviceClass::attachStartOfFrame()
+#endif
+
 #if defined __cplusplus
 
 #include "Arduino.h"
@@ -35,6 +39,10 @@
 #include "api/USBAPI.h"
 #include "CDC.h"
 
+class EPHandler;
+class CDCBridge;
+class Uart;
+
 #if ARDUINO_API_VERSION > 10000
 using namespace arduino;
 #endif
@@ -58,6 +66,16 @@ public:
 
 	void standby();
 
+	// Start-Of-Frame hooks, called every 1 ms from the USB interrupt with
+	// the 11-bit frame number. Returns false when USB_SOF_HANDLERS are
+	// already attached.
+	bool attachStartOfFrame(void (*handler)(uint16_t frameNumber));
+	void detachStartOfFrame(void (*handler)(uint16_t frameNumber));
+	uint16_t frameNumber();
+	// micros() when the last Start-Of-Frame interrupt was taken, before
+	// any handler runs
+	uint32_t frameMicros();
+
 	// Setup API
 	bool handleClassInterfaceSetup(USBSetup &setup);
 	bool handleStandardSetup(USBSetup &setup);
@@ -69,6 +87,7 @@ public:
 	uint32_t recvControl(void *data, uint32_t len);
 	uint32_t sendConfiguration(uint32_t maxlen);
 	bool sendStringDescriptor(const uint8_t *string, uint32_t maxlen);
+	void sendDescriptorBuffer(const void *data, uint32_t len, uint32_t maxlen);
 	void initControl(int end);
 	uint8_t SendInterfaces(uint32_t* total);
 	void packMessages(bool val);
@@ -76,6 +95,7 @@ public:
 	// Generic EndPoint API
 	void initEndpoints(void);
 	void initEP(uint32_t ep, uint32_t type);
+	void setHandler(uint32_t ep, EPHandler *handler);
 
 	uint32_t send(uint32_t ep, const void *data, uint32_t len);
 	void sendZlp(uint32_t ep);
@@ -97,15 +117,72 @@ private:
 };
 extern USBDeviceClass USBDevice;
 
+//================================================================================
+//	Host time from the USB frame clock
+
+// The host starts a frame every 1 ms. USBFrameClock locks a software loop
+// onto the Start-Of-Frame interrupts to measure micros() against it, so
+// that a local timestamp converts to host time: the frame count times
+// 1000, plus the microseconds into the frame. The low 11 bits of the
+// frame count are the frame number the host sees.
+class USBFrameClockClass {
+public:
+	USBFrameClockClass();
+
+	bool begin();
+	void end();
+
+	// The loop is tracking the frames within a few microseconds
+	bool locked();
+
+	// Host time now, or when micros() returned localMicros
+	uint64_t micros();
+	uint64_t toHostMicros(uint32_t localMicros);
+
+	uint32_t frames();
+	// Deviation of the local clock from the host's, parts per million,
+	// positive when it runs fast
+	int32_t ppm();
+
+private:
+	static void onStartOfFrame(uint16_t frameNumber);
+	void startOfFrame(uint16_t frameNumber, uint32_t localMicros);
+
+	bool started;
+	uint16_t lastFrameNumber;
+	uint32_t lastMicros;
+	uint32_t lockCount;
+	uint64_t frame;     // frames since the 11-bit counter was last 0
+	int64_t local;      // micros() since begin(), not wrapping
+	int64_t anchor;     // local time of 'frame', 16.16 fixed point
+	int32_t period;     // local microseconds per frame, 16.16 fixed point
+};
+extern USBFrameClockClass USBFrameClock;
+
 //================================================================================
 //	Serial over CDC (Serial1 is the physical port)
 
+typedef struct {
+	uint32_t dwDTERate;
+	uint8_t bCharFormat;
+	uint8_t bParityType;
+	uint8_t bDataBits;
+	uint8_t lineState;
+} LineInfo;
+
+// Every Serial_ instance is a separate CDC ACM function (IAD + 2 interfaces)
+// with its own endpoints, so more ports can be added next to SerialUSB:
+//
+//   Serial_ SerialTelemetry(USBDevice);
+//
+// Each port uses 2 endpoint numbers (notification IN, data OUT/IN pair):
+// up to 3 ports fit in the 7 available endpoints, together with one HID.
 class Serial_ : public Stream, public arduino::PluggableUSBModule
 {
 public:
 	Serial_(USBDeviceClass &_usb);
 	void begin(uint32_t baud_count);
-	void begin(unsigned long, uint8_t);
+	void begin(uint32_t baud_count, uint8_t config);
 	void end(void);
 
 	virtual int available(void);
@@ -160,6 +237,15 @@ public:
 		SPACE_PARITY = 4,
 	};
 
+	// Bridge mode: the port is connected straight to a hardware serial
+	// port, the data moves both ways through DMA. The UART follows the
+	// host's line coding, DTR and RTS drive the given pins (active low,
+	// -1 for none). read() and write() are not available meanwhile.
+	// Returns false if there are not enough DMA channels.
+	bool bridge(Uart &uart, int dtrPin = -1, int rtsPin = -1);
+	void unbridge();
+	bool bridged() { return _bridge != NULL; }
+
 protected:
     // Implementation of the PUSBListNode
     int getInterface(uint8_t* interfaceNum);
@@ -169,6 +255,10 @@ protected:
     void handleEndpoint(int ep);
     void enableInterrupt();
 
+    // Apply to every CDC port plugged in
+    static void enableInterrupts();
+    static void handleEndpoints(int ep);
+
 friend USBDeviceClass;
 
 private:
@@ -176,8 +266,15 @@ private:
 
 	USBDeviceClass &usb;
 	bool stalled;
-	unsigned int epType[3];
+	unsigned int epType[2];
+
+	volatile LineInfo _usbLineInfo;
+	volatile int32_t breakValue;
+	int _serialPeek;
+	CDCBridge *_bridge;
 
+	Serial_ *nextSerial;
+	static Serial_ *rootSerial;
 };
 extern Serial_ SerialUSB;
 
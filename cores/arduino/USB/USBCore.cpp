@@ -93,18 +93,60 @@ volatile uint32_t _usbConfiguration = 0;
 volatile uint32_t _usbSetInterface = 0;
 
 static __attribute__((__aligned__(4))) //__attribute__((__section__(".bss_hram0")))
-uint8_t udd_ep_out_cache_buffer[7][64];
+uint8_t udd_ep_out_cache_buffer[USB_EPT_NUM][64];
 
 static __attribute__((__aligned__(4))) //__attribute__((__section__(".bss_hram0")))
-uint8_t udd_ep_in_cache_buffer[7][64];
+uint8_t udd_ep_in_cache_buffer[USB_EPT_NUM][64];
 
 // Some EP are handled using EPHanlders.
 // Possibly all the sparse EP handling subroutines will be
 // converted into reusable EPHandlers in the future.
-static EPHandler *epHandlers[7] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+static EPHandler *epHandlers[USB_EPT_NUM] = {NULL};
+// Bulk OUT endpoints using the DoubleBufferedEPOutHandler created by initEP()
+static uint32_t epDefaultHandlers = 0;
+
+// Start-Of-Frame hooks, see attachStartOfFrame()
+static void (*sofHandlers[USB_SOF_HANDLERS])(uint16_t) = {NULL};
+static volatile uint32_t sofMicros = 0;
 
 //==================================================================
 
+// Descriptors are sent to the host straight from these buffers, the
+// USB peripheral reads them with its own DMA
+static __attribute__((__aligned__(4)))
+uint8_t _string_buffer[2 + 2 * (ISERIAL_MAX_LEN - 1)];
+
+bool _dry_run = false;
+bool _pack_message = false;
+uint16_t _pack_size = 0;
+__attribute__((__aligned__(4))) uint8_t _pack_buffer[USB_CONFIGURATION_MAX_LEN];
+
+// Length of the configuration descriptor held in _pack_buffer, 0 until it
+// is built for the current enumeration
+static uint16_t _configuration_size = 0;
+// Whether a module provides a BOS descriptor, -1 until asked
+static int8_t _has_bos = -1;
+
+// Send a descriptor held in RAM without copying it, truncated to the
+// length requested by the host. The buffer is word aligned and must stay
+// untouched until the transfer is over.
+void USBDeviceClass::sendDescriptorBuffer(const void *data, uint32_t len, uint32_t maxlen)
+{
+	if (len > maxlen) {
+		len = maxlen;
+	}
+
+	// A reply shorter than requested that ends on a packet boundary
+	// must be terminated by a zero length packet
+	if (len < maxlen && (len % EPX_SIZE) == 0) {
+		usbd.epBank1EnableAutoZLP(0);
+	}
+
+	usbd.epBank1SetAddress(0, (void *)data);
+	usbd.epBank1SetMultiPacketSize(0, 0);
+	usbd.epBank1SetByteCount(0, len);
+}
+
 // Send a USB descriptor string. The string is stored as a
 // plain ASCII string but is sent out as UTF-16 with the
 // correct 2-byte prefix
@@ -113,27 +155,18 @@ bool USBDeviceClass::sendStringDescriptor(const uint8_t *string, uint32_t maxlen
 	if (maxlen < 2)
 		return false;
 
-	uint8_t* buffer = (uint8_t*)malloc(maxlen);
-	buffer[0] = strlen((const char*)string) * 2 + 2;
-	buffer[1] = 0x03;
-
-	uint8_t i;
-	for (i = 2; i < maxlen && *string; i++) {
-		buffer[i++] = *string++;
-		if (i == maxlen) break;
-		buffer[i] = 0;
+	uint32_t i = 2;
+	while (*string && i < sizeof(_string_buffer)) {
+		_string_buffer[i++] = *string++;
+		_string_buffer[i++] = 0;
 	}
+	_string_buffer[0] = i;
+	_string_buffer[1] = 0x03;
 
-	bool ret = USBDevice.sendControl(buffer, i);
-	free(buffer);
-	return ret;
+	sendDescriptorBuffer(_string_buffer, i, maxlen);
+	return true;
 }
 
-bool _dry_run = false;
-bool _pack_message = false;
-uint16_t _pack_size = 0;
-uint8_t _pack_buffer[256];
-
 void USBDeviceClass::packMessages(bool val)
 {
 	if (val) {
@@ -156,34 +189,56 @@ uint8_t USBDeviceClass::SendInterfaces(uint32_t* total)
 	return interfaces;
 }
 
-// Construct a dynamic configuration descriptor
-// This really needs dynamic endpoint allocation etc
-uint32_t USBDeviceClass::sendConfiguration(uint32_t maxlen)
+// Collect the interfaces of all modules behind the configuration
+// header, in a single pass
+static void buildConfiguration()
 {
 	uint32_t total = 0;
-	// Count and measure interfaces
-	_dry_run = true;
-	uint8_t interfaces = SendInterfaces(&total);
+
+	_pack_message = true;
+	_pack_size = sizeof(ConfigDescriptor);
+	uint8_t interfaces = USBDevice.SendInterfaces(&total);
+	_pack_message = false;
 
 	ConfigDescriptor config = D_CONFIG((uint16_t)(total + sizeof(ConfigDescriptor)), interfaces);
+	memcpy(_pack_buffer, &config, sizeof(ConfigDescriptor));
+	_configuration_size = _pack_size;
+}
 
-	//	Now send them
-	_dry_run = false;
+// Construct a dynamic configuration descriptor
+// Built on the first request of each enumeration, then served from RAM
+uint32_t USBDeviceClass::sendConfiguration(uint32_t maxlen)
+{
+	if (_configuration_size == 0) {
+		buildConfiguration();
+	}
 
-	if (maxlen == sizeof(ConfigDescriptor)) {
-		sendControl(&config, sizeof(ConfigDescriptor));
-		return true;
+	if (_configuration_size > sizeof(_pack_buffer)) {
+		// does not fit, see USB_CONFIGURATION_MAX_LEN
+		return false;
 	}
 
-	total = 0;
+	sendDescriptorBuffer(_pack_buffer, _configuration_size, maxlen);
+	return true;
+}
 
-	packMessages(true);
-	sendControl(&config, sizeof(ConfigDescriptor));
-	SendInterfaces(&total);
-	packMessages(false);
+#ifdef PLUGGABLE_USB_ENABLED
+// Dry-run a GET_DESCRIPTOR(BOS) through the modules
+static bool hasBOSDescriptor()
+{
+	USBSetup bos;
+	memset(&bos, 0, sizeof(bos));
+	bos.bmRequestType = REQUEST_DEVICETOHOST;
+	bos.bRequest = GET_DESCRIPTOR;
+	bos.wValueH = USB_BOS_DESCRIPTOR_TYPE;
+	bos.wLength = 0xFFFF;
 
-	return true;
+	_dry_run = true;
+	int ret = PluggableUSB().getDescriptor(bos);
+	_dry_run = false;
+	return ret > 0;
 }
+#endif
 
 bool USBDeviceClass::sendDescriptor(USBSetup &setup)
 {
@@ -215,6 +270,19 @@ bool USBDeviceClass::sendDescriptor(USBSetup &setup)
 		if (*desc_addr > setup.wLength) {
 			desc_length = setup.wLength;
 		}
+
+#ifdef PLUGGABLE_USB_ENABLED
+		// Hosts only ask for the BOS descriptor of USB 2.1 devices
+		if (_has_bos < 0) {
+			_has_bos = hasBOSDescriptor();
+		}
+		if (_has_bos) {
+			DeviceDescriptor desc = *(const DeviceDescriptor*)desc_addr;
+			desc.usbVersion = 0x210;
+			sendControl(&desc, desc_length ? desc_length : desc.len);
+			return true;
+		}
+#endif
 	}
 	else if (USB_STRING_DESCRIPTOR_TYPE == t)
 	{
@@ -277,23 +345,7 @@ void USBDeviceClass::init()
 	digitalWrite(PIN_LED_RXL, HIGH);
 #endif
 
-	// Enable USB clock
-	PM->APBBMASK.reg |= PM_APBBMASK_USB;
-
-	// Set up the USB DP/DN pins
-	PORT->Group[0].PINCFG[PIN_PA24G_USB_DM].bit.PMUXEN = 1;
-	PORT->Group[0].PMUX[PIN_PA24G_USB_DM/2].reg &= ~(0xF << (4 * (PIN_PA24G_USB_DM & 0x01u)));
-	PORT->Group[0].PMUX[PIN_PA24G_USB_DM/2].reg |= MUX_PA24G_USB_DM << (4 * (PIN_PA24G_USB_DM & 0x01u));
-	PORT->Group[0].PINCFG[PIN_PA25G_USB_DP].bit.PMUXEN = 1;
-	PORT->Group[0].PMUX[PIN_PA25G_USB_DP/2].reg &= ~(0xF << (4 * (PIN_PA25G_USB_DP & 0x01u)));
-	PORT->Group[0].PMUX[PIN_PA25G_USB_DP/2].reg |= MUX_PA25G_USB_DP << (4 * (PIN_PA25G_USB_DP & 0x01u));
-
-	// Put Generic Clock Generator 0 as source for Generic Clock Multiplexer 6 (USB reference)
-	GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID(6)     | // Generic Clock Multiplexer 6
-	                    GCLK_CLKCTRL_GEN_GCLK0 | // Generic Clock Generator 0 is source
-	                    GCLK_CLKCTRL_CLKEN;
-	while (GCLK->STATUS.bit.SYNCBUSY)
-		;
+	usbd.initClockAndPins();
 
 	USB_SetHandler(&UDD_Handler);
 
@@ -345,8 +397,7 @@ void USBDeviceClass::setAddress(uint32_t addr)
 	while (!usbd.epBank1IsTransferComplete(0)) {}
 
 	// Set USB address to addr
-	USB->DEVICE.DADD.bit.DADD = addr; // Address
-	USB->DEVICE.DADD.bit.ADDEN = 1; // Enable
+	usbd.setAddress(addr);
 }
 
 bool USBDeviceClass::detach()
@@ -407,9 +458,72 @@ void USBDeviceClass::initEndpoints() {
 	}
 }
 
+bool USBDeviceClass::attachStartOfFrame(void (*handler)(uint16_t))
+{
+	for (int i = 0; i < USB_SOF_HANDLERS; i++) {
+		if (sofHandlers[i] == NULL || sofHandlers[i] == handler) {
+			sofHandlers[i] = handler;
+			return true;
+		}
+	}
+	return false;
+}
+
+void USBDeviceClass::detachStartOfFrame(void (*handler)(uint16_t))
+{
+	synchronized {
+		// Keep the attached handlers packed at the front
+		int n = 0;
+		for (int i = 0; i < USB_SOF_HANDLERS; i++) {
+			if (sofHandlers[i] != handler) {
+				sofHandlers[n++] = sofHandlers[i];
+			}
+		}
+		while (n < USB_SOF_HANDLERS) {
+			sofHandlers[n++] = NULL;
+		}
+	}
+}
+
+uint16_t USBDeviceClass::frameNumber()
+{
+	return usbd.frameNumber();
+}
+
+uint32_t USBDeviceClass::frameMicros()
+{
+	return sofMicros;
+}
+
+void USBDeviceClass::setHandler(uint32_t ep, EPHandler *handler)
+{
+	if (epDefaultHandlers & (1ul << ep)) {
+		delete (DoubleBufferedEPOutHandler*)epHandlers[ep];
+		epDefaultHandlers &= ~(1ul << ep);
+	}
+	epHandlers[ep] = handler;
+
+	// Hand a bulk OUT endpoint back to the default handler
+	if (handler == NULL && _usbConfiguration) {
+		initEP(ep, EndPoints[ep]);
+	}
+}
+
 void USBDeviceClass::initEP(uint32_t ep, uint32_t config)
 {
-	if (config == (USB_ENDPOINT_TYPE_INTERRUPT | USB_ENDPOINT_IN(0)))
+	if (config & USB_ENDPOINT_HANDLER_MASK)
+	{
+		if (epHandlers[ep] != NULL) {
+			epHandlers[ep]->init();
+		}
+	}
+	else if (config > 0xFF)
+	{
+		// USB_ENDPOINT_PAIR: configure both banks
+		initEP(ep, config & 0xFF);
+		initEP(ep, config >> 8);
+	}
+	else if (config == (USB_ENDPOINT_TYPE_INTERRUPT | USB_ENDPOINT_IN(0)))
 	{
 		usbd.epBank1SetSize(ep, 64);
 		usbd.epBank1SetAddress(ep, &udd_ep_in_cache_buffer[ep]);
@@ -417,10 +531,16 @@ void USBDeviceClass::initEP(uint32_t ep, uint32_t config)
 	}
 	else if (config == (USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_OUT(0)))
 	{
-		if (epHandlers[ep] != NULL) {
-			delete (DoubleBufferedEPOutHandler*)epHandlers[ep];
+		if (epHandlers[ep] != NULL && !(epDefaultHandlers & (1ul << ep))) {
+			// Taken over with setHandler()
+			epHandlers[ep]->init();
+		} else {
+			if (epHandlers[ep] != NULL) {
+				delete (DoubleBufferedEPOutHandler*)epHandlers[ep];
+			}
+			epHandlers[ep] = new DoubleBufferedEPOutHandler(usbd, ep);
+			epDefaultHandlers |= (1ul << ep);
 		}
-		epHandlers[ep] = new DoubleBufferedEPOutHandler(usbd, ep);
 	}
 	else if (config == (USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_IN(0)))
 	{
@@ -447,7 +567,9 @@ void USBDeviceClass::initEP(uint32_t ep, uint32_t config)
 
 void USBDeviceClass::flush(uint32_t ep)
 {
-	if (available(ep)) {
+	// When an OUT handler shares the endpoint number, available()
+	// reports its received bytes, not the IN bank
+	if (!epHandlers[ep] && available(ep)) {
 		// RAM buffer is full, we can send data (IN)
 		usbd.epBank1SetReady(ep);
 
@@ -470,18 +592,17 @@ void USBDeviceClass::clear(uint32_t ep) {
 void USBDeviceClass::stall(uint32_t ep)
 {
 	// TODO: test
-	// TODO: use .bit. notation
 
 	// Stall endpoint
-	USB->DEVICE.DeviceEndpoint[ep].EPSTATUSSET.reg = USB_DEVICE_EPSTATUSSET_STALLRQ(2);
+	usbd.epBank1SetStallReq(ep);
 }
 
 bool USBDeviceClass::connected()
 {
 	// Count frame numbers
-	uint8_t f = USB->DEVICE.FNUM.bit.FNUM;
+	uint8_t f = usbd.frameNumber();
 	//delay(3);
-	return f != USB->DEVICE.FNUM.bit.FNUM;
+	return f != usbd.frameNumber();
 }
 
 
@@ -592,15 +713,7 @@ uint8_t USBDeviceClass::armRecvCtrlOUT(uint32_t ep)
 // Timeout for sends
 #define TX_TIMEOUT_MS 70
 
-static char LastTransmitTimedOut[7] = {
-	0,
-	0,
-	0,
-	0,
-	0,
-	0,
-	0
-};
+static char LastTransmitTimedOut[USB_EPT_NUM] = { 0 };
 
 // Blocking Send of data to an endpoint
 uint32_t USBDeviceClass::send(uint32_t ep, const void *data, uint32_t len)
@@ -695,7 +808,10 @@ uint32_t USBDeviceClass::sendControl(const void* _data, uint32_t len)
 		return length;
 
 	if (_pack_message == true) {
-		memcpy(&_pack_buffer[_pack_size], data, len);
+		// past the end only the size is counted
+		if (_pack_size + len <= sizeof(_pack_buffer)) {
+			memcpy(&_pack_buffer[_pack_size], data, len);
+		}
 		_pack_size += len;
 		return length;
 	}
@@ -755,6 +871,17 @@ bool USBDeviceClass::handleStandardSetup(USBSetup &setup)
 		else // if( setup.wValueL == 0) // ENDPOINTHALT
 		{
 			isEndpointHalt = 0;
+			if (REQUEST_ENDPOINT == (setup.bmRequestType & REQUEST_RECIPIENT)) {
+				// Release the stall and restart the data toggle (DATA0)
+				uint8_t ep = setup.wIndex & 0x0F;
+				if (setup.wIndex & USB_ENDPOINT_DIRECTION_MASK) {
+					usbd.epBank1ResetStallReq(ep);
+					usbd.epBank1ResetDataToggle(ep);
+				} else {
+					usbd.epBank0ResetStallReq(ep);
+					usbd.epBank0ResetDataToggle(ep);
+				}
+			}
 			sendZlp(0);
 			return true;
 		}
@@ -799,7 +926,7 @@ bool USBDeviceClass::handleStandardSetup(USBSetup &setup)
 			_usbConfiguration = setup.wValueL;
 
 			#ifdef CDC_ENABLED
-			SerialUSB.enableInterrupt();
+			Serial_::enableInterrupts();
 			#endif
 
 			sendZlp(0);
@@ -809,11 +936,22 @@ bool USBDeviceClass::handleStandardSetup(USBSetup &setup)
 		}
 
 	case GET_INTERFACE:
+#if defined(PLUGGABLE_USB_ENABLED)
+		// Modules with alternate settings answer for their interfaces
+		if (PluggableUSB().setup(setup)) {
+			return true;
+		}
+#endif
 		armSend(0, (void*)&_usbSetInterface, 1);
 		return true;
 
 	case SET_INTERFACE:
 		_usbSetInterface = setup.wValueL;
+#if defined(PLUGGABLE_USB_ENABLED)
+		if (PluggableUSB().setup(setup)) {
+			return true;
+		}
+#endif
 		sendZlp(0);
 		return true;
 
@@ -837,6 +975,10 @@ void USBDeviceClass::ISRHandler()
 		// Configure EP 0
 		initEP(0, USB_ENDPOINT_TYPE_CONTROL);
 
+		// Descriptors are rebuilt for the new enumeration
+		_configuration_size = 0;
+		_has_bos = -1;
+
 		// Enable Setup-Received interrupt
 		usbd.epBank0EnableSetupReceived(0);
 
@@ -846,8 +988,26 @@ void USBDeviceClass::ISRHandler()
 	// Start-Of-Frame
 	if (usbd.isStartOfFrameInterrupt())
 	{
+		if (sofHandlers[0]) {
+			// Time the frame first, the handlers below add their own latency
+			sofMicros = micros();
+		}
 		usbd.ackStartOfFrameInterrupt();
 
+		if (sofHandlers[0]) {
+			uint16_t frame = usbd.frameNumber();
+			for (int i = 0; i < USB_SOF_HANDLERS && sofHandlers[i]; i++) {
+				sofHandlers[i](frame);
+			}
+		}
+
+		// A handler serving several endpoint numbers is notified once
+		for (int ep = 1; ep < USB_EPT_NUM; ep++) {
+			if (epHandlers[ep] && epHandlers[ep] != epHandlers[ep - 1]) {
+				epHandlers[ep]->startOfFrame();
+			}
+		}
+
 		// check whether the one-shot period has elapsed.  if so, turn off the LED
 #ifdef PIN_LED_TXL
 		if (txLEDPulse > 0) {
@@ -886,6 +1046,7 @@ void USBDeviceClass::ISRHandler()
 		 */
 		usbd.epBank0SetByteCount(0, 0);
 		usbd.epBank0ResetReady(0);
+		usbd.epBank1DisableAutoZLP(0);
 
 		bool ok;
 		if (REQUEST_STANDARD == (setup.bmRequestType & REQUEST_TYPE)) {
@@ -917,7 +1078,9 @@ void USBDeviceClass::ISRHandler()
 				epHandlers[ep]->handleEndpoint();
 			} else {
 				#if defined(PLUGGABLE_USB_ENABLED)
-				SerialUSB.handleEndpoint(ep);
+				#ifdef CDC_ENABLED
+				Serial_::handleEndpoints(ep);
+				#endif
 				usbd.epAckPendingInterrupts(ep);
 				#endif
 			}
@@ -926,9 +1089,11 @@ void USBDeviceClass::ISRHandler()
 }
 
 // PluggableUSB contructor
+// lastEp is the next free endpoint number, so endpoints 1..USB_ENDPOINTS
+// can be plugged before reaching totalEP
 PluggableUSB_::PluggableUSB_() : lastIf(0),
                                  lastEp(1),
-                                 rootNode(NULL), totalEP(USB_ENDPOINTS)
+                                 rootNode(NULL), totalEP(USB_ENDPOINTS + 1)
 {
 	// Empty
 }
@@ -44,6 +44,15 @@
 #define USB_ENDPOINT_TYPE_BULK                 0x02
 #define USB_ENDPOINT_TYPE_INTERRUPT            0x03
 
+// An OUT and an IN endpoint sharing the same endpoint number: the OUT
+// direction uses bank 0 and the IN direction uses bank 1
+#define USB_ENDPOINT_PAIR(_out, _in)           ((_out) | ((_in) << 8))
+
+// Endpoint serviced by an EPHandler that its module installs with
+// USBDeviceClass::setHandler(): initEP() only calls the handler's init()
+#define USB_ENDPOINT_HANDLER_MASK              0x10000
+#define USB_ENDPOINT_HANDLER(_config)          ((_config) | USB_ENDPOINT_HANDLER_MASK)
+
 // bmRequestType
 #define REQUEST_HOSTTODEVICE		0x00
 #define REQUEST_DEVICETOHOST		0x80
@@ -87,6 +96,8 @@
 #define USB_ENDPOINT_DESCRIPTOR_TYPE           5
 #define USB_DEVICE_QUALIFIER                   6
 #define USB_OTHER_SPEED_CONFIGURATION          7
+#define USB_BOS_DESCRIPTOR_TYPE                15
+#define USB_DEVICE_CAPABILITY_TYPE             16
 
 #define USB_DEVICE_CLASS_COMMUNICATIONS        0x02
 #define USB_DEVICE_CLASS_HUMAN_INTERFACE       0x03
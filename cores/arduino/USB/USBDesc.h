@@ -32,6 +32,11 @@
 
 #define ISERIAL_MAX_LEN        65
 
+// Room for the configuration descriptor of all the plugged modules
+#ifndef USB_CONFIGURATION_MAX_LEN
+#define USB_CONFIGURATION_MAX_LEN 512
+#endif
+
 // Defined string description
 #define IMANUFACTURER	1
 #define IPRODUCT    2
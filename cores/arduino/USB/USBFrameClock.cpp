@@ -0,0 +1,162 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <Arduino.h>
+#include "USBAPI.h"
+#include "sync.h"
+
+#if defined(USBCON)
+
+// One frame, 16.16 fixed point microseconds
+#define FRAME_PERIOD (1000L << 16)
+
+// A Start-Of-Frame further than this from the prediction restarts the
+// loop: missed interrupts, suspend, bus reset
+#define FRAME_RESYNC_US 100
+
+// The loop is locked after FRAME_LOCK_COUNT frames in a row within
+// FRAME_LOCK_US of the prediction
+#define FRAME_LOCK_US    4
+#define FRAME_LOCK_COUNT 32
+
+USBFrameClockClass::USBFrameClockClass() :
+	started(false), lastFrameNumber(0), lastMicros(0), lockCount(0),
+	frame(0), local(0), anchor(0), period(FRAME_PERIOD)
+{
+}
+
+bool USBFrameClockClass::begin()
+{
+	synchronized {
+		started = false;
+		lockCount = 0;
+		period = FRAME_PERIOD;
+	}
+	return USBDevice.attachStartOfFrame(onStartOfFrame);
+}
+
+void USBFrameClockClass::end()
+{
+	USBDevice.detachStartOfFrame(onStartOfFrame);
+	started = false;
+	lockCount = 0;
+}
+
+void USBFrameClockClass::onStartOfFrame(uint16_t frameNumber)
+{
+	USBFrameClock.startOfFrame(frameNumber, USBDevice.frameMicros());
+}
+
+void USBFrameClockClass::startOfFrame(uint16_t frameNumber, uint32_t localMicros)
+{
+	uint32_t delta = (frameNumber - lastFrameNumber) & 0x7FF;
+
+	local += (uint32_t)(localMicros - lastMicros);
+	lastMicros = localMicros;
+	lastFrameNumber = frameNumber;
+
+	if (!started) {
+		frame = frameNumber;
+		local = 0;
+		anchor = 0;
+		started = true;
+		return;
+	}
+
+	frame += delta;
+	int64_t predicted = anchor + (int64_t)period * delta;
+	int64_t error = local * 65536 - predicted;
+
+	if (delta == 0 || error > (FRAME_RESYNC_US << 16) || error < -(FRAME_RESYNC_US << 16)) {
+		// Start over from this frame, the period is still good
+		anchor = local * 65536;
+		lockCount = 0;
+		return;
+	}
+
+	// Second order loop, critically damped: the phase error moves the
+	// anchor a little and corrects the period even less. This averages
+	// out the interrupt latency jitter and the 1 us steps of micros(),
+	// and follows the drift of the local clock. It settles in about
+	// 500 frames.
+	anchor = predicted + error / 32;
+	period += (int32_t)(error / (4096 * (int32_t)delta));
+
+	if (error < (FRAME_LOCK_US << 16) && error > -(FRAME_LOCK_US << 16)) {
+		if (lockCount < FRAME_LOCK_COUNT) {
+			lockCount++;
+		}
+	} else {
+		lockCount = 0;
+	}
+}
+
+bool USBFrameClockClass::locked()
+{
+	return lockCount >= FRAME_LOCK_COUNT;
+}
+
+uint64_t USBFrameClockClass::micros()
+{
+	return toHostMicros(::micros());
+}
+
+uint64_t USBFrameClockClass::toHostMicros(uint32_t localMicros)
+{
+	int64_t a, l;
+	uint64_t f;
+	int32_t p;
+	uint32_t last;
+
+	synchronized {
+		a = anchor;
+		l = local;
+		f = frame;
+		p = period;
+		last = lastMicros;
+	}
+
+	// Local time since the anchor frame, 16.16, scaled to host frames
+	int64_t since = (l + (int32_t)(localMicros - last)) * 65536 - a;
+	return f * 1000 + since * 1000 / p;
+}
+
+uint32_t USBFrameClockClass::frames()
+{
+	uint64_t f;
+
+	synchronized {
+		f = frame;
+	}
+	return (uint32_t)f;
+}
+
+int32_t USBFrameClockClass::ppm()
+{
+	int32_t p;
+
+	synchronized {
+		p = period;
+	}
+	return (int32_t)(((int64_t)p - FRAME_PERIOD) * 1000000 / FRAME_PERIOD);
+}
+
+USBFrameClockClass USBFrameClock;
+
+#endif
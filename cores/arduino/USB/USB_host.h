@@ -38,6 +38,12 @@ extern "C" {
 	UHD_SPEED_HIGH = 2,
 } uhd_speed_t;*/
 
+//! Pipe completion callback, called from the USB interrupt with UHD_Pipe_Status()
+typedef void (*uhd_pipe_callback_t)(uint32_t ul_pipe, uint32_t ul_status);
+
+//! Start of frame callback, called from the USB interrupt with the frame number
+typedef void (*uhd_sof_callback_t)(uint32_t ul_frame);
+
 //! States of USBB interface
 typedef enum {
 	UHD_STATE_NO_VBUS = 0,
@@ -58,6 +64,12 @@ extern uint32_t UHD_Pipe_Read(uint32_t ul_pipe, uint32_t ul_size, uint8_t* data)
 extern void UHD_Pipe_Write(uint32_t ul_pipe, uint32_t ul_size, uint8_t* data);
 extern void UHD_Pipe_Send(uint32_t ul_pipe, uint32_t ul_token_type);
 extern uint32_t UHD_Pipe_Is_Transfer_Complete(uint32_t ul_pipe, uint32_t ul_token_type);
+extern void UHD_Pipe_Start(uint32_t ul_pipe, uint32_t ul_token_type, uint32_t ul_nak_limit);
+extern void UHD_Pipe_Transfer(uint32_t ul_pipe, uint32_t ul_token_type, uint8_t *data, uint32_t ul_size, uint32_t ul_nak_limit);
+extern uint32_t UHD_Pipe_Status(uint32_t ul_pipe);
+extern void UHD_Pipe_Abort(uint32_t ul_pipe);
+extern void UHD_Pipe_SetCallback(uint32_t ul_pipe, uhd_pipe_callback_t callback);
+extern void UHD_SetStartOfFrameCallback(uhd_sof_callback_t callback);
 
 #ifdef __cplusplus
 }
@@ -38,6 +38,15 @@ static uhd_vbus_state_t uhd_state = UHD_STATE_NO_VBUS;
 
 __attribute__((__aligned__(4))) volatile UsbHostDescriptor usb_pipe_table[USB_EPT_NUM];
 
+// Pipe transfers started by UHD_Pipe_Start(), completed in UHD_Handler()
+static volatile uint32_t uhd_pipe_status[USB_EPT_NUM];
+static uint32_t uhd_pipe_naks[USB_EPT_NUM];
+static uint32_t uhd_pipe_nak_limit[USB_EPT_NUM];
+static uhd_pipe_callback_t uhd_pipe_callback[USB_EPT_NUM];
+
+// Called on each start of frame, see UHD_SetStartOfFrameCallback()
+static uhd_sof_callback_t uhd_sof_callback;
+
 extern void (*gpf_isr)(void);
 
 
@@ -147,6 +156,8 @@ void UHD_Init(void)
 	memset((void *)usb_pipe_table, 0, sizeof(usb_pipe_table));
 
 	uhd_state = UHD_STATE_NO_VBUS;
+	// The reset disabled the SOF interrupt
+	uhd_sof_callback = NULL;
 
 	// Put VBUS on USB port
 	#ifdef PIN_USB_HOST_ENABLE
@@ -168,6 +179,52 @@ void UHD_Init(void)
 }
 
 
+/**
+ * \brief Pipe interrupt: completes the transfer started by UHD_Pipe_Start().
+ *
+ * \param ul_pipe Pipe number.
+ */
+static void uhd_pipe_interrupt(uint32_t ul_pipe)
+{
+	uint8_t flags = USB->HOST.HostPipe[ul_pipe].PINTFLAG.reg & USB->HOST.HostPipe[ul_pipe].PINTENSET.reg;
+	uint32_t status;
+
+	if (flags & (USB_HOST_PINTFLAG_TRCPT0 | USB_HOST_PINTFLAG_TRCPT1 | USB_HOST_PINTFLAG_TXSTP))
+	{
+		status = 0;
+	}
+	else if (flags & USB_HOST_PINTFLAG_STALL)
+	{
+		status = USB_ERRORSTALL;
+	}
+	else if (flags & USB_HOST_PINTFLAG_PERR)
+	{
+		status = (usb_pipe_table[ul_pipe].HostDescBank[0].STATUS_PIPE.reg & USB_ERROR_DATATOGGLE) ?
+		         USB_ERROR_DATATOGGLE : USB_ERRORTIMEOUT;
+	}
+	else
+	{
+		// NAK: the pipe stays unfrozen and the token is sent again, up to the NAK limit
+		USB->HOST.HostPipe[ul_pipe].PINTFLAG.reg = USB_HOST_PINTFLAG_TRFAIL;
+		usb_pipe_table[ul_pipe].HostDescBank[0].STATUS_BK.reg = 0;
+		if (uhd_pipe_nak_limit[ul_pipe] == 0 || ++uhd_pipe_naks[ul_pipe] < uhd_pipe_nak_limit[ul_pipe])
+		{
+			return;
+		}
+		status = USB_ERRORFLOW;
+	}
+
+	uhd_freeze_pipe(ul_pipe);
+	USB->HOST.HostPipe[ul_pipe].PINTENCLR.reg = USB_HOST_PINTENSET_TRANSFER;
+	USB->HOST.HostPipe[ul_pipe].PINTFLAG.reg = USB_HOST_PINTENSET_TRANSFER;
+	uhd_pipe_status[ul_pipe] = status;
+
+	if (uhd_pipe_callback[ul_pipe])
+	{
+		uhd_pipe_callback[ul_pipe](ul_pipe, status);
+	}
+}
+
 /**
  * \brief Interrupt sub routine for USB Host state machine management.
  */
@@ -178,6 +235,16 @@ void UHD_Handler(void)
 	if (USB->HOST.CTRLA.bit.MODE) {
 		/*host mode ISR */
 
+		/* pipe interrupts */
+		uint32_t pipes = uhd_endpoint_interrupt();
+		for (uint32_t pipe = 0; pipes; pipe++, pipes >>= 1)
+		{
+			if (pipes & 1)
+			{
+				uhd_pipe_interrupt(pipe);
+			}
+		}
+
 		/* get interrupt flags */
 		flags = USB->HOST.INTFLAG.reg;
 
@@ -187,6 +254,10 @@ void UHD_Handler(void)
 			/* clear the flag */
 			USB->HOST.INTFLAG.reg = USB_HOST_INTFLAG_HSOF;
 			uhd_state             = UHD_STATE_CONNECTED;
+			if (uhd_sof_callback)
+			{
+				uhd_sof_callback(USB->HOST.FNUM.bit.FNUM);
+			}
 			return;
 		}
 
@@ -258,6 +329,9 @@ void UHD_Handler(void)
 			/* clear the flag */
 			uhd_ack_disconnection();
 			uhd_disable_disconnection_int();
+			// No more frames: the SOF interrupt must not report the port connected
+			USB->HOST.INTENCLR.reg = USB_HOST_INTENCLR_HSOF;
+			uhd_sof_callback = NULL;
 			// Stop reset signal, in case of disconnection during reset
 			uhd_stop_reset();
 			// Disable wakeup/resumes interrupts,
@@ -507,7 +581,126 @@ uint32_t UHD_Pipe_Is_Transfer_Complete(uint32_t ul_pipe, uint32_t ul_token_type)
    return 0;
 }
 
+/**
+ * \brief Start a pipe transfer, completed by the USB interrupt.
+ *
+ * The pipe content is set up by UHD_Pipe_Write(), or by the caller for IN
+ * tokens. The transfer ends on completion, STALL, pipe error or once
+ * \p ul_nak_limit NAKs have been received (0 for no limit): UHD_Pipe_Status()
+ * then gives the result, and the pipe callback, if any, is called.
+ *
+ * \param ul_pipe Pipe number.
+ * \param ul_token_type Token type.
+ * \param ul_nak_limit Number of NAKs before giving up, 0 to retry forever.
+ */
+void UHD_Pipe_Start(uint32_t ul_pipe, uint32_t ul_token_type, uint32_t ul_nak_limit)
+{
+	uhd_pipe_status[ul_pipe]    = UHD_PIPE_BUSY;
+	uhd_pipe_naks[ul_pipe]      = 0;
+	uhd_pipe_nak_limit[ul_pipe] = ul_nak_limit;
+
+	USB->HOST.HostPipe[ul_pipe].PINTFLAG.reg = USB_HOST_PINTENSET_TRANSFER;
+	usb_pipe_table[ul_pipe].HostDescBank[0].STATUS_BK.reg   = 0;
+	usb_pipe_table[ul_pipe].HostDescBank[0].STATUS_PIPE.reg = 0;
+	// With no limit the NAKs need not be counted: a pipe polling an idle
+	// device does not interrupt the CPU
+	USB->HOST.HostPipe[ul_pipe].PINTENSET.reg = ul_nak_limit ? USB_HOST_PINTENSET_TRANSFER :
+	                                            (USB_HOST_PINTENSET_TRANSFER & ~USB_HOST_PINTENSET_TRFAIL);
+
+	UHD_Pipe_Send(ul_pipe, ul_token_type);
+}
+
+/**
+ * \brief Start a multi-packet pipe transfer, completed by the USB interrupt.
+ *
+ * The pipe moves the whole buffer without the CPU: OUT data is split in
+ * packets, IN packets are stored one after the other until a short packet
+ * or \p ul_size bytes. uhd_byte_count() then gives the number of bytes
+ * received. An IN transfer of 0 bytes receives a single packet.
+ *
+ * \param ul_pipe Pipe number.
+ * \param ul_token_type tokIN or tokOUT.
+ * \param data Word aligned buffer.
+ * \param ul_size Number of bytes, up to UHD_PIPE_MAX_TRANSFER. A multiple of
+ * the packet size for IN.
+ * \param ul_nak_limit Number of NAKs before giving up, 0 to retry forever.
+ */
+void UHD_Pipe_Transfer(uint32_t ul_pipe, uint32_t ul_token_type, uint8_t *data, uint32_t ul_size, uint32_t ul_nak_limit)
+{
+	usb_pipe_table[ul_pipe].HostDescBank[0].ADDR.reg = (uint32_t)data;
+	if (ul_token_type == USB_HOST_PCFG_PTOKEN_IN)
+	{
+		usb_pipe_table[ul_pipe].HostDescBank[0].PCKSIZE.bit.BYTE_COUNT        = 0;
+		usb_pipe_table[ul_pipe].HostDescBank[0].PCKSIZE.bit.MULTI_PACKET_SIZE = ul_size;
+	}
+	else
+	{
+		usb_pipe_table[ul_pipe].HostDescBank[0].PCKSIZE.bit.BYTE_COUNT        = ul_size;
+		usb_pipe_table[ul_pipe].HostDescBank[0].PCKSIZE.bit.MULTI_PACKET_SIZE = 0;
+	}
+	usb_pipe_table[ul_pipe].HostDescBank[0].PCKSIZE.bit.AUTO_ZLP = 0;
+
+	UHD_Pipe_Start(ul_pipe, ul_token_type, ul_nak_limit);
+}
+
+/**
+ * \brief Status of the last transfer started on a pipe.
+ *
+ * \param ul_pipe Pipe number.
+ *
+ * \return UHD_PIPE_BUSY while running, 0 on success, or USB_ERRORFLOW (NAK
+ * limit), USB_ERRORTIMEOUT, USB_ERROR_DATATOGGLE or USB_ERRORSTALL.
+ */
+uint32_t UHD_Pipe_Status(uint32_t ul_pipe)
+{
+	return uhd_pipe_status[ul_pipe];
+}
+
+/**
+ * \brief Stop a pipe transfer without calling the pipe callback.
+ *
+ * \param ul_pipe Pipe number.
+ */
+void UHD_Pipe_Abort(uint32_t ul_pipe)
+{
+	uhd_freeze_pipe(ul_pipe);
+	USB->HOST.HostPipe[ul_pipe].PINTENCLR.reg = USB_HOST_PINTENSET_TRANSFER;
+	USB->HOST.HostPipe[ul_pipe].PINTFLAG.reg = USB_HOST_PINTENSET_TRANSFER;
+	uhd_pipe_status[ul_pipe] = USB_ERRORTIMEOUT;
+}
+
+/**
+ * \brief Set the function called from the USB interrupt when a pipe transfer ends.
+ *
+ * \param ul_pipe Pipe number.
+ * \param callback Completion callback, NULL for none.
+ */
+void UHD_Pipe_SetCallback(uint32_t ul_pipe, uhd_pipe_callback_t callback)
+{
+	uhd_pipe_callback[ul_pipe] = callback;
+}
 
+/**
+ * \brief Set the function called from the USB interrupt at each start of frame,
+ * every millisecond while the port is connected. The SOF interrupt is only
+ * enabled while there is a callback.
+ *
+ * \param callback Start of frame callback, NULL for none.
+ */
+void UHD_SetStartOfFrameCallback(uhd_sof_callback_t callback)
+{
+	uhd_sof_callback = callback;
+
+	if (callback)
+	{
+		USB->HOST.INTFLAG.reg = USB_HOST_INTFLAG_HSOF;
+		USB->HOST.INTENSET.reg = USB_HOST_INTENSET_HSOF;
+	}
+	else
+	{
+		USB->HOST.INTENCLR.reg = USB_HOST_INTENCLR_HSOF;
+	}
+}
 
 
 // USB_Handler ISR
@@ -44,6 +44,16 @@ extern __attribute__((__aligned__(4))) volatile UsbHostDescriptor usb_pipe_table
 #define USB_ERRORFLOW	      USB_HOST_STATUS_BK_ERRORFLOW
 #define USB_ERRORTIMEOUT      USB_HOST_STATUS_PIPE_TOUTER
 #define USB_ERROR_DATATOGGLE  USB_HOST_STATUS_PIPE_DTGLER
+#define USB_ERRORSTALL        0x40
+
+// Pipe transfer status, see UHD_Pipe_Status(): 0 once complete, an error above otherwise
+#define UHD_PIPE_BUSY         0xFFFF
+
+// Largest UHD_Pipe_Transfer(): BYTE_COUNT and MULTI_PACKET_SIZE are 14 bits, rounded down to 64 byte packets
+#define UHD_PIPE_MAX_TRANSFER 16320
+
+#define USB_HOST_PINTENSET_TRANSFER  (USB_HOST_PINTENSET_TRCPT0 | USB_HOST_PINTENSET_TRCPT1 | USB_HOST_PINTENSET_TXSTP | \
+                                      USB_HOST_PINTENSET_TRFAIL | USB_HOST_PINTENSET_PERR | USB_HOST_PINTENSET_STALL)
 
 #define USB_PCKSIZE_SIZE_8_BYTES        0
 #define USB_PCKSIZE_SIZE_16_BYTES       1
@@ -20,8 +20,6 @@
 #include "wiring_private.h"
 #include "Uart.h"
 
-#define NO_RTS_PIN 255
-#define NO_CTS_PIN 255
 #define RTS_RX_THRESHOLD 10
 
 Uart::Uart(SERCOM *_s, uint8_t _pinRX, uint8_t _pinTX, SercomRXPad _padRX, SercomUartTXPad _padTX) :
@@ -24,6 +24,9 @@
 
 #define SERIAL_BUFFER_SIZE  64
 
+#define NO_RTS_PIN 255
+#define NO_CTS_PIN 255
+
 class Uart : public HardwareSerial
 {
   public:
@@ -45,6 +48,9 @@ class Uart : public HardwareSerial
     operator bool() { return true; }
 
   private:
+    // Drives the SERCOM through DMA instead of IrqHandler()
+    friend class CDCBridge;
+
     SERCOM *sercom;
     SafeRingBuffer rxBuffer;
     SafeRingBuffer txBuffer;
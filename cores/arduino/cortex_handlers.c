@@ -141,6 +141,11 @@ void Reset_Handler(void)
 {
   uint32_t *pSrc, *pDest;
 
+  /* Count the boot time at 1MHz, SystemInit() reads it (bootTime) */
+  SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+  SysTick->VAL = 0;
+  SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+
   /* Initialize the initialized data section */
   pSrc = &__etext;
   pDest = &__data_start__;
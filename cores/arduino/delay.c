@@ -72,6 +72,7 @@ void delay( unsigned long ms )
   while (ms > 0)
   {
     yield();
+    updateClock();
     while (ms > 0 && (micros() - start) >= 1000)
     {
       ms--;
@@ -81,12 +82,14 @@ void delay( unsigned long ms )
 }
 
 #include "Reset.h" // for tickReset()
+#include "SystemClock.h" // for tickClock()
 
 void SysTick_DefaultHandler(void)
 {
   // Increment tick count each ms
   _ulTickCount++;
   tickReset();
+  tickClock();
 }
 
 /**
@@ -46,12 +46,14 @@ int main( void )
   USBDevice.attach();
 #endif
 
+  bootTime.setup = bootMicros();
   setup();
 
   for (;;)
   {
     loop();
     if (serialEventRun) serialEventRun();
+    serviceClock();
   }
 
   return 0;
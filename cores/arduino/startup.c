@@ -16,8 +16,8 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
-#include <samd.h>
-#include "variant.h"
+#include "Arduino.h"
+#include "SystemClock.h"
 
 #include <stdio.h>
 
@@ -34,6 +34,12 @@
  * 5) Switch Generic Clock Generator 0 to DFLL48M. CPU will run at 48MHz.
  * 6) Modify PRESCaler value of OSCM to have 8MHz
  * 7) Put OSC8M as source for Generic Clock Generator 3
+ *
+ * Waiting for XOSC32K and for the DFLL lock takes hundreds of milliseconds. When a previous
+ * boot saved its locked DFLL values, 4) runs the DFLL in open loop from them and 1) to 3) and
+ * the lock complete in the background: tickClock(), from the SysTick handler, watches the
+ * status flags and updateClock(), from the main loop and delay(), writes the clock registers.
+ * A register written from the interrupt could land in the middle of a sketch's GCLK sequence.
  */
 // Constants for Clock generators
 #define GENERIC_CLOCK_GENERATOR_MAIN      (0u)
@@ -44,19 +50,257 @@
 // Constants for Clock multiplexers
 #define GENERIC_CLOCK_MULTIPLEXER_DFLL48M (0u)
 
+#if defined(CRYSTALLESS)
+#define SYSCTRL_PCLKSR_32KRDY SYSCTRL_PCLKSR_OSC32KRDY
+#else
+#define SYSCTRL_PCLKSR_32KRDY SYSCTRL_PCLKSR_XOSC32KRDY
+#endif
+
+/*
+ * DFLL values of the last lock, restored by SystemInit() at the next boot. They have a flash
+ * row of their own, so that saving them erases nothing else. Uploading a sketch erases them
+ * and the first boot after it takes the slow path.
+ */
+#define DFLL_CALIBRATION_MAGIC      (0xCA1Bul << 16)
+#define DFLL_CALIBRATION_MASK       (SYSCTRL_DFLLVAL_COARSE_Msk | SYSCTRL_DFLLVAL_FINE_Msk)
+#define DFLL_CALIBRATION_FINE_DRIFT 8 // Fine steps the lock may wander from the saved value
+
+__attribute__ ((aligned (NVMCTRL_ROW_SIZE), used))
+static volatile const uint32_t dfllCalibration[NVMCTRL_ROW_SIZE / 4] = { [0 ... NVMCTRL_ROW_SIZE / 4 - 1] = 0xFFFFFFFF };
+
+BootTime bootTime;
+
+/* Seen by tickClock() from the SysTick handler, which only polls the status */
+static volatile bool oscillatorReady;
+static volatile bool lockReached;
+/* Set in main context, which does all the clock register writes */
+static volatile bool referenceReady;
+static volatile bool dfllLocked;
+static volatile bool dfllSavePending;
+static uint32_t dfllSaved; // DFLLVAL restored at boot, 0 if there was none
+static uint32_t dfllValue; // DFLLVAL at the lock
+
+static void waitDFLLSync( void )
+{
+  while ( (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_DFLLRDY) == 0 )
+  {
+    /* Wait for synchronization */
+  }
+}
+
+/* ----------------------------------------------------------------------------------------------
+ * 2) Put XOSC32K as source of Generic Clock Generator 1
+ * 3) Put Generic Clock Generator 1 as source for Generic Clock Multiplexer 0 (DFLL48M reference)
+ */
+static void enableReference( void )
+{
+  GCLK->GENDIV.reg = GCLK_GENDIV_ID( GENERIC_CLOCK_GENERATOR_XOSC32K ) ; // Generic Clock Generator 1
+
+  while ( GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY )
+  {
+    /* Wait for synchronization */
+  }
+
+  /* Write Generic Clock Generator 1 configuration */
+  GCLK->GENCTRL.reg = GCLK_GENCTRL_ID( GENERIC_CLOCK_GENERATOR_OSC32K ) | // Generic Clock Generator 1
+#if defined(CRYSTALLESS)
+                      GCLK_GENCTRL_SRC_OSC32K | // Selected source is Internal 32KHz Oscillator
+#else
+                      GCLK_GENCTRL_SRC_XOSC32K | // Selected source is External 32KHz Oscillator
+#endif
+//                      GCLK_GENCTRL_OE | // Output clock to a pin for tests
+                      GCLK_GENCTRL_GENEN ;
+
+  while ( GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY )
+  {
+    /* Wait for synchronization */
+  }
+
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID( GENERIC_CLOCK_MULTIPLEXER_DFLL48M ) | // Generic Clock Multiplexer 0
+                      GCLK_CLKCTRL_GEN_GCLK1 | // Generic Clock Generator 1 is source
+                      GCLK_CLKCTRL_CLKEN ;
+
+  while ( GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY )
+  {
+    /* Wait for synchronization */
+  }
+
+  referenceReady = true;
+}
+
+/* Reads the DFLL values once locked, they are saved by serviceClock() if they moved */
+static void lockDone( void )
+{
+  SYSCTRL->DFLLSYNC.reg = SYSCTRL_DFLLSYNC_READREQ;
+  waitDFLLSync();
+  dfllValue = SYSCTRL->DFLLVAL.reg & DFLL_CALIBRATION_MASK;
+
+  int32_t drift = (int32_t)(dfllValue & SYSCTRL_DFLLVAL_FINE_Msk) - (int32_t)(dfllSaved & SYSCTRL_DFLLVAL_FINE_Msk);
+  if ( (dfllValue & SYSCTRL_DFLLVAL_COARSE_Msk) != (dfllSaved & SYSCTRL_DFLLVAL_COARSE_Msk) ||
+       drift > DFLL_CALIBRATION_FINE_DRIFT || drift < -DFLL_CALIBRATION_FINE_DRIFT )
+  {
+    dfllSavePending = true;
+  }
+
+  dfllLocked = true;
+}
+
+static bool lockFlags( void )
+{
+#if defined(CRYSTALLESS)
+  /* Coarse lock is bypassed, the USB clock recovery only locks fine */
+  return (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_DFLLLCKF) != 0;
+#else
+  return (SYSCTRL->PCLKSR.reg & (SYSCTRL_PCLKSR_DFLLLCKC | SYSCTRL_PCLKSR_DFLLLCKF)) ==
+         (SYSCTRL_PCLKSR_DFLLLCKC | SYSCTRL_PCLKSR_DFLLLCKF);
+#endif
+}
+
+void tickClock( void )
+{
+  if ( dfllLocked )
+  {
+    return;
+  }
+
+  if ( !oscillatorReady )
+  {
+    if ( SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_32KRDY )
+    {
+      oscillatorReady = true;
+      bootTime.reference = bootMicros();
+    }
+    return;
+  }
+
+  if ( referenceReady && !lockReached && lockFlags() )
+  {
+    lockReached = true;
+    bootTime.locked = bootMicros();
+  }
+}
+
+void updateClock( void )
+{
+  /* The SysTick handler may interrupt a GCLK or SYSCTRL sequence, never run from it */
+  if ( __get_IPSR() != 0 || dfllLocked )
+  {
+    return;
+  }
+
+  if ( !referenceReady )
+  {
+    if ( !oscillatorReady )
+    {
+      return;
+    }
+    enableReference();
+
+#if !defined(CRYSTALLESS)
+    /* Close the loop: the DFLL starts from the restored values, small steps keep it near 48MHz */
+    waitDFLLSync();
+    SYSCTRL->DFLLCTRL.reg |= SYSCTRL_DFLLCTRL_MODE | SYSCTRL_DFLLCTRL_QLDIS ;
+    waitDFLLSync();
+#endif
+    return;
+  }
+
+  if ( lockReached )
+  {
+    lockDone();
+  }
+}
+
+bool clockLocked( void )
+{
+  updateClock();
+  return dfllLocked;
+}
+
+void waitClockLock( void )
+{
+#if defined(CRYSTALLESS)
+  while ( !referenceReady )
+#else
+  while ( !dfllLocked )
+#endif
+  {
+    /* The SysTick handler may be polling as well */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tickClock();
+    if ( !primask )
+    {
+      __enable_irq();
+    }
+    updateClock();
+  }
+  serviceClock();
+}
+
+/* Completes the lock, then erases the calibration row and writes the record in its first page */
+void serviceClock( void )
+{
+  updateClock();
+
+  if ( !dfllSavePending )
+  {
+    return;
+  }
+  dfllSavePending = false;
+
+  uint32_t record = DFLL_CALIBRATION_MAGIC | dfllValue;
+
+  /* MANW is set by SystemInit(): the page is written by the WP command */
+  while ( !NVMCTRL->INTFLAG.bit.READY );
+  NVMCTRL->STATUS.reg |= NVMCTRL_STATUS_MASK;
+  NVMCTRL->ADDR.reg = (uint32_t)dfllCalibration / 2;
+  NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_ER;
+  while ( !NVMCTRL->INTFLAG.bit.READY );
+
+  NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_PBC;
+  while ( !NVMCTRL->INTFLAG.bit.READY );
+
+  volatile uint32_t *d = (volatile uint32_t *)dfllCalibration;
+  d[0] = record;
+  d[1] = ~record;
+  NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_WP;
+  while ( !NVMCTRL->INTFLAG.bit.READY );
+
+  if ( (NVMCTRL->STATUS.reg & (NVMCTRL_STATUS_LOCKE | NVMCTRL_STATUS_PROGE)) == 0 )
+  {
+    dfllSaved = dfllValue;
+  }
+}
+
+uint32_t bootMicros( void )
+{
+  return bootTime.init + micros();
+}
+
 void SystemInit( void )
 {
+  /* SysTick counts from reset at the 1MHz reset clock, see Reset_Handler() */
+  uint32_t ticks;
+
   /* Set 1 Flash Wait State for 48MHz, cf tables 20.9 and 35.27 in SAMD21 Datasheet */
   NVMCTRL->CTRLB.bit.RWS = NVMCTRL_CTRLB_RWS_HALF_Val ;
 
   /* Turn on the digital interface clock */
   PM->APBAMASK.reg |= PM_APBAMASK_GCLK ;
 
+  /* DFLL values saved by a previous boot */
+  uint32_t record = dfllCalibration[0];
+  if ( (record & ~DFLL_CALIBRATION_MASK) == DFLL_CALIBRATION_MAGIC && dfllCalibration[1] == ~record )
+  {
+    dfllSaved = record & DFLL_CALIBRATION_MASK;
+  }
 
 #if defined(CRYSTALLESS)
 
   /* ----------------------------------------------------------------------------------------------
    * 1) Enable OSC32K clock (Internal 32.768Hz oscillator)
+   * The DFLL follows the USB frames, it does not wait for OSC32K.
    */
 
   uint32_t calib = (*((uint32_t *) FUSES_OSC32K_CAL_ADDR) & FUSES_OSC32K_CAL_Msk) >> FUSES_OSC32K_CAL_Pos;
@@ -66,8 +310,6 @@ void SystemInit( void )
                         SYSCTRL_OSC32K_EN32K |
                         SYSCTRL_OSC32K_ENABLE;
 
-  while ( (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_OSC32KRDY) == 0 ); // Wait for oscillator stabilization
-
 #else // has crystal
 
   /* ----------------------------------------------------------------------------------------------
@@ -77,9 +319,9 @@ void SystemInit( void )
                          SYSCTRL_XOSC32K_XTALEN | SYSCTRL_XOSC32K_EN32K ;
   SYSCTRL->XOSC32K.bit.ENABLE = 1 ; /* separate call, as described in chapter 15.6.3 */
 
-  while ( (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_XOSC32KRDY) == 0 )
+  while ( dfllSaved == 0 && (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_XOSC32KRDY) == 0 )
   {
-    /* Wait for oscillator stabilization */
+    /* Wait for oscillator stabilization, unless the DFLL can start from the saved values */
   }
 
 #endif
@@ -95,41 +337,12 @@ void SystemInit( void )
     /* Wait for reset to complete */
   }
 
-  /* ----------------------------------------------------------------------------------------------
-   * 2) Put XOSC32K as source of Generic Clock Generator 1
-   */
-  GCLK->GENDIV.reg = GCLK_GENDIV_ID( GENERIC_CLOCK_GENERATOR_XOSC32K ) ; // Generic Clock Generator 1
-
-  while ( GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY )
-  {
-    /* Wait for synchronization */
-  }
-
-  /* Write Generic Clock Generator 1 configuration */
-  GCLK->GENCTRL.reg = GCLK_GENCTRL_ID( GENERIC_CLOCK_GENERATOR_OSC32K ) | // Generic Clock Generator 1
-#if defined(CRYSTALLESS)
-                      GCLK_GENCTRL_SRC_OSC32K | // Selected source is Internal 32KHz Oscillator
-#else
-                      GCLK_GENCTRL_SRC_XOSC32K | // Selected source is External 32KHz Oscillator
-#endif
-//                      GCLK_GENCTRL_OE | // Output clock to a pin for tests
-                      GCLK_GENCTRL_GENEN ;
-
-  while ( GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY )
-  {
-    /* Wait for synchronization */
-  }
-
-  /* ----------------------------------------------------------------------------------------------
-   * 3) Put Generic Clock Generator 1 as source for Generic Clock Multiplexer 0 (DFLL48M reference)
-   */
-  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID( GENERIC_CLOCK_MULTIPLEXER_DFLL48M ) | // Generic Clock Multiplexer 0
-                      GCLK_CLKCTRL_GEN_GCLK1 | // Generic Clock Generator 1 is source
-                      GCLK_CLKCTRL_CLKEN ;
-
-  while ( GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY )
+  /* A generator cannot be set up from a source that is not running yet */
+  if ( SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_32KRDY )
   {
-    /* Wait for synchronization */
+    enableReference();
+    oscillatorReady = true;
+    bootTime.reference = SysTick_LOAD_RELOAD_Msk - SysTick->VAL;
   }
 
   /* ----------------------------------------------------------------------------------------------
@@ -165,9 +378,13 @@ void SystemInit( void )
   if (coarse == 0x3f) {
     coarse = 0x1f;
   }
-  // TODO(tannewt): Load this value from memory we've written previously. There
-  // isn't a value from the Atmel factory.
+  // There isn't a fine value from the Atmel factory, start from the middle
+  // unless a previous boot saved the value USB clock recovery locked on.
   uint32_t fine = 0x1ff;
+  if (dfllSaved) {
+    coarse = (dfllSaved & SYSCTRL_DFLLVAL_COARSE_Msk) >> SYSCTRL_DFLLVAL_COARSE_Pos;
+    fine = (dfllSaved & SYSCTRL_DFLLVAL_FINE_Msk) >> SYSCTRL_DFLLVAL_FINE_Pos;
+  }
 
   SYSCTRL->DFLLVAL.bit.COARSE = coarse;
   SYSCTRL->DFLLVAL.bit.FINE = fine;
@@ -198,23 +415,45 @@ void SystemInit( void )
 
 #else   // has crystal
 
-  /* Write full configuration to DFLL control register */
-  SYSCTRL->DFLLCTRL.reg |= SYSCTRL_DFLLCTRL_MODE | /* Enable the closed loop mode */
-                           SYSCTRL_DFLLCTRL_WAITLOCK |
-                           SYSCTRL_DFLLCTRL_QLDIS ; /* Disable Quick lock */
-
-  while ( (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_DFLLRDY) == 0 )
+  if ( dfllSaved )
   {
-    /* Wait for synchronization */
-  }
+    /* Open loop from the saved values, updateClock() closes the loop once XOSC32K runs */
+    SYSCTRL->DFLLMUL.reg = SYSCTRL_DFLLMUL_CSTEP( 1 ) |
+                           SYSCTRL_DFLLMUL_FSTEP( 16 ) |
+                           SYSCTRL_DFLLMUL_MUL( (VARIANT_MCK + VARIANT_MAINOSC/2) / VARIANT_MAINOSC ) ;
 
-  /* Enable the DFLL */
-  SYSCTRL->DFLLCTRL.reg |= SYSCTRL_DFLLCTRL_ENABLE ;
+    waitDFLLSync();
+
+    SYSCTRL->DFLLVAL.reg = dfllSaved ;
 
-  while ( (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_DFLLLCKC) == 0 ||
-          (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_DFLLLCKF) == 0 )
+    waitDFLLSync();
+
+    /* referenceReady is set if XOSC32K came up already */
+    if ( referenceReady )
+    {
+      SYSCTRL->DFLLCTRL.reg |= SYSCTRL_DFLLCTRL_MODE | SYSCTRL_DFLLCTRL_QLDIS ;
+    }
+  }
+  else
   {
-    /* Wait for locks flags */
+    /* Write full configuration to DFLL control register */
+    SYSCTRL->DFLLCTRL.reg |= SYSCTRL_DFLLCTRL_MODE | /* Enable the closed loop mode */
+                             SYSCTRL_DFLLCTRL_WAITLOCK |
+                             SYSCTRL_DFLLCTRL_QLDIS ; /* Disable Quick lock */
+
+    while ( (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_DFLLRDY) == 0 )
+    {
+      /* Wait for synchronization */
+    }
+
+    /* Enable the DFLL */
+    SYSCTRL->DFLLCTRL.reg |= SYSCTRL_DFLLCTRL_ENABLE ;
+
+    while ( (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_DFLLLCKC) == 0 ||
+            (SYSCTRL->PCLKSR.reg & SYSCTRL_PCLKSR_DFLLLCKF) == 0 )
+    {
+      /* Wait for locks flags */
+    }
   }
 
 #endif
@@ -246,6 +485,9 @@ void SystemInit( void )
     /* Wait for synchronization */
   }
 
+  ticks = SysTick->VAL;
+  bootTime.clock = SysTick_LOAD_RELOAD_Msk - ticks;
+
   /* ----------------------------------------------------------------------------------------------
    * 6) Modify PRESCaler value of OSC8M to have 8MHz
    */
@@ -298,4 +540,19 @@ void SystemInit( void )
    * 9) Disable automatic NVM write operations
    */
   NVMCTRL->CTRLB.bit.MANW = 1;
+
+  /* ----------------------------------------------------------------------------------------------
+   * 10) Boot times until now, the slow path has locked already. SysTick counts at 48MHz since 5).
+   */
+  bootTime.init = bootTime.clock + (ticks - SysTick->VAL) / (VARIANT_MCK / 1000000);
+
+#if !defined(CRYSTALLESS)
+  if ( !dfllSaved )
+  {
+    /* Locked before 5), save the values for the next boot now */
+    lockDone();
+    bootTime.locked = bootTime.clock;
+    serviceClock();
+  }
+#endif
 }
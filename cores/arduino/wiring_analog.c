@@ -26,6 +26,16 @@ extern "C" {
 static int _readResolution = 10;
 static int _ADCResolution = 10;
 static int _writeResolution = 8;
+// log2 of the samples accumulated by the ADC for each result, see analogReadAveraging()
+static uint32_t _ADCAveraging = 0;
+
+// analogRead() keeps the ADC enabled between calls, see analogReadConfig()
+static bool _ADCKeepEnabled = false;
+// Positive input of the last conversion, ADC_MUX_NONE when the next conversion must be thrown away
+#define ADC_MUX_NONE 0xFF
+static uint8_t _ADCMux = ADC_MUX_NONE;
+// Reference set by analogReference(), -1 before its first call
+static int _ADCReference = -1;
 
 // Wait for synchronization of registers between the clock domains
 static __inline__ void syncADC() __attribute__((always_inline, unused));
@@ -53,20 +63,110 @@ static void syncTCC(Tcc* TCCx) {
   while (TCCx->SYNCBUSY.reg & TCC_SYNCBUSY_MASK);
 }
 
+// The ADC resolution and accumulation for the read resolution and the averaging
+static void updateADCResolution(void)
+{
+  int res = _readResolution;
+
+  if (_ADCAveraging == 0) {
+    if (res > 10) {
+      ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_12BIT_Val;
+      _ADCResolution = 12;
+    } else if (res > 8) {
+      ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_10BIT_Val;
+      _ADCResolution = 10;
+    } else {
+      ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_8BIT_Val;
+      _ADCResolution = 8;
+    }
+    syncADC();
+    ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_1 | ADC_AVGCTRL_ADJRES(0);
+    syncADC();
+    return;
+  }
+
+  // 12 bit conversions are summed up, then shifted down to 16 bits by the ADC
+  // past 16 samples. Each 4 samples give one more bit (oversampling), as far
+  // as the read resolution asks for, the rest is averaged.
+  uint32_t sumBits = 12 + _ADCAveraging;
+  if (sumBits > 16) {
+    sumBits = 16;
+  }
+  uint32_t resultBits = 12 + _ADCAveraging / 2;
+  if (res < 12) {
+    res = 12;
+  }
+  if (resultBits > (uint32_t)res) {
+    resultBits = res;
+  }
+  if (resultBits > 16) {
+    resultBits = 16;
+  }
+
+  ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_16BIT_Val;
+  syncADC();
+  ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM(_ADCAveraging) | ADC_AVGCTRL_ADJRES(sumBits - resultBits);
+  syncADC();
+  _ADCResolution = resultBits;
+}
+
 void analogReadResolution(int res)
 {
+  if (res == _readResolution) {
+    return;
+  }
   _readResolution = res;
-  if (res > 10) {
-    ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_12BIT_Val;
-    _ADCResolution = 12;
-  } else if (res > 8) {
-    ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_10BIT_Val;
-    _ADCResolution = 10;
-  } else {
-    ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_8BIT_Val;
-    _ADCResolution = 8;
+  updateADCResolution();
+}
+
+void analogReadAveraging(uint32_t samples)
+{
+  uint32_t n = 0;
+
+  // A power of 2, up to 1024
+  while (n < ADC_AVGCTRL_SAMPLENUM_1024_Val && (2ul << n) <= samples) {
+    n++;
   }
+  _ADCAveraging = n;
+  updateADCResolution();
+}
+
+void analogReadConfig(uint32_t prescaler, uint32_t sampleLength, bool keepEnabled)
+{
+  // Changed with the ADC disabled, the next analogRead() enables it
+  syncADC();
+  ADC->CTRLA.bit.ENABLE = 0x00;
+  syncADC();
+  ADC->CTRLB.bit.PRESCALER = prescaler;
   syncADC();
+  ADC->SAMPCTRL.reg = ADC_SAMPCTRL_SAMPLEN(sampleLength);
+  syncADC();
+
+  _ADCKeepEnabled = keepEnabled;
+  _ADCMux = ADC_MUX_NONE;
+}
+
+void analogReadMode(eAnalogReadMode mode)
+{
+  switch (mode)
+  {
+    case AR_MODE_FAST:
+      // 48MHz/32 = 1.5MHz ADC clock, the fastest within the rated 2.1MHz, and one extra half
+      // cycle of sampling: about 175ksps at 12 bits, for low impedance sources
+      analogReadConfig(ADC_CTRLB_PRESCALER_DIV32_Val, 1, true);
+      break;
+
+    case AR_MODE_PRECISE:
+    default:
+      // As set by init(): 48MHz/512 ADC clock, longest sampling time
+      analogReadConfig(ADC_CTRLB_PRESCALER_DIV512_Val, 0x3f, false);
+      break;
+  }
+}
+
+void analogReadReset(void)
+{
+  _ADCMux = ADC_MUX_NONE;
 }
 
 void analogWriteResolution(int res)
@@ -93,6 +193,14 @@ static inline uint32_t mapResolution(uint32_t value, uint32_t from, uint32_t to)
  */
 void analogReference(eAnalogReference mode)
 {
+  if ((int)mode == _ADCReference) {
+    return;
+  }
+  _ADCReference = mode;
+
+  // The first conversion after the reference is changed must not be used
+  _ADCMux = ADC_MUX_NONE;
+
   syncADC();
   switch (mode)
   {
@@ -125,26 +233,41 @@ void analogReference(eAnalogReference mode)
   }
 }
 
-int analogRead(pin_size_t pin)
+bool analogReadPrepare(uint32_t pin)
 {
-  uint32_t valueRead = 0;
+  uint32_t mux;
 
   if (pin < A0) {
     pin += A0;
   }
 
-  pinPeripheral(pin, PIO_ANALOG);
+  const PinDescription *pinDesc = &g_APinDescription[pin];
+  mux = pinDesc->ulADCChannelNumber;
+
+  // Read again, the pin is still analog unless pinMode() or analogWrite() took it
+  uint32_t pmux = PORT->Group[pinDesc->ulPort].PMUX[pinDesc->ulPin >> 1].reg >> ((pinDesc->ulPin & 1) * 4);
+  if (!PORT->Group[pinDesc->ulPort].PINCFG[pinDesc->ulPin].bit.PMUXEN || (pmux & 0xF) != PIO_ANALOG) {
+    pinPeripheral(pin, PIO_ANALOG);
+  }
 
   // Disable DAC, if analogWrite() was used previously to enable the DAC
-  if ((g_APinDescription[pin].ulADCChannelNumber == ADC_Channel0) || (g_APinDescription[pin].ulADCChannelNumber == DAC_Channel0)) {
+  if (((mux == ADC_Channel0) || (mux == DAC_Channel0)) && DAC->CTRLA.bit.ENABLE) {
     syncDAC();
     DAC->CTRLA.bit.ENABLE = 0x00; // Disable DAC
     //DAC->CTRLB.bit.EOEN = 0x00; // The DAC output is turned off.
     syncDAC();
   }
 
-  syncADC();
-  ADC->INPUTCTRL.bit.MUXPOS = g_APinDescription[pin].ulADCChannelNumber; // Selection for the positive ADC input
+  // The first conversion after the ADC is enabled, or after a change of input
+  // or reference, is thrown away. With the ADC kept enabled on the same input,
+  // one conversion is enough.
+  bool discard = !_ADCKeepEnabled || (mux != _ADCMux);
+
+  if (mux != _ADCMux) {
+    syncADC();
+    ADC->INPUTCTRL.bit.MUXPOS = mux; // Selection for the positive ADC input
+    _ADCMux = mux;
+  }
 
   // Control A
   /*
@@ -158,20 +281,42 @@ int analogRead(pin_size_t pin)
    * Before enabling the ADC, the asynchronous clock source must be selected and enabled, and the ADC reference must be
    * configured. The first conversion after the reference is changed must not be used.
    */
-  syncADC();
-  ADC->CTRLA.bit.ENABLE = 0x01;             // Enable ADC
+  if (!ADC->CTRLA.bit.ENABLE) {
+    syncADC();
+    ADC->CTRLA.bit.ENABLE = 0x01;             // Enable ADC
+  }
 
-  // Start conversion
-  syncADC();
-  ADC->SWTRIG.bit.START = 1;
+  return discard;
+}
 
-  // Waiting for the 1st conversion to complete
-  while (ADC->INTFLAG.bit.RESRDY == 0);
+int analogReadFinish(uint32_t result)
+{
+  if (!_ADCKeepEnabled) {
+    syncADC();
+    ADC->CTRLA.bit.ENABLE = 0x00;             // Disable ADC
+    syncADC();
+  }
+
+  return mapResolution(result, _ADCResolution, _readResolution);
+}
+
+int analogRead(pin_size_t pin)
+{
+  uint32_t valueRead = 0;
 
-  // Clear the Data Ready flag
-  ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  if (analogReadPrepare(pin)) {
+    // Start conversion
+    syncADC();
+    ADC->SWTRIG.bit.START = 1;
 
-  // Start conversion again, since The first conversion after the reference is changed must not be used.
+    // Waiting for the 1st conversion to complete
+    while (ADC->INTFLAG.bit.RESRDY == 0);
+
+    // Clear the Data Ready flag
+    ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  }
+
+  // Start conversion
   syncADC();
   ADC->SWTRIG.bit.START = 1;
 
@@ -179,11 +324,7 @@ int analogRead(pin_size_t pin)
   while (ADC->INTFLAG.bit.RESRDY == 0);   // Waiting for conversion to complete
   valueRead = ADC->RESULT.reg;
 
-  syncADC();
-  ADC->CTRLA.bit.ENABLE = 0x00;             // Disable ADC
-  syncADC();
-
-  return mapResolution(valueRead, _ADCResolution, _readResolution);
+  return analogReadFinish(valueRead);
 }
 
 
@@ -206,6 +347,15 @@ void analogWrite(pin_size_t pin, int value)
 
     value = mapResolution(value, _writeResolution, 10);
 
+    // Already enabled: only the value changes, if it does
+    if (DAC->CTRLA.bit.ENABLE) {
+      if (DAC->DATA.reg != (value & 0x3FF)) {
+        syncDAC();
+        DAC->DATA.reg = value & 0x3FF;
+      }
+      return;
+    }
+
     syncDAC();
     DAC->DATA.reg = value & 0x3FF;  // DAC on 10 bits.
     syncDAC();
@@ -0,0 +1,168 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * analogRead() driven by the ADC interrupt. Kept apart from wiring_analog.c
+ * so that ADC_Handler is only linked in by sketches using it.
+ */
+
+#include "Arduino.h"
+#include "wiring_private.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  pin_size_t pin;
+  analogReadCallback callback;  // NULL: analogReadStart()
+} AnalogReadRequest;
+
+// Reads to do, the first one in progress
+static AnalogReadRequest _queue[ANALOG_READ_QUEUE_SIZE];
+static volatile uint32_t _queueHead = 0;
+static volatile uint32_t _queueCount = 0;
+// The conversion in progress is the thrown away one
+static volatile bool _discarding = false;
+
+// analogReadStart() in progress, and its value
+static volatile bool _startBusy = false;
+static volatile int _startResult = 0;
+
+// Wait for synchronization of registers between the clock domains
+static __inline__ void syncADC() __attribute__((always_inline, unused));
+static void syncADC() {
+  while (ADC->STATUS.bit.SYNCBUSY == 1)
+    ;
+}
+
+static void startConversion(void)
+{
+  syncADC();
+  ADC->SWTRIG.bit.START = 1;
+}
+
+// Starts the read at the head of the queue
+static void startRead(void)
+{
+  _discarding = analogReadPrepare(_queue[_queueHead].pin);
+
+  ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  ADC->INTENSET.reg = ADC_INTENSET_RESRDY;
+  startConversion();
+}
+
+static bool queueRead(pin_size_t pin, analogReadCallback callback)
+{
+  static bool interruptEnabled = false;
+  bool queued = false;
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  if (!interruptEnabled) {
+    NVIC_SetPriority(ADC_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+    NVIC_EnableIRQ(ADC_IRQn);
+    interruptEnabled = true;
+  }
+
+  if (_queueCount < ANALOG_READ_QUEUE_SIZE) {
+    AnalogReadRequest *request = &_queue[(_queueHead + _queueCount) % ANALOG_READ_QUEUE_SIZE];
+    request->pin = pin;
+    request->callback = callback;
+    _queueCount++;
+    queued = true;
+
+    if (_queueCount == 1) {
+      startRead();
+    }
+  }
+
+  __set_PRIMASK(primask);
+  return queued;
+}
+
+bool analogReadAsync(pin_size_t pin, analogReadCallback callback)
+{
+  if (callback == NULL) {
+    return false;
+  }
+  return queueRead(pin, callback);
+}
+
+bool analogReadStart(pin_size_t pin)
+{
+  if (_startBusy) {
+    return false;
+  }
+
+  _startBusy = true;
+  if (!queueRead(pin, NULL)) {
+    _startBusy = false;
+    return false;
+  }
+  return true;
+}
+
+bool analogReadPoll(void)
+{
+  return !_startBusy;
+}
+
+int analogReadResult(void)
+{
+  while (_startBusy)
+    ;
+  return _startResult;
+}
+
+void ADC_Handler(void)
+{
+  uint32_t result = ADC->RESULT.reg;
+  ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+
+  if (_discarding) {
+    _discarding = false;
+    startConversion();
+    return;
+  }
+
+  AnalogReadRequest request = _queue[_queueHead];
+  _queueHead = (_queueHead + 1) % ANALOG_READ_QUEUE_SIZE;
+  _queueCount--;
+
+  int value = analogReadFinish(result);
+
+  // The next conversion runs during the callback
+  if (_queueCount) {
+    startRead();
+  } else {
+    ADC->INTENCLR.reg = ADC_INTENCLR_RESRDY;
+  }
+
+  if (request.callback) {
+    request.callback(request.pin, value);
+  } else {
+    _startResult = value;
+    _startBusy = false;
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
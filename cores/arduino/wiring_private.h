@@ -19,6 +19,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdarg.h>
 
@@ -31,6 +32,15 @@ extern "C" {
 
 int pinPeripheral( uint32_t ulPin, EPioType ulPeripheral );
 
+// The ADC was set up by something else than analogRead(): its next call starts over
+void analogReadReset( void );
+
+// The two ends of analogRead(), around the conversions. Prepare sets the ADC up
+// for the pin and tells if a first conversion must be thrown away, finish
+// turns a result into the value returned.
+bool analogReadPrepare( uint32_t ulPin );
+int analogReadFinish( uint32_t result );
+
 #ifdef __cplusplus
 } // extern "C"
 
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Builds the USB device stack simulator for the host, see README.md
+#
+#   ARDUINO_API=/path/to/ArduinoCore-API ./build.sh
+#
+set -e
+
+if [ -z "$ARDUINO_API" ] || [ ! -d "$ARDUINO_API/api" ]; then
+	echo "Set ARDUINO_API to an ArduinoCore-API checkout (the directory holding api/)"
+	exit 1
+fi
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+CORE=$HERE/../../cores/arduino
+OUT=${OUT:-$HERE/build}
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+
+# The simulator headers come first: they replace Arduino.h and the
+# peripheral behind SAMD21_USBDevice.h
+FLAGS="-g -O2 -Wall -DUSB_DEVICE_SIMULATION -DUSBCON -DUSB_VID=0x2341 -DUSB_PID=0x804d -DARDUINO=10819
+       -I$HERE/include -I$CORE -I$ARDUINO_API
+       -I$ARDUINO_API/api/deprecated -I$ARDUINO_API/api/deprecated-avr-comp"
+
+SOURCES="$HERE/src/main.cpp $HERE/src/USBSimHost.cpp $HERE/src/wiring.cpp
+         $CORE/USB/USBCore.cpp $CORE/USB/CDC.cpp $CORE/USB/USBFrameClock.cpp
+         $ARDUINO_API/api/PluggableUSB.cpp $ARDUINO_API/api/Print.cpp
+         $ARDUINO_API/api/Stream.cpp $ARDUINO_API/api/String.cpp"
+
+mkdir -p "$OUT"
+$CC $FLAGS -c "$CORE/itoa.c" -o "$OUT/itoa.o"
+for f in $SOURCES; do
+	$CXX -std=gnu++11 $FLAGS -c "$f" -o "$OUT/$(basename "$f" .cpp).o"
+done
+$CXX -o "$OUT/usbsim" "$OUT"/*.o
+
+echo "$OUT/usbsim"
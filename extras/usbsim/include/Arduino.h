@@ -0,0 +1,84 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Stand-in for cores/arduino/Arduino.h when the USB device stack is
+ * built on the host: the Arduino API plus the few CMSIS and wiring
+ * symbols the stack uses, backed by the simulator.
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+// Pulled in before memcpy is redirected below
+#include <string.h>
+#include <stdint.h>
+#ifdef __cplusplus
+#include <cstring>
+#endif
+
+#include "api/ArduinoAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Core clock the busy-wait timeouts are computed from
+#define SystemCoreClock 48000000UL
+
+#define clockCyclesPerMicrosecond() ( SystemCoreClock / 1000000L )
+#define clockCyclesToMicroseconds(a) ( ((a) * 1000L) / (SystemCoreClock / 1000L) )
+#define microsecondsToClockCycles(a) ( (a) * (SystemCoreClock / 1000000L) )
+
+// Peripheral parameters of the SAMD21 USB module
+#define USB_EPT_NUM 8
+
+// Interrupt controller: the simulator raises the USB interrupt itself,
+// PRIMASK holds it off like on the Cortex-M0+
+typedef enum { USB_IRQn = 7 } IRQn_Type;
+
+uint32_t __get_PRIMASK(void);
+void __disable_irq(void);
+void __enable_irq(void);
+#define __ISB() do { } while (0)
+
+#define NVIC_SetPriority(irq, priority) do { (void)(irq); (void)(priority); } while (0)
+#define NVIC_EnableIRQ(irq) do { (void)(irq); } while (0)
+
+#define interrupts()    __enable_irq()
+#define noInterrupts()  __disable_irq()
+
+void USB_SetHandler(void (*pf_isr)(void));
+
+// Every copy made by the stack goes through the simulator's counters
+void *usbSimMemcpy(void *dst, const void *src, size_t n);
+#define memcpy(dst, src, n) usbSimMemcpy(dst, src, n)
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// USB Device
+#include "USB/USBDesc.h"
+#include "USB/USBCore.h"
+#include "USB/USBAPI.h"
+
+// ARM toolchain doesn't provide itoa etc, provide them
+#include "api/itoa.h"
+
+#endif // Arduino_h
@@ -0,0 +1,282 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Software model of the SAMD21 USB device peripheral, included by
+ * SAMD21_USBDevice.h in place of the register interface when
+ * USB_DEVICE_SIMULATION is defined.
+ *
+ * The register file and the endpoint descriptor table are replaced by
+ * plain structs: the stack fills banks and sets BKnRDY exactly as on the
+ * chip, and the simulated bus (usbSimBusCycle()) moves the data between
+ * the banks and the scripted host.
+ */
+
+#pragma once
+
+// INTFLAG (device)
+#define USB_SIM_INTFLAG_SOF     0x04
+#define USB_SIM_INTFLAG_EORST   0x08
+
+// EPINTFLAG
+#define USB_SIM_EPINT_TRCPT0    0x01
+#define USB_SIM_EPINT_TRCPT1    0x02
+#define USB_SIM_EPINT_TRFAIL0   0x04
+#define USB_SIM_EPINT_TRFAIL1   0x08
+#define USB_SIM_EPINT_RXSTP     0x10
+#define USB_SIM_EPINT_STALL0    0x20
+#define USB_SIM_EPINT_STALL1    0x40
+
+// One endpoint bank: PCKSIZE/ADDR of the descriptor plus its EPSTATUS bits
+struct USBSimBank {
+	uint8_t *address;
+	uint16_t size;            // max packet size in bytes
+	uint8_t type;             // EPTYPE, 0 = disabled
+	uint16_t byteCount;
+	uint16_t multiPacketSize;
+	bool autoZlp;
+	bool ready;               // BKnRDY
+	bool stallReq;            // STALLRQn
+};
+
+struct USBSimEndpoint {
+	USBSimBank bank[2];
+	uint8_t intFlag;          // EPINTFLAG
+	uint8_t intEnable;        // EPINTENSET
+};
+
+// What the stack cost, reset by the host between measurements
+struct USBSimCounters {
+	uint64_t interrupts;      // USB_Handler invocations
+	uint64_t statusPolls;     // BKnRDY/TRCPTn reads outside the handler
+	uint64_t busyPolls;       // ... that found the transfer still pending
+	uint64_t memcpyCalls;
+	uint64_t memcpyBytes;
+	uint64_t packets;         // data packets on the bus, ZLPs included
+	uint64_t payloadBytes;    // bulk/interrupt data moved, EP0 excluded
+};
+
+struct USBSimDevice {
+	bool enabled;
+	bool attached;
+	uint8_t address;
+	bool addressEnabled;
+	uint16_t frameNumber;
+	uint8_t intFlag;          // INTFLAG
+	uint8_t intEnable;        // INTENSET
+	USBSimEndpoint ep[USB_EPT_NUM];
+
+	bool primask;
+	bool inInterrupt;
+
+	// Status polls per bus transaction slot: 1 means the host answers
+	// the first poll, higher values model a busy bus
+	uint32_t latency;
+	uint32_t pollsToBus;
+
+	USBSimCounters count;
+};
+
+extern USBSimDevice usbSim;
+
+// Run one bus cycle: deliver queued host OUT packets into free banks and
+// collect ready IN banks. Called by the host, and by the stack's status
+// polls since a busy-waiting CPU is what lets the bus make progress.
+void usbSimBusCycle();
+
+class USBDevice_SAMD21G18x {
+public:
+	// USB Device function mapping
+	// ---------------------------
+
+	// Reset USB Device
+	inline void reset() {
+		bool attached = usbSim.attached;
+		uint32_t latency = usbSim.latency;
+		USBSimCounters count = usbSim.count;
+		memset(&usbSim, 0, sizeof(usbSim));
+		usbSim.attached = attached;
+		usbSim.latency = latency;
+		usbSim.count = count;
+	}
+
+	// Clock the peripheral and route the DM/DP pins to it
+	inline void initClockAndPins() { }
+
+	// Enable
+	inline void enable()  { usbSim.enabled = true; }
+	inline void disable() { usbSim.enabled = false; }
+
+	// USB mode (device/host)
+	inline void setUSBDeviceMode() { }
+	inline void setUSBHostMode()   { }
+
+	inline void runInStandby()   { }
+	inline void noRunInStandby() { }
+	inline void wakeupHost()     { }
+
+	// USB QoS
+	inline void setDataSensitiveQoS() { }
+	inline void setConfigSensitiveQoS() { }
+
+	// USB speed
+	inline void setFullSpeed()       { }
+	inline void setLowSpeed()        { }
+	inline void setHiSpeed()         { }
+	inline void setHiSpeedTestMode() { }
+
+	// Authorize attach if Vbus is present
+	inline void attach() { usbSim.attached = true; }
+	inline void detach() { usbSim.attached = false; }
+
+	// USB Interrupts
+	inline bool isEndOfResetInterrupt()        { return usbSim.intFlag & USB_SIM_INTFLAG_EORST; }
+	inline void ackEndOfResetInterrupt()       { usbSim.intFlag &= ~USB_SIM_INTFLAG_EORST; }
+	inline void enableEndOfResetInterrupt()    { usbSim.intEnable |= USB_SIM_INTFLAG_EORST; }
+	inline void disableEndOfResetInterrupt()   { usbSim.intEnable &= ~USB_SIM_INTFLAG_EORST; }
+
+	inline bool isStartOfFrameInterrupt()      { return usbSim.intFlag & USB_SIM_INTFLAG_SOF; }
+	inline void ackStartOfFrameInterrupt()     { usbSim.intFlag &= ~USB_SIM_INTFLAG_SOF; }
+	inline void enableStartOfFrameInterrupt()  { usbSim.intEnable |= USB_SIM_INTFLAG_SOF; }
+	inline void disableStartOfFrameInterrupt() { usbSim.intEnable &= ~USB_SIM_INTFLAG_SOF; }
+
+	// USB Address
+	inline void setAddress(uint32_t addr)   { usbSim.address = addr; usbSim.addressEnabled = true; }
+	inline void unsetAddress()              { usbSim.address = 0;    usbSim.addressEnabled = false; }
+
+	// Frame number
+	inline uint16_t frameNumber() { return usbSim.frameNumber; }
+
+	// Load calibration values
+	inline void calibrate() { }
+
+	// USB Device Endpoints function mapping
+	// -------------------------------------
+
+	// Config
+	inline void epBank0SetType(ep_t ep, uint8_t type) { usbSim.ep[ep].bank[0].type = type; }
+	inline void epBank1SetType(ep_t ep, uint8_t type) { usbSim.ep[ep].bank[1].type = type; }
+
+	// Interrupts
+	inline uint16_t epInterruptSummary() {
+		uint16_t summary = 0;
+		for (int ep = 0; ep < USB_EPT_NUM; ep++) {
+			if (usbSim.ep[ep].intFlag) summary |= 1 << ep;
+		}
+		return summary;
+	}
+
+	inline bool epHasPendingInterrupts(ep_t ep)     { return usbSim.ep[ep].intFlag != 0; }
+	inline bool epBank0IsSetupReceived(ep_t ep)     { return usbSim.ep[ep].intFlag & USB_SIM_EPINT_RXSTP; }
+	inline bool epBank0IsStalled(ep_t ep)           { return usbSim.ep[ep].intFlag & USB_SIM_EPINT_STALL0; }
+	inline bool epBank1IsStalled(ep_t ep)           { return usbSim.ep[ep].intFlag & USB_SIM_EPINT_STALL1; }
+	inline bool epBank0IsTransferFailed(ep_t ep)    { return usbSim.ep[ep].intFlag & USB_SIM_EPINT_TRFAIL0; }
+	inline bool epBank1IsTransferFailed(ep_t ep)    { return usbSim.ep[ep].intFlag & USB_SIM_EPINT_TRFAIL1; }
+	inline bool epBank0IsTransferComplete(ep_t ep)  { busSlot(); return polled(usbSim.ep[ep].intFlag & USB_SIM_EPINT_TRCPT0, false); }
+	inline bool epBank1IsTransferComplete(ep_t ep)  { busSlot(); return polled(usbSim.ep[ep].intFlag & USB_SIM_EPINT_TRCPT1, false); }
+
+	inline void epAckPendingInterrupts(ep_t ep)     { usbSim.ep[ep].intFlag = 0; }
+	inline void epBank0AckSetupReceived(ep_t ep)    { usbSim.ep[ep].intFlag &= ~USB_SIM_EPINT_RXSTP; }
+	inline void epBank0AckStalled(ep_t ep)          { usbSim.ep[ep].intFlag &= ~USB_SIM_EPINT_STALL0; }
+	inline void epBank1AckStalled(ep_t ep)          { usbSim.ep[ep].intFlag &= ~USB_SIM_EPINT_STALL1; }
+	inline void epBank0AckTransferFailed(ep_t ep)   { usbSim.ep[ep].intFlag &= ~USB_SIM_EPINT_TRFAIL0; }
+	inline void epBank1AckTransferFailed(ep_t ep)   { usbSim.ep[ep].intFlag &= ~USB_SIM_EPINT_TRFAIL1; }
+	inline void epBank0AckTransferComplete(ep_t ep) { usbSim.ep[ep].intFlag &= ~USB_SIM_EPINT_TRCPT0; }
+	inline void epBank1AckTransferComplete(ep_t ep) { usbSim.ep[ep].intFlag &= ~USB_SIM_EPINT_TRCPT1; }
+
+	inline void epBank0EnableSetupReceived(ep_t ep)    { usbSim.ep[ep].intEnable |= USB_SIM_EPINT_RXSTP; }
+	inline void epBank0EnableStalled(ep_t ep)          { usbSim.ep[ep].intEnable |= USB_SIM_EPINT_STALL0; }
+	inline void epBank1EnableStalled(ep_t ep)          { usbSim.ep[ep].intEnable |= USB_SIM_EPINT_STALL1; }
+	inline void epBank0EnableTransferFailed(ep_t ep)   { usbSim.ep[ep].intEnable |= USB_SIM_EPINT_TRFAIL0; }
+	inline void epBank1EnableTransferFailed(ep_t ep)   { usbSim.ep[ep].intEnable |= USB_SIM_EPINT_TRFAIL1; }
+	inline void epBank0EnableTransferComplete(ep_t ep) { usbSim.ep[ep].intEnable |= USB_SIM_EPINT_TRCPT0; }
+	inline void epBank1EnableTransferComplete(ep_t ep) { usbSim.ep[ep].intEnable |= USB_SIM_EPINT_TRCPT1; }
+
+	inline void epBank0DisableSetupReceived(ep_t ep)    { usbSim.ep[ep].intEnable &= ~USB_SIM_EPINT_RXSTP; }
+	inline void epBank0DisableStalled(ep_t ep)          { usbSim.ep[ep].intEnable &= ~USB_SIM_EPINT_STALL0; }
+	inline void epBank1DisableStalled(ep_t ep)          { usbSim.ep[ep].intEnable &= ~USB_SIM_EPINT_STALL1; }
+	inline void epBank0DisableTransferFailed(ep_t ep)   { usbSim.ep[ep].intEnable &= ~USB_SIM_EPINT_TRFAIL0; }
+	inline void epBank1DisableTransferFailed(ep_t ep)   { usbSim.ep[ep].intEnable &= ~USB_SIM_EPINT_TRFAIL1; }
+	inline void epBank0DisableTransferComplete(ep_t ep) { usbSim.ep[ep].intEnable &= ~USB_SIM_EPINT_TRCPT0; }
+	inline void epBank1DisableTransferComplete(ep_t ep) { usbSim.ep[ep].intEnable &= ~USB_SIM_EPINT_TRCPT1; }
+
+	// Status
+	inline bool epBank0IsReady(ep_t ep)    { busSlot(); return polled(usbSim.ep[ep].bank[0].ready, false); }
+	inline bool epBank1IsReady(ep_t ep)    { busSlot(); return polled(usbSim.ep[ep].bank[1].ready, true); }
+	inline void epBank0SetReady(ep_t ep)   { usbSim.ep[ep].bank[0].ready = true; }
+	inline void epBank1SetReady(ep_t ep)   { usbSim.ep[ep].bank[1].ready = true; }
+	inline void epBank0ResetReady(ep_t ep) { usbSim.ep[ep].bank[0].ready = false; }
+	inline void epBank1ResetReady(ep_t ep) { usbSim.ep[ep].bank[1].ready = false; }
+
+	inline void epBank0SetStallReq(ep_t ep)   { usbSim.ep[ep].bank[0].stallReq = true; }
+	inline void epBank1SetStallReq(ep_t ep)   { usbSim.ep[ep].bank[1].stallReq = true; }
+	inline void epBank0ResetStallReq(ep_t ep) { usbSim.ep[ep].bank[0].stallReq = false; }
+	inline void epBank1ResetStallReq(ep_t ep) { usbSim.ep[ep].bank[1].stallReq = false; }
+
+	inline void epBank0ResetDataToggle(ep_t) { }
+	inline void epBank1ResetDataToggle(ep_t) { }
+
+	// Packet
+	inline uint16_t epBank0ByteCount(ep_t ep) { return usbSim.ep[ep].bank[0].byteCount; }
+	inline uint16_t epBank1ByteCount(ep_t ep) { return usbSim.ep[ep].bank[1].byteCount; }
+	inline void epBank0SetByteCount(ep_t ep, uint16_t bc) { usbSim.ep[ep].bank[0].byteCount = bc & 0x3FFF; }
+	inline void epBank1SetByteCount(ep_t ep, uint16_t bc) { usbSim.ep[ep].bank[1].byteCount = bc & 0x3FFF; }
+	inline void epBank0SetMultiPacketSize(ep_t ep, uint16_t s) { usbSim.ep[ep].bank[0].multiPacketSize = s & 0x3FFF; }
+	inline void epBank1SetMultiPacketSize(ep_t ep, uint16_t s) { usbSim.ep[ep].bank[1].multiPacketSize = s & 0x3FFF; }
+
+	inline void epBank0SetAddress(ep_t ep, void *addr) { usbSim.ep[ep].bank[0].address = (uint8_t *)addr; }
+	inline void epBank1SetAddress(ep_t ep, void *addr) { usbSim.ep[ep].bank[1].address = (uint8_t *)addr; }
+	inline void epBank0SetSize(ep_t ep, uint16_t size) { usbSim.ep[ep].bank[0].size = size; }
+	inline void epBank1SetSize(ep_t ep, uint16_t size) { usbSim.ep[ep].bank[1].size = size; }
+
+	inline void epBank0DisableAutoZLP(ep_t ep) { usbSim.ep[ep].bank[0].autoZlp = false; }
+	inline void epBank1DisableAutoZLP(ep_t ep) { usbSim.ep[ep].bank[1].autoZlp = false; }
+	inline void epBank0EnableAutoZLP(ep_t ep)  { usbSim.ep[ep].bank[0].autoZlp = true; }
+	inline void epBank1EnableAutoZLP(ep_t ep)  { usbSim.ep[ep].bank[1].autoZlp = true; }
+
+	// USB Device Endpoint transactions helpers
+	// ----------------------------------------
+
+	inline void epReleaseOutBank0(ep_t ep, uint16_t s) {
+		epBank0SetMultiPacketSize(ep, s);
+		epBank0SetByteCount(ep, 0);
+		epBank0ResetReady(ep);
+	}
+
+private:
+	// A status read gives the bus a chance to move: every 'latency'
+	// reads the host gets a transaction slot
+	inline void busSlot() {
+		if (++usbSim.pollsToBus >= usbSim.latency) {
+			usbSim.pollsToBus = 0;
+			usbSimBusCycle();
+		}
+	}
+
+	// Counts the reads made by the sketch side: whether they found the
+	// transfer still pending tells how long send() and friends spin
+	inline bool polled(bool value, bool busy) {
+		if (!usbSim.inInterrupt) {
+			usbSim.count.statusPolls++;
+			if (value == busy) {
+				usbSim.count.busyPolls++;
+			}
+		}
+		return value;
+	}
+};
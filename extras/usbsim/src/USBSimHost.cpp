@@ -0,0 +1,386 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "USBSimHost.h"
+
+#include <stdio.h>
+
+USBSimDevice usbSim;
+
+// Interrupts that keep firing without the bus moving mean the handler
+// does not acknowledge a flag it enabled
+#define INTERRUPT_STORM 1000
+
+static void (*usbHandler)(void);
+
+// Host side of each endpoint
+static std::deque<std::vector<uint8_t> > outPackets[USB_EPT_NUM];
+static std::vector<uint8_t> inData[USB_EPT_NUM];
+static uint32_t inTransfers[USB_EPT_NUM];
+static bool inPaused[USB_EPT_NUM];
+static bool inStalled[USB_EPT_NUM];
+static bool outStalled[USB_EPT_NUM];
+
+extern "C" void USB_SetHandler(void (*pf_isr)(void))
+{
+	usbHandler = pf_isr;
+}
+
+extern "C" uint32_t __get_PRIMASK(void)
+{
+	return usbSim.primask ? 1 : 0;
+}
+
+extern "C" void __disable_irq(void)
+{
+	usbSim.primask = true;
+}
+
+extern "C" void __enable_irq(void)
+{
+	usbSim.primask = false;
+}
+
+// One transaction per endpoint and direction, returns true if the bus moved
+static bool busCycle()
+{
+	bool moved = false;
+
+	if (!usbSim.enabled || !usbSim.attached) {
+		return false;
+	}
+
+	for (int n = 0; n < USB_EPT_NUM; n++) {
+		USBSimEndpoint &ep = usbSim.ep[n];
+
+		// OUT: the next packet fills a free bank
+		USBSimBank &out = ep.bank[0];
+		if (out.type != 0 && !outPackets[n].empty() && !out.ready) {
+			if (out.stallReq) {
+				// the host gives up on the transfer
+				outPackets[n].clear();
+				outStalled[n] = true;
+				ep.intFlag |= USB_SIM_EPINT_STALL0;
+			} else {
+				std::vector<uint8_t> &packet = outPackets[n].front();
+				uint16_t limit = out.multiPacketSize ? out.multiPacketSize : out.size;
+				uint16_t len = std::min<uint32_t>(packet.size(), limit - out.byteCount);
+				std::copy(packet.begin(), packet.begin() + len, out.address + out.byteCount);
+				out.byteCount += len;
+
+				// a short packet or a full buffer ends the transfer
+				if (packet.size() < out.size || out.multiPacketSize == 0 || out.byteCount >= limit) {
+					out.ready = true;
+					ep.intFlag |= USB_SIM_EPINT_TRCPT0;
+				}
+
+				usbSim.count.packets++;
+				if (n != 0) {
+					usbSim.count.payloadBytes += len;
+				}
+				outPackets[n].pop_front();
+			}
+			moved = true;
+		}
+
+		// IN: the host polls every configured endpoint
+		USBSimBank &in = ep.bank[1];
+		if (in.type != 0 && !inPaused[n]) {
+			if (in.stallReq) {
+				if (!inStalled[n]) {
+					inStalled[n] = true;
+					ep.intFlag |= USB_SIM_EPINT_STALL1;
+					moved = true;
+				}
+			} else if (in.ready) {
+				uint16_t len = in.byteCount;
+				inData[n].insert(inData[n].end(), in.address, in.address + len);
+				inTransfers[n]++;
+
+				usbSim.count.packets += (len + in.size - 1) / in.size;
+				if (len == 0 || (in.autoZlp && (len % in.size) == 0)) {
+					usbSim.count.packets++;
+				}
+				if (n != 0) {
+					usbSim.count.payloadBytes += len;
+				}
+
+				in.ready = false;
+				ep.intFlag |= USB_SIM_EPINT_TRCPT1;
+				moved = true;
+			}
+		}
+	}
+	return moved;
+}
+
+void usbSimBusCycle()
+{
+	busCycle();
+}
+
+static bool interruptPending()
+{
+	if (usbSim.intFlag & usbSim.intEnable) {
+		return true;
+	}
+	for (int n = 0; n < USB_EPT_NUM; n++) {
+		if (usbSim.ep[n].intFlag & usbSim.ep[n].intEnable) {
+			return true;
+		}
+	}
+	return false;
+}
+
+USBSimHost::USBSimHost()
+{
+	if (usbSim.latency == 0) {
+		usbSim.latency = 1;
+	}
+}
+
+void USBSimHost::service()
+{
+	uint32_t storm = 0;
+
+	for (;;) {
+		bool moved = busCycle();
+
+		if (!interruptPending() || usbSim.primask || !usbHandler) {
+			if (!moved) {
+				return;
+			}
+			continue;
+		}
+
+		if (!moved && ++storm == INTERRUPT_STORM) {
+			fprintf(stderr, "usbsim: interrupt never acknowledged\n");
+			return;
+		}
+
+		usbSim.inInterrupt = true;
+		usbSim.count.interrupts++;
+		usbHandler();
+		usbSim.inInterrupt = false;
+	}
+}
+
+void USBSimHost::busReset()
+{
+	usbSim.address = 0;
+	usbSim.addressEnabled = false;
+	for (int n = 0; n < USB_EPT_NUM; n++) {
+		usbSim.ep[n].intFlag = 0;
+		usbSim.ep[n].bank[0].ready = false;
+		usbSim.ep[n].bank[1].ready = false;
+		usbSim.ep[n].bank[0].stallReq = false;
+		usbSim.ep[n].bank[1].stallReq = false;
+		outPackets[n].clear();
+		inData[n].clear();
+		inTransfers[n] = 0;
+		inStalled[n] = false;
+		outStalled[n] = false;
+	}
+	usbSim.intFlag |= USB_SIM_INTFLAG_EORST;
+	service();
+}
+
+void USBSimHost::frames(uint32_t count)
+{
+	extern void usbSimAdvanceMillis(uint32_t ms);
+
+	while (count--) {
+		usbSim.frameNumber = (usbSim.frameNumber + 1) & 0x7FF;
+		usbSim.intFlag |= USB_SIM_INTFLAG_SOF;
+		usbSimAdvanceMillis(1);
+		service();
+	}
+}
+
+int USBSimHost::control(uint8_t requestType, uint8_t request, uint16_t value,
+                        uint16_t index, uint16_t length, void *data)
+{
+	USBSimEndpoint &ep0 = usbSim.ep[0];
+	uint8_t setup[8] = {
+		requestType, request,
+		uint8_t(value & 0xFF), uint8_t(value >> 8),
+		uint8_t(index & 0xFF), uint8_t(index >> 8),
+		uint8_t(length & 0xFF), uint8_t(length >> 8)
+	};
+
+	if (ep0.bank[0].type == 0) {
+		return -1;
+	}
+
+	outPackets[0].clear();
+	inData[0].clear();
+	inTransfers[0] = 0;
+	inStalled[0] = false;
+
+	// SETUP is always acknowledged and clears the endpoint 0 stall
+	std::copy(setup, setup + sizeof(setup), ep0.bank[0].address);
+	ep0.bank[0].byteCount = sizeof(setup);
+	ep0.bank[0].ready = true;
+	ep0.bank[0].stallReq = false;
+	ep0.bank[1].stallReq = false;
+	ep0.intFlag |= USB_SIM_EPINT_RXSTP;
+
+	bool deviceToHost = requestType & 0x80;
+	if (!deviceToHost && length) {
+		out(0, data, length);
+	}
+	service();
+
+	if (inStalled[0]) {
+		return -1;
+	}
+
+	if (deviceToHost) {
+		// Status stage: zero length OUT
+		out(0, NULL, 0);
+		service();
+
+		uint32_t len = std::min<uint32_t>(inData[0].size(), length);
+		std::copy(inData[0].begin(), inData[0].begin() + len, (uint8_t *)data);
+		return len;
+	}
+
+	// Status stage: the device answers the IN token with a ZLP
+	if (inTransfers[0] == 0) {
+		return -1;
+	}
+	return length;
+}
+
+int USBSimHost::getDescriptor(uint8_t type, uint8_t index, void *data, uint16_t length)
+{
+	return control(0x80, GET_DESCRIPTOR, (type << 8) | index, 0, length, data);
+}
+
+bool USBSimHost::enumerate(uint8_t address)
+{
+	uint8_t buffer[USB_CONFIGURATION_MAX_LEN];
+
+	busReset();
+
+	// The first request only needs bMaxPacketSize0
+	DeviceDescriptor device;
+	if (getDescriptor(USB_DEVICE_DESCRIPTOR_TYPE, 0, &device, 64) != sizeof(device)) {
+		return false;
+	}
+
+	busReset();
+	if (control(0x00, SET_ADDRESS, address, 0, 0) < 0) {
+		return false;
+	}
+	if (!usbSim.addressEnabled || usbSim.address != address) {
+		return false;
+	}
+
+	if (getDescriptor(USB_DEVICE_DESCRIPTOR_TYPE, 0, &device, sizeof(device)) != sizeof(device)) {
+		return false;
+	}
+
+	ConfigDescriptor header;
+	if (getDescriptor(USB_CONFIGURATION_DESCRIPTOR_TYPE, 0, &header, sizeof(header)) != sizeof(header)) {
+		return false;
+	}
+	if (header.clen > sizeof(buffer) ||
+	    getDescriptor(USB_CONFIGURATION_DESCRIPTOR_TYPE, 0, buffer, header.clen) != header.clen) {
+		return false;
+	}
+	config.assign(buffer, buffer + header.clen);
+
+	// Language, manufacturer and product strings
+	if (getDescriptor(USB_STRING_DESCRIPTOR_TYPE, 0, buffer, 255) < 4) {
+		return false;
+	}
+	if (device.iManufacturer && getDescriptor(USB_STRING_DESCRIPTOR_TYPE, device.iManufacturer, buffer, 255) < 2) {
+		return false;
+	}
+	if (device.iProduct && getDescriptor(USB_STRING_DESCRIPTOR_TYPE, device.iProduct, buffer, 255) < 2) {
+		return false;
+	}
+
+	return control(0x00, SET_CONFIGURATION, 1, 0, 0) >= 0;
+}
+
+uint8_t USBSimHost::findEndpoint(uint8_t type, bool in, uint8_t n)
+{
+	for (uint32_t i = 0; i + 1 < config.size() && config[i] != 0; i += config[i]) {
+		if (config[i + 1] != USB_ENDPOINT_DESCRIPTOR_TYPE) {
+			continue;
+		}
+		uint8_t addr = config[i + 2];
+		uint8_t attr = config[i + 3];
+		if ((attr & 0x03) == type && ((addr & 0x80) != 0) == in && n-- == 0) {
+			return addr & 0x0F;
+		}
+	}
+	return 0;
+}
+
+void USBSimHost::out(uint8_t ep, const void *data, uint32_t len)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	uint16_t size = usbSim.ep[ep].bank[0].size ? usbSim.ep[ep].bank[0].size : EPX_SIZE;
+
+	outStalled[ep] = false;
+	do {
+		uint32_t n = std::min<uint32_t>(len, size);
+		outPackets[ep].push_back(std::vector<uint8_t>(p, p + n));
+		p += n;
+		len -= n;
+	} while (len);
+	service();
+}
+
+uint32_t USBSimHost::pendingOut(uint8_t ep)
+{
+	uint32_t pending = 0;
+	for (size_t i = 0; i < outPackets[ep].size(); i++) {
+		pending += outPackets[ep][i].size();
+	}
+	return pending;
+}
+
+uint32_t USBSimHost::availableIn(uint8_t ep)
+{
+	return inData[ep].size();
+}
+
+uint32_t USBSimHost::in(uint8_t ep, void *data, uint32_t len)
+{
+	len = std::min<uint32_t>(len, inData[ep].size());
+	std::copy(inData[ep].begin(), inData[ep].begin() + len, (uint8_t *)data);
+	inData[ep].erase(inData[ep].begin(), inData[ep].begin() + len);
+	return len;
+}
+
+void USBSimHost::pauseIn(uint8_t ep, bool paused)
+{
+	inPaused[ep] = paused;
+	if (!paused) {
+		service();
+	}
+}
+
+bool USBSimHost::stalled(uint8_t ep, bool in)
+{
+	return in ? inStalled[ep] : outStalled[ep];
+}
@@ -0,0 +1,76 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+// Standard headers first, the Arduino API may define min() and max()
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <Arduino.h>
+#include "USB/SAMD21_USBDevice.h"
+
+// A scripted USB host driving the simulated peripheral. Every call moves
+// the bus forward and runs the device's interrupt handler until the
+// interrupt line goes idle, like a host controller polling a real device.
+class USBSimHost {
+public:
+	USBSimHost();
+
+	// Bus events
+	void busReset();
+	void frames(uint32_t count = 1);   // Start-Of-Frame, 1 ms each
+
+	// Move the bus and serve the device interrupt until both are idle
+	void service();
+
+	// Control transfer on endpoint 0: returns the length of the data
+	// stage, or -1 when the device stalled the request
+	int control(uint8_t requestType, uint8_t request, uint16_t value,
+	            uint16_t index, uint16_t length, void *data = NULL);
+	int getDescriptor(uint8_t type, uint8_t index, void *data, uint16_t length);
+
+	// Reset, address and configure the device, reading the descriptors
+	// on the way. The iSerial string is not requested: it comes from the
+	// chip serial number, which only exists on the target.
+	bool enumerate(uint8_t address = 5);
+
+	const uint8_t *configuration() { return config.data(); }
+	uint16_t configurationLength() { return config.size(); }
+
+	// Endpoint number of the n-th endpoint with the given transfer type
+	// and direction in the configuration, 0 if there is none
+	uint8_t findEndpoint(uint8_t type, bool in, uint8_t n = 0);
+
+	// Bulk and interrupt transfers. OUT data is split in packets of the
+	// endpoint size and queued, the device takes them as its bank frees
+	// up. IN data is collected whenever the device arms its bank.
+	void out(uint8_t ep, const void *data, uint32_t len);
+	uint32_t pendingOut(uint8_t ep);
+	uint32_t availableIn(uint8_t ep);
+	uint32_t in(uint8_t ep, void *data, uint32_t len);
+
+	// A host that stops reading leaves the device's IN bank full
+	void pauseIn(uint8_t ep, bool paused);
+
+	bool stalled(uint8_t ep, bool in);
+
+private:
+	std::vector<uint8_t> config;
+};
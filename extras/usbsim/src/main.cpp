@@ -0,0 +1,259 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * usbsim: runs the core's USB device stack (USBCore + CDC) against a
+ * scripted host.
+ *
+ *   usbsim                      enumerate, then check CDC requests and echo
+ *   usbsim --bench [bytes]      cost of SerialUSB transfers per payload byte
+ *          [--latency polls]    status polls before the host takes a packet
+ *          [--chunk bytes]      size of the sketch's write() calls
+ */
+
+#include "USBSimHost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#undef memcpy
+
+#define CDC_SET_LINE_CODING         0x20
+#define CDC_GET_LINE_CODING         0x21
+#define CDC_SET_CONTROL_LINE_STATE  0x22
+
+static USBSimHost host;
+static uint8_t epOut, epIn;
+
+static int failures;
+
+extern int32_t usbSimClockPPM;
+
+static uint32_t frameCalls;
+static uint16_t lastFrame;
+
+static void countFrame(uint16_t frameNumber)
+{
+	frameCalls++;
+	lastFrame = frameNumber;
+}
+
+static void check(bool ok, const char *what)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) {
+		failures++;
+	}
+}
+
+// The sketch: send back what was received
+static void echo()
+{
+	char buffer[EPX_SIZE];
+	int n;
+	while ((n = SerialUSB.available()) > 0) {
+		if (n > (int)sizeof(buffer)) {
+			n = sizeof(buffer);
+		}
+		n = SerialUSB.readBytes(buffer, n);
+		SerialUSB.write((const uint8_t *)buffer, n);
+	}
+}
+
+static bool start()
+{
+	USBDevice.init();
+	USBDevice.attach();
+
+	if (!host.enumerate()) {
+		return false;
+	}
+	epOut = host.findEndpoint(USB_ENDPOINT_TYPE_BULK, false);
+	epIn = host.findEndpoint(USB_ENDPOINT_TYPE_BULK, true);
+	return epOut && epIn;
+}
+
+static int functional()
+{
+	check(start(), "enumeration");
+	if (failures) {
+		return 1;
+	}
+
+	uint8_t lineCoding[7] = { 0x80, 0x25, 0, 0, 0, 0, 8 };   // 9600 8N1
+	check(host.control(0x21, CDC_SET_LINE_CODING, 0, 0, sizeof(lineCoding), lineCoding) == sizeof(lineCoding),
+	      "SET_LINE_CODING");
+	check(SerialUSB.baud() == 9600 && SerialUSB.numbits() == 8, "line coding reaches the sketch");
+
+	uint8_t readBack[7] = { 0 };
+	check(host.control(0xA1, CDC_GET_LINE_CODING, 0, 0, sizeof(readBack), readBack) == sizeof(readBack) &&
+	      memcmp(lineCoding, readBack, sizeof(readBack)) == 0, "GET_LINE_CODING");
+
+	check(host.control(0x21, CDC_SET_CONTROL_LINE_STATE, 0x03, 0, 0) == 0 && SerialUSB.dtr(),
+	      "SET_CONTROL_LINE_STATE");
+
+	check(host.control(0x21, CDC_SET_LINE_CODING, 0, 9, sizeof(lineCoding), lineCoding) < 0,
+	      "request to an unknown interface stalls");
+	check(host.control(0x80, GET_STATUS, 0, 0, 2, readBack) == 2, "endpoint 0 recovers from the stall");
+
+	uint64_t interrupts = usbSim.count.interrupts;
+	host.frames(10);
+	check(usbSim.count.interrupts - interrupts == 10, "one interrupt per Start-Of-Frame");
+
+	check(USBDevice.attachStartOfFrame(countFrame), "attach a Start-Of-Frame hook");
+	host.frames(10);
+	check(frameCalls == 10 && lastFrame == usbSim.frameNumber, "the hook gets every frame number");
+	USBDevice.detachStartOfFrame(countFrame);
+
+	// A device clock running 50 ppm fast
+	usbSimClockPPM = 50;
+	USBFrameClock.begin();
+	host.frames(3000);
+	int64_t offset = (int64_t)USBFrameClock.micros() - (int64_t)USBFrameClock.frames() * 1000;
+	check(USBFrameClock.locked() && USBFrameClock.ppm() >= 49 && USBFrameClock.ppm() <= 51 &&
+	      offset >= -1 && offset <= 1, "the frame clock locks on the host's frames");
+	check((USBFrameClock.frames() & 0x7FF) == usbSim.frameNumber, "frame count extends the frame number");
+	USBFrameClock.end();
+	usbSimClockPPM = 0;
+
+	// Echo through SerialUSB, with transfers not aligned on packets
+	static uint8_t sent[3000], received[3000];
+	for (uint32_t i = 0; i < sizeof(sent); i++) {
+		sent[i] = i * 7 + (i >> 8);
+	}
+	uint32_t count = 0;
+	for (uint32_t pos = 0; pos < sizeof(sent); ) {
+		uint32_t len = 1 + (pos % 200);
+		if (pos + len > sizeof(sent)) {
+			len = sizeof(sent) - pos;
+		}
+		host.out(epOut, sent + pos, len);
+		pos += len;
+		while (host.pendingOut(epOut) || SerialUSB.available()) {
+			echo();
+			host.service();
+		}
+		count += host.in(epIn, received + count, sizeof(received) - count);
+	}
+	check(count == sizeof(sent) && memcmp(sent, received, sizeof(sent)) == 0, "bulk echo");
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
+
+static void report(const char *name, uint32_t bytes)
+{
+	const USBSimCounters &c = usbSim.count;
+	double payload = c.payloadBytes ? (double)c.payloadBytes : 1.0;
+
+	printf("%-5s %8u bytes %7llu packets | per payload byte: memcpy %.2f bytes, "
+	       "%.4f interrupts, %.3f status polls (%.3f busy)\n",
+	       name, bytes, (unsigned long long)c.packets,
+	       c.memcpyBytes / payload, c.interrupts / payload,
+	       c.statusPolls / payload, c.busyPolls / payload);
+}
+
+static void resetCounters()
+{
+	memset(&usbSim.count, 0, sizeof(usbSim.count));
+}
+
+static int bench(uint32_t bytes, uint32_t chunk)
+{
+	static uint8_t buffer[16384], sink[16384];
+	if (chunk == 0 || chunk > sizeof(buffer)) {
+		chunk = EPX_SIZE;
+	}
+	memset(buffer, 0x55, sizeof(buffer));
+
+	if (!start()) {
+		printf("enumeration failed\n");
+		return 1;
+	}
+	host.control(0x21, CDC_SET_CONTROL_LINE_STATE, 0x03, 0, 0);
+
+	// Host to device, the sketch reads as data arrives
+	resetCounters();
+	for (uint32_t done = 0; done < bytes; ) {
+		uint32_t len = bytes - done < chunk ? bytes - done : chunk;
+		host.out(epOut, buffer, len);
+		done += len;
+		while (host.pendingOut(epOut) || SerialUSB.available()) {
+			char data[EPX_SIZE];
+			int n;
+			while ((n = SerialUSB.available()) > 0) {
+				SerialUSB.readBytes(data, n < EPX_SIZE ? n : EPX_SIZE);
+			}
+			host.service();
+		}
+	}
+	report("rx", bytes);
+
+	// Device to host, the sketch writes 'chunk' bytes at a time as fast
+	// as it can: the bus only moves while send() polls the IN bank
+	resetCounters();
+	for (uint32_t done = 0; done < bytes; ) {
+		uint32_t len = bytes - done < chunk ? bytes - done : chunk;
+		SerialUSB.write(buffer, len);
+		done += len;
+		host.in(epIn, sink, sizeof(sink));
+	}
+	host.service();
+	report("tx", bytes);
+
+	// Both ways through echo()
+	resetCounters();
+	for (uint32_t done = 0; done < bytes; ) {
+		uint32_t len = bytes - done < chunk ? bytes - done : chunk;
+		host.out(epOut, buffer, len);
+		done += len;
+		while (host.pendingOut(epOut) || SerialUSB.available()) {
+			echo();
+			host.service();
+		}
+		host.in(epIn, sink, sizeof(sink));
+	}
+	report("echo", bytes);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	bool benchmark = false;
+	uint32_t bytes = 65536;
+	uint32_t chunk = EPX_SIZE;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--bench")) {
+			benchmark = true;
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				bytes = strtoul(argv[++i], NULL, 0);
+			}
+		} else if (!strcmp(argv[i], "--latency") && i + 1 < argc) {
+			usbSim.latency = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--chunk") && i + 1 < argc) {
+			chunk = strtoul(argv[++i], NULL, 0);
+		} else {
+			fprintf(stderr, "usage: %s [--bench [bytes]] [--latency polls] [--chunk bytes]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	return benchmark ? bench(bytes, chunk) : functional();
+}
@@ -0,0 +1,91 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+// The core functions the USB stack and the API need, on the host
+
+#include <Arduino.h>
+#include <Reset.h>
+#include "USB/SAMD21_USBDevice.h"
+
+#include <stdio.h>
+
+#undef memcpy
+
+// Simulated time: advanced by the host, one Start-Of-Frame per millisecond
+static uint32_t now;
+
+// Error of the device's clock against the host's, for micros()
+int32_t usbSimClockPPM;
+
+void usbSimAdvanceMillis(uint32_t ms)
+{
+	now += ms;
+}
+
+extern "C" {
+
+unsigned long millis(void)
+{
+	return now;
+}
+
+unsigned long micros(void)
+{
+	return (uint64_t)now * (1000000 + usbSimClockPPM) / 1000;
+}
+
+void delay(unsigned long ms)
+{
+	now += ms;
+}
+
+void delayMicroseconds(unsigned int)
+{
+}
+
+void yield(void)
+{
+}
+
+void *usbSimMemcpy(void *dst, const void *src, size_t n)
+{
+	usbSim.count.memcpyCalls++;
+	usbSim.count.memcpyBytes += n;
+	return memcpy(dst, src, n);
+}
+
+// 1200 bps touch: there is nothing to reset
+void initiateReset(int)
+{
+}
+
+void tickReset()
+{
+}
+
+void cancelReset()
+{
+}
+
+char *dtostrf(double val, signed char width, unsigned char prec, char *sout)
+{
+	sprintf(sout, "%*.*f", width, prec, val);
+	return sout;
+}
+
+} // extern "C"
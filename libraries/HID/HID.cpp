@@ -21,8 +21,11 @@
 
 #if defined(USBCON)
 
+extern USBDevice_SAMD21G18x usbd;
 extern USBDeviceClass USBDevice;
 
+#define QUEUE_MASK (HID_REPORT_QUEUE_SIZE - 1)
+
 HID_& HID()
 {
 	static HID_ obj;
@@ -88,10 +91,140 @@ void HID_::AppendDescriptor(HIDSubDescriptor *node)
 
 int HID_::SendReport(uint8_t id, const void* data, int len)
 {
-	uint8_t p[64];
-	p[0] = id;
-	memcpy(&p[1], data, len);
-	return USBDevice.send(pluggedEndpoint, p, len+1);
+	if (len < 0 || len + 1 > HID_REPORT_MAX_SIZE) {
+		return -1;
+	}
+
+	// convert the timeout from milliseconds to a number of times through
+	// the wait loop; it takes (roughly) 50 clock cycles per iteration.
+	uint32_t timeout = microsecondsToClockCycles(HID_SEND_TIMEOUT_MS * 1000) / 50;
+
+	for (;;) {
+		int ret = queueReport(id, data, len);
+		if (ret != 0) {
+			return ret;
+		}
+
+		// The queue is full: wait for the host to take a report, unless it
+		// already did not in time for the previous one
+		if (dropWhenFull || lastSendTimedOut || timeout-- == 0) {
+			lastSendTimedOut = !dropWhenFull;
+			return -1;
+		}
+
+		// Reports leave from the USB interrupt, polled here as well in case
+		// it is masked
+		synchronized {
+			handleEndpoint();
+		}
+	}
+}
+
+// Returns len + 1 once queued, 0 when the queue is full, -1 when the
+// device is not configured
+int HID_::queueReport(uint8_t id, const void* data, int len)
+{
+	int ret = -1;
+	synchronized {
+		if (configured) {
+			uint32_t slot = head;
+
+			if (coalescing) {
+				// Replace the latest queued report with this ID
+				for (uint32_t i = head; i != tail; i--) {
+					if (reports[(i - 1) & QUEUE_MASK][0] == id) {
+						slot = i - 1;
+						break;
+					}
+				}
+			}
+
+			if (slot != head || head - tail < HID_REPORT_QUEUE_SIZE) {
+				uint8_t *report = reports[slot & QUEUE_MASK];
+				report[0] = id;
+				memcpy(&report[1], data, len);
+				reportLength[slot & QUEUE_MASK] = len + 1;
+				if (slot == head) {
+					head = slot + 1;
+				}
+				if (!sending) {
+					sendReport();
+				}
+				lastSendTimedOut = false;
+				ret = len + 1;
+			} else {
+				ret = 0;
+			}
+		}
+	}
+	return ret;
+}
+
+int HID_::availableForWrite()
+{
+	return HID_REPORT_QUEUE_SIZE - (head - tail);
+}
+
+// Called with the IN bank free, from the USB interrupt or with
+// interrupts disabled
+void HID_::sendReport()
+{
+	uint8_t ep = pluggedEndpoint;
+	uint32_t slot = tail & QUEUE_MASK;
+	uint8_t len = reportLength[slot];
+
+	memcpy(inPacket, reports[slot], len);
+	tail++;
+
+	sending = true;
+	usbd.epBank1SetMultiPacketSize(ep, 0);
+	usbd.epBank1SetByteCount(ep, len);
+	usbd.epBank1AckTransferComplete(ep);
+	usbd.epBank1SetReady(ep);
+}
+
+void HID_::init()
+{
+	uint8_t ep = pluggedEndpoint;
+	usbd.epBank1SetSize(ep, EPX_SIZE);
+	usbd.epBank1SetType(ep, 4); // INTERRUPT IN
+	usbd.epBank1SetAddress(ep, inPacket);
+	usbd.epBank1EnableTransferComplete(ep);
+
+	// Reports queued for a previous configuration are dropped
+	head = tail = 0;
+	sending = false;
+	lastSendTimedOut = false;
+	configured = true;
+}
+
+void HID_::handleEndpoint()
+{
+	uint8_t ep = pluggedEndpoint;
+
+	if (usbd.epBank1IsTransferComplete(ep))
+	{
+		usbd.epBank1AckTransferComplete(ep);
+		sending = false;
+		if (head != tail) {
+			sendReport();
+		}
+	}
+}
+
+uint32_t HID_::recv(void * /* data */, uint32_t /* len */)
+{
+	return 0;
+}
+
+uint32_t HID_::available()
+{
+	return 0;
+}
+
+int HID_::peek()
+{
+	return -1;
 }
 
 bool HID_::setup(USBSetup& setup)
@@ -148,10 +281,15 @@ bool HID_::setup(USBSetup& setup)
 
 HID_::HID_(void) : PluggableUSBModule(1, 1, epType),
                    rootNode(NULL), descriptorSize(0),
-                   protocol(1), idle(1)
+                   protocol(1), idle(1),
+                   coalescing(false), dropWhenFull(false), lastSendTimedOut(false),
+                   configured(false), sending(false), head(0), tail(0)
 {
-	epType[0] = USB_ENDPOINT_TYPE_INTERRUPT | USB_ENDPOINT_IN(0);;
-	PluggableUSB().plug(this);
+	// Interrupt IN endpoint, serviced by this object
+	epType[0] = USB_ENDPOINT_HANDLER(USB_ENDPOINT_TYPE_INTERRUPT | USB_ENDPOINT_IN(0));
+	if (PluggableUSB().plug(this)) {
+		USBDevice.setHandler(pluggedEndpoint, this);
+	}
 }
 
 int HID_::begin(void)
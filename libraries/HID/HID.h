@@ -22,11 +22,26 @@
 #include <stdint.h>
 #include <Arduino.h>
 #include "api/PluggableUSB.h"
+#include "USB/SAMD21_USBDevice.h"
 
 #if defined(USBCON)
 
 #define _USING_HID
 
+// Reports waiting for the interrupt endpoint, per interface. Must be a
+// power of 2.
+#ifndef HID_REPORT_QUEUE_SIZE
+#define HID_REPORT_QUEUE_SIZE 8
+#endif
+
+// Largest report, the report ID byte included
+#define HID_REPORT_MAX_SIZE   EPX_SIZE
+
+// Longest wait for a free slot in the report queue, as for USBDevice.send()
+#ifndef HID_SEND_TIMEOUT_MS
+#define HID_SEND_TIMEOUT_MS   70
+#endif
+
 // HID 'Driver'
 // ------------
 #define HID_GET_REPORT        0x01
@@ -83,14 +98,44 @@ public:
   const uint16_t length;
 };
 
-class HID_ : public PluggableUSBModule
+// Every HID_ object is a separate HID interface with its own interrupt
+// endpoint. HID() is the one shared by Keyboard, Mouse and the like, more
+// can be declared next to it:
+//
+//   HID_ Gamepad;
+class HID_ : public PluggableUSBModule, public EPHandler
 {
 public:
   HID_(void);
   int begin(void);
+
+  // Queue a report for the host. Reports leave in order, one per interrupt
+  // IN transaction. When the queue is full, waits for a free slot up to
+  // HID_SEND_TIMEOUT_MS; once a wait has timed out, the following reports
+  // do not wait until one is queued again. Returns len + 1, or -1 when the
+  // report is not queued or the device is not configured.
   int SendReport(uint8_t id, const void* data, int len);
   void AppendDescriptor(HIDSubDescriptor* node);
 
+  // With coalescing, a report replaces the queued one with the same ID
+  // instead of taking a new slot: only the latest state of a report is
+  // sent. Suits absolute values (gamepads, sensors), not key events.
+  void setCoalescing(bool enable) { coalescing = enable; }
+
+  // Drop reports at once when the queue is full instead of waiting: never
+  // blocks, but a lost key release leaves the key down on the host.
+  void setDropWhenFull(bool enable) { dropWhenFull = enable; }
+
+  // Free slots in the report queue
+  int availableForWrite();
+
+  // EPHandler
+  virtual void init();
+  virtual void handleEndpoint();
+  virtual uint32_t recv(void *data, uint32_t len);
+  virtual uint32_t available();
+  virtual int peek();
+
 protected:
   // Implementation of the PluggableUSBModule
   int getInterface(uint8_t* interfaceCount);
@@ -99,6 +144,9 @@ protected:
   uint8_t getShortName(char* name);
 
 private:
+  int queueReport(uint8_t id, const void* data, int len);
+  void sendReport();
+
   unsigned int epType[1];
 
   HIDSubDescriptor* rootNode;
@@ -106,6 +154,19 @@ private:
 
   uint8_t protocol;
   uint8_t idle;
+
+  bool coalescing;
+  bool dropWhenFull;
+  bool lastSendTimedOut;
+  volatile bool configured;
+  volatile bool sending;    // IN bank owned by the USB peripheral
+
+  // Report queue, head and tail wrap around freely
+  volatile uint32_t head, tail;
+  uint8_t reportLength[HID_REPORT_QUEUE_SIZE];
+  uint8_t reports[HID_REPORT_QUEUE_SIZE][HID_REPORT_MAX_SIZE];
+
+  __attribute__((__aligned__(4))) uint8_t inPacket[HID_REPORT_MAX_SIZE];
 };
 
 // Replacement for global singleton.
@@ -19,7 +19,7 @@
 #include <Arduino.h>
 #include <wiring_private.h>
 
-#include "utility/DMA.h"
+#include <DMA.h>
 #include "utility/SAMD21_I2SDevice.h"
 
 static I2SDevice_SAMD21G18x i2sd(*I2S);
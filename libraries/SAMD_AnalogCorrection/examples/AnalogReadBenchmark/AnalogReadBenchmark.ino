@@ -0,0 +1,82 @@
+/*
+  This sketch measures the CPU cycles taken by analogRead(), back to back on
+  the same pin and alternating between two pins, in the precise (default)
+  and fast modes.
+
+  The Cortex-M0+ has no cycle counter (DWT CYCCNT): the cycles are counted
+  with SysTick, which counts down from LOAD to 0 every millisecond at the CPU
+  clock. It is good for spans under 1 ms, which a single read is.
+
+  This example code is in the public domain.
+*/
+
+#define PIN_A                A1
+#define PIN_B                A2
+
+#define READS                64
+
+// Cycles since 'start', a SysTick->VAL reading less than 1 ms ago
+static inline uint32_t cyclesSince(uint32_t start)
+{
+  uint32_t now = SysTick->VAL;
+  uint32_t period = SysTick->LOAD + 1;
+
+  return (start + period - now) % period;
+}
+
+void benchmark(const char *name, int pinA, int pinB)
+{
+  uint32_t total = 0;
+  uint32_t best = 0xFFFFFFFF;
+
+  // the first read sets the pin and input up: not counted
+  analogRead(pinB);
+
+  for (int i = 0; i < READS; i++)
+  {
+    int pin = (i & 1) ? pinB : pinA;
+
+    noInterrupts();
+    uint32_t start = SysTick->VAL;
+    analogRead(pin);
+    uint32_t cycles = cyclesSince(start);
+    interrupts();
+
+    total += cycles;
+    if (cycles < best)
+      best = cycles;
+  }
+
+  Serial.print(name);
+  Serial.print(": min ");
+  Serial.print(best);
+  Serial.print(" cycles, average ");
+  Serial.print(total / READS);
+  Serial.print(" cycles (");
+  Serial.print(total / READS / (F_CPU / 1000000));
+  Serial.println(" us)");
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  while (!Serial);
+
+  analogReadResolution(12);
+
+  Serial.println("\r\nanalogRead() in precise mode");
+  analogReadMode(AR_MODE_PRECISE);
+  benchmark("   same pin       ", PIN_A, PIN_A);
+  benchmark("   alternating    ", PIN_A, PIN_B);
+
+  Serial.println("\r\nanalogRead() in fast mode");
+  analogReadMode(AR_MODE_FAST);
+  benchmark("   same pin       ", PIN_A, PIN_A);
+  benchmark("   alternating    ", PIN_A, PIN_B);
+
+  analogReadMode(AR_MODE_PRECISE);
+}
+
+void loop()
+{
+}
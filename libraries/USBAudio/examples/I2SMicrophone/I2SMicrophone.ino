@@ -0,0 +1,47 @@
+/*
+ This example streams a pair of I2S MEMS microphones (left and right
+ channel) to the computer, where they show up as a USB microphone.
+
+ The I2S clock is divided from 48 MHz, 31250 Hz is a sample rate the
+ divider produces exactly with 32 bit slots, so the stream runs at its
+ nominal rate.
+
+ Circuit:
+ * Arduino/Genuino Zero, MKR family and Nano 33 IoT
+ * two ICS43432 (or SPH0645) microphones, one with L/R to GND and one to 3.3V:
+   * WS connected to pin 0 (Zero) or 3 (MKR) or A2 (Nano)
+   * CLK connected to pin 1 (Zero) or 2 (MKR) or A3 (Nano)
+   * SD connected to pin 9 (Zero) or A6 (MKR) or 4 (Nano)
+ */
+
+#include <I2S.h>
+#include <USBAudio.h>
+
+#define SAMPLE_RATE 31250
+
+USBAudio microphone(USB_AUDIO_MICROPHONE, SAMPLE_RATE, 2);
+
+int32_t samples[128];
+
+void onI2SReceive() {
+  // called from the DMA interrupt when a buffer has been filled
+  int bytes = I2S.read(samples, sizeof(samples));
+
+  // dropped while the host does not record
+  microphone.write(samples, bytes / sizeof(samples[0]));
+}
+
+void setup() {
+  I2S.onReceive(onI2SReceive);
+
+  // start I2S at the sample rate with 32-bits per sample
+  if (!I2S.begin(I2S_PHILIPS_MODE, SAMPLE_RATE, 32)) {
+    while (1); // do nothing
+  }
+
+  // start the first reception
+  I2S.available();
+}
+
+void loop() {
+}
@@ -0,0 +1,467 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "USBAudio.h"
+
+#if defined(USBCON)
+
+extern USBDevice_SAMD21G18x usbd;
+extern USBDeviceClass USBDevice;
+
+#define MIC_INPUT_TERMINAL       1
+#define MIC_OUTPUT_TERMINAL      2
+#define SPEAKER_INPUT_TERMINAL   3
+#define SPEAKER_OUTPUT_TERMINAL  4
+
+#define FIFO_MASK                (USB_AUDIO_FIFO_SIZE - 1)
+
+// Isochronous, asynchronous
+#define ENDPOINT_ATTR_ASYNC      0x05
+// Isochronous, feedback
+#define ENDPOINT_ATTR_FEEDBACK   0x11
+
+// Smallest bank size (8 ... 512, 1023) that holds a packet
+static uint16_t endpointSize(uint16_t packetSize)
+{
+	uint16_t size = 8;
+	while (size < packetSize && size < 512) {
+		size <<= 1;
+	}
+	return (size < packetSize) ? 1023 : size;
+}
+
+uint8_t USBAudio::functionCount(uint8_t functions)
+{
+	return ((functions & USB_AUDIO_MICROPHONE) ? 1 : 0) + ((functions & USB_AUDIO_SPEAKER) ? 1 : 0);
+}
+
+USBAudio::USBAudio(uint8_t _functions, uint32_t sampleRate, uint8_t channels) :
+	PluggableUSBModule(functionCount(_functions), 1 + functionCount(_functions), epType),
+	functions(_functions),
+	nrChannels(channels == 0 ? 1 : (channels > USB_AUDIO_MAX_CHANNELS ? USB_AUDIO_MAX_CHANNELS : channels)),
+	rate(sampleRate > USB_AUDIO_MAX_SAMPLE_RATE ? USB_AUDIO_MAX_SAMPLE_RATE : sampleRate),
+	micAlternate(0), speakerAlternate(0),
+	micHead(0), micTail(0), speakerHead(0), speakerTail(0),
+	micAccumulator(0), feedback(0), feedbackFrames(0), framesRead(0), framesReadMark(0)
+{
+	uint8_t endpoints = 0;
+	if (functions & USB_AUDIO_MICROPHONE) {
+		epType[endpoints++] = USB_ENDPOINT_HANDLER(USB_ENDPOINT_TYPE_ISOCHRONOUS | USB_ENDPOINT_IN(0));
+	}
+	if (functions & USB_AUDIO_SPEAKER) {
+		// Data OUT and its feedback IN share the endpoint number
+		epType[endpoints++] = USB_ENDPOINT_HANDLER(USB_ENDPOINT_PAIR(USB_ENDPOINT_TYPE_ISOCHRONOUS | USB_ENDPOINT_OUT(0),
+		                                                             USB_ENDPOINT_TYPE_ISOCHRONOUS | USB_ENDPOINT_IN(0)));
+	}
+
+	if (endpoints == 0 || !PluggableUSB().plug(this)) {
+		return;
+	}
+	for (uint8_t i = 0; i < endpoints; i++) {
+		USBDevice.setHandler(pluggedEndpoint + i, this);
+	}
+}
+
+int USBAudio::sendStreamingInterface(uint8_t interface, uint8_t terminal, uint8_t endpoint, bool withFeedback)
+{
+	AudioStreamingDescriptor streamingInterface = {
+		D_AUDIO_INTERFACE(interface, 0, 0, AUDIO_SUBCLASS_STREAMING),
+		D_AUDIO_INTERFACE(interface, 1, uint8_t(withFeedback ? 2 : 1), AUDIO_SUBCLASS_STREAMING),
+		{ 7, AUDIO_CS_INTERFACE, AUDIO_AS_GENERAL, terminal, 1, AUDIO_FORMAT_PCM },
+		{ 11, AUDIO_CS_INTERFACE, AUDIO_AS_FORMAT_TYPE, 1, nrChannels, 2, 16, 1,
+		  { uint8_t(rate), uint8_t(rate >> 8), uint8_t(rate >> 16) } },
+		D_AUDIO_ENDPOINT(endpoint, ENDPOINT_ATTR_ASYNC, maxPacketSize(), 0,
+		                 uint8_t(withFeedback ? USB_ENDPOINT_IN(speakerEndpoint()) : 0)),
+		{ 7, AUDIO_CS_ENDPOINT, AUDIO_EP_GENERAL, 0, 0, 0 }
+	};
+	int total = USBDevice.sendControl(&streamingInterface, sizeof(streamingInterface));
+
+	if (withFeedback) {
+		AudioEndpointDescriptor feedbackEndpoint =
+			D_AUDIO_ENDPOINT(USB_ENDPOINT_IN(speakerEndpoint()), ENDPOINT_ATTR_FEEDBACK, 3, USB_AUDIO_FEEDBACK_REFRESH, 0);
+		total += USBDevice.sendControl(&feedbackEndpoint, sizeof(feedbackEndpoint));
+	}
+	return total;
+}
+
+int USBAudio::getInterface(uint8_t* interfaceCount)
+{
+	uint8_t streams = functionCount(functions);
+	*interfaceCount += 1 + streams;
+
+	IADDescriptor iad = D_IAD(pluggedInterface, uint8_t(1 + streams), 0x01, AUDIO_SUBCLASS_CONTROL, 0);
+	InterfaceDescriptor controlInterface = D_AUDIO_INTERFACE(pluggedInterface, 0, 0, AUDIO_SUBCLASS_CONTROL);
+
+	uint16_t channelConfig = (nrChannels == 2) ? 0x0003 : 0x0000; // left/right front
+	AudioInputTerminalDescriptor micInput = {
+		12, AUDIO_CS_INTERFACE, AUDIO_AC_INPUT_TERMINAL, MIC_INPUT_TERMINAL,
+		AUDIO_TERMINAL_MICROPHONE, 0, nrChannels, channelConfig, 0, 0
+	};
+	AudioOutputTerminalDescriptor micOutput = {
+		9, AUDIO_CS_INTERFACE, AUDIO_AC_OUTPUT_TERMINAL, MIC_OUTPUT_TERMINAL,
+		AUDIO_TERMINAL_STREAMING, 0, MIC_INPUT_TERMINAL, 0
+	};
+	AudioInputTerminalDescriptor speakerInput = {
+		12, AUDIO_CS_INTERFACE, AUDIO_AC_INPUT_TERMINAL, SPEAKER_INPUT_TERMINAL,
+		AUDIO_TERMINAL_STREAMING, 0, nrChannels, channelConfig, 0, 0
+	};
+	AudioOutputTerminalDescriptor speakerOutput = {
+		9, AUDIO_CS_INTERFACE, AUDIO_AC_OUTPUT_TERMINAL, SPEAKER_OUTPUT_TERMINAL,
+		AUDIO_TERMINAL_SPEAKER, 0, SPEAKER_INPUT_TERMINAL, 0
+	};
+
+	AudioControlHeaderDescriptor header = {
+		uint8_t(8 + streams), AUDIO_CS_INTERFACE, AUDIO_AC_HEADER, 0x0100, 0, streams, { 0, 0 }
+	};
+	header.totalLength = header.len + streams * (sizeof(AudioInputTerminalDescriptor) + sizeof(AudioOutputTerminalDescriptor));
+	uint8_t i = 0;
+	if (functions & USB_AUDIO_MICROPHONE) {
+		header.interfaces[i++] = micInterface();
+	}
+	if (functions & USB_AUDIO_SPEAKER) {
+		header.interfaces[i++] = speakerInterface();
+	}
+
+	int total = USBDevice.sendControl(&iad, sizeof(iad));
+	total += USBDevice.sendControl(&controlInterface, sizeof(controlInterface));
+	total += USBDevice.sendControl(&header, header.len);
+	if (functions & USB_AUDIO_MICROPHONE) {
+		total += USBDevice.sendControl(&micInput, sizeof(micInput));
+		total += USBDevice.sendControl(&micOutput, sizeof(micOutput));
+	}
+	if (functions & USB_AUDIO_SPEAKER) {
+		total += USBDevice.sendControl(&speakerInput, sizeof(speakerInput));
+		total += USBDevice.sendControl(&speakerOutput, sizeof(speakerOutput));
+	}
+
+	if (functions & USB_AUDIO_MICROPHONE) {
+		total += sendStreamingInterface(micInterface(), MIC_OUTPUT_TERMINAL, USB_ENDPOINT_IN(micEndpoint()), false);
+	}
+	if (functions & USB_AUDIO_SPEAKER) {
+		total += sendStreamingInterface(speakerInterface(), SPEAKER_INPUT_TERMINAL, USB_ENDPOINT_OUT(speakerEndpoint()), true);
+	}
+	return total;
+}
+
+int USBAudio::getDescriptor(USBSetup& /* setup */)
+{
+	return 0;
+}
+
+bool USBAudio::setup(USBSetup& setup)
+{
+	if (setup.wIndex < pluggedInterface || setup.wIndex > pluggedInterface + functionCount(functions)) {
+		return false;
+	}
+	// No class controls (volume, mute, sampling frequency)
+	if ((setup.bmRequestType & REQUEST_TYPE) != REQUEST_STANDARD) {
+		return false;
+	}
+
+	bool mic = (functions & USB_AUDIO_MICROPHONE) && setup.wIndex == micInterface();
+	bool speaker = (functions & USB_AUDIO_SPEAKER) && setup.wIndex == speakerInterface();
+
+	if (setup.bRequest == SET_INTERFACE) {
+		if (mic) {
+			setMicAlternate(setup.wValueL);
+		} else if (speaker) {
+			setSpeakerAlternate(setup.wValueL);
+		}
+		USBDevice.sendZlp(0);
+		return true;
+	}
+
+	if (setup.bRequest == GET_INTERFACE) {
+		uint8_t alternate = mic ? micAlternate : (speaker ? speakerAlternate : 0);
+		USBDevice.sendControl(&alternate, 1);
+		return true;
+	}
+
+	return false;
+}
+
+void USBAudio::init()
+{
+	micAlternate = 0;
+	speakerAlternate = 0;
+
+	uint16_t size = endpointSize(maxPacketSize());
+
+	if (functions & USB_AUDIO_MICROPHONE) {
+		uint8_t ep = micEndpoint();
+		usbd.epBank1SetSize(ep, size);
+		usbd.epBank1SetAddress(ep, micPacket);
+		usbd.epBank1SetType(ep, 2); // ISOCHRONOUS IN
+		usbd.epBank1ResetReady(ep);
+		usbd.epBank1EnableTransferComplete(ep);
+		usbd.epBank1EnableTransferFailed(ep);
+	}
+
+	if (functions & USB_AUDIO_SPEAKER) {
+		uint8_t ep = speakerEndpoint();
+		usbd.epBank0SetSize(ep, size);
+		usbd.epBank0SetAddress(ep, speakerPacket);
+		usbd.epBank0SetType(ep, 2); // ISOCHRONOUS OUT
+		usbd.epBank0SetReady(ep);   // nothing received until the stream opens
+		usbd.epBank0EnableTransferComplete(ep);
+		usbd.epBank0EnableTransferFailed(ep);
+
+		// Feedback, armed on SOF
+		usbd.epBank1SetSize(ep, 8);
+		usbd.epBank1SetAddress(ep, feedbackPacket);
+		usbd.epBank1SetType(ep, 2); // ISOCHRONOUS IN
+		usbd.epBank1ResetReady(ep);
+	}
+}
+
+void USBAudio::setMicAlternate(uint8_t alternate)
+{
+	micAlternate = alternate;
+	if (alternate) {
+		// Start with fresh samples
+		micTail = micHead;
+		micAccumulator = 0;
+		sendMicPacket();
+	} else {
+		usbd.epBank1ResetReady(micEndpoint());
+	}
+}
+
+void USBAudio::setSpeakerAlternate(uint8_t alternate)
+{
+	uint8_t ep = speakerEndpoint();
+	speakerAlternate = alternate;
+	if (alternate) {
+		feedback = (rate << 14) / 1000;
+		feedbackFrames = 0;
+		framesReadMark = framesRead;
+		usbd.epReleaseOutBank0(ep, maxPacketSize());
+	} else {
+		usbd.epBank0SetReady(ep);
+		usbd.epBank1ResetReady(ep);
+	}
+}
+
+void USBAudio::sendMicPacket()
+{
+	uint8_t ep = micEndpoint();
+
+	// Nominal frames for this ms, fractional rates (44.1 kHz) are spread out
+	micAccumulator += rate;
+	uint32_t frames = micAccumulator / 1000;
+	micAccumulator -= frames * 1000;
+
+	// Asynchronous source: the host takes the packet sizes it is given,
+	// one frame more or less keeps the FIFO around half full
+	uint32_t level = (micHead - micTail) / nrChannels;
+	uint32_t half = USB_AUDIO_FIFO_SIZE / nrChannels / 2;
+	if (level > half + frames) {
+		frames++;
+	} else if (level + frames < half && frames > 0) {
+		frames--;
+	}
+	if (frames > level) {
+		frames = level;
+	}
+
+	uint32_t tail = micTail;
+	uint32_t count = frames * nrChannels;
+	int16_t *packet = (int16_t *)micPacket;
+	for (uint32_t i = 0; i < count; i++) {
+		packet[i] = micFifo[(tail + i) & FIFO_MASK];
+	}
+	micTail = tail + count;
+
+	usbd.epBank1SetMultiPacketSize(ep, 0);
+	usbd.epBank1SetByteCount(ep, count * 2);
+	usbd.epBank1SetReady(ep);
+}
+
+void USBAudio::sendFeedback()
+{
+	// Measured drain rate, smoothed over a few refresh periods
+	if (++feedbackFrames == (1 << USB_AUDIO_FEEDBACK_REFRESH)) {
+		uint32_t frames = framesRead - framesReadMark;
+		framesReadMark += frames;
+		feedbackFrames = 0;
+		if (frames) {
+			feedback = (feedback * 3 + (frames << (14 - USB_AUDIO_FEEDBACK_REFRESH))) / 4;
+		}
+	}
+
+	uint8_t ep = speakerEndpoint();
+	if (usbd.epBank1IsReady(ep)) {
+		// previous value not polled yet
+		return;
+	}
+
+	// Steer the FIFO towards half full, within one frame per ms of nominal
+	int32_t nominal = (rate << 14) / 1000;
+	int32_t error = (int32_t)(USB_AUDIO_FIFO_SIZE / 2) - (int32_t)(speakerHead - speakerTail);
+	int32_t value = (int32_t)feedback + (error / nrChannels) * 16;
+	if (value > nominal + (1 << 14)) {
+		value = nominal + (1 << 14);
+	} else if (value < nominal - (1 << 14)) {
+		value = nominal - (1 << 14);
+	}
+
+	// 10.14 format, 3 bytes
+	feedbackPacket[0] = value;
+	feedbackPacket[1] = value >> 8;
+	feedbackPacket[2] = value >> 16;
+	usbd.epBank1SetMultiPacketSize(ep, 0);
+	usbd.epBank1SetByteCount(ep, 3);
+	usbd.epBank1SetReady(ep);
+}
+
+void USBAudio::startOfFrame()
+{
+	if (micAlternate && !usbd.epBank1IsReady(micEndpoint())) {
+		// A frame went by without a packet, keep the stream primed
+		sendMicPacket();
+	}
+	if (speakerAlternate) {
+		sendFeedback();
+	}
+}
+
+void USBAudio::handleEndpoint()
+{
+	if (functions & USB_AUDIO_MICROPHONE) {
+		uint8_t ep = micEndpoint();
+		if (usbd.epBank1IsTransferFailed(ep)) {
+			usbd.epBank1AckTransferFailed(ep);
+		}
+		if (usbd.epBank1IsTransferComplete(ep)) {
+			usbd.epBank1AckTransferComplete(ep);
+			if (micAlternate && !usbd.epBank1IsReady(ep)) {
+				sendMicPacket();
+			}
+		}
+	}
+
+	if (functions & USB_AUDIO_SPEAKER) {
+		uint8_t ep = speakerEndpoint();
+		if (usbd.epBank0IsTransferFailed(ep)) {
+			// corrupted packet, dropped
+			usbd.epBank0AckTransferFailed(ep);
+			if (speakerAlternate) {
+				usbd.epReleaseOutBank0(ep, maxPacketSize());
+			}
+		}
+		if (usbd.epBank0IsTransferComplete(ep)) {
+			usbd.epBank0AckTransferComplete(ep);
+
+			uint32_t count = usbd.epBank0ByteCount(ep) / 2;
+			uint32_t head = speakerHead;
+			uint32_t space = USB_AUDIO_FIFO_SIZE - (head - speakerTail);
+			if (count > space) {
+				count = space;
+			}
+			count -= count % nrChannels;
+
+			const int16_t *packet = (const int16_t *)speakerPacket;
+			for (uint32_t i = 0; i < count; i++) {
+				speakerFifo[(head + i) & FIFO_MASK] = packet[i];
+			}
+			speakerHead = head + count;
+
+			if (speakerAlternate) {
+				usbd.epReleaseOutBank0(ep, maxPacketSize());
+			}
+		}
+		if (usbd.epBank1IsTransferComplete(ep)) {
+			usbd.epBank1AckTransferComplete(ep);
+		}
+		if (usbd.epBank1IsTransferFailed(ep)) {
+			usbd.epBank1AckTransferFailed(ep);
+		}
+	}
+}
+
+int USBAudio::availableForWrite()
+{
+	uint32_t space = USB_AUDIO_FIFO_SIZE - (micHead - micTail);
+	return space - space % nrChannels;
+}
+
+size_t USBAudio::write(const int16_t *samples, size_t count)
+{
+	uint32_t head = micHead;
+	uint32_t space = USB_AUDIO_FIFO_SIZE - (head - micTail);
+	if (count > space) {
+		count = space;
+	}
+	count -= count % nrChannels;
+
+	for (size_t i = 0; i < count; i++) {
+		micFifo[(head + i) & FIFO_MASK] = samples[i];
+	}
+	micHead = head + count;
+	return count;
+}
+
+size_t USBAudio::write(const int32_t *samples, size_t count)
+{
+	uint32_t head = micHead;
+	uint32_t space = USB_AUDIO_FIFO_SIZE - (head - micTail);
+	if (count > space) {
+		count = space;
+	}
+	count -= count % nrChannels;
+
+	for (size_t i = 0; i < count; i++) {
+		micFifo[(head + i) & FIFO_MASK] = samples[i] >> 16;
+	}
+	micHead = head + count;
+	return count;
+}
+
+size_t USBAudio::read(int16_t *samples, size_t count)
+{
+	uint32_t tail = speakerTail;
+	uint32_t level = speakerHead - tail;
+	if (count > level) {
+		count = level;
+	}
+	count -= count % nrChannels;
+
+	for (size_t i = 0; i < count; i++) {
+		samples[i] = speakerFifo[(tail + i) & FIFO_MASK];
+	}
+	speakerTail = tail + count;
+	framesRead += count / nrChannels;
+	return count;
+}
+
+uint32_t USBAudio::recv(void *data, uint32_t len)
+{
+	return read((int16_t *)data, len / 2) * 2;
+}
+
+uint32_t USBAudio::available()
+{
+	return speakerHead - speakerTail;
+}
+
+int USBAudio::peek()
+{
+	return -1;
+}
+
+#endif /* if defined(USBCON) */
@@ -0,0 +1,247 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _USB_AUDIO_H_INCLUDED
+#define _USB_AUDIO_H_INCLUDED
+
+#include <Arduino.h>
+#include "api/PluggableUSB.h"
+#include "USB/SAMD21_USBDevice.h"
+
+#if defined(USBCON)
+
+// Functions of the audio device, can be combined
+#define USB_AUDIO_MICROPHONE          0x01  // device to host
+#define USB_AUDIO_SPEAKER             0x02  // host to device
+
+// Streams are 16 bit PCM, interleaved
+#define USB_AUDIO_MAX_CHANNELS        4
+#define USB_AUDIO_MAX_SAMPLE_RATE     48000
+#define USB_AUDIO_MAX_PACKET_SIZE     ((USB_AUDIO_MAX_SAMPLE_RATE / 1000 + 1) * USB_AUDIO_MAX_CHANNELS * 2)
+
+// Samples buffered in each direction, must be a power of 2
+#ifndef USB_AUDIO_FIFO_SIZE
+#define USB_AUDIO_FIFO_SIZE           1024
+#endif
+
+// The speaker feedback is refreshed every 2^USB_AUDIO_FEEDBACK_REFRESH frames
+#define USB_AUDIO_FEEDBACK_REFRESH    5
+
+// Audio class
+#define AUDIO_SUBCLASS_CONTROL        0x01
+#define AUDIO_SUBCLASS_STREAMING      0x02
+
+#define AUDIO_CS_INTERFACE            0x24
+#define AUDIO_CS_ENDPOINT             0x25
+
+#define AUDIO_AC_HEADER               0x01
+#define AUDIO_AC_INPUT_TERMINAL       0x02
+#define AUDIO_AC_OUTPUT_TERMINAL      0x03
+#define AUDIO_AS_GENERAL              0x01
+#define AUDIO_AS_FORMAT_TYPE          0x02
+#define AUDIO_EP_GENERAL              0x01
+
+#define AUDIO_TERMINAL_STREAMING      0x0101
+#define AUDIO_TERMINAL_MICROPHONE     0x0201
+#define AUDIO_TERMINAL_SPEAKER        0x0301
+
+#define AUDIO_FORMAT_PCM              0x0001
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  subtype;
+  uint16_t bcdADC;
+  uint16_t totalLength;
+  uint8_t  inCollection;
+  uint8_t  interfaces[2];
+} AudioControlHeaderDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  subtype;
+  uint8_t  terminalID;
+  uint16_t terminalType;
+  uint8_t  assocTerminal;
+  uint8_t  nrChannels;
+  uint16_t channelConfig;
+  uint8_t  channelNames;
+  uint8_t  terminal;
+} AudioInputTerminalDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  subtype;
+  uint8_t  terminalID;
+  uint16_t terminalType;
+  uint8_t  assocTerminal;
+  uint8_t  sourceID;
+  uint8_t  terminal;
+} AudioOutputTerminalDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  subtype;
+  uint8_t  terminalLink;
+  uint8_t  delay;
+  uint16_t formatTag;
+} AudioStreamingGeneralDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  subtype;
+  uint8_t  formatType;
+  uint8_t  nrChannels;
+  uint8_t  subframeSize;
+  uint8_t  bitResolution;
+  uint8_t  samFreqType;
+  uint8_t  samFreq[3];
+} AudioFormatTypeIDescriptor;
+
+// Audio class endpoints use the 9 byte endpoint descriptor
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  addr;
+  uint8_t  attr;
+  uint16_t packetSize;
+  uint8_t  interval;
+  uint8_t  refresh;
+  uint8_t  synchAddress;
+} AudioEndpointDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  subtype;
+  uint8_t  attributes;
+  uint8_t  lockDelayUnits;
+  uint16_t lockDelay;
+} AudioDataEndpointDescriptor;
+
+// One audio streaming interface: the zero bandwidth setting, then the
+// streaming setting with its data endpoint (and the speaker feedback)
+typedef struct __attribute__((packed))
+{
+  InterfaceDescriptor             idle;
+  InterfaceDescriptor             streaming;
+  AudioStreamingGeneralDescriptor general;
+  AudioFormatTypeIDescriptor      format;
+  AudioEndpointDescriptor         data;
+  AudioDataEndpointDescriptor     dataGeneral;
+} AudioStreamingDescriptor;
+
+#define D_AUDIO_INTERFACE(_n, _alt, _numEndpoints, _subClass) \
+  { 9, 4, _n, _alt, _numEndpoints, 0x01, _subClass, 0, 0 }
+
+#define D_AUDIO_ENDPOINT(_addr, _attr, _packetSize, _refresh, _synchAddress) \
+  { 9, 5, _addr, _attr, _packetSize, 1, _refresh, _synchAddress }
+
+class USBAudio : public PluggableUSBModule, public EPHandler
+{
+public:
+  USBAudio(uint8_t functions = USB_AUDIO_MICROPHONE, uint32_t sampleRate = 48000, uint8_t channels = 1);
+
+  uint32_t sampleRate() { return rate; }
+  uint8_t channels() { return nrChannels; }
+
+  // True while the host has the stream open
+  bool microphoneActive() { return micAlternate != 0; }
+  bool speakerActive() { return speakerAlternate != 0; }
+
+  // Microphone: queue samples for the host. Only whole frames (one
+  // sample per channel) are taken, the number of samples queued is
+  // returned. The 32 bit version keeps the upper 16 bits, as delivered
+  // by I2S MEMS microphones.
+  int availableForWrite();
+  size_t write(const int16_t *samples, size_t count);
+  size_t write(const int32_t *samples, size_t count);
+
+  // Speaker: samples received from the host
+  size_t read(int16_t *samples, size_t count);
+
+  // EPHandler
+  virtual void init();
+  virtual void startOfFrame();
+  virtual void handleEndpoint();
+  virtual uint32_t recv(void *data, uint32_t len);
+  virtual uint32_t available();   // speaker samples
+  virtual int peek();
+
+protected:
+  // Implementation of the PluggableUSBModule
+  int getInterface(uint8_t* interfaceCount);
+  int getDescriptor(USBSetup& setup);
+  bool setup(USBSetup& setup);
+
+private:
+  static uint8_t functionCount(uint8_t functions);
+
+  uint8_t micInterface() { return pluggedInterface + 1; }
+  uint8_t speakerInterface() { return pluggedInterface + ((functions & USB_AUDIO_MICROPHONE) ? 2 : 1); }
+  uint8_t micEndpoint() { return pluggedEndpoint; }
+  uint8_t speakerEndpoint() { return pluggedEndpoint + ((functions & USB_AUDIO_MICROPHONE) ? 1 : 0); }
+  uint16_t maxPacketSize() { return (rate / 1000 + 1) * nrChannels * 2; }
+
+  int sendStreamingInterface(uint8_t interface, uint8_t terminal, uint8_t endpoint, bool feedback);
+
+  void setMicAlternate(uint8_t alternate);
+  void setSpeakerAlternate(uint8_t alternate);
+  void sendMicPacket();
+  void sendFeedback();
+
+  const uint8_t functions;
+  const uint8_t nrChannels;
+  const uint32_t rate;
+  unsigned int epType[2];
+
+  volatile uint8_t micAlternate;
+  volatile uint8_t speakerAlternate;
+
+  // Sample FIFOs, head and tail count samples and wrap around freely
+  volatile uint32_t micHead, micTail;
+  volatile uint32_t speakerHead, speakerTail;
+  volatile int16_t micFifo[USB_AUDIO_FIFO_SIZE];
+  volatile int16_t speakerFifo[USB_AUDIO_FIFO_SIZE];
+
+  uint32_t micAccumulator;    // sub-frame remainder of the nominal rate
+
+  uint32_t feedback;          // frames per ms, 10.14 fixed point
+  uint32_t feedbackFrames;    // SOFs in the current measure
+  volatile uint32_t framesRead;
+  uint32_t framesReadMark;    // framesRead at the start of the measure
+
+  __attribute__((__aligned__(4))) uint8_t micPacket[USB_AUDIO_MAX_PACKET_SIZE];
+  __attribute__((__aligned__(4))) uint8_t speakerPacket[USB_AUDIO_MAX_PACKET_SIZE];
+  __attribute__((__aligned__(4))) uint8_t feedbackPacket[4];
+};
+
+#endif
+
+#endif
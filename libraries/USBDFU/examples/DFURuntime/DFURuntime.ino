@@ -0,0 +1,30 @@
+/*
+ This example adds a DFU runtime interface next to SerialUSB. A new
+ sketch can then be uploaded with
+
+   dfu-util -d 2341: -D sketch.bin
+
+ dfu-util asks the board to detach, the board restarts in the
+ bootloader's DFU mode and the sketch is replaced. The LED is turned
+ off when the host requests the detach.
+
+ Circuit:
+ * Arduino/Genuino Zero, MKR family and Nano 33 IoT
+ */
+
+#include <USBDFU.h>
+
+USBDFU dfu;
+
+void detach() {
+  digitalWrite(LED_BUILTIN, LOW);
+}
+
+void setup() {
+  pinMode(LED_BUILTIN, OUTPUT);
+  digitalWrite(LED_BUILTIN, HIGH);
+  dfu.onDetach(detach);
+}
+
+void loop() {
+}
@@ -0,0 +1,97 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "USBDFU.h"
+#include <Reset.h>
+
+#if defined(USBCON)
+
+extern USBDeviceClass USBDevice;
+
+// Longest time the host waits for the device to come back in DFU mode (ms)
+#define DFU_DETACH_TIMEOUT  1000
+
+USBDFU::USBDFU() : PluggableUSBModule(0, 1, NULL),
+	state(DFU_STATE_APP_IDLE), detachCallback(NULL)
+{
+	PluggableUSB().plug(this);
+}
+
+void USBDFU::onDetach(void (*callback)(void))
+{
+	detachCallback = callback;
+}
+
+int USBDFU::getInterface(uint8_t* interfaceCount)
+{
+	*interfaceCount += 1; // uses 1
+
+	USBDFUDescriptor dfuInterface = {
+		D_INTERFACE(pluggedInterface, 0, DFU_INTERFACE_CLASS, DFU_INTERFACE_SUBCLASS, DFU_PROTOCOL_RUNTIME),
+		{ 9, DFU_FUNCTIONAL_DESCRIPTOR, DFU_CAN_DNLOAD | DFU_WILL_DETACH,
+		  DFU_DETACH_TIMEOUT, USB_DFU_TRANSFER_SIZE, 0x0110 }
+	};
+	return USBDevice.sendControl(&dfuInterface, sizeof(dfuInterface));
+}
+
+int USBDFU::getDescriptor(USBSetup& /* setup */)
+{
+	return 0;
+}
+
+bool USBDFU::setup(USBSetup& setup)
+{
+	if (pluggedInterface != setup.wIndex) {
+		return false;
+	}
+
+	uint8_t request = setup.bRequest;
+	uint8_t requestType = setup.bmRequestType;
+
+	if (requestType == REQUEST_DEVICETOHOST_CLASS_INTERFACE)
+	{
+		if (request == DFU_GETSTATUS) {
+			// bStatus OK, bwPollTimeout, bState, iString
+			uint8_t status[6] = { 0, 0, 0, 0, state, 0 };
+			USBDevice.sendControl(status, sizeof(status));
+			return true;
+		}
+		if (request == DFU_GETSTATE) {
+			USBDevice.sendControl(&state, 1);
+			return true;
+		}
+	}
+
+	if (requestType == REQUEST_HOSTTODEVICE_CLASS_INTERFACE)
+	{
+		if (request == DFU_DETACH) {
+			state = DFU_STATE_APP_DETACH;
+			if (detachCallback) {
+				detachCallback();
+			}
+			// The reset drops the pull-up: the host sees the device
+			// leave and come back as the bootloader
+			initiateDFUReset(USB_DFU_DETACH_DELAY);
+			USBDevice.sendZlp(0);
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _USB_DFU_H_INCLUDED
+#define _USB_DFU_H_INCLUDED
+
+#include <Arduino.h>
+#include "api/PluggableUSB.h"
+#include "USB/SAMD21_USBDevice.h"
+
+#if defined(USBCON)
+
+// DFU 1.1 interface: application specific class, DFU subclass
+#define DFU_INTERFACE_CLASS           0xFE
+#define DFU_INTERFACE_SUBCLASS        0x01
+#define DFU_PROTOCOL_RUNTIME          0x01
+
+#define DFU_FUNCTIONAL_DESCRIPTOR     0x21
+
+// Class requests
+#define DFU_DETACH                    0x00
+#define DFU_DNLOAD                    0x01
+#define DFU_UPLOAD                    0x02
+#define DFU_GETSTATUS                 0x03
+#define DFU_CLRSTATUS                 0x04
+#define DFU_GETSTATE                  0x05
+#define DFU_ABORT                     0x06
+
+// bmAttributes
+#define DFU_CAN_DNLOAD                0x01
+#define DFU_CAN_UPLOAD                0x02
+#define DFU_MANIFESTATION_TOLERANT    0x04
+#define DFU_WILL_DETACH               0x08
+
+// Runtime states
+#define DFU_STATE_APP_IDLE            0
+#define DFU_STATE_APP_DETACH          1
+
+// Block size of the bootloader's DFU mode, the host reads it again from
+// the bootloader after the detach
+#define USB_DFU_TRANSFER_SIZE         4096
+
+// Time given to the control transfer to complete before the reset (ms)
+#ifndef USB_DFU_DETACH_DELAY
+#define USB_DFU_DETACH_DELAY          50
+#endif
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;           // 9
+  uint8_t  dtype;         // 0x21
+  uint8_t  attributes;
+  uint16_t detachTimeout;
+  uint16_t transferSize;
+  uint16_t bcdDFUVersion;
+} DFUFunctionalDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  InterfaceDescriptor     dfu;
+  DFUFunctionalDescriptor functional;
+} USBDFUDescriptor;
+
+// DFU 1.1 runtime interface. On DFU_DETACH the board restarts in the
+// bootloader's DFU mode, the sketch is not erased: "dfu-util -D sketch.bin"
+// updates a running board without the 1200 bps touch on the serial port.
+class USBDFU : public PluggableUSBModule
+{
+public:
+  USBDFU();
+
+  // Called from the USB interrupt when the host asks for the detach, the
+  // board resets USB_DFU_DETACH_DELAY ms later
+  void onDetach(void (*callback)(void));
+
+protected:
+  // Implementation of the PluggableUSBModule
+  int getInterface(uint8_t* interfaceCount);
+  int getDescriptor(USBSetup& setup);
+  bool setup(USBSetup& setup);
+
+private:
+  uint8_t state;
+  void (*detachCallback)(void);
+};
+
+#endif
+
+#endif
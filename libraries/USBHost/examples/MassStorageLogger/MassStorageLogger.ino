@@ -0,0 +1,76 @@
+/*
+ Mass Storage Logger Example
+
+ Logs analog readings to a USB flash drive connected to the
+ Native USB port of an Arduino Zero, one sector after the other.
+
+ There is no file system: the sectors are written raw, starting
+ at LOG_START. Do not use a drive holding data you want to keep.
+
+ This sample code is part of the public domain.
+ */
+
+#include <masstorage.h>
+
+#define LOG_START   2048    // first sector written
+#define LOG_SECTORS 16      // sectors written per call, 8KB
+
+// Initialize USB Controller
+USBHost usb;
+
+// Attach mass storage driver to USB
+BulkOnly drive(&usb);
+
+// Two buffers: one is filled while the drive writes the other
+__attribute__((__aligned__(4))) uint8_t buffer[2][LOG_SECTORS * 512];
+uint32_t fill = 0;
+uint32_t used = 0;
+uint32_t sector = LOG_START;
+
+void setup()
+{
+  SERIAL_PORT_MONITOR.begin(115200);
+  SERIAL_PORT_MONITOR.println("Mass Storage Logger");
+
+  if (usb.Init())
+    SERIAL_PORT_MONITOR.println("USB host did not start");
+}
+
+void loop()
+{
+  // Process USB tasks
+  usb.Task();
+
+  if (!drive.isReady())
+    return;
+
+  if (drive.sectorSize() != 512) {
+    SERIAL_PORT_MONITOR.println("Sector size not supported");
+    while (1);
+  }
+
+  if (used + 2 <= sizeof(buffer[0])) {
+    uint16_t value = analogRead(A0);
+    buffer[fill][used++] = value;
+    buffer[fill][used++] = value >> 8;
+    return;
+  }
+
+  // Full: queue the write and carry on logging in the other buffer, as
+  // long as the write of the other one is done
+  while (drive.pending())
+    usb.Task();
+
+  if (!drive.writeSectorsAsync(sector, buffer[fill], LOG_SECTORS)) {
+    SERIAL_PORT_MONITOR.print("Write error: ");
+    SERIAL_PORT_MONITOR.println(drive.lastError(), HEX);
+    return;
+  }
+
+  SERIAL_PORT_MONITOR.print("Logged up to sector ");
+  SERIAL_PORT_MONITOR.println(sector + LOG_SECTORS - 1);
+
+  sector += LOG_SECTORS;
+  fill = 1 - fill;
+  used = 0;
+}
@@ -0,0 +1,57 @@
+/*
+ USB Serial Terminal Example
+
+ Connects the serial monitor to a USB modem, a board with a
+ native USB serial port (CDC-ACM) or an FTDI serial adapter,
+ plugged in the Native USB port of an Arduino Zero.
+
+ This sample code is part of the public domain.
+ */
+
+#include <cdcacm.h>
+#include <cdcftdi.h>
+
+// Initialize USB Controller
+USBHost usb;
+
+// Attach the serial drivers to USB, the device picks one
+ACM acm(&usb);
+FTDI ftdi(&usb);
+
+void setup()
+{
+  SERIAL_PORT_MONITOR.begin(115200);
+  SERIAL_PORT_MONITOR.println("USB Serial Terminal");
+
+  if (usb.Init())
+    SERIAL_PORT_MONITOR.println("USB host did not start");
+
+  // Applied once the device is attached
+  acm.begin(115200);
+  ftdi.begin(115200);
+}
+
+void forward(USBSerialHost &device)
+{
+  uint8_t buffer[64];
+  int n;
+
+  if (!device)
+    return;
+
+  while ((n = device.available()) > 0) {
+    n = device.readBytes(buffer, n < (int)sizeof(buffer) ? n : sizeof(buffer));
+    SERIAL_PORT_MONITOR.write(buffer, n);
+  }
+  while (SERIAL_PORT_MONITOR.available())
+    device.write(SERIAL_PORT_MONITOR.read());
+}
+
+void loop()
+{
+  // Process USB tasks
+  usb.Task();
+
+  forward(acm);
+  forward(ftdi);
+}
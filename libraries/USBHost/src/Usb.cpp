@@ -30,6 +30,8 @@ static uint32_t usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE;
 USBHost::USBHost() : bmHubPre(0) {
 	// Set up state machine
 	usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE; //set up state machine
+	enumeration.active = false;
+	addressTime = 0;
 }
 
 /* Initialize data structures */
@@ -115,11 +117,166 @@ uint32_t USBHost::SetPipeAddress(uint32_t addr, uint32_t ep, EpInfo **ppep, uint
          */
 
 	// CTRL_PIPE.PDADDR: usb_pipe_table[pipe_num].HostDescBank[0].CTRL_PIPE.bit.PDADDR = addr
-	uhd_configure_address((*ppep)->epAddr, addr); 	// Set peripheral address
+	// The other pipes are taken by StartTransfer(), which sets their address
+	if(!(*ppep)->epAddr)
+		uhd_configure_address((*ppep)->epAddr, addr); 	// Set peripheral address
 
 	return 0;
 }
 
+// Transfers started by StartTransfer(), one per pipe. They move one packet
+// at a time: the pipe interrupt checks each packet and sends the next one.
+// Pipe 0 is the control pipe. The others go to the endpoint of the transfer
+// they carry, and stay with it until another endpoint needs a free pipe.
+struct PipeTransfer {
+	EpInfo *pep;            // endpoint of the pipe, NULL while the pipe was never used
+	uint8_t addr;           // its device
+	uint8_t *data;
+	uint32_t length;        // bytes requested
+	uint32_t count;         // bytes transferred
+	uint32_t packet;        // bytes asked for by the pipe transfer in flight
+	uint32_t nakLimit;
+	uint32_t rcode;
+	USBTransferCallback callback;
+	void *arg;
+	bool in;
+	bool multiPacket;       // the pipe can move several packets at once: 'data' is word aligned, not on the control pipe
+	volatile bool busy;
+	volatile bool reserved; // synchronous transfer, until WaitTransfer() has its result
+};
+
+static PipeTransfer transfers[USB_EPT_NUM];
+
+// OUT packets are copied here, the caller's buffer may not be word aligned
+__attribute__((__aligned__(4))) static uint8_t outPackets[USB_EPT_NUM][64];
+
+static void setToggle(uint32_t pipe, uint32_t toggle) {
+	if(toggle)
+		USB->HOST.HostPipe[pipe].PSTATUSSET.reg = USB_HOST_PSTATUSSET_DTGL;
+	else
+		USB->HOST.HostPipe[pipe].PSTATUSCLR.reg = USB_HOST_PSTATUSCLR_DTGL;
+}
+
+// Pipe of the endpoint 'pep' of device 'addr' in that direction, or else one
+// no transfer is using, preferably never used: USB_EPT_NUM if there is none.
+// Called with interrupts disabled.
+static uint32_t findPipe(uint32_t addr, EpInfo *pep, bool in) {
+	uint32_t idle = USB_EPT_NUM;
+
+	if(!pep->epAddr)
+		return 0;
+
+	for(uint32_t pipe = 1; pipe < USB_EPT_NUM; pipe++) {
+		PipeTransfer &t = transfers[pipe];
+
+		if(t.pep == pep && t.in == in && t.addr == addr)
+			return pipe;
+		if(!t.busy && !t.reserved && (idle == USB_EPT_NUM || !t.pep))
+			idle = pipe;
+	}
+	return idle;
+}
+
+// Point 'pipe' at the endpoint 'pep' of device 'addr'
+static void configurePipe(uint32_t pipe, uint32_t addr, EpInfo *pep, bool in) {
+	uint32_t size = 0;
+
+	// Polls and bulk transfers alike are scheduled by the host library. Single
+	// bank: multi-packet transfers only use bank 0.
+	UHD_Pipe_Alloc(addr, pipe, USB_HOST_PTYPE_BULK, in ? USB_EP_DIR_IN : USB_EP_DIR_OUT, pep->maxPktSize, pep->nakInterval, 0);
+	usb_pipe_table[pipe].HostDescBank[0].CTRL_PIPE.bit.PEPNUM = pep->epAddr;
+
+	// Packet size of the endpoint, so that a packet shorter than that ends an IN
+	while((8U << size) < pep->maxPktSize)
+		size++;
+	usb_pipe_table[pipe].HostDescBank[0].PCKSIZE.bit.SIZE = size;
+}
+
+static void sendPacket(uint32_t pipe) {
+	PipeTransfer &t = transfers[pipe];
+	uint32_t left = t.length - t.count;
+	uint32_t size = left - (left % t.pep->maxPktSize);
+
+	if(!t.in && left <= UHD_PIPE_MAX_TRANSFER)
+		size = left; // the last packet may be short
+
+	if(t.multiPacket && size > t.pep->maxPktSize) {
+		// Several packets in one go, the pipe moves them without the CPU
+		t.packet = (size > UHD_PIPE_MAX_TRANSFER) ? UHD_PIPE_MAX_TRANSFER : size;
+		UHD_Pipe_Transfer(pipe, t.in ? tokIN : tokOUT, t.data + t.count, t.packet, t.nakLimit);
+	} else if(t.in) {
+		t.packet = t.pep->maxPktSize;
+		UHD_Pipe_Transfer(pipe, tokIN, t.data + t.count, 0, t.nakLimit);
+	} else {
+		t.packet = (left >= t.pep->maxPktSize) ? t.pep->maxPktSize : left;
+		memcpy(outPackets[pipe], t.data + t.count, t.packet);
+		UHD_Pipe_Write(pipe, t.packet, outPackets[pipe]);
+		UHD_Pipe_Start(pipe, tokOUT, t.nakLimit);
+	}
+}
+
+static void transferDone(uint32_t pipe, uint32_t rcode) {
+	PipeTransfer &t = transfers[pipe];
+
+	// Save toggle value
+	if(t.in)
+		t.pep->bmRcvToggle = USB_HOST_DTGL(pipe);
+	else
+		t.pep->bmSndToggle = USB_HOST_DTGL(pipe);
+
+	t.rcode = rcode;
+	t.busy = false;
+	if(t.callback)
+		t.callback(rcode, t.count, t.arg);
+}
+
+// Pipe callback, called from UHD_Handler() at the end of each packet
+static void pipeComplete(uint32_t pipe, uint32_t status) {
+	PipeTransfer &t = transfers[pipe];
+	uint32_t pktsize;
+
+	if(!t.busy)
+		return; // SETUP or status stage, see dispatchPkt()
+
+	if(status == USB_ERROR_DATATOGGLE) {
+		// Keep the packets a multi-packet IN got before the error
+		if(t.in && t.packet > t.pep->maxPktSize) {
+			pktsize = uhd_byte_count(pipe);
+			t.count += pktsize - (pktsize % t.pep->maxPktSize);
+		}
+		// yes, we flip it wrong here so that next time it is actually correct!
+		setToggle(pipe, USB_HOST_DTGL(pipe));
+		sendPacket(pipe);
+		return;
+	}
+	if(status) {
+		transferDone(pipe, status);
+		return;
+	}
+
+	bool shortPacket = false;
+	if(t.in) {
+		pktsize = uhd_byte_count(pipe); // Number of received bytes
+		USB->HOST.HostPipe[pipe].PSTATUSCLR.reg = USB_HOST_PSTATUSCLR_BK0RDY;
+		shortPacket = (pktsize < t.packet);
+
+		// The device may send more than asked for: trim the value, and hope for the best.
+		if(pktsize > t.length - t.count)
+			pktsize = t.length - t.count;
+	} else {
+		pktsize = t.packet;
+	}
+	t.count += pktsize;
+
+	/* The transfer is complete under two conditions:           */
+	/* 1. The device sent a short packet (L.T. maxPacketSize)   */
+	/* 2. 'length' bytes have been transferred.                 */
+	if(shortPacket || t.count >= t.length)
+		transferDone(pipe, 0);
+	else
+		sendPacket(pipe);
+}
+
 /* Control transfer. Sets address, endpoint, fills control packet with necessary data, dispatches control packet, and initiates bulk IN transfer,   */
 /* depending on request. Actual requests are defined as inlines                                                                                      */
 /* return codes:                */
@@ -137,6 +294,10 @@ uint32_t USBHost::ctrlReq(uint32_t addr, uint32_t ep, uint8_t bmReqType, uint8_t
 
 	TRACE_USBHOST(printf("    => ctrlReq\r\n");)
 
+	// Give the device the recovery time of its last SET_ADDRESS (USB 2.0 sect.9.2.6.3)
+	while(millis() - addressTime < USB_SET_ADDRESS_DELAY)
+		;
+
 	rcode = SetPipeAddress(addr, ep, &pep, nak_limit);
 	if(rcode)
 		return rcode;
@@ -177,30 +338,32 @@ uint32_t USBHost::ctrlReq(uint32_t addr, uint32_t ep, uint8_t bmReqType, uint8_t
 
 			pep->bmRcvToggle = 1; //bmRCVTOG1;
 
-			// Bytes read into buffer
-			uint32_t read = nbytes;
+			// 'dataptr' may be smaller than the request: read it 'nbytes' at a time
+			// and hand each chunk to the parser
+			while(left) {
+				// Bytes read into buffer
+				uint32_t read = nbytes;
 
-			rcode = InTransfer(pep, nak_limit, (uint8_t*)&read, dataptr);
+				rcode = InTransfer(addr, pep, nak_limit, &read, dataptr);
 
-			if((rcode&USB_ERROR_DATATOGGLE) == USB_ERROR_DATATOGGLE) {
-						// yes, we flip it wrong here so that next time it is actually correct!
-						//pep->bmRcvToggle = (regRd(rHRSL) & bmSNDTOGRD) ? 0 : 1;
-						pep->bmRcvToggle = USB_HOST_DTGL(pep->epAddr);
-						//continue;
-			}
+				if(rcode) {
+					//USBTRACE2("\n\rUSBHost::ctrlReq : in transfer: ", rcode");
+					return rcode;
+				}
+				// Invoke callback function if inTransfer completed successfully and callback function pointer is specified
+				if(p)
+					((USBReadParser*)p)->Parse(read, dataptr, total - left);
 
-			if(rcode) {
-				//USBTRACE2("\n\rUSBHost::ctrlReq : in transfer: ", rcode");
-				return rcode;
+				left -= (read < left) ? read : left;
+
+				if(read < nbytes)
+					break;
 			}
-			// Invoke callback function if inTransfer completed successfully and callback function pointer is specified
-			if(!rcode && p)
-				((USBReadParser*)p)->Parse(read, dataptr, total - left);
 		}
 		else // OUT transfer
 		{			
 			pep->bmSndToggle = 1; //bmSNDTOG1;
-			rcode = OutTransfer(pep, nak_limit, nbytes, dataptr);
+			rcode = OutTransfer(addr, pep, nak_limit, nbytes, dataptr);
 		}
 		if(rcode) //return error
 			return (rcode);
@@ -229,88 +392,22 @@ uint32_t USBHost::inTransfer(uint32_t addr, uint32_t ep, uint8_t *nbytesptr, uin
                 USBTRACE3("(USB::InTransfer) ep requested ", ep, 0x81);
                 return rcode;
         }
-	return InTransfer(pep, nak_limit, nbytesptr, data);
-}
-
-uint32_t USBHost::InTransfer(EpInfo *pep, uint32_t nak_limit, uint8_t *nbytesptr, uint8_t* data) {
-	uint32_t rcode = 0;
-	uint32_t pktsize = 0;
 
 	uint32_t nbytes = *nbytesptr;
-	uint32_t maxpktsize = pep->maxPktSize;
-
-	*nbytesptr = 0;
-	//set toggle value
-	if(pep->bmRcvToggle)
-		USB->HOST.HostPipe[pep->epAddr].PSTATUSSET.reg = USB_HOST_PSTATUSSET_DTGL;
-	else
-		USB->HOST.HostPipe[pep->epAddr].PSTATUSCLR.reg = USB_HOST_PSTATUSCLR_DTGL;
-
-	usb_pipe_table[pep->epAddr].HostDescBank[0].ADDR.reg = (uint32_t)data;
-
-	// use a 'break' to exit this loop
-	while (1) {
-   		/* get pipe config from setting register */
- 		usb_pipe_table[pep->epAddr].HostDescBank[0].ADDR.reg += pktsize;
-
-		rcode = dispatchPkt(tokIN, pep->epAddr, nak_limit); //IN packet to EP-'endpoint'. Function takes care of NAKS.
-		if(rcode == USB_ERROR_DATATOGGLE) {
-            // yes, we flip it wrong here so that next time it is actually correct!
-            //pep->bmRcvToggle = (regRd(rHRSL) & bmSNDTOGRD) ? 0 : 1;
-			pep->bmRcvToggle = USB_HOST_DTGL(pep->epAddr);
-            //set toggle value
-			if(pep->bmRcvToggle)
-				USB->HOST.HostPipe[pep->epAddr].PSTATUSSET.reg = USB_HOST_PSTATUSSET_DTGL;
-			else
-				USB->HOST.HostPipe[pep->epAddr].PSTATUSCLR.reg = USB_HOST_PSTATUSCLR_DTGL;
-            continue;
-		}
-        if(rcode) {
-                uhd_freeze_pipe(pep->epAddr);
-                //printf(">>>>>>>> Problem! dispatchPkt %2.2x\r\n", rcode);
-                return(rcode);// break; //should be 0, indicating ACK. Else return error code.
-        }
-        /* check for RCVDAVIRQ and generate error if not present */
-        /* the only case when absence of RCVDAVIRQ makes sense is when toggle error occurred. Need to add handling for that */
-				
-		pktsize = uhd_byte_count(pep->epAddr); // Number of received bytes
-		
-		USB->HOST.HostPipe[pep->epAddr].PSTATUSCLR.reg = USB_HOST_PSTATUSCLR_BK0RDY;
-        
-		//printf("Got %i bytes \r\n", pktsize);
-		// This would be OK, but...
-		//assert(pktsize <= nbytes);
-		if(pktsize > nbytes) {
-			// This can happen. Use of assert on Arduino locks up the Arduino.
-			// So I will trim the value, and hope for the best.
-			//printf(">>>>>>>> Problem! Wanted %i bytes but got %i.\r\n", nbytes, pktsize);
-			pktsize = nbytes;
-		}
-
-		int16_t mem_left = (int16_t)nbytes - *((int16_t*)nbytesptr);
-
-		if(mem_left < 0)
-			mem_left = 0;
+	rcode = InTransfer(addr, pep, nak_limit, &nbytes, data);
+	*nbytesptr = nbytes;
+	return rcode;
+}
 
-        //data = bytesRd(rRCVFIFO, ((pktsize > mem_left) ? mem_left : pktsize), data);
+uint32_t USBHost::InTransfer(uint32_t addr, EpInfo *pep, uint32_t nak_limit, uint32_t *nbytesptr, uint8_t* data) {
+	uint32_t pipe;
+	uint32_t rcode = StartTransfer(addr, pep, nak_limit, true, *nbytesptr, data, NULL, NULL, &pipe);
 
-        //regWr(rHIRQ, bmRCVDAVIRQ); // Clear the IRQ & free the buffer
-        *nbytesptr += pktsize;// add this packet's byte count to total transfer length
+	*nbytesptr = 0;
+	if(rcode)
+		return rcode;
 
-        /* The transfer is complete under two conditions:           */
-        /* 1. The device sent a short packet (L.T. maxPacketSize)   */
-        /* 2. 'nbytes' have been transferred.                       */
-        if((pktsize < maxpktsize) || (*nbytesptr >= nbytes)) // have we transferred 'nbytes' bytes?
-		{					 
-            // Save toggle value
-            pep->bmRcvToggle = USB_HOST_DTGL(pep->epAddr);
-            //printf("\r\n");
-            rcode = 0;
-            break;
-		} // if
-	} //while( 1 )
-	uhd_freeze_pipe(pep->epAddr);
-	return ( rcode);
+	return WaitTransfer(pipe, nbytesptr);
 }
 
 /* OUT transfer to arbitrary endpoint. Handles multiple packets if necessary. Transfers 'nbytes' bytes. */
@@ -326,81 +423,370 @@ uint32_t USBHost::outTransfer(uint32_t addr, uint32_t ep, uint32_t nbytes, uint8
 	if(rcode)
 		return rcode;
 
-	return OutTransfer(pep, nak_limit, nbytes, data);
+	return OutTransfer(addr, pep, nak_limit, nbytes, data);
+}
+
+uint32_t USBHost::OutTransfer(uint32_t addr, EpInfo *pep, uint32_t nak_limit, uint32_t nbytes, uint8_t *data) {
+	uint32_t pipe;
+	uint32_t rcode = StartTransfer(addr, pep, nak_limit, false, nbytes, data, NULL, NULL, &pipe);
+
+	if(rcode)
+		return rcode;
+
+	return WaitTransfer(pipe, NULL);
+}
+
+/* Asynchronous IN transfer: returns at once, 'callback' is called from the USB interrupt */
+/* with the result and the number of bytes received.                                      */
+uint32_t USBHost::inTransferAsync(uint32_t addr, uint32_t ep, uint32_t nbytes, uint8_t* data, USBTransferCallback callback, void *arg) {
+	EpInfo *pep = NULL;
+	uint32_t nak_limit = 0;
+
+	uint32_t rcode = SetPipeAddress(addr, ep, &pep, nak_limit);
+
+	if(rcode)
+		return rcode;
+
+	return StartTransfer(addr, pep, nak_limit, true, nbytes, data, callback, arg, NULL);
+}
+
+/* Asynchronous OUT transfer: returns at once, 'callback' is called from the USB interrupt */
+uint32_t USBHost::outTransferAsync(uint32_t addr, uint32_t ep, uint32_t nbytes, uint8_t* data, USBTransferCallback callback, void *arg) {
+	EpInfo *pep = NULL;
+	uint32_t nak_limit = 0;
+
+	uint32_t rcode = SetPipeAddress(addr, ep, &pep, nak_limit);
+
+	if(rcode)
+		return rcode;
+
+	return StartTransfer(addr, pep, nak_limit, false, nbytes, data, callback, arg, NULL);
+}
+
+bool USBHost::transferPending(uint32_t addr, uint32_t ep) {
+	EpInfo *pep = getEpInfoEntry(addr, ep);
+
+	if(!pep)
+		return false;
+
+	for(uint32_t pipe = 0; pipe < USB_EPT_NUM; pipe++) {
+		if(transfers[pipe].busy && transfers[pipe].pep == pep && transfers[pipe].addr == addr)
+			return true;
+	}
+	return false;
 }
 
-uint32_t USBHost::OutTransfer(EpInfo *pep, uint32_t nak_limit, uint32_t nbytes, uint8_t *data) {
-	uint32_t rcode = 0, retry_count;
-	uint8_t *data_p = data; //local copy of the data pointer
-	uint32_t bytes_tosend, nak_count;
-	uint32_t bytes_left = nbytes;
-	uint8_t buf[64];
-	uint8_t i;
+/* Stop the asynchronous transfers of an endpoint, both directions. Their callback is not called */
+void USBHost::cancelTransfer(uint32_t addr, uint32_t ep) {
+	EpInfo *pep = getEpInfoEntry(addr, ep);
+
+	if(!pep)
+		return;
+
+	for(uint32_t pipe = 0; pipe < USB_EPT_NUM; pipe++) {
+		PipeTransfer &t = transfers[pipe];
+
+		noInterrupts();
+		if(t.busy && t.pep == pep && t.addr == addr) {
+			UHD_Pipe_Abort(pipe);
+			t.busy = false;
+		}
+		interrupts();
+	}
+}
 
-	uint32_t maxpktsize = pep->maxPktSize;
+/* Start a transfer on a pipe of 'pep', the pipe interrupt carries it on packet by packet. */
+/* With no callback, WaitTransfer() gets the result from the pipe put in 'pipeptr'.         */
+uint32_t USBHost::StartTransfer(uint32_t addr, EpInfo *pep, uint32_t nak_limit, bool in, uint32_t nbytes, uint8_t *data, USBTransferCallback callback, void *arg, uint32_t *pipeptr) {
+	uint32_t pipe;
 
-    if(maxpktsize < 1 || maxpktsize > 64)
+	if(pep->maxPktSize < 1 || pep->maxPktSize > 64)
 		return USB_ERROR_INVALID_MAX_PKT_SIZE;
 
-	for( i=0; i<nbytes; i++) {
-		buf[i] = data[i];
+	// A periodic poll holds its pipe for one packet at most: wait for it,
+	// unless called from an interrupt or with interrupts disabled
+	uint32_t primask = __get_PRIMASK();
+	noInterrupts();
+	while((pipe = findPipe(addr, pep, in)) < USB_EPT_NUM && transfers[pipe].busy &&
+	      transfers[pipe].callback == PollDone && !primask && !__get_IPSR()) {
+		interrupts();
+		noInterrupts();
+	}
+	if(pipe == USB_EPT_NUM || transfers[pipe].busy || transfers[pipe].reserved) {
+		__set_PRIMASK(primask);
+		return USB_ERROR_TRANSFER_BUSY;
 	}
-	//unsigned long timeout = millis() + USB_XFER_TIMEOUT;
 
+	PipeTransfer &t = transfers[pipe];
+	bool moved = pipe && (t.pep != pep || t.in != in || t.addr != addr ||
+	                      usb_pipe_table[pipe].HostDescBank[0].CTRL_PIPE.bit.PEPNUM != pep->epAddr);
+
+	t.busy = true;
+	t.reserved = !callback;
+	t.pep = pep;
+	t.addr = addr;
+	t.in = in;
+	__set_PRIMASK(primask);
+
+	if(pipeptr)
+		*pipeptr = pipe;
+
+	// The pipe carried another endpoint: its type, direction and packet size change
+	if(moved)
+		configurePipe(pipe, addr, pep, in);
+
+	t.data = data;
+	t.length = nbytes;
+	t.count = 0;
+	t.nakLimit = nak_limit;
+	t.rcode = 0;
+	t.callback = callback;
+	t.arg = arg;
+	t.multiPacket = pipe && !((uint32_t)data & 3);
+
+	uhd_configure_address(pipe, addr);
 	//set toggle value
-	if(pep->bmSndToggle)
-		USB->HOST.HostPipe[pep->epAddr].PSTATUSSET.reg = USB_HOST_PSTATUSSET_DTGL;
-	else
-		USB->HOST.HostPipe[pep->epAddr].PSTATUSCLR.reg = USB_HOST_PSTATUSCLR_DTGL;
+	setToggle(pipe, in ? pep->bmRcvToggle : pep->bmSndToggle);
+	UHD_Pipe_SetCallback(pipe, pipeComplete);
+
+	// Nothing to send
+	if(!in && !nbytes) {
+		t.busy = false;
+		if(callback)
+			callback(0, 0, arg);
+		return 0;
+	}
 
-	while(bytes_left) {
-		retry_count = 0;
-		nak_count = 0;
-		bytes_tosend = (bytes_left >= maxpktsize) ? maxpktsize : bytes_left;
-		UHD_Pipe_Write(pep->epAddr, bytes_tosend, buf); //filling output FIFO
+	sendPacket(pipe);
+	return 0;
+}
 
-		//set number of bytes
-		//dispatch packet
-		//wait for the completion IRQ
-		//clear IRQ
+/* Wait for the end of the transfer started on 'pipe', giving up after USB_XFER_TIMEOUT */
+uint32_t USBHost::WaitTransfer(uint32_t pipe, uint32_t *nbytesptr) {
+	PipeTransfer &t = transfers[pipe];
+	uint32_t timeout = millis() + USB_XFER_TIMEOUT;
 
-		rcode = dispatchPkt(tokOUT, pep->epAddr, nak_limit);
-		if (rcode)
-		{
-			switch(rcode) {
-				case USB_ERRORFLOW:
-					nak_count++;
-					if(nak_limit && (nak_count == nak_limit))
-							goto breakout;
-					return ( rcode);
-					break;
-				case USB_ERRORTIMEOUT:
-					retry_count++;
-					if(retry_count == USB_RETRY_LIMIT)
-							goto breakout;
-					return ( rcode);
-					break;
-				case USB_ERROR_DATATOGGLE:
-					// yes, we flip it wrong here so that next time it is actually correct!
-					pep->bmSndToggle = USB_HOST_DTGL(pep->epAddr);
-					//set toggle value
-					if(pep->bmSndToggle)
-						USB->HOST.HostPipe[pep->epAddr].PSTATUSSET.reg = USB_HOST_PSTATUSSET_DTGL;
-					else
-						USB->HOST.HostPipe[pep->epAddr].PSTATUSCLR.reg = USB_HOST_PSTATUSCLR_DTGL;
-					break;
-				default:
-						goto breakout;
-			}//switch( rcode
+	while(t.busy) {
+		// Check timeout but don't hold timeout if VBUS is lost
+		if((long)(millis() - timeout) >= 0L || UHD_GetVBUSState() != UHD_STATE_CONNECTED) {
+			noInterrupts();
+			if(t.busy) {
+				UHD_Pipe_Abort(pipe);
+				t.busy = false;
+				t.rcode = USB_ERROR_TRANSFER_TIMEOUT;
+			}
+			interrupts();
 		}
+	}
 
-		bytes_left -= bytes_tosend;
-		data_p += bytes_tosend;
-    }//while( bytes_left...
-breakout:
+	if(nbytesptr)
+		*nbytesptr = t.count;
+	t.reserved = false;
+	return t.rcode;
+}
 
-    pep->bmSndToggle = USB_HOST_DTGL(pep->epAddr);
-    return ( rcode); //should be 0 in all cases
+/* Stop all transfers, the asynchronous ones get USB_ERROR_TRANSFER_ABORTED */
+void USBHost::AbortTransfers() {
+	for(uint32_t pipe = 0; pipe < USB_EPT_NUM; pipe++) {
+		PipeTransfer &t = transfers[pipe];
+
+		noInterrupts();
+		bool busy = t.busy;
+		if(busy) {
+			UHD_Pipe_Abort(pipe);
+			t.busy = false;
+			t.rcode = USB_ERROR_TRANSFER_ABORTED;
+		}
+		interrupts();
+
+		if(busy && t.callback)
+			t.callback(USB_ERROR_TRANSFER_ABORTED, t.count, t.arg);
+	}
+}
+
+// Periodic schedule, see schedulePoll(). Each poll is one IN token, sent on the
+// pipe of its endpoint: a poll that finds no free pipe is sent in a later frame,
+// or as soon as another poll is done.
+struct PeriodicPoll {
+	EpInfo *pep;            // NULL for a free entry
+	uint8_t addr;
+	uint8_t interval;       // frames, power of two
+	uint8_t phase;          // frame of the first poll, below 'interval'
+	volatile bool due;      // waiting for a pipe
+	volatile bool held;     // got data, waiting for resumePoll()
+	uint8_t *data;
+	uint32_t length;
+	USBTransferCallback callback;
+	void *arg;
+};
+
+static PeriodicPoll polls[USB_PERIODIC_MAX];
+static uint8_t frameLoad[USB_PERIODIC_FRAMES];  // polls in each frame of the schedule
+static uint32_t pollCount;
+
+// Phase putting a poll every 'interval' frames in the least loaded frames
+static uint32_t leastLoadedPhase(uint32_t interval) {
+	uint32_t best = 0;
+	uint32_t bestLoad = ~0UL;
+
+	for(uint32_t phase = 0; phase < interval; phase++) {
+		uint32_t load = 0;
+
+		for(uint32_t frame = phase; frame < USB_PERIODIC_FRAMES; frame += interval) {
+			if(frameLoad[frame] > load)
+				load = frameLoad[frame];
+		}
+		if(load < bestLoad) {
+			best = phase;
+			bestLoad = load;
+		}
+	}
+	return best;
+}
+
+uint32_t USBHost::schedulePoll(uint32_t addr, uint32_t ep, uint32_t interval, uint32_t nbytes, uint8_t* data, USBTransferCallback callback, void *arg) {
+	EpInfo *pep = getEpInfoEntry(addr, ep);
+	PeriodicPoll *p = NULL;
+	uint32_t frames = 1;
+
+	if(!ep || !pep)
+		return USB_ERROR_EP_NOT_FOUND_IN_TBL;
+
+	if(pep->maxPktSize < 1 || pep->maxPktSize > 64)
+		return USB_ERROR_INVALID_MAX_PKT_SIZE;
+
+	unschedulePoll(addr, ep);
+
+	for(uint32_t i = 0; i < USB_PERIODIC_MAX; i++) {
+		if(!polls[i].pep) {
+			p = &polls[i];
+			break;
+		}
+	}
+	if(!p)
+		return USB_ERROR_SCHEDULE_FULL;
+
+	while(frames * 2 <= interval && frames * 2 <= USB_PERIODIC_FRAMES)
+		frames *= 2;
+
+	p->addr = addr;
+	p->interval = frames;
+	p->phase = leastLoadedPhase(frames);
+	p->due = false;
+	p->held = false;
+	p->data = data;
+	p->length = nbytes;
+	p->callback = callback;
+	p->arg = arg;
+	for(uint32_t frame = p->phase; frame < USB_PERIODIC_FRAMES; frame += frames)
+		frameLoad[frame]++;
+	pollCount++;
+
+	// The start of frame interrupt takes the entry from here
+	noInterrupts();
+	p->pep = pep;
+	interrupts();
+
+	UHD_SetStartOfFrameCallback(StartOfFrame);
+	return 0;
+}
+
+void USBHost::resumePoll(uint32_t addr, uint32_t ep) {
+	for(uint32_t i = 0; i < USB_PERIODIC_MAX; i++) {
+		if(polls[i].pep && polls[i].addr == addr && polls[i].pep->epAddr == ep)
+			polls[i].held = false;
+	}
+}
+
+void USBHost::unschedulePoll(uint32_t addr, uint32_t ep) {
+	for(uint32_t i = 0; i < USB_PERIODIC_MAX; i++) {
+		if(polls[i].pep && polls[i].addr == addr && polls[i].pep->epAddr == ep)
+			DropPoll(i);
+	}
+}
+
+/* Remove a poll from the schedule, stopping it if it is on a pipe. Its callback is not called. */
+void USBHost::DropPoll(uint32_t index) {
+	PeriodicPoll &p = polls[index];
+
+	noInterrupts();
+	for(uint32_t pipe = 1; pipe < USB_EPT_NUM; pipe++) {
+		PipeTransfer &t = transfers[pipe];
+
+		if(t.busy && t.callback == PollDone && t.arg == &p) {
+			UHD_Pipe_Abort(pipe);
+			t.busy = false;
+		}
+	}
+	p.pep = NULL;
+	interrupts();
+
+	for(uint32_t frame = p.phase; frame < USB_PERIODIC_FRAMES; frame += p.interval)
+		frameLoad[frame]--;
+	if(!--pollCount)
+		UHD_SetStartOfFrameCallback(NULL);
+}
+
+/* Unbind the idle pipes of a device, the next one at its address configures them afresh */
+void USBHost::ForgetPipes(uint32_t addr) {
+	for(uint32_t pipe = 1; pipe < USB_EPT_NUM; pipe++) {
+		PipeTransfer &t = transfers[pipe];
+
+		noInterrupts();
+		if(!t.busy && !t.reserved && t.addr == addr)
+			t.pep = NULL;
+		interrupts();
+	}
+}
+
+/* Empty the schedule once the transfers are aborted */
+void USBHost::ClearSchedule() {
+	UHD_SetStartOfFrameCallback(NULL);
+	memset(polls, 0, sizeof(polls));
+	memset(frameLoad, 0, sizeof(frameLoad));
+	pollCount = 0;
+}
+
+// Start of frame callback, from the USB interrupt
+void USBHost::StartOfFrame(uint32_t frame) {
+	frame %= USB_PERIODIC_FRAMES; // the 11 bit frame number wraps on a multiple
+
+	for(uint32_t i = 0; i < USB_PERIODIC_MAX; i++) {
+		PeriodicPoll &p = polls[i];
+
+		if(p.pep && !p.held && (frame & (p.interval - 1)) == p.phase)
+			p.due = true;
+	}
+	StartPolls();
+}
+
+// Send the polls that are due, those that find no free pipe stay due
+void USBHost::StartPolls() {
+	for(uint32_t i = 0; i < USB_PERIODIC_MAX; i++) {
+		PeriodicPoll &p = polls[i];
+
+		// A single IN: a NAK ends it
+		if(p.pep && p.due && !StartTransfer(p.addr, p.pep, 1, true, p.length, p.data, PollDone, &p, NULL))
+			p.due = false;
+	}
+}
+
+// Poll completion, from the USB interrupt, or from Task() when the device goes away
+void USBHost::PollDone(uint32_t rcode, uint32_t nbytes, void *arg) {
+	PeriodicPoll &p = *(PeriodicPoll *)arg;
+
+	if(rcode == USB_ERROR_TRANSFER_ABORTED)
+		return;
+
+	if(rcode != USB_ERRORFLOW) {
+		if(!rcode && nbytes)
+			p.held = true;
+		if(p.callback)
+			p.callback(rcode, nbytes, p.arg);
+	}
+
+	// The polls waiting for a pipe
+	StartPolls();
 }
 
 /* dispatch USB packet. Assumes peripheral address is set and relevant buffer is loaded/empty       */
@@ -411,57 +797,28 @@ breakout:
 /* return codes 0x00-0x0f are HRSLT( 0x00 being success ), 0xff means timeout                       */
 uint32_t USBHost::dispatchPkt(uint32_t token, uint32_t epAddr, uint32_t nak_limit) {
 	uint32_t timeout = millis() + USB_XFER_TIMEOUT;
-	uint32_t nak_count = 0, retry_count=0;
-	uint32_t rcode = USB_ERROR_TRANSFER_TIMEOUT;
+	uint32_t retry_count = 0;
+	uint32_t rcode;
 
 	TRACE_USBHOST(printf("     => dispatchPkt token=%lu pipe=%lu nak_limit=%lu\r\n", token, epAddr, nak_limit);)
 
-	UHD_Pipe_Send(epAddr, token); //launch the transfer
-
-	// Check timeout but don't hold timeout if VBUS is lost
-	while ((timeout > millis()) && (UHD_GetVBUSState() == UHD_STATE_CONNECTED))
-	{
-		// Wait for transfer completion
-		if (UHD_Pipe_Is_Transfer_Complete(epAddr, token))
-		{
-			return 0;
-		}
+	for(;;) {
+		UHD_Pipe_Start(epAddr, token, nak_limit); //launch the transfer, UHD_Handler() counts the NAKs
 
-		//case hrNAK:
-		if((USB->HOST.HostPipe[epAddr].PINTFLAG.reg & USB_HOST_PINTFLAG_TRFAIL) ) {
-			USB->HOST.HostPipe[epAddr].PINTFLAG.reg = USB_HOST_PINTFLAG_TRFAIL;
-			nak_count++;
-			if(nak_limit && (nak_count == nak_limit)) {
-				rcode = USB_ERRORFLOW;
-				return (rcode);
-			}
-		}
-
-		//case hrNAK:
-		if( (usb_pipe_table[epAddr].HostDescBank[0].STATUS_BK.reg & USB_ERRORFLOW ) ) {
-			nak_count++;
-			if(nak_limit && (nak_count == nak_limit)) {
-				rcode = USB_ERRORFLOW;
-				return (rcode);
+		// Check timeout but don't hold timeout if VBUS is lost
+		while((rcode = UHD_Pipe_Status(epAddr)) == UHD_PIPE_BUSY) {
+			if((long)(millis() - timeout) >= 0L || UHD_GetVBUSState() != UHD_STATE_CONNECTED) {
+				UHD_Pipe_Abort(epAddr);
+				return USB_ERROR_TRANSFER_TIMEOUT;
 			}
 		}
 
 		//case hrTIMEOUT:
-		if(usb_pipe_table[epAddr].HostDescBank[0].STATUS_PIPE.reg & USB_ERRORTIMEOUT) {
-			retry_count++;
-			if(retry_count == USB_RETRY_LIMIT)	{
-				rcode = USB_ERRORTIMEOUT;
-				return (rcode);
-			}
-		}
+		if(rcode == USB_ERRORTIMEOUT && ++retry_count < USB_RETRY_LIMIT)
+			continue;
 
-		if( (usb_pipe_table[epAddr].HostDescBank[0].STATUS_PIPE.reg & USB_ERROR_DATATOGGLE ) ) {
-			rcode = USB_ERROR_DATATOGGLE;
-			return (rcode);
-		}
+		return rcode;
 	}
-
-	return rcode;
 }
 
 /* USB main task. Performs enumeration/cleanup */
@@ -503,11 +860,20 @@ void USBHost::Task(void) //USB state machine
 		if (devConfig[i])
 			rcode = devConfig[i]->Poll();
 
+	// Carry on configuring a device behind a hub once its delay has elapsed
+	if (enumeration.active && enumeration.parent && (long)(millis() - enumeration.deadline) >= 0L)
+		Enumerate();
+
 	// Perform USB enumeration stage and clean up
 	switch (usb_task_state) {
 		case USB_DETACHED_SUBSTATE_INITIALIZE:
 			TRACE_USBHOST(printf(" + USB_DETACHED_SUBSTATE_INITIALIZE\r\n");)
 
+			// Drop the device being configured, the transfers in progress and the polls
+			enumeration.active = false;
+			AbortTransfers();
+			ClearSchedule();
+
 			// Init USB stack and driver
 			UHD_Init();
 
@@ -554,7 +920,7 @@ void USBHost::Task(void) //USB state machine
 			// Wait for SOF received first
 			if (Is_uhd_sof())
 			{
-				if (delay < millis())
+				if ((long)(millis() - delay) >= 0L)
 				{
 					TRACE_USBHOST(printf(" + USB_ATTACHED_SUBSTATE_WAIT_SOF\r\n");)
 
@@ -564,8 +930,17 @@ void USBHost::Task(void) //USB state machine
 			}
 			break;
 		case USB_STATE_CONFIGURING:
-			TRACE_USBHOST(printf(" + USB_STATE_CONFIGURING\r\n");)
-			rcode = Configuring(0, 0, lowspeed);
+			if (!enumeration.active) {
+				TRACE_USBHOST(printf(" + USB_STATE_CONFIGURING\r\n");)
+				rcode = Configuring(0, 0, lowspeed);
+			}
+			else if (!enumeration.parent && (long)(millis() - enumeration.deadline) >= 0L) {
+				rcode = Enumerate();
+			}
+			else {
+				// Waiting for the device, or for a hub port being configured
+				break;
+			}
 
 			if (rcode) {
 				TRACE_USBHOST(printf("/!\\ USBHost::Task : USB_STATE_CONFIGURING failed with code: %lu\r\n", rcode);)
@@ -627,50 +1002,6 @@ uint32_t USBHost::DefaultAddressing(uint32_t parent, uint32_t port, uint32_t low
 	return 0;
 }
 
-uint32_t USBHost::AttemptConfig(uint32_t driver, uint32_t parent, uint32_t port, uint32_t lowspeed) {
-        //printf("AttemptConfig: parent = %i, port = %i\r\n", parent, port);
-        uint8_t retries = 0;
-
-again:
-        uint8_t rcode = devConfig[driver]->ConfigureDevice(parent, port, lowspeed);
-        if(rcode == USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET) {
-                if(parent == 0) {
-                        // Send a bus reset on the root interface.
-                        //regWr(rHCTL, bmBUSRST); //issue bus reset
-                        UHD_BusReset();
-                        delay(102); // delay 102ms, compensate for clock inaccuracy.
-                } else {
-                        // reset parent port
-                        devConfig[parent]->ResetHubPort(port);
-                }
-        } else if(rcode != 0x00/*hrJERR*/ && retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
-                delay(100);
-                retries++;
-                goto again;
-        } else if(rcode)
-                return rcode;
-
-        rcode = devConfig[driver]->Init(parent, port, lowspeed);
-        if(rcode != 0x00/*hrJERR*/ && retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
-                delay(100);
-                retries++;
-                goto again;
-        }
-        if(rcode) {
-                // Issue a bus reset, because the device may be in a limbo state
-                if(parent == 0) {
-                        // Send a bus reset on the root interface.
-                        //regWr(rHCTL, bmBUSRST); //issue bus reset
-                        UHD_BusReset();
-                        delay(102); // delay 102ms, compensate for clock inaccuracy.
-                } else {
-                        // reset parent port
-                        devConfig[parent]->ResetHubPort(port);
-                }
-        }
-        return rcode;
-}
-
 /*
  * This is broken. We need to enumerate differently.
  * It causes major problems with several devices if detected in an unexpected order.
@@ -711,100 +1042,191 @@ again:
  * 8: if we get here, no driver likes the device plugged in, so exit failure.
  *
  */
+// Enumeration steps, see Enumerate()
+#define USB_ENUM_DESCRIPTOR     0       // read the device descriptor
+#define USB_ENUM_NEXT_DRIVER    1       // pick the next driver to try
+#define USB_ENUM_CONFIGURE      2       // driver ConfigureDevice()
+#define USB_ENUM_INIT           3       // driver Init()
+#define USB_ENUM_FAILED         4       // bus reset after a failed Init()
+
+/* Start configuring the device at address 0. Returns USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE
+   when it has to wait (reset, retry): Task() resumes it then, so that no delay is spent here.
+   Returns USB_ERROR_ENUMERATION_BUSY while another device is being configured. */
 uint32_t USBHost::Configuring(uint32_t parent, uint32_t port, uint32_t lowspeed) {
-       //uint32_t bAddress = 0;
         //printf("Configuring: parent = %i, port = %i\r\n", parent, port);
-        uint32_t devConfigIndex;
+        if(enumeration.active)
+                return USB_ERROR_ENUMERATION_BUSY;
+
+        enumeration.active = true;
+        enumeration.step = USB_ENUM_DESCRIPTOR;
+        enumeration.parent = parent;
+        enumeration.port = port;
+        enumeration.lowspeed = lowspeed;
+
+        // The device behind a hub port that was just reset needs its recovery
+        // time, Task() gives it to the root port before calling here
+        if(parent)
+                return EnumerationWait(USB_PORT_RECOVERY_DELAY);
+        return Enumerate();
+}
+
+uint32_t USBHost::Enumerate() {
+        uint32_t parent = enumeration.parent;
+        uint32_t port = enumeration.port;
+        uint32_t lowspeed = enumeration.lowspeed;
         uint32_t rcode = 0;
-        uint8_t buf[sizeof (USB_DEVICE_DESCRIPTOR)];
-        USB_DEVICE_DESCRIPTOR *udd = reinterpret_cast<USB_DEVICE_DESCRIPTOR *>(buf);
-        UsbDeviceDefinition *p = NULL;
-        EpInfo *oldep_ptr = NULL;
-        EpInfo epInfo;
-
-        epInfo.epAddr = 0;
-        epInfo.maxPktSize = 8;
-        epInfo.bmSndToggle = 0;
-        epInfo.bmRcvToggle = 0;
-        epInfo.bmNakPower = USB_NAK_MAX_POWER;
-
-        //delay(2000);
-        AddressPool &addrPool = GetAddressPool();
-        // Get pointer to pseudo device with address 0 assigned
-        p = addrPool.GetUsbDevicePtr(0);
-        if(!p) {
-                //printf("Configuring error: USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL\r\n");
-                return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
-        }
 
-        // Save old pointer to EP_RECORD of address 0
-        oldep_ptr = p->epinfo;
+        switch(enumeration.step) {
+        case USB_ENUM_DESCRIPTOR:
+        {
+                uint8_t buf[sizeof (USB_DEVICE_DESCRIPTOR)];
+                USB_DEVICE_DESCRIPTOR *udd = reinterpret_cast<USB_DEVICE_DESCRIPTOR *>(buf);
+                UsbDeviceDefinition *p = NULL;
+                EpInfo *oldep_ptr = NULL;
+                EpInfo epInfo;
+
+                epInfo.epAddr = 0;
+                epInfo.maxPktSize = 8;
+                epInfo.bmSndToggle = 0;
+                epInfo.bmRcvToggle = 0;
+                epInfo.bmNakPower = USB_NAK_MAX_POWER;
+
+                AddressPool &addrPool = GetAddressPool();
+                // Get pointer to pseudo device with address 0 assigned
+                p = addrPool.GetUsbDevicePtr(0);
+                if(!p) {
+                        //printf("Configuring error: USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL\r\n");
+                        return EnumerationDone(USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL);
+                }
 
-        // Temporary assign new pointer to epInfo to p->epinfo in order to
-        // avoid toggle inconsistence
+                // Save old pointer to EP_RECORD of address 0
+                oldep_ptr = p->epinfo;
 
-        p->epinfo = &epInfo;
+                // Temporary assign new pointer to epInfo to p->epinfo in order to
+                // avoid toggle inconsistence
 
-        p->lowspeed = lowspeed;
-        // Get device descriptor
-        rcode = getDevDescr(0, 0, sizeof (USB_DEVICE_DESCRIPTOR), (uint8_t*)buf);
-        // The first GetDescriptor give us the endpoint 0 max packet size.
-        epInfo.maxPktSize = buf[7];
-        // Restore p->epinfo
-        p->epinfo = oldep_ptr;
+                p->epinfo = &epInfo;
 
-        if(rcode) {
-                //printf("Configuring error: Can't get USB_DEVICE_DESCRIPTOR\r\n");
-                return rcode;
-        }
+                p->lowspeed = lowspeed;
+                // Get device descriptor
+                rcode = getDevDescr(0, 0, sizeof (USB_DEVICE_DESCRIPTOR), (uint8_t*)buf);
+                // The first GetDescriptor give us the endpoint 0 max packet size.
+                epInfo.maxPktSize = buf[7];
+                // Restore p->epinfo
+                p->epinfo = oldep_ptr;
+
+                if(rcode) {
+                        //printf("Configuring error: Can't get USB_DEVICE_DESCRIPTOR\r\n");
+                        return EnumerationDone(rcode);
+                }
 
-        // to-do?
-        // Allocate new address according to device class
-        //bAddress = addrPool.AllocAddress(parent, false, port);
-
-        //if (!bAddress)
-        //        return USB_ERROR_OUT_OF_ADDRESS_SPACE_IN_POOL;
-        uint16_t vid = udd->idVendor;
-        uint16_t pid = udd->idProduct;
-        uint8_t klass = udd->bDeviceClass;
-
-        // Attempt to configure if VID/PID or device class matches with a driver
-        for(devConfigIndex = 0; devConfigIndex < USB_NUMDEVICES; devConfigIndex++) {
-                if(!devConfig[devConfigIndex]) continue; // no driver
-                if(devConfig[devConfigIndex]->GetAddress()) continue; // consumed
-                if(devConfig[devConfigIndex]->VIDPIDOK(vid, pid) || devConfig[devConfigIndex]->DEVCLASSOK(klass)) {
-                        rcode = AttemptConfig(devConfigIndex, parent, port, lowspeed);
-                        if(rcode != USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED)
+                enumeration.vid = udd->idVendor;
+                enumeration.pid = udd->idProduct;
+                enumeration.klass = udd->bDeviceClass;
+                enumeration.pass = 0;
+                enumeration.driver = 0;
+                enumeration.step = USB_ENUM_NEXT_DRIVER;
+        }
+        // fall through
+        case USB_ENUM_NEXT_DRIVER:
+                // First the drivers whose VID/PID or device class matches, then blindly the others
+                for(;; enumeration.driver++) {
+                        if(enumeration.driver == USB_NUMDEVICES) {
+                                if(enumeration.pass) {
+                                        // if we get here that means that the device class is not supported by any of registered classes
+                                        return EnumerationDone(DefaultAddressing(parent, port, lowspeed));
+                                }
+                                enumeration.pass = 1;
+                                enumeration.driver = 0;
+                        }
+                        USBDeviceConfig *dev = devConfig[enumeration.driver];
+                        if(!dev) continue; // no driver
+                        if(dev->GetAddress()) continue; // consumed
+                        bool match = dev->VIDPIDOK(enumeration.vid, enumeration.pid) || dev->DEVCLASSOK(enumeration.klass);
+                        if(match == !enumeration.pass)
                                 break;
                 }
+                enumeration.retries = 0;
+                enumeration.step = USB_ENUM_CONFIGURE;
+        // fall through
+        case USB_ENUM_CONFIGURE:
+                rcode = devConfig[enumeration.driver]->ConfigureDevice(parent, port, lowspeed);
+                if(rcode == USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET) {
+                        enumeration.step = USB_ENUM_INIT;
+                        if(parent == 0) {
+                                // Send a bus reset on the root interface.
+                                UHD_BusReset();
+                        } else {
+                                // reset parent port
+                                devConfig[parent]->ResetHubPort(port);
+                        }
+                        return EnumerationWait(USB_RESET_DELAY);
+                } else if(rcode != 0x00/*hrJERR*/ && enumeration.retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
+                        enumeration.retries++;
+                        return EnumerationWait(USB_RETRY_DELAY);
+                } else if(rcode)
+                        return DriverDone(rcode);
+                enumeration.step = USB_ENUM_INIT;
+        // fall through
+        case USB_ENUM_INIT:
+                rcode = devConfig[enumeration.driver]->Init(parent, port, lowspeed);
+                if(rcode == USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE) {
+                        // The driver waits, see initWait(): Init() goes on from Task()
+                        return rcode;
+                }
+                if(rcode != 0x00/*hrJERR*/ && enumeration.retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
+                        enumeration.retries++;
+                        enumeration.step = USB_ENUM_CONFIGURE;
+                        return EnumerationWait(USB_RETRY_DELAY);
+                }
+                if(rcode) {
+                        // Issue a bus reset, because the device may be in a limbo state
+                        enumeration.rcode = rcode;
+                        enumeration.step = USB_ENUM_FAILED;
+                        if(parent == 0) {
+                                // Send a bus reset on the root interface.
+                                UHD_BusReset();
+                        } else {
+                                // reset parent port
+                                devConfig[parent]->ResetHubPort(port);
+                        }
+                        return EnumerationWait(USB_RESET_DELAY);
+                }
+                return DriverDone(rcode);
+        case USB_ENUM_FAILED:
+                return DriverDone(enumeration.rcode);
         }
+        return EnumerationDone(rcode);
+}
 
-        if(devConfigIndex < USB_NUMDEVICES) {
-                return rcode;
-        }
+/* Come back to Enumerate() from Task() in 'ms' milliseconds */
+uint32_t USBHost::EnumerationWait(uint32_t ms) {
+        enumeration.deadline = millis() + ms;
+        return USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE;
+}
 
+uint32_t USBHost::EnumerationDone(uint32_t rcode) {
+        enumeration.active = false;
+        return rcode;
+}
 
-        // blindly attempt to configure
-        for(devConfigIndex = 0; devConfigIndex < USB_NUMDEVICES; devConfigIndex++) {
-                if(!devConfig[devConfigIndex]) continue;
-                if(devConfig[devConfigIndex]->GetAddress()) continue; // consumed
-                if(devConfig[devConfigIndex]->VIDPIDOK(vid, pid) || devConfig[devConfigIndex]->DEVCLASSOK(klass)) continue; // If this is true it means it must have returned USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED above
-                rcode = AttemptConfig(devConfigIndex, parent, port, lowspeed);
+/* A driver is done with the device: keep the result, or try the next driver */
+uint32_t USBHost::DriverDone(uint32_t rcode) {
+        bool next;
 
+        if(enumeration.pass == 0)
+                next = (rcode == USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED);
+        else
+                next = (rcode == USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED || rcode == USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE);
+
+        if(!next) {
                 //printf("ERROR ENUMERATING %2.2x\r\n", rcode);
-                if(!(rcode == USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED || rcode == USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE)) {
-                        // in case of an error dev_index should be reset to 0
-                        //		in order to start from the very beginning the
-                        //		next time the program gets here
-                        //if (rcode != USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE)
-                        //        devConfigIndex = 0;
-                        return rcode;
-                }
-	}
-        // if we get here that means that the device class is not supported by any of registered classes
-	rcode = DefaultAddressing(parent, port, lowspeed);
+                return EnumerationDone(rcode);
+        }
 
-	return rcode;
+        enumeration.driver++;
+        enumeration.step = USB_ENUM_NEXT_DRIVER;
+        return Enumerate();
 }
 
 uint32_t USBHost::ReleaseDevice(uint32_t addr) {
@@ -813,8 +1235,17 @@ uint32_t USBHost::ReleaseDevice(uint32_t addr) {
 
 	for(uint32_t i = 0; i < USB_NUMDEVICES; i++) {
                 if(!devConfig[i]) continue;
-		if(devConfig[i]->GetAddress() == addr)
-			return devConfig[i]->Release();
+		if(devConfig[i]->GetAddress() == addr) {
+			uint32_t rcode = devConfig[i]->Release();
+
+			// The polls the driver left behind
+			for(uint32_t j = 0; j < USB_PERIODIC_MAX; j++) {
+				if(polls[j].pep && polls[j].addr == addr)
+					DropPoll(j);
+			}
+			ForgetPipes(addr);
+			return rcode;
+		}
 	}
 	return 0;
 }
@@ -858,8 +1289,8 @@ uint32_t USBHost::getStrDescr(uint32_t addr, uint32_t ep, uint32_t nbytes, uint3
 
 uint32_t USBHost::setAddr(uint32_t oldaddr, uint32_t ep, uint32_t newaddr) {
         uint32_t rcode = ctrlReq(oldaddr, ep, bmREQ_SET, USB_REQUEST_SET_ADDRESS, newaddr, 0x00, 0x0000, 0x0000, 0x0000, NULL, NULL);
-        //delay(2); //per USB 2.0 sect.9.2.6.3
-        delay(300); // Older spec says you should wait at least 200ms
+        // The next ctrlReq() waits out USB_SET_ADDRESS_DELAY, per USB 2.0 sect.9.2.6.3
+        addressTime = millis();
         return rcode;
         //return ( ctrlReq(oldaddr, ep, bmREQ_SET, USB_REQUEST_SET_ADDRESS, newaddr, 0x00, 0x0000, 0x0000, 0x0000, NULL, NULL));
 }
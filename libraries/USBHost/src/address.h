@@ -42,6 +42,7 @@ struct EpInfo {
 			uint8_t		bmNakPower	:	6;		// Binary order for NAK_LIMIT value
                 };
 	};
+	uint8_t nakInterval; // ms between the retries of a NAKed bulk token, 0 for at once
 };
 
 //	  7   6   5   4   3   2   1   0
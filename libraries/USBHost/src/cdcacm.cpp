@@ -0,0 +1,89 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "cdcacm.h"
+
+/* The communication interface holds the notification endpoint, the data interface the bulk endpoints */
+bool ACM::Match(const USB_DEVICE_DESCRIPTOR *udd) {
+        bControlFound = false;
+
+        for(uint32_t i = 0; i < udd->bNumConfigurations; i++) {
+                ConfigDescParser<USB_CLASS_COM_AND_CDC_CTRL, CDC_SUBCLASS_ACM, 0, CP_MASK_COMPARE_CLASS | CP_MASK_COMPARE_SUBCLASS> controlParser(this);
+                ConfigDescParser<USB_CLASS_CDC_DATA, 0, 0, CP_MASK_COMPARE_CLASS> dataParser(this);
+
+                if(pUsb->getConfDescr(0, 0, i, &controlParser))
+                        return false;
+                if(pUsb->getConfDescr(0, 0, i, &dataParser))
+                        return false;
+                if(bNumEP == USB_SERIAL_MAX_ENDPOINTS)
+                        break;
+        }
+
+        // Without a notification endpoint, take the usual layout: control, then data
+        if(!bControlFound)
+                bControlIface = bIface ? bIface - 1 : 0;
+        return bNumEP == USB_SERIAL_MAX_ENDPOINTS;
+}
+
+void ACM::EndpointXtract(uint32_t conf, uint32_t iface, uint32_t alt, uint32_t proto, const USB_ENDPOINT_DESCRIPTOR *pep) {
+        // Notifications are not used, the interface number is
+        if((pep->bmAttributes & 0x03) == 3) {
+                if(!bControlFound) {
+                        bControlIface = iface;
+                        bControlFound = true;
+                }
+                return;
+        }
+        USBSerialHost::EndpointXtract(conf, iface, alt, proto, pep);
+}
+
+uint32_t ACM::SetLineCoding(uint32_t baudrate, uint16_t conf) {
+        uint8_t coding[7];
+
+        coding[0] = baudrate;
+        coding[1] = baudrate >> 8;
+        coding[2] = baudrate >> 16;
+        coding[3] = baudrate >> 24;
+
+        switch(conf & SERIAL_STOP_BIT_MASK) {
+                case SERIAL_STOP_BIT_1_5: coding[4] = 1; break;
+                case SERIAL_STOP_BIT_2:   coding[4] = 2; break;
+                default:                  coding[4] = 0; break;
+        }
+
+        switch(conf & SERIAL_PARITY_MASK) {
+                case SERIAL_PARITY_ODD:   coding[5] = 1; break;
+                case SERIAL_PARITY_EVEN:  coding[5] = 2; break;
+                case SERIAL_PARITY_MARK:  coding[5] = 3; break;
+                case SERIAL_PARITY_SPACE: coding[5] = 4; break;
+                default:                  coding[5] = 0; break;
+        }
+
+        switch(conf & SERIAL_DATA_MASK) {
+                case SERIAL_DATA_5: coding[6] = 5; break;
+                case SERIAL_DATA_6: coding[6] = 6; break;
+                case SERIAL_DATA_7: coding[6] = 7; break;
+                default:            coding[6] = 8; break;
+        }
+
+        return pUsb->ctrlReq(bAddress, 0, bmREQ_CDCOUT, CDC_REQ_SET_LINE_CODING, 0, 0, bControlIface, sizeof(coding), sizeof(coding), coding, NULL);
+}
+
+uint32_t ACM::SetControlLines(bool dtrOn, bool rtsOn) {
+        return pUsb->ctrlReq(bAddress, 0, bmREQ_CDCOUT, CDC_REQ_SET_CONTROL_LINE_STATE, (dtrOn ? 0x01 : 0) | (rtsOn ? 0x02 : 0), 0, bControlIface, 0, 0, NULL, NULL);
+}
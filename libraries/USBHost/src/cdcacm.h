@@ -0,0 +1,54 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* CDC Abstract Control Model: modems, boards with a native USB serial port */
+
+#ifndef CDCACM_H_INCLUDED
+#define CDCACM_H_INCLUDED
+
+#include "usbserial.h"
+
+#define CDC_SUBCLASS_ACM                0x02
+
+// Class requests
+#define CDC_REQ_SET_LINE_CODING         0x20
+#define CDC_REQ_SET_CONTROL_LINE_STATE  0x22
+
+#define bmREQ_CDCOUT                    USB_SETUP_HOST_TO_DEVICE|USB_SETUP_TYPE_CLASS|USB_SETUP_RECIPIENT_INTERFACE
+
+class ACM : public USBSerialHost {
+public:
+        ACM(USBHost *pUsb) : USBSerialHost(pUsb), bControlIface(0), bControlFound(false) {
+        };
+
+        virtual uint32_t DEVCLASSOK(uint32_t klass) {
+                return (klass == USB_CLASS_COM_AND_CDC_CTRL);
+        };
+
+        virtual void EndpointXtract(uint32_t conf, uint32_t iface, uint32_t alt, uint32_t proto, const USB_ENDPOINT_DESCRIPTOR *ep);
+
+protected:
+        uint32_t bControlIface;         // interface the class requests go to
+        bool bControlFound;
+
+        virtual bool Match(const USB_DEVICE_DESCRIPTOR *udd);
+        virtual uint32_t SetLineCoding(uint32_t baud, uint16_t config);
+        virtual uint32_t SetControlLines(bool dtr, bool rts);
+};
+
+#endif /* CDCACM_H_INCLUDED */
@@ -0,0 +1,158 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "cdcftdi.h"
+
+static const uint16_t ftdiPIDs[] = {
+        0x6001,         // FT232R, FT245R
+        0x6010,         // FT2232C/D/H
+        0x6011,         // FT4232H
+        0x6014,         // FT232H
+        0x6015,         // FT-X
+};
+
+uint32_t FTDI::VIDPIDOK(uint32_t vid, uint32_t pid) {
+        if(vid != FTDI_VID)
+                return false;
+        for(uint32_t i = 0; i < sizeof(ftdiPIDs) / sizeof(ftdiPIDs[0]); i++) {
+                if(pid == ftdiPIDs[i])
+                        return true;
+        }
+        return false;
+}
+
+bool FTDI::Match(const USB_DEVICE_DESCRIPTOR *udd) {
+        if(!VIDPIDOK(udd->idVendor, udd->idProduct))
+                return false;
+
+        bcdDevice = udd->bcdDevice;
+
+        for(uint32_t i = 0; i < udd->bNumConfigurations; i++) {
+                ConfigDescParser<USB_CLASS_VENDOR_SPECIFIC, 0, 0, CP_MASK_COMPARE_CLASS> confDescrParser(this);
+
+                if(pUsb->getConfDescr(0, 0, i, &confDescrParser))
+                        return false;
+                if(bNumEP == USB_SERIAL_MAX_ENDPOINTS)
+                        break;
+        }
+        return bNumEP == USB_SERIAL_MAX_ENDPOINTS;
+}
+
+/* wIndex of the requests: port A is 1 */
+uint32_t FTDI::Port() {
+        return bIface + 1;
+}
+
+/* FT2232C/D and the H chips take the baud rate divisor high bits in the high byte of wIndex */
+bool FTDI::IndexHasPort() {
+        return bcdDevice == 0x0500 || bcdDevice == 0x0700 || bcdDevice == 0x0800 || bcdDevice == 0x0900;
+}
+
+uint32_t FTDI::Setup() {
+        uint32_t rcode;
+
+        rcode = pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_RESET, 0, 0, Port(), 0, 0, NULL, NULL);
+        if(rcode)
+                return rcode;
+
+        // No flow control
+        return pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_SET_FLOW_CTRL, 0, 0, Port(), 0, 0, NULL, NULL);
+}
+
+uint32_t FTDI::SetLineCoding(uint32_t baudrate, uint16_t conf) {
+        // Divisor in eighths, the fraction is coded on 3 bits
+        static const uint8_t fraction[8] = { 0, 3, 2, 4, 1, 5, 6, 7 };
+        uint32_t clock = 3000000, flags = 0;
+        uint32_t divisor, encoded;
+        uint16_t value, index;
+        uint32_t rcode;
+
+        if(!baudrate)
+                return USB_ERROR_INVALID_ARGUMENT;
+
+        // H chips: 12MHz clock for the high rates
+        if(bcdDevice >= 0x0700 && bcdDevice <= 0x0900 && baudrate >= 1200) {
+                clock = 12000000;
+                flags = 0x20000;
+        }
+
+        divisor = (clock * 8 + baudrate / 2) / baudrate;
+        if(divisor < 8)
+                divisor = 8;
+        if(divisor > 0x3FFF * 8)
+                divisor = 0x3FFF * 8;
+
+        encoded = (divisor >> 3) | ((uint32_t)fraction[divisor & 7] << 14);
+        // Special values for clock / 1 and clock / 1.5
+        if(divisor == 8)
+                encoded = 0;
+        else if(divisor == 12)
+                encoded = 1;
+        encoded |= flags;
+
+        value = encoded;
+        index = encoded >> 16;
+        if(IndexHasPort())
+                index = (index << 8) | Port();
+
+        rcode = pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_SET_BAUD_RATE, value, value >> 8, index, 0, 0, NULL, NULL);
+        if(rcode)
+                return rcode;
+
+        // Data bits, parity (bits 8-10), stop bits (bits 11-13)
+        switch(conf & SERIAL_DATA_MASK) {
+                case SERIAL_DATA_7: value = 7; break;
+                default:            value = 8; break;
+        }
+        switch(conf & SERIAL_PARITY_MASK) {
+                case SERIAL_PARITY_ODD:   value |= 1 << 8; break;
+                case SERIAL_PARITY_EVEN:  value |= 2 << 8; break;
+                case SERIAL_PARITY_MARK:  value |= 3 << 8; break;
+                case SERIAL_PARITY_SPACE: value |= 4 << 8; break;
+                default: break;
+        }
+        switch(conf & SERIAL_STOP_BIT_MASK) {
+                case SERIAL_STOP_BIT_1_5: value |= 1 << 11; break;
+                case SERIAL_STOP_BIT_2:   value |= 2 << 11; break;
+                default: break;
+        }
+
+        return pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_SET_DATA, value, value >> 8, Port(), 0, 0, NULL, NULL);
+}
+
+uint32_t FTDI::SetControlLines(bool dtrOn, bool rtsOn) {
+        // High byte: lines to change
+        uint16_t value = 0x0300 | (dtrOn ? 0x01 : 0) | (rtsOn ? 0x02 : 0);
+
+        return pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_MODEM_CTRL, value, value >> 8, Port(), 0, 0, NULL, NULL);
+}
+
+/* Each packet starts with the modem and line status */
+void FTDI::Received(const uint8_t *data, uint32_t length) {
+        uint32_t packet = epInfo[epDataInIndex].maxPktSize;
+
+        while(length >= 2) {
+                uint32_t n = (length < packet) ? length : packet;
+
+                modemStatus = data[0];
+                lineStatus = data[1];
+                Store(data + 2, n - 2);
+                data += n;
+                length -= n;
+        }
+}
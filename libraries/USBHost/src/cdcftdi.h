@@ -0,0 +1,69 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* FTDI serial adapters: FT232R, FT-X, FT2232 and FT232H families (first port of multi-port chips) */
+
+#ifndef CDCFTDI_H_INCLUDED
+#define CDCFTDI_H_INCLUDED
+
+#include "usbserial.h"
+
+#define FTDI_VID                        0x0403
+
+// Vendor requests
+#define FTDI_SIO_RESET                  0x00
+#define FTDI_SIO_MODEM_CTRL             0x01
+#define FTDI_SIO_SET_FLOW_CTRL          0x02
+#define FTDI_SIO_SET_BAUD_RATE          0x03
+#define FTDI_SIO_SET_DATA               0x04
+
+#define bmREQ_FTDI_OUT                  USB_SETUP_HOST_TO_DEVICE|USB_SETUP_TYPE_VENDOR|USB_SETUP_RECIPIENT_DEVICE
+
+class FTDI : public USBSerialHost {
+public:
+        FTDI(USBHost *pUsb) : USBSerialHost(pUsb), bcdDevice(0), modemStatus(0), lineStatus(0) {
+        };
+
+        virtual uint32_t VIDPIDOK(uint32_t vid, uint32_t pid);
+
+        // First two bytes of the last packet received: CTS, DSR, RI, DCD and
+        // overrun, parity, framing errors, break
+        uint8_t getModemStatus() {
+                return modemStatus;
+        };
+        uint8_t getLineStatus() {
+                return lineStatus;
+        };
+
+protected:
+        uint16_t bcdDevice;             // chip type
+        volatile uint8_t modemStatus;
+        volatile uint8_t lineStatus;
+
+        virtual bool Match(const USB_DEVICE_DESCRIPTOR *udd);
+        virtual uint32_t Setup();
+        virtual uint32_t SetLineCoding(uint32_t baud, uint16_t config);
+        virtual uint32_t SetControlLines(bool dtr, bool rts);
+        virtual void Received(const uint8_t *data, uint32_t length);
+
+private:
+        uint32_t Port();
+        bool IndexHasPort();
+};
+
+#endif /* CDCFTDI_H_INCLUDED */
@@ -18,7 +18,6 @@ e-mail   :  support@circuitsathome.com
 #define __HID_H__
 
 #include "Usb.h"
-#include "hidusagestr.h"
 
 #define MAX_REPORT_PARSERS			2
 #define HID_MAX_HID_CLASS_DESCRIPTORS		5
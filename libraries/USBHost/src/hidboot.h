@@ -194,11 +194,17 @@ class HIDBoot : public HID //public USBDeviceConfig, public UsbConfigXtracter
         uint32_t bNumIface; // number of interfaces in the configuration
         uint32_t bNumEP; // total number of EP in the configuration
 
-        uint32_t qNextPollTime;			// next poll time
         uint32_t bPollEnable;			// poll enable flag
-        uint32_t bInterval; // largest interval
+        uint8_t bInterval[epMUL(BOOT_PROTOCOL)]; // polling interval of each interrupt IN endpoint
+        uint8_t bInitState;                     // where Init() goes on after a wait, 0 for a new device
+        uint8_t bLeds;                          // keyboard LEDs still to twinkle
+
+        // Reports of the periodic polls, parsed by Poll()
+        __attribute__((__aligned__(4))) uint8_t report[epMUL(BOOT_PROTOCOL)][64];
+        volatile uint32_t reportLength[epMUL(BOOT_PROTOCOL)];
 
 	void Initialize();
+        static void ReportReceived(uint32_t rcode, uint32_t nbytes, void *arg);
 
 	virtual HIDReportParser* GetReportParser(uint32_t id) { 
                 return pRptParser[id];
@@ -228,8 +234,8 @@ public:
 template <const uint8_t BOOT_PROTOCOL>
 HIDBoot<BOOT_PROTOCOL>::HIDBoot(USBHost *p) :
 		HID(p),
-		qNextPollTime(0),
-		bPollEnable(false) {
+		bPollEnable(false),
+		bInitState(0) {
 	Initialize();
 
         for(int i = 0; i < epMUL(BOOT_PROTOCOL); i++) {
@@ -274,11 +280,17 @@ uint32_t HIDBoot<BOOT_PROTOCOL>::Init(uint32_t parent, uint32_t port, uint32_t l
 	//USBTRACE2("totalEndpoints:", (uint8_t) (totalEndpoints(BOOT_PROTOCOL)));
 	//USBTRACE2("epMUL:", epMUL(BOOT_PROTOCOL));
 
+        // Carry on after a wait: the host calls Init() again once it is over
+        switch(bInitState) {
+        case 1: goto SetConfiguration;
+        case 2: goto SetBootProtocol;
+        case 3: goto TwinkleLeds;
+        }
+
     // Check if address has already been assigned to an instance
 	if(bAddress)
 		return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
 
-    bInterval = 0;
 	// Get pointer to pseudo device with address 0 assigned
 	p = addrPool.GetUsbDevicePtr(0);
 
@@ -430,16 +442,20 @@ uint32_t HIDBoot<BOOT_PROTOCOL>::Init(uint32_t parent, uint32_t port, uint32_t l
         //USBTRACE2("setEpInfoEntry returned ", rcode);
         USBTRACE2("Cnf:", bConfNum);
 
-        delay(1000);
+        bInitState = 1;
+        return pUsb->initWait(1000);
 
+SetConfiguration:
 	// Set Configuration Value
 	rcode = pUsb->setConf(bAddress, 0, bConfNum);
 
 	if(rcode)
 		goto FailSetConfDescr;
 
-        delay(1000);
+        bInitState = 2;
+        return pUsb->initWait(1000);
 
+SetBootProtocol:
         USBTRACE2("bIfaceNum:", bIfaceNum);
         USBTRACE2("bNumIface:", bNumIface);
 
@@ -460,19 +476,29 @@ uint32_t HIDBoot<BOOT_PROTOCOL>::Init(uint32_t parent, uint32_t port, uint32_t l
 
         // Get RPIPE and throw it away.
 
-        if(BOOT_PROTOCOL & HID_PROTOCOL_KEYBOARD) {
-                // Wake keyboard interface by twinkling up to 5 LEDs that are in the spec.
-                // kana, compose, scroll, caps, num
-                rcode = 0x20; // Reuse rcode.
-                while(rcode) {
-                        rcode >>= 1;
-                        // Ignore any error returned, we don't care if LED is not supported
-                        SetReport(0, 0, 2, 0, 1, (uint8_t*)&rcode); // Eventually becomes zero (All off)
-                        delay(25);
-                }
+        // Wake keyboard interface by twinkling up to 5 LEDs that are in the spec.
+        // kana, compose, scroll, caps, num
+        bLeds = (BOOT_PROTOCOL & HID_PROTOCOL_KEYBOARD) ? 0x20 : 0;
+
+TwinkleLeds:
+        if(bLeds) {
+                bLeds >>= 1;
+                // Ignore any error returned, we don't care if LED is not supported
+                SetReport(0, 0, 2, 0, 1, &bLeds); // Eventually becomes zero (All off)
+                bInitState = 3;
+                return pUsb->initWait(25);
         }
+        bInitState = 0;
         USBTRACE("BM configured\r\n");
 
+        // Each interrupt IN endpoint is polled at its interval from the start of frame interrupt
+        for(uint32_t i = 0; i < epMUL(BOOT_PROTOCOL); i++) {
+                reportLength[i] = 0;
+                rcode = pUsb->schedulePoll(bAddress, epInfo[epInterruptInIndex + i].epAddr, bInterval[i],
+                        epInfo[epInterruptInIndex + i].maxPktSize, report[i], ReportReceived, (void *)&reportLength[i]);
+                if(rcode) goto Fail;
+        }
+
 	bPollEnable = true;
 	return 0;
 
@@ -531,7 +557,7 @@ void HIDBoot<BOOT_PROTOCOL>::EndpointXtract(uint32_t conf, uint32_t iface, uint3
 	bIfaceNum = iface;
 
 	if((pep->bmAttributes & 0x03) == 3 && (pep->bEndpointAddress & 0x80) == 0x80) {
-                if(pep->bInterval > bInterval) bInterval = pep->bInterval;
+                bInterval[bNumEP - epInterruptInIndex] = pep->bInterval;
 
 		// Fill in the endpoint info structure
 		epInfo[bNumEP].epAddr		= (pep->bEndpointAddress & 0x0F);
@@ -546,66 +572,65 @@ void HIDBoot<BOOT_PROTOCOL>::EndpointXtract(uint32_t conf, uint32_t iface, uint3
 
 template <const uint8_t BOOT_PROTOCOL>
 uint32_t HIDBoot<BOOT_PROTOCOL>::Release() {
+        for(uint32_t i = 0; i < epMUL(BOOT_PROTOCOL); i++)
+                pUsb->unschedulePoll(bAddress, epInfo[epInterruptInIndex + i].epAddr);
+
 	pUsb->GetAddressPool().FreeAddress(bAddress);
 
 	bConfNum			= 0;
 	bIfaceNum			= 0;
 	bNumEP				= 1;
 	bAddress			= 0;
-	qNextPollTime		= 0;
 	bPollEnable			= false;
+	bInitState			= 0;
 
 	return 0;
 }
 
+// Periodic poll completion, from the USB interrupt: the report waits for Poll()
+template <const uint8_t BOOT_PROTOCOL>
+void HIDBoot<BOOT_PROTOCOL>::ReportReceived(uint32_t rcode, uint32_t nbytes, void *arg) {
+        if(!rcode && nbytes)
+                *(volatile uint32_t *)arg = nbytes;
+}
+
 template <const uint8_t BOOT_PROTOCOL>
 uint32_t HIDBoot<BOOT_PROTOCOL>::Poll() {
-	uint32_t rcode = 0;
-
-        if(bPollEnable && ((long)(millis() - qNextPollTime) >= 0L)) {
-
-                // To-do: optimize manually, using the for loop only if needed.
-                for(int i = 0; i < epMUL(BOOT_PROTOCOL); i++) {
-                        const uint16_t const_buff_len = 16;
-                        uint8_t buf[const_buff_len];
-
-                        USBTRACE3("(hidboot.h) i=", i, 0x81);
-                        USBTRACE3("(hidboot.h) epInfo[epInterruptInIndex + i].epAddr=", epInfo[epInterruptInIndex + i].epAddr, 0x81);
-                        USBTRACE3("(hidboot.h) epInfo[epInterruptInIndex + i].maxPktSize=", epInfo[epInterruptInIndex + i].maxPktSize, 0x81);
-                        uint16_t read = (uint16_t)epInfo[epInterruptInIndex + i].maxPktSize;
-                        UHD_Pipe_Alloc(bAddress, epInfo[epInterruptInIndex + i].epAddr, USB_HOST_PTYPE_BULK, USB_EP_DIR_IN, epInfo[epInterruptInIndex + i].maxPktSize, 0, USB_HOST_NB_BK_1);
-                        rcode = pUsb->inTransfer(bAddress, epInfo[epInterruptInIndex + i].epAddr, (uint8_t*)&read, buf);
-                        // SOME buggy dongles report extra keys (like sleep) using a 2 byte packet on the wrong endpoint.
-                        // Since keyboard and mice must report at least 3 bytes, we ignore the extra data.
-                        if(!rcode && read > 2) {
-                                if(pRptParser[i])
-                                        pRptParser[i]->Parse((HID*)this, 0, (uint8_t)read, buf);
+        if(!bPollEnable)
+                return 0;
+
+        for(uint32_t i = 0; i < epMUL(BOOT_PROTOCOL); i++) {
+                uint32_t read = reportLength[i];
+
+                if(!read)
+                        continue;
+
+                // SOME buggy dongles report extra keys (like sleep) using a 2 byte packet on the wrong endpoint.
+                // Since keyboard and mice must report at least 3 bytes, we ignore the extra data.
+                if(read > 2) {
+                        if(pRptParser[i])
+                                pRptParser[i]->Parse((HID*)this, 0, (uint8_t)read, report[i]);
 #ifdef DEBUG_USB_HOST
-                                // We really don't care about errors and anomalies unless we are debugging.
-                        } else {
-                                if(rcode != USB_ERRORFLOW) {
-                                        USBTRACE3("(hidboot.h) Poll:", rcode, 0x81);
-                                }
-                                if(!rcode && read) {
-                                        USBTRACE3("(hidboot.h) Strange read count: ", read, 0x80);
-                                        USBTRACE3("(hidboot.h) Interface:", i, 0x80);
-                                }
-                        }
+                        // We really don't care about errors and anomalies unless we are debugging.
+                } else {
+                        USBTRACE3("(hidboot.h) Strange read count: ", read, 0x80);
+                        USBTRACE3("(hidboot.h) Interface:", i, 0x80);
+                }
 
-                        if(!rcode && read && (UsbDEBUGlvl > 0x7f)) {
-                                for(uint8_t i = 0; i < read; i++) {
-                                        PrintHex<uint8_t > (buf[i], 0x80);
-                                        USBTRACE1(" ", 0x80);
-                                }
-                                if(read)
-                                        USBTRACE1("\r\n", 0x80);
-#endif
+                if(UsbDEBUGlvl > 0x7f) {
+                        for(uint32_t j = 0; j < read; j++) {
+                                PrintHex<uint8_t > (report[i][j], 0x80);
+                                USBTRACE1(" ", 0x80);
                         }
-
+                        USBTRACE1("\r\n", 0x80);
+#endif
                 }
-                qNextPollTime = millis() + bInterval;
+
+                // The buffer is free for the next report
+                reportLength[i] = 0;
+                pUsb->resumePoll(bAddress, epInfo[epInterruptInIndex + i].epAddr);
         }
-        return rcode;
+        return 0;
 }
 
 #endif /* HIDBOOT_H_INCLUDED */
@@ -17,6 +17,7 @@ e-mail   :  support@circuitsathome.com
 
 #include "hidescriptorparser.h"
 
+#if !defined(USBHOST_HID_NO_USAGE_TITLES)
 const char * const ReportDescParserBase::usagePageTitles0[] PROGMEM = {
         pstrUsagePageGenericDesktopControls,
         pstrUsagePageSimulationControls,
@@ -989,6 +990,7 @@ const char * const ReportDescParserBase::medInstrTitles4[] PROGMEM = {
         pstrUsageSoftControlSelect,
         pstrUsageSoftControlAdjust
 };
+#endif
 
 void ReportDescParserBase::Parse(const uint32_t len, const uint8_t *pbuf, const uint32_t & /* offset */) {
         uint32_t cntdn = (uint32_t)len;
@@ -1259,6 +1261,8 @@ void ReportDescParserBase::SetUsagePage(uint16_t page) {
                 }
 }
 
+#if !defined(USBHOST_HID_NO_USAGE_TITLES)
+
 void ReportDescParserBase::PrintUsagePage(uint16_t page) {
         const char * const * w;
         E_Notify(pstrSpace, 0x80);
@@ -1437,6 +1441,80 @@ void ReportDescParserBase::PrintMedicalInstrumentPageUsage(uint16_t usage) {
         else E_Notify(pstrUsagePageUndefined, 0x80);
 }
 
+#else // USBHOST_HID_NO_USAGE_TITLES
+
+// Without the title tables, pages and usages are printed as numbers
+static void PrintUsageNumber(uint16_t usage) {
+        E_Notify(PSTR(" "), 0x80);
+        PrintHex<uint16_t > (usage, 0x80);
+}
+
+void ReportDescParserBase::PrintUsagePage(uint16_t page) {
+        PrintUsageNumber(page);
+}
+
+void ReportDescParserBase::PrintButtonPageUsage(uint16_t usage) {
+        E_Notify(PSTR(" Btn"), 0x80);
+        PrintHex<uint16_t > (usage, 0x80);
+        E_Notify(PSTR("\r\n"), 0x80);
+}
+
+void ReportDescParserBase::PrintOrdinalPageUsage(uint16_t usage) {
+        E_Notify(PSTR(" Inst"), 0x80);
+        PrintHex<uint16_t > (usage, 0x80);
+        E_Notify(PSTR("\r\n"), 0x80);
+}
+
+void ReportDescParserBase::PrintGenericDesktopPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintSimulationControlsPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintVRControlsPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintSportsControlsPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintGameControlsPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintGenericDeviceControlsPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintLEDPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintTelephonyPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintConsumerPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintDigitizerPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintAlphanumDisplayPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+void ReportDescParserBase::PrintMedicalInstrumentPageUsage(uint16_t usage) {
+        PrintUsageNumber(usage);
+}
+
+#endif // USBHOST_HID_NO_USAGE_TITLES
+
 uint8_t ReportDescParser2::ParseItem(uint8_t **pp, uint32_t *pcntdn) {
         //uint8_t	ret = enErrorSuccess;
 
@@ -19,6 +19,13 @@ e-mail   :  support@circuitsathome.com
 
 #include "hid.h"
 
+// Define USBHOST_HID_NO_USAGE_TITLES to leave the usage page and usage title
+// tables out of the build: the descriptor printing parsers then print pages
+// and usages as numbers. It saves about 12kB of flash in sketches using them.
+#if !defined(USBHOST_HID_NO_USAGE_TITLES)
+#include "hidusagestr.h"
+#endif
+
 class ReportDescParserBase : public USBReadParser {
 public:
         typedef void (*UsagePageFunc)(uint16_t usage);
@@ -43,6 +50,7 @@ public:
 
         static void PrintItemTitle(uint8_t prefix);
 
+#if !defined(USBHOST_HID_NO_USAGE_TITLES)
         static const char * const usagePageTitles0[];
         static const char * const usagePageTitles1[];
         static const char * const genDesktopTitles0[];
@@ -94,6 +102,7 @@ public:
         static const char * const medInstrTitles2[];
         static const char * const medInstrTitles3[];
         static const char * const medInstrTitles4[];
+#endif
 
 protected:
         static UsagePageFunc usagePageFunctions[];
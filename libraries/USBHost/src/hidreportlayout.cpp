@@ -0,0 +1,318 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "hidreportlayout.h"
+
+HIDReportLayout::HIDReportLayout() {
+        clear();
+}
+
+void HIDReportLayout::clear() {
+        numFields = 0;
+        numReports = 0;
+        stackDepth = 0;
+        memset(&global, 0, sizeof(global));
+        numUsages = 0;
+        hasRange = false;
+        reportIds = false;
+        overflow = false;
+        itemLeft = 0;
+        longItem = 0;
+        skip = 0;
+}
+
+bool HIDReportLayout::compile(const uint8_t *descr, uint32_t length) {
+        uint32_t offset = 0;
+
+        clear();
+        Parse(length, descr, offset);
+        return valid();
+}
+
+void HIDReportLayout::Parse(const uint32_t len, const uint8_t *pbuf, const uint32_t & /* offset */) {
+        for(uint32_t i = 0; i < len; i++)
+                Feed(pbuf[i]);
+}
+
+/* Items are assembled byte by byte: they may straddle the pieces given to Parse() */
+void HIDReportLayout::Feed(uint8_t b) {
+        if(skip) {
+                skip--;
+                return;
+        }
+        if(longItem) {
+                // Long item: data size, then tag and data, all skipped
+                longItem = 0;
+                skip = b + 1;
+                return;
+        }
+        if(itemLeft) {
+                itemData |= (uint32_t)b << (8 * itemPos++);
+                if(!--itemLeft)
+                        Item(itemPrefix, itemData, itemPos);
+                return;
+        }
+
+        if(b == 0xFE) {
+                longItem = 1;
+                return;
+        }
+
+        itemPrefix = b;
+        itemData = 0;
+        itemPos = 0;
+        itemLeft = ((b & DATA_SIZE_MASK) == DATA_SIZE_4) ? 4 : (b & DATA_SIZE_MASK);
+        if(!itemLeft)
+                Item(itemPrefix, 0, 0);
+}
+
+/* Usage with its page: a 4 byte usage carries its own page */
+uint32_t HIDReportLayout::Usage(uint32_t data, uint32_t size) {
+        return (size == 4) ? data : ((uint32_t)global.usagePage << 16) | (data & 0xFFFF);
+}
+
+void HIDReportLayout::Item(uint8_t prefix, uint32_t data, uint32_t size) {
+        // Sign extended value
+        int32_t value = (int32_t)data;
+        if(size == 1)
+                value = (int8_t)data;
+        else if(size == 2)
+                value = (int16_t)data;
+
+        switch(prefix & TYPE_MASK) {
+                case TYPE_MAIN:
+                        switch(prefix & TAG_MASK) {
+                                case TAG_MAIN_INPUT:
+                                        MainItem(HID_FIELD_INPUT, data);
+                                        break;
+                                case TAG_MAIN_OUTPUT:
+                                        MainItem(HID_FIELD_OUTPUT, data);
+                                        break;
+                                case TAG_MAIN_FEATURE:
+                                        MainItem(HID_FIELD_FEATURE, data);
+                                        break;
+                        }
+                        // Local items only last up to the main item
+                        numUsages = 0;
+                        hasRange = false;
+                        break;
+
+                case TYPE_GLOBAL:
+                        switch(prefix & TAG_MASK) {
+                                case TAG_GLOBAL_USAGEPAGE:
+                                        global.usagePage = data;
+                                        break;
+                                case TAG_GLOBAL_LOGICALMIN:
+                                        global.logicalMin = value;
+                                        break;
+                                case TAG_GLOBAL_LOGICALMAX:
+                                        global.logicalMax = value;
+                                        global.logicalMaxRaw = data;
+                                        break;
+                                case TAG_GLOBAL_REPORTSIZE:
+                                        global.reportSize = data;
+                                        break;
+                                case TAG_GLOBAL_REPORTID:
+                                        global.reportId = data;
+                                        reportIds = true;
+                                        break;
+                                case TAG_GLOBAL_REPORTCOUNT:
+                                        global.reportCount = data;
+                                        break;
+                                case TAG_GLOBAL_PUSH:
+                                        if(stackDepth < HID_LAYOUT_STACK_DEPTH)
+                                                stack[stackDepth] = global;
+                                        else
+                                                overflow = true;
+                                        stackDepth++;
+                                        break;
+                                case TAG_GLOBAL_POP:
+                                        if(stackDepth && --stackDepth < HID_LAYOUT_STACK_DEPTH)
+                                                global = stack[stackDepth];
+                                        break;
+                        }
+                        break;
+
+                case TYPE_LOCAL:
+                        switch(prefix & TAG_MASK) {
+                                case TAG_LOCAL_USAGE:
+                                        if(numUsages < HID_LAYOUT_MAX_USAGES)
+                                                usages[numUsages++] = Usage(data, size);
+                                        break;
+                                case TAG_LOCAL_USAGEMIN:
+                                        usageMin = Usage(data, size);
+                                        hasRange = true;
+                                        break;
+                                case TAG_LOCAL_USAGEMAX:
+                                        usageMax = Usage(data, size);
+                                        hasRange = true;
+                                        break;
+                        }
+                        break;
+        }
+}
+
+/* Bit count of a report so far, which is where the next field goes */
+uint16_t *HIDReportLayout::ReportBits(uint8_t id, uint8_t type) {
+        for(uint32_t i = 0; i < numReports; i++) {
+                if(reports[i].id == id && reports[i].type == type)
+                        return &reports[i].bits;
+        }
+        if(numReports == HID_LAYOUT_MAX_REPORTS)
+                return NULL;
+
+        reports[numReports].id = id;
+        reports[numReports].type = type;
+        reports[numReports].bits = id ? 8 : 0; // the ID byte
+        return &reports[numReports++].bits;
+}
+
+/* Usage of element i: the usages listed, then the range. The last one repeats. */
+uint32_t HIDReportLayout::ElementUsage(uint32_t i) {
+        if(i < numUsages)
+                return usages[i];
+        if(hasRange) {
+                uint32_t usage = usageMin + (i - numUsages);
+                return (usage > usageMax) ? usageMax : usage;
+        }
+        return numUsages ? usages[numUsages - 1] : 0;
+}
+
+void HIDReportLayout::MainItem(uint8_t type, uint8_t flags) {
+        uint16_t *bits = ReportBits(global.reportId, type);
+        uint32_t size = global.reportSize;
+        uint32_t count = global.reportCount;
+        uint32_t first = numFields;
+
+        if(!bits) {
+                overflow = true;
+                return;
+        }
+
+        // Constant items are padding
+        if(!(flags & 0x01) && size >= 1 && size <= 32) {
+                if(flags & HID_FIELD_VARIABLE) {
+                        for(uint32_t i = 0; i < count; i++)
+                                AddElement(type, flags, ElementUsage(i), *bits + i * size, first);
+                } else if(count) {
+                        // Array: one field, the values are usage indexes
+                        AddElement(type, flags, hasRange ? usageMin : ElementUsage(0), *bits, first);
+                        if(numFields > first)
+                                fields[numFields - 1].count = count;
+                }
+        }
+
+        *bits += size * count;
+}
+
+/* Add an element to the last field of the main item if it follows on, else start a field */
+void HIDReportLayout::AddElement(uint8_t type, uint8_t flags, uint32_t usage, uint32_t bitOffset, uint32_t first) {
+        uint16_t page = usage >> 16;
+        uint16_t id = usage & 0xFFFF;
+
+        if(numFields > first) {
+                HIDReportField &last = fields[numFields - 1];
+
+                if(last.usagePage == page && (uint32_t)last.bitOffset + last.count * last.bitSize == bitOffset) {
+                        if(!(last.flags & HID_FIELD_SAME_USAGE) && last.usage + last.count == id) {
+                                last.count++;
+                                return;
+                        }
+                        if(last.usage == id && (last.count == 1 || (last.flags & HID_FIELD_SAME_USAGE))) {
+                                last.flags |= HID_FIELD_SAME_USAGE;
+                                last.count++;
+                                return;
+                        }
+                }
+        }
+
+        if(numFields == HID_LAYOUT_MAX_FIELDS) {
+                overflow = true;
+                return;
+        }
+
+        HIDReportField &f = fields[numFields++];
+        f.reportId = global.reportId;
+        f.type = type;
+        f.flags = flags & (HID_FIELD_VARIABLE | HID_FIELD_RELATIVE | HID_FIELD_NULL_STATE);
+        f.bitSize = global.reportSize;
+        f.usagePage = page;
+        f.usage = id;
+        f.bitOffset = bitOffset;
+        f.count = 1;
+        f.logicalMin = global.logicalMin;
+        f.logicalMax = global.logicalMax;
+        // A maximum written without its sign bit, like 255 on one byte
+        if(global.logicalMin >= 0 && global.logicalMax < global.logicalMin)
+                f.logicalMax = global.logicalMaxRaw;
+}
+
+const HIDReportField *HIDReportLayout::find(uint16_t usagePage, uint16_t usage, uint8_t type, uint32_t *index) const {
+        for(uint32_t i = 0; i < numFields; i++) {
+                const HIDReportField &f = fields[i];
+
+                if(f.type != type || f.usagePage != usagePage)
+                        continue;
+
+                if(!(f.flags & HID_FIELD_VARIABLE)) {
+                        // Array: holds the usage if it is in its range
+                        if(usage >= f.usage && (uint32_t)(usage - f.usage) <= (uint32_t)(f.logicalMax - f.logicalMin)) {
+                                if(index)
+                                        *index = 0;
+                                return &f;
+                        }
+                } else if(f.flags & HID_FIELD_SAME_USAGE) {
+                        if(usage == f.usage) {
+                                if(index)
+                                        *index = 0;
+                                return &f;
+                        }
+                } else if(usage >= f.usage && (uint32_t)(usage - f.usage) < f.count) {
+                        if(index)
+                                *index = usage - f.usage;
+                        return &f;
+                }
+        }
+        return NULL;
+}
+
+uint32_t HIDReportLayout::reportLength(uint8_t reportId, uint8_t type) const {
+        for(uint32_t i = 0; i < numReports; i++) {
+                if(reports[i].id == reportId && reports[i].type == type)
+                        return (reports[i].bits + 7) / 8;
+        }
+        return 0;
+}
+
+bool HIDReportLayout::readValue(const HIDReportField *field, const uint8_t *report, uint32_t length, int32_t &value, uint32_t index) {
+        if(!field || index >= field->count)
+                return false;
+        if(field->reportId && (!length || report[0] != field->reportId))
+                return false;
+        if(field->bitOffset + (index + 1) * field->bitSize > length * 8)
+                return false;
+
+        value = getValue(field, report, index);
+        return true;
+}
+
+uint16_t HIDReportLayout::arrayUsage(const HIDReportField *field, int32_t value) {
+        if(value < field->logicalMin || value > field->logicalMax)
+                return 0;
+        return field->usage + (value - field->logicalMin);
+}
@@ -0,0 +1,186 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* HID report descriptor compiled into a table of fields, and field extraction from reports */
+
+#ifndef HIDREPORTLAYOUT_H_INCLUDED
+#define HIDREPORTLAYOUT_H_INCLUDED
+
+#include <stdint.h>
+#include "hid.h"
+
+// Report types
+#define HID_FIELD_INPUT                 0
+#define HID_FIELD_OUTPUT                1
+#define HID_FIELD_FEATURE               2
+
+// HIDReportField::flags: bits of the main item, plus
+#define HID_FIELD_VARIABLE              0x02    // one value per element, else an array of usage indexes
+#define HID_FIELD_RELATIVE              0x04
+#define HID_FIELD_NULL_STATE            0x40
+#define HID_FIELD_SAME_USAGE            0x80    // all elements have 'usage', else element i has usage + i
+
+#ifndef HID_LAYOUT_MAX_FIELDS
+#define HID_LAYOUT_MAX_FIELDS           32
+#endif
+#define HID_LAYOUT_MAX_REPORTS          8       // report ID and type pairs
+#define HID_LAYOUT_MAX_USAGES           16      // usages of a main item
+#define HID_LAYOUT_STACK_DEPTH          2       // PUSH/POP
+
+// A run of elements of a main item with consecutive usages
+struct HIDReportField {
+        uint8_t reportId;
+        uint8_t type;                   // HID_FIELD_INPUT, HID_FIELD_OUTPUT or HID_FIELD_FEATURE
+        uint8_t flags;
+        uint8_t bitSize;                // of one element, 1 to 32
+        uint16_t usagePage;
+        uint16_t usage;                 // of element 0. Arrays: usage of the logical minimum
+        uint16_t bitOffset;             // of element 0, from the start of the report with its ID byte
+        uint16_t count;                 // elements
+        int32_t logicalMin;
+        int32_t logicalMax;
+};
+
+/* The report descriptor is compiled once, typically right from the device:       */
+/*      hid.GetReportDescr(iface, &layout);                                         */
+/* then the fields of interest are looked up with find(), and their values taken  */
+/* out of each report with getValue(), without parsing.                            */
+class HIDReportLayout : public USBReadParser {
+public:
+        HIDReportLayout();
+
+        void clear();
+        bool compile(const uint8_t *descr, uint32_t length);
+
+        // USBReadParser implementation: the descriptor may come in pieces
+        virtual void Parse(const uint32_t len, const uint8_t *pbuf, const uint32_t &offset);
+
+        // False when the descriptor did not fit in the tables
+        bool valid() const {
+                return !overflow;
+        };
+
+        uint32_t fieldCount() const {
+                return numFields;
+        };
+
+        const HIDReportField *getField(uint32_t index) const {
+                return (index < numFields) ? &fields[index] : NULL;
+        };
+
+        // Field holding a usage, and the index of its element
+        const HIDReportField *find(uint16_t usagePage, uint16_t usage, uint8_t type = HID_FIELD_INPUT, uint32_t *index = NULL) const;
+
+        bool hasReportIds() const {
+                return reportIds;
+        };
+
+        // Report length in bytes, ID byte included
+        uint32_t reportLength(uint8_t reportId, uint8_t type = HID_FIELD_INPUT) const;
+
+        // 'bitSize' bits at 'bitOffset', little endian, up to 32
+        static inline uint32_t extractBits(const uint8_t *report, uint32_t bitOffset, uint32_t bitSize) {
+                const uint8_t *p = report + (bitOffset >> 3);
+                uint32_t shift = bitOffset & 7;
+                uint32_t last = (shift + bitSize - 1) >> 3; // last byte holding the field
+                uint32_t value = p[0];
+
+                if(last >= 1)
+                        value |= (uint32_t)p[1] << 8;
+                if(last >= 2)
+                        value |= (uint32_t)p[2] << 16;
+                if(last >= 3)
+                        value |= (uint32_t)p[3] << 24;
+                value >>= shift;
+                if(last >= 4)
+                        value |= (uint32_t)p[4] << (32 - shift);
+                if(bitSize < 32)
+                        value &= (1UL << bitSize) - 1;
+                return value;
+        };
+
+        // Value of element 'index', sign extended when the logical minimum is negative.
+        // No checks: the report must be the field's and long enough.
+        static inline int32_t getValue(const HIDReportField *field, const uint8_t *report, uint32_t index = 0) {
+                uint32_t size = field->bitSize;
+                uint32_t value = extractBits(report, field->bitOffset + index * size, size);
+
+                if(field->logicalMin < 0 && size < 32 && (value & (1UL << (size - 1))))
+                        value |= ~((1UL << size) - 1);
+                return (int32_t)value;
+        };
+
+        // Checked getValue(): false if the report has another ID or is too short
+        static bool readValue(const HIDReportField *field, const uint8_t *report, uint32_t length, int32_t &value, uint32_t index = 0);
+
+        // Usage an array element stands for, 0 for none
+        static uint16_t arrayUsage(const HIDReportField *field, int32_t value);
+
+private:
+        struct Globals {
+                uint16_t usagePage;
+                uint8_t reportId;
+                uint8_t reportSize;
+                uint16_t reportCount;
+                int32_t logicalMin;
+                int32_t logicalMax;
+                uint32_t logicalMaxRaw;         // in case the maximum is unsigned
+        };
+
+        HIDReportField fields[HID_LAYOUT_MAX_FIELDS];
+        uint32_t numFields;
+
+        struct {
+                uint8_t id;
+                uint8_t type;
+                uint16_t bits;
+        } reports[HID_LAYOUT_MAX_REPORTS];
+        uint32_t numReports;
+
+        Globals global;
+        Globals stack[HID_LAYOUT_STACK_DEPTH];
+        uint32_t stackDepth;
+
+        // Local items, up to the next main item
+        uint32_t usages[HID_LAYOUT_MAX_USAGES]; // page << 16 | usage
+        uint32_t numUsages;
+        uint32_t usageMin;
+        uint32_t usageMax;
+        bool hasRange;
+
+        bool reportIds;
+        bool overflow;
+
+        // Item being read
+        uint8_t itemPrefix;
+        uint8_t itemLeft;               // data bytes to come
+        uint8_t itemPos;
+        uint8_t longItem;               // 0, or 1 while reading the size of a long item
+        uint16_t skip;                  // long item bytes to skip
+        uint32_t itemData;
+
+        void Feed(uint8_t b);
+        void Item(uint8_t prefix, uint32_t data, uint32_t size);
+        void MainItem(uint8_t type, uint8_t flags);
+        uint16_t *ReportBits(uint8_t id, uint8_t type);
+        uint32_t ElementUsage(uint32_t i);
+        void AddElement(uint8_t type, uint8_t flags, uint32_t usage, uint32_t bitOffset, uint32_t first);
+        uint32_t Usage(uint32_t data, uint32_t size);
+};
+
+#endif /* HIDREPORTLAYOUT_H_INCLUDED */
@@ -0,0 +1,654 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* USB mass storage, Bulk-Only Transport */
+
+#include "masstorage.h"
+
+const uint32_t BulkOnly::epDataInIndex  = 1;
+const uint32_t BulkOnly::epDataOutIndex = 2;
+
+// Result of a command the caller waits for
+struct MassResult {
+        volatile bool done;
+        uint32_t status;
+};
+
+static void massCompleted(uint32_t status, void *arg) {
+        MassResult *result = (MassResult *)arg;
+
+        result->status = status;
+        result->done = true;
+}
+
+static uint32_t bigEndian32(const uint8_t *p) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+BulkOnly::BulkOnly(USBHost *p) :
+pUsb(p),
+bAddress(0),
+bConfNum(0),
+bIface(0),
+bNumEP(1),
+bMaxLUN(0),
+queueHead(0),
+queueCount(0),
+stage(STAGE_IDLE),
+recovery(RECOVER_RESET),
+statusRetried(false),
+recoverCode(0),
+commandTime(0),
+tag(0),
+errorCode(0) {
+        // initialize endpoint data structures
+        for(uint32_t i = 0; i < MASS_MAX_ENDPOINTS; i++) {
+                epInfo[i].epAddr        = 0;
+                epInfo[i].maxPktSize    = (i) ? 0 : 8;
+                epInfo[i].bmSndToggle   = 0;
+                epInfo[i].bmRcvToggle   = 0;
+                // A drive NAKs while it writes to flash: don't count, Poll() has a command timeout
+                epInfo[i].bmNakPower    = (i) ? USB_NAK_NONAK : USB_NAK_MAX_POWER;
+                // and retry once per frame meanwhile
+                epInfo[i].nakInterval   = 1;
+        }
+        for(uint32_t i = 0; i < MASS_MAX_LUNS; i++)
+                unit[i].ready = false;
+
+        // register in USB subsystem
+        if(pUsb) {
+                pUsb->RegisterDeviceClass(this); //set devConfig[] entry
+        }
+}
+
+uint32_t BulkOnly::Init(uint32_t parent, uint32_t port, uint32_t lowspeed) {
+        uint8_t buf[sizeof (USB_DEVICE_DESCRIPTOR)];
+        USB_DEVICE_DESCRIPTOR * udd = reinterpret_cast<USB_DEVICE_DESCRIPTOR*>(buf);
+        uint32_t rcode;
+        UsbDeviceDefinition *p = NULL;
+        EpInfo *oldep_ptr = NULL;
+
+        // get memory address of USB device address pool
+        AddressPool &addrPool = pUsb->GetAddressPool();
+
+        USBTRACE("\r\nBulkOnly Init");
+
+        // check if address has already been assigned to an instance
+        if(bAddress)
+                return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
+
+        // Get pointer to pseudo device with address 0 assigned
+        p = addrPool.GetUsbDevicePtr(0);
+
+        if(!p)
+                return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
+
+        if(!p->epinfo)
+                return USB_ERROR_EPINFO_IS_NULL;
+
+        // Save old pointer to EP_RECORD of address 0
+        oldep_ptr = p->epinfo;
+
+        // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
+        p->epinfo = epInfo;
+
+        p->lowspeed = lowspeed;
+
+        // Get device descriptor  GET_DESCRIPTOR
+        rcode = pUsb->getDevDescr(0, 0, sizeof(USB_DEVICE_DESCRIPTOR), (uint8_t*)buf);
+
+        // Look for a Bulk-Only interface while the device is still at address 0, so that
+        // the next driver finds it untouched if there is none
+        if(!rcode) {
+                epInfo[0].maxPktSize = udd->bMaxPacketSize0;
+
+                for(uint32_t i = 0; i < udd->bNumConfigurations; i++) {
+                        ConfigDescParser<USB_CLASS_MASS_STORAGE, MASS_SUBCLASS_SCSI, MASS_PROTO_BBB, CP_MASK_COMPARE_ALL> confDescrParser(this);
+
+                        rcode = pUsb->getConfDescr(0, 0, i, &confDescrParser);
+                        if(rcode || bNumEP == MASS_MAX_ENDPOINTS)
+                                break;
+                }
+        }
+
+        // Restore p->epinfo
+        p->epinfo = oldep_ptr;
+
+        if(rcode)
+                goto Fail;
+
+        // Pipes are numbered after the device endpoints: IN and OUT need different numbers
+        if(bNumEP != MASS_MAX_ENDPOINTS || epInfo[epDataInIndex].epAddr == epInfo[epDataOutIndex].epAddr) {
+                rcode = USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+                goto Fail;
+        }
+
+        // Allocate new address according to device class
+        bAddress = addrPool.AllocAddress(parent, false, port);
+        if(!bAddress) {
+                rcode = USB_ERROR_OUT_OF_ADDRESS_SPACE_IN_POOL;
+                goto Fail;
+        }
+
+        // Assign new address to the device  SET_ADDRESS
+        rcode = pUsb->setAddr(0, 0, bAddress);
+        if(rcode) {
+                p->lowspeed = false;
+                goto Fail;
+        }
+
+        p->lowspeed = false;
+
+        //get pointer to assigned address record
+        p = addrPool.GetUsbDevicePtr(bAddress);
+        if(!p) {
+                rcode = USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
+                goto Fail;
+        }
+
+        p->lowspeed = lowspeed;
+
+        // Assign epInfo to epinfo pointer - all 3 endpoints
+        rcode = pUsb->setEpInfoEntry(bAddress, MASS_MAX_ENDPOINTS, epInfo);
+        if(rcode)
+                goto Fail;
+
+        // Set Configuration Value
+        rcode = pUsb->setConf(bAddress, 0, bConfNum);
+        if(rcode)
+                goto Fail;
+
+        // Devices with a single LUN may stall GET MAX LUN
+        bMaxLUN = 0;
+        if(!pUsb->ctrlReq(bAddress, 0, bmREQ_MASSIN, MASS_REQ_GET_MAX_LUN, 0, 0, bIface, 1, 1, buf, NULL))
+                bMaxLUN = (buf[0] < MASS_MAX_LUNS) ? buf[0] : MASS_MAX_LUNS - 1;
+
+        // Poll() checks the units, the medium may take a while to spin up
+        for(uint32_t i = 0; i < MASS_MAX_LUNS; i++) {
+                unit[i].ready = false;
+                unit[i].nextCheck = millis();
+        }
+
+        USBTRACE2("\r\nBulkOnly configured, LUNs: ", bMaxLUN + 1);
+        return 0;
+
+Fail:
+        USBTRACE2("\r\nBulkOnly Init Failed, error code: ", rcode);
+        Release();
+        return rcode;
+}
+
+/* Extracts bulk-IN and bulk-OUT endpoint information from config descriptor */
+void BulkOnly::EndpointXtract(uint32_t conf, uint32_t iface, uint32_t /* alt */, uint32_t /* proto */, const USB_ENDPOINT_DESCRIPTOR *pep) {
+        if(bNumEP == MASS_MAX_ENDPOINTS)
+                return;
+
+        if((pep->bmAttributes & 0x03) == 2) {
+                uint32_t index = ((pep->bEndpointAddress & 0x80) == 0x80) ? epDataInIndex : epDataOutIndex;
+
+                if(epInfo[index].epAddr)
+                        return;
+
+                bConfNum = conf;
+                bIface = iface;
+
+                // Fill in the endpoint info structure
+                epInfo[index].epAddr = (pep->bEndpointAddress & 0x0F);
+                epInfo[index].maxPktSize = (uint8_t)pep->wMaxPacketSize;
+                epInfo[index].bmSndToggle = 0;
+                epInfo[index].bmRcvToggle = 0;
+
+                bNumEP++;
+        }
+}
+
+/* Performs a cleanup after failed Init() attempt, or once the device is gone */
+uint32_t BulkOnly::Release() {
+        if(bAddress) {
+                pUsb->cancelTransfer(bAddress, epInfo[epDataInIndex].epAddr);
+                pUsb->cancelTransfer(bAddress, epInfo[epDataOutIndex].epAddr);
+        }
+        Flush(MASS_ERR_NO_DEVICE);
+
+        pUsb->GetAddressPool().FreeAddress(bAddress);
+
+        for(uint32_t i = 1; i < MASS_MAX_ENDPOINTS; i++)
+                epInfo[i].epAddr = 0;
+        for(uint32_t i = 0; i < MASS_MAX_LUNS; i++)
+                unit[i].ready = false;
+
+        bNumEP = 1; //must have to be reset to 1
+        bMaxLUN = 0;
+        bAddress = 0;
+        return 0;
+}
+
+uint32_t BulkOnly::Poll() {
+        if(!bAddress)
+                return 0;
+
+        Service();
+
+        // Bring up the units, without holding the bus while commands are queued
+        for(uint32_t lun = 0; lun <= bMaxLUN && stage == STAGE_IDLE; lun++) {
+                if(!unit[lun].ready && (long)(millis() - unit[lun].nextCheck) >= 0L) {
+                        CheckUnit(lun);
+                        unit[lun].nextCheck = millis() + MASS_READY_INTERVAL;
+                }
+        }
+        return 0;
+}
+
+/* TEST UNIT READY, then READ CAPACITY */
+uint32_t BulkOnly::CheckUnit(uint32_t lun) {
+        uint8_t cdb[10] = { SCSI_CMD_TEST_UNIT_READY };
+        uint32_t rcode;
+
+        rcode = Transaction(cdb, 6, lun, false, NULL, 0);
+        if(rcode)
+                return rcode;
+
+        memset(cdb, 0, sizeof(cdb));
+        cdb[0] = SCSI_CMD_READ_CAPACITY_10;
+        rcode = Transaction(cdb, 10, lun, true, info, 8);
+        if(rcode)
+                return rcode;
+
+        // Last block address and block size
+        unit[lun].capacity = bigEndian32(info) + 1;
+        unit[lun].blockSize = bigEndian32(info + 4);
+        unit[lun].ready = (unit[lun].blockSize != 0);
+
+        USBTRACE2("\r\nLUN ready, blocks: ", unit[lun].capacity);
+        return 0;
+}
+
+bool BulkOnly::isReady(uint32_t lun) {
+        return bAddress && lun <= bMaxLUN && unit[lun].ready;
+}
+
+uint32_t BulkOnly::sectorCount(uint32_t lun) {
+        return isReady(lun) ? unit[lun].capacity : 0;
+}
+
+uint32_t BulkOnly::sectorSize(uint32_t lun) {
+        return isReady(lun) ? unit[lun].blockSize : 0;
+}
+
+uint32_t BulkOnly::pending() {
+        return queueCount;
+}
+
+bool BulkOnly::readSectors(uint32_t sector, uint8_t *data, uint32_t count, uint32_t lun) {
+        return TransferWait(SCSI_CMD_READ_10, sector, data, count, lun);
+}
+
+bool BulkOnly::writeSectors(uint32_t sector, const uint8_t *data, uint32_t count, uint32_t lun) {
+        return TransferWait(SCSI_CMD_WRITE_10, sector, (uint8_t *)data, count, lun);
+}
+
+bool BulkOnly::readSectorsAsync(uint32_t sector, uint8_t *data, uint32_t count, MassStorageCallback callback, void *arg, uint32_t lun) {
+        return Transfer(SCSI_CMD_READ_10, sector, data, count, callback, arg, lun);
+}
+
+bool BulkOnly::writeSectorsAsync(uint32_t sector, const uint8_t *data, uint32_t count, MassStorageCallback callback, void *arg, uint32_t lun) {
+        return Transfer(SCSI_CMD_WRITE_10, sector, (uint8_t *)data, count, callback, arg, lun);
+}
+
+/* Wait for the queued commands, then ask the drive to flush its cache */
+bool BulkOnly::sync(uint32_t lun) {
+        uint8_t cdb[10] = { SCSI_CMD_SYNCHRONIZE_CACHE_10 };
+
+        while(queueCount)
+                Service();
+
+        if(!isReady(lun))
+                return false;
+
+        // Many drives write through and don't support the command
+        Transaction(cdb, 10, lun, false, NULL, 0);
+        return true;
+}
+
+/* Queue a READ(10) or WRITE(10) */
+bool BulkOnly::Transfer(uint8_t opcode, uint32_t sector, uint8_t *data, uint32_t count, MassStorageCallback callback, void *arg, uint32_t lun) {
+        if(!isReady(lun)) {
+                errorCode = MASS_ERR_UNIT_NOT_READY;
+                return false;
+        }
+        if(!count || count > 0xFFFF) {
+                errorCode = USB_ERROR_INVALID_ARGUMENT;
+                return false;
+        }
+
+        uint8_t cdb[10] = {
+                opcode, 0,
+                (uint8_t)(sector >> 24), (uint8_t)(sector >> 16), (uint8_t)(sector >> 8), (uint8_t)sector,
+                0,
+                (uint8_t)(count >> 8), (uint8_t)count,
+                0
+        };
+        return Queue(cdb, 10, lun, opcode == SCSI_CMD_READ_10, data, count * unit[lun].blockSize, callback, arg);
+}
+
+bool BulkOnly::TransferWait(uint8_t opcode, uint32_t sector, uint8_t *data, uint32_t count, uint32_t lun) {
+        MassResult result = { false, 0 };
+
+        // Wait for room behind the queued commands
+        while(queueCount == MASS_QUEUE_SIZE)
+                Service();
+
+        if(!Transfer(opcode, sector, data, count, massCompleted, &result, lun))
+                return false;
+
+        while(!result.done)
+                Service();
+
+        if(result.status) {
+                errorCode = result.status;
+                // Let Poll() find out whether the medium is still there
+                if(result.status == MASS_ERR_CMD_FAILED)
+                        unit[lun].ready = false;
+                return false;
+        }
+        return true;
+}
+
+/* Queue a command and wait for it. A failed command is followed by REQUEST SENSE,
+   which clears the condition (unit attention after a medium change, ...) */
+uint32_t BulkOnly::Transaction(const uint8_t *cdb, uint32_t cdbLength, uint32_t lun, bool in, uint8_t *data, uint32_t length) {
+        MassResult result = { false, 0 };
+
+        while(queueCount == MASS_QUEUE_SIZE)
+                Service();
+
+        if(!Queue(cdb, cdbLength, lun, in, data, length, massCompleted, &result))
+                return errorCode;
+
+        while(!result.done)
+                Service();
+
+        if(result.status == MASS_ERR_CMD_FAILED) {
+                uint8_t sense[10] = { SCSI_CMD_REQUEST_SENSE, 0, 0, 0, 18, 0 };
+                MassResult senseResult = { false, 0 };
+
+                if(Queue(sense, 6, lun, true, info, 18, massCompleted, &senseResult)) {
+                        while(!senseResult.done)
+                                Service();
+                }
+        }
+        return result.status;
+}
+
+bool BulkOnly::Queue(const uint8_t *cdb, uint32_t cdbLength, uint32_t lun, bool in, uint8_t *data, uint32_t length, MassStorageCallback callback, void *arg) {
+        bool start;
+
+        noInterrupts();
+        if(!bAddress || queueCount == MASS_QUEUE_SIZE) {
+                interrupts();
+                errorCode = bAddress ? MASS_ERR_QUEUE_FULL : MASS_ERR_NO_DEVICE;
+                return false;
+        }
+
+        Command &c = queue[(queueHead + queueCount) % MASS_QUEUE_SIZE];
+        memcpy(c.cdb, cdb, cdbLength);
+        c.cdbLength = cdbLength;
+        c.lun = lun;
+        c.in = in;
+        c.data = data;
+        c.length = length;
+        c.callback = callback;
+        c.arg = arg;
+        queueCount++;
+
+        // Otherwise the command before starts it once done
+        start = (stage == STAGE_IDLE);
+        if(start)
+                stage = STAGE_COMMAND;
+        interrupts();
+
+        if(start)
+                StartCommand();
+        return true;
+}
+
+/* Command Block Wrapper of the command at the queue head */
+void BulkOnly::StartCommand() {
+        Command &c = queue[queueHead];
+        uint32_t rcode;
+
+        memset(cbw, 0, sizeof(cbw));
+        cbw[0] = (uint8_t)MASS_CBW_SIGNATURE;
+        cbw[1] = (uint8_t)(MASS_CBW_SIGNATURE >> 8);
+        cbw[2] = (uint8_t)(MASS_CBW_SIGNATURE >> 16);
+        cbw[3] = (uint8_t)(MASS_CBW_SIGNATURE >> 24);
+        tag++;
+        memcpy(cbw + 4, &tag, 4);
+        memcpy(cbw + 8, &c.length, 4);
+        cbw[12] = c.in ? 0x80 : 0x00;
+        cbw[13] = c.lun;
+        cbw[14] = c.cdbLength;
+        memcpy(cbw + 15, c.cdb, c.cdbLength);
+
+        stage = STAGE_COMMAND;
+        statusRetried = false;
+        commandTime = millis();
+
+        rcode = pUsb->outTransferAsync(bAddress, epInfo[epDataOutIndex].epAddr, MASS_CBW_SIZE, cbw, CommandSent, this);
+        if(rcode)
+                Fail(rcode);
+}
+
+/* Command Status Wrapper */
+void BulkOnly::ReadStatus() {
+        uint32_t rcode;
+
+        stage = STAGE_STATUS;
+        rcode = pUsb->inTransferAsync(bAddress, epInfo[epDataInIndex].epAddr, MASS_CSW_SIZE, csw, StatusDone, this);
+        if(rcode)
+                Fail(rcode);
+}
+
+void BulkOnly::CommandSent(uint32_t rcode, uint32_t /* nbytes */, void *arg) {
+        BulkOnly *self = (BulkOnly *)arg;
+        Command &c = self->queue[self->queueHead];
+
+        if(self->stage != STAGE_COMMAND)
+                return; // timed out
+        if(rcode) {
+                self->Fail(rcode);
+                return;
+        }
+        if(!c.length) {
+                self->ReadStatus();
+                return;
+        }
+
+        self->stage = STAGE_DATA;
+        if(c.in)
+                rcode = self->pUsb->inTransferAsync(self->bAddress, self->epInfo[epDataInIndex].epAddr, c.length, c.data, DataDone, self);
+        else
+                rcode = self->pUsb->outTransferAsync(self->bAddress, self->epInfo[epDataOutIndex].epAddr, c.length, c.data, DataDone, self);
+        if(rcode)
+                self->Fail(rcode);
+}
+
+void BulkOnly::DataDone(uint32_t rcode, uint32_t /* nbytes */, void *arg) {
+        BulkOnly *self = (BulkOnly *)arg;
+
+        if(self->stage != STAGE_DATA)
+                return; // timed out
+        if(rcode == USB_ERRORSTALL) {
+                // The device ends the data stage early: clear the halt, the CSW tells why
+                self->recovery = RECOVER_DATA_HALT;
+                self->stage = STAGE_RECOVER;
+                return;
+        }
+        if(rcode) {
+                self->Fail(rcode);
+                return;
+        }
+        self->ReadStatus();
+}
+
+void BulkOnly::StatusDone(uint32_t rcode, uint32_t nbytes, void *arg) {
+        BulkOnly *self = (BulkOnly *)arg;
+        uint32_t signature, tag;
+
+        if(self->stage != STAGE_STATUS)
+                return; // timed out
+        if(rcode == USB_ERRORSTALL && !self->statusRetried) {
+                self->statusRetried = true;
+                self->recovery = RECOVER_STATUS_HALT;
+                self->stage = STAGE_RECOVER;
+                return;
+        }
+        if(rcode) {
+                self->Fail(rcode);
+                return;
+        }
+
+        memcpy(&signature, self->csw, 4);
+        memcpy(&tag, self->csw + 4, 4);
+        if(nbytes != MASS_CSW_SIZE || signature != MASS_CSW_SIGNATURE || tag != self->tag) {
+                self->Fail(MASS_ERR_BAD_CSW);
+                return;
+        }
+
+        switch(self->csw[12]) {
+                case 0:
+                        self->CommandDone(MASS_ERR_SUCCESS);
+                        break;
+                case 1:
+                        self->CommandDone(MASS_ERR_CMD_FAILED);
+                        break;
+                default:
+                        self->Fail(MASS_ERR_PHASE_ERROR);
+                        break;
+        }
+}
+
+/* Pop the head command, report it and start the next one */
+void BulkOnly::CommandDone(uint32_t status) {
+        Command &c = queue[queueHead];
+        MassStorageCallback callback = c.callback;
+        void *arg = c.arg;
+        bool more;
+
+        noInterrupts();
+        queueHead = (queueHead + 1) % MASS_QUEUE_SIZE;
+        queueCount--;
+        more = (queueCount != 0);
+        stage = more ? STAGE_COMMAND : STAGE_IDLE;
+        interrupts();
+
+        if(status)
+                errorCode = status;
+
+        // The callback may queue the next command
+        if(callback)
+                callback(status, arg);
+        if(more)
+                StartCommand();
+}
+
+/* Transfer error: Poll() resets the device, then fails the command */
+void BulkOnly::Fail(uint32_t rcode) {
+        if(rcode == USB_ERROR_TRANSFER_ABORTED) {
+                // Device gone
+                Flush(MASS_ERR_NO_DEVICE);
+                return;
+        }
+        recoverCode = rcode;
+        recovery = RECOVER_RESET;
+        stage = STAGE_RECOVER;
+}
+
+/* Fail all queued commands */
+void BulkOnly::Flush(uint32_t status) {
+        while(queueCount) {
+                Command &c = queue[queueHead];
+
+                queueHead = (queueHead + 1) % MASS_QUEUE_SIZE;
+                queueCount--;
+                if(c.callback)
+                        c.callback(status, c.arg);
+        }
+        stage = STAGE_IDLE;
+}
+
+/* Recovery and timeouts, outside of the USB interrupt: they need control requests */
+void BulkOnly::Service() {
+        bool timeout = false;
+
+        if(!bAddress)
+                return;
+
+        noInterrupts();
+        if(stage != STAGE_IDLE && stage != STAGE_RECOVER &&
+                ((long)(millis() - commandTime) >= MASS_COMMAND_TIMEOUT || UHD_GetVBUSState() != UHD_STATE_CONNECTED)) {
+                // The transfer callbacks ignore what comes late
+                recoverCode = (UHD_GetVBUSState() == UHD_STATE_CONNECTED) ? MASS_ERR_TIMEOUT : MASS_ERR_NO_DEVICE;
+                recovery = RECOVER_RESET;
+                stage = STAGE_RECOVER;
+                timeout = true;
+        }
+        interrupts();
+
+        if(stage != STAGE_RECOVER)
+                return;
+
+        if(timeout) {
+                pUsb->cancelTransfer(bAddress, epInfo[epDataInIndex].epAddr);
+                pUsb->cancelTransfer(bAddress, epInfo[epDataOutIndex].epAddr);
+        }
+
+        switch(recovery) {
+                case RECOVER_DATA_HALT:
+                        ClearEpHalt(queue[queueHead].in ? epDataInIndex : epDataOutIndex);
+                        ReadStatus();
+                        break;
+                case RECOVER_STATUS_HALT:
+                        ClearEpHalt(epDataInIndex);
+                        ReadStatus();
+                        break;
+                default:
+                        ResetRecovery();
+                        CommandDone(recoverCode);
+                        break;
+        }
+}
+
+/* Bulk-Only Mass Storage Reset, then clear the halt of both bulk endpoints */
+void BulkOnly::ResetRecovery() {
+        pUsb->ctrlReq(bAddress, 0, bmREQ_MASSOUT, MASS_REQ_BOMSR, 0, 0, bIface, 0, 0, NULL, NULL);
+        ClearEpHalt(epDataInIndex);
+        ClearEpHalt(epDataOutIndex);
+}
+
+uint32_t BulkOnly::ClearEpHalt(uint32_t index) {
+        uint32_t ep = epInfo[index].epAddr | ((index == epDataInIndex) ? 0x80 : 0x00);
+        uint32_t rcode;
+
+        rcode = pUsb->ctrlReq(bAddress, 0, bmREQ_CLEAR_EP_FEATURE, USB_REQUEST_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, 0, ep, 0, 0, NULL, NULL);
+
+        // The endpoint starts over with DATA0
+        epInfo[index].bmSndToggle = 0;
+        epInfo[index].bmRcvToggle = 0;
+        return rcode;
+}
@@ -0,0 +1,200 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* USB mass storage, Bulk-Only Transport with SCSI transparent commands (flash drives, card readers) */
+
+#ifndef MASSTORAGE_H_INCLUDED
+#define MASSTORAGE_H_INCLUDED
+
+#include <stdint.h>
+#include "Usb.h"
+#include "Arduino.h"
+
+// Interface subclass and protocol
+#define MASS_SUBCLASS_SCSI              0x06
+#define MASS_PROTO_BBB                  0x50    // Bulk-Only Transport
+
+// Class requests
+#define MASS_REQ_GET_MAX_LUN            0xFE
+#define MASS_REQ_BOMSR                  0xFF    // Bulk-Only Mass Storage Reset
+
+#define bmREQ_MASSOUT                   USB_SETUP_HOST_TO_DEVICE|USB_SETUP_TYPE_CLASS|USB_SETUP_RECIPIENT_INTERFACE
+#define bmREQ_MASSIN                    USB_SETUP_DEVICE_TO_HOST|USB_SETUP_TYPE_CLASS|USB_SETUP_RECIPIENT_INTERFACE
+
+// SCSI commands
+#define SCSI_CMD_TEST_UNIT_READY        0x00
+#define SCSI_CMD_REQUEST_SENSE          0x03
+#define SCSI_CMD_READ_CAPACITY_10       0x25
+#define SCSI_CMD_READ_10                0x28
+#define SCSI_CMD_WRITE_10               0x2A
+#define SCSI_CMD_SYNCHRONIZE_CACHE_10   0x35
+
+#define MASS_CBW_SIGNATURE              0x43425355
+#define MASS_CSW_SIGNATURE              0x53425355
+#define MASS_CBW_SIZE                   31
+#define MASS_CSW_SIZE                   13
+
+// Command results, besides the USB error codes
+#define MASS_ERR_SUCCESS                0x00
+#define MASS_ERR_CMD_FAILED             0x01    // CSW status: command failed, see REQUEST SENSE
+#define MASS_ERR_PHASE_ERROR            0x02    // CSW status: phase error, the device was reset
+#define MASS_ERR_BAD_CSW                0x03    // invalid CSW, the device was reset
+#define MASS_ERR_UNIT_NOT_READY         0x04
+#define MASS_ERR_QUEUE_FULL             0x05
+#define MASS_ERR_TIMEOUT                0x06
+#define MASS_ERR_NO_DEVICE              0x07
+
+#define MASS_MAX_ENDPOINTS              3       // endpoint 0, bulk IN, bulk OUT
+#define MASS_MAX_LUNS                   4
+#ifndef MASS_QUEUE_SIZE
+#define MASS_QUEUE_SIZE                 4       // commands waiting for the bus, including the one running
+#endif
+#define MASS_COMMAND_TIMEOUT            10000   // milliseconds, a flash write may take long
+#define MASS_READY_INTERVAL             100     // milliseconds between TEST UNIT READY polls
+
+// Called when a queued command is done, with MASS_ERR_SUCCESS or an error: from the USB
+// interrupt, or from Poll() when the device had to be recovered
+typedef void (*MassStorageCallback)(uint32_t status, void *arg);
+
+class BulkOnly : public USBDeviceConfig, public UsbConfigXtracter {
+public:
+        BulkOnly(USBHost *pUsb);
+
+        // Block device interface: 'sector' counts in blocks of sectorSize() bytes.
+        // The calls wait for the command, queued behind the ones in progress.
+        uint32_t sectorCount(uint32_t lun = 0);
+        uint32_t sectorSize(uint32_t lun = 0);
+        bool readSectors(uint32_t sector, uint8_t *data, uint32_t count, uint32_t lun = 0);
+        bool writeSectors(uint32_t sector, const uint8_t *data, uint32_t count, uint32_t lun = 0);
+        bool sync(uint32_t lun = 0);
+
+        // Queued commands: return at once, false when the queue is full. The data
+        // must stay untouched until the callback; word aligned data moves by
+        // multi-packet transfers.
+        bool readSectorsAsync(uint32_t sector, uint8_t *data, uint32_t count, MassStorageCallback callback = NULL, void *arg = NULL, uint32_t lun = 0);
+        bool writeSectorsAsync(uint32_t sector, const uint8_t *data, uint32_t count, MassStorageCallback callback = NULL, void *arg = NULL, uint32_t lun = 0);
+        uint32_t pending();             // commands queued or running
+
+        bool isReady(uint32_t lun = 0); // medium present, capacity known
+        uint32_t getMaxLUN() {
+                return bMaxLUN;
+        };
+        uint32_t lastError() {
+                return errorCode;
+        };
+
+        // USBDeviceConfig implementation
+        virtual uint32_t Init(uint32_t parent, uint32_t port, uint32_t lowspeed);
+        virtual uint32_t Release();
+        virtual uint32_t Poll();
+
+        virtual uint32_t GetAddress() {
+                return bAddress;
+        };
+
+        virtual uint32_t DEVCLASSOK(uint32_t klass) {
+                return (klass == USB_CLASS_MASS_STORAGE);
+        };
+
+        // UsbConfigXtracter implementation
+        virtual void EndpointXtract(uint32_t conf, uint32_t iface, uint32_t alt, uint32_t proto, const USB_ENDPOINT_DESCRIPTOR *ep);
+
+protected:
+        static const uint32_t epDataInIndex;    // DataIn endpoint index
+        static const uint32_t epDataOutIndex;   // DataOUT endpoint index
+
+        USBHost         *pUsb;
+        uint32_t        bAddress;
+        uint32_t        bConfNum;
+        uint32_t        bIface;
+        uint32_t        bNumEP;
+        uint32_t        bMaxLUN;
+
+        EpInfo          epInfo[MASS_MAX_ENDPOINTS];
+
+private:
+        struct Command {
+                uint8_t cdb[10];
+                uint8_t cdbLength;
+                uint8_t lun;
+                bool in;
+                uint8_t *data;
+                uint32_t length;
+                MassStorageCallback callback;
+                void *arg;
+        };
+
+        // Commands run one after the other, driven by the transfer callbacks
+        Command queue[MASS_QUEUE_SIZE];
+        volatile uint32_t queueHead;
+        volatile uint32_t queueCount;
+
+        // Bulk-Only stage of the command at the queue head
+        enum {
+                STAGE_IDLE,
+                STAGE_COMMAND,
+                STAGE_DATA,
+                STAGE_STATUS,
+                STAGE_RECOVER           // an error Poll() has to recover from
+        };
+        enum {
+                RECOVER_DATA_HALT,      // clear the halt of the data endpoint, then read the CSW
+                RECOVER_STATUS_HALT,    // clear the halt of the IN endpoint, then read the CSW again
+                RECOVER_RESET           // reset recovery, the command fails with 'recoverCode'
+        };
+        volatile uint8_t stage;
+        uint8_t recovery;
+        bool statusRetried;
+        uint32_t recoverCode;
+        uint32_t commandTime;           // millis() when the head command started
+        uint32_t tag;
+        uint32_t errorCode;
+
+        __attribute__((__aligned__(4))) uint8_t cbw[MASS_CBW_SIZE + 1];
+        __attribute__((__aligned__(4))) uint8_t csw[64];        // a whole packet, in case the device sends more
+        __attribute__((__aligned__(4))) uint8_t info[64];       // READ CAPACITY and REQUEST SENSE data
+
+        struct {
+                bool ready;
+                uint32_t capacity;
+                uint32_t blockSize;
+                uint32_t nextCheck;
+        } unit[MASS_MAX_LUNS];
+
+        bool Queue(const uint8_t *cdb, uint32_t cdbLength, uint32_t lun, bool in, uint8_t *data, uint32_t length, MassStorageCallback callback, void *arg);
+        bool Transfer(uint8_t opcode, uint32_t sector, uint8_t *data, uint32_t count, MassStorageCallback callback, void *arg, uint32_t lun);
+        bool TransferWait(uint8_t opcode, uint32_t sector, uint8_t *data, uint32_t count, uint32_t lun);
+        uint32_t Transaction(const uint8_t *cdb, uint32_t cdbLength, uint32_t lun, bool in, uint8_t *data, uint32_t length);
+        uint32_t CheckUnit(uint32_t lun);
+        void Service();
+
+        void StartCommand();
+        void ReadStatus();
+        void CommandDone(uint32_t status);
+        void Fail(uint32_t rcode);
+        void Flush(uint32_t status);
+        void ResetRecovery();
+        uint32_t ClearEpHalt(uint32_t index);
+
+        // Transfer callbacks, from the USB interrupt
+        static void CommandSent(uint32_t rcode, uint32_t nbytes, void *arg);
+        static void DataDone(uint32_t rcode, uint32_t nbytes, void *arg);
+        static void StatusDone(uint32_t rcode, uint32_t nbytes, void *arg);
+};
+
+#endif /* MASSTORAGE_H_INCLUDED */
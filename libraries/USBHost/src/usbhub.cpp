@@ -25,7 +25,12 @@ bAddress(0),
 bNbrPorts(0),
 //bInitState(0),
 qNextPollTime(0),
-bPollEnable(false) {
+bResetPort(0),
+qResetCheckTime(0),
+qResetTimeout(0),
+bPollEnable(false),
+bInterval(0),
+statusLength(0) {
         epInfo[0].epAddr = 0;
         epInfo[0].maxPktSize = 8;
         epInfo[0].bmSndToggle = 0;
@@ -161,6 +166,11 @@ uint32_t USBHub::Init(uint32_t parent, uint32_t port, uint32_t lowspeed) {
         if(rcode)
                 goto FailGetConfDescr;
 
+        // Interval of the status change endpoint, after the configuration and interface descriptors
+        bInterval = 255;
+        if(cd_len >= 25 && cd_len <= sizeof(buf) && buf[19] == USB_DESCRIPTOR_ENDPOINT)
+                bInterval = buf[24];
+
         // The following code is of no practical use in real life applications.
         // It only intended for the usb protocol sniffer to properly parse hub-class requests.
         {
@@ -186,6 +196,14 @@ uint32_t USBHub::Init(uint32_t parent, uint32_t port, uint32_t lowspeed) {
                 SetPortFeature(HUB_FEATURE_PORT_POWER, j, 0); //HubPortPowerOn(j);
 
         pUsb->SetHubPreMask();
+
+        // Status changes come from the periodic poll of the interrupt endpoint
+        statusLength = 0;
+        rcode = pUsb->schedulePoll(bAddress, 1, bInterval, sizeof(statusChange), statusChange, StatusReceived, (void *)&statusLength);
+
+        if(rcode)
+                goto Fail;
+
         bPollEnable = true;
         //                bInitState = 0;
         //}
@@ -215,6 +233,7 @@ Fail:
 }
 
 uint32_t USBHub::Release() {
+        pUsb->unschedulePoll(bAddress, 1);
         pUsb->GetAddressPool().FreeAddress(bAddress);
 
         if(bAddress == 0x41)
@@ -223,6 +242,7 @@ uint32_t USBHub::Release() {
         bAddress = 0;
         bNbrPorts = 0;
         qNextPollTime = 0;
+        bResetPort = 0;
         bPollEnable = false;
         return 0;
 }
@@ -233,22 +253,33 @@ uint32_t USBHub::Poll() {
         if(!bPollEnable)
                 return 0;
 
-        if(((long)(millis() - qNextPollTime) >= 0L)) {
+        if(bResetPort && (long)(millis() - qResetCheckTime) >= 0L)
+                CheckPortReset();
+
+        if(statusLength) {
                 rcode = CheckHubStatus();
+
+                // The endpoint is polled again
+                statusLength = 0;
+                pUsb->resumePoll(bAddress, 1);
+        }
+
+        if(!rcode && ((long)(millis() - qNextPollTime) >= 0L)) {
+                rcode = CheckDisabledPorts();
                 qNextPollTime = millis() + 100;
         }
         return rcode;
 }
 
+// Periodic poll completion, from the USB interrupt: the bitmap waits for Poll()
+void USBHub::StatusReceived(uint32_t rcode, uint32_t nbytes, void *arg) {
+        if(!rcode && nbytes)
+                *(volatile uint32_t *)arg = nbytes;
+}
+
 uint32_t USBHub::CheckHubStatus() {
         uint32_t rcode;
-        uint8_t buf[8];
-        uint32_t read = 1;
-
-        rcode = pUsb->inTransfer(bAddress, 1, (uint8_t*)&read, buf);
-
-        if(rcode)
-                return rcode;
+        uint8_t *buf = statusChange;
 
         //if (buf[0] & 0x01) // Hub Status Change
         //{
@@ -280,6 +311,11 @@ uint32_t USBHub::CheckHubStatus() {
                                 return rcode;
                 }
         } // for
+        return 0;
+}
+
+uint32_t USBHub::CheckDisabledPorts() {
+        uint32_t rcode;
 
         for(uint32_t port = 1; port <= bNbrPorts; port++) {
                 HubEvent evt;
@@ -307,30 +343,40 @@ uint32_t USBHub::CheckHubStatus() {
         return 0;
 }
 
+// Reset asked for by the host while it configures the device of the port: the
+// host waits for the reset and its recovery, Poll() sees the reset to its end
 void USBHub::ResetHubPort(uint32_t port) {
-        HubEvent evt;
-        evt.bmEvent = 0;
-        uint8_t rcode;
-
         ClearPortFeature(HUB_FEATURE_C_PORT_ENABLE, port, 0);
         ClearPortFeature(HUB_FEATURE_C_PORT_CONNECTION, port, 0);
         SetPortFeature(HUB_FEATURE_PORT_RESET, port, 0);
 
+        bResetPort = port;
+        qResetCheckTime = millis() + 10;
+        qResetTimeout = millis() + 300;
+}
 
-        for(int i = 0; i < 3; i++) {
-                rcode = GetPortStatus(port, 4, evt.evtBuff);
-                if(rcode) break; // Some kind of error, bail.
-                if(evt.bmEvent == bmHUB_PORT_EVENT_RESET_COMPLETE || evt.bmEvent == bmHUB_PORT_EVENT_LS_RESET_COMPLETE) {
-                        break;
-                }
-                delay(100); // simulate polling.
+void USBHub::CheckPortReset() {
+        HubEvent evt;
+        evt.bmEvent = 0;
+        uint32_t rcode;
+
+        rcode = GetPortStatus(bResetPort, 4, evt.evtBuff);
+        if(!rcode && evt.bmEvent != bmHUB_PORT_EVENT_RESET_COMPLETE && evt.bmEvent != bmHUB_PORT_EVENT_LS_RESET_COMPLETE &&
+                (long)(millis() - qResetTimeout) < 0L) {
+                qResetCheckTime = millis() + 10; // simulate polling.
+                return;
         }
-        ClearPortFeature(HUB_FEATURE_C_PORT_RESET, port, 0);
-        ClearPortFeature(HUB_FEATURE_C_PORT_CONNECTION, port, 0);
-        delay(20);
+        // Done, some kind of error, or too long
+        ClearPortFeature(HUB_FEATURE_C_PORT_RESET, bResetPort, 0);
+        ClearPortFeature(HUB_FEATURE_C_PORT_CONNECTION, bResetPort, 0);
+        bResetPort = 0;
 }
 
 uint32_t USBHub::PortStatusChange(uint32_t port, HubEvent &evt) {
+        // Being reset for the host, see CheckPortReset()
+        if(port == bResetPort)
+                return 0;
+
         switch(evt.bmEvent) {
                         // Device connected event
                 case bmHUB_PORT_EVENT_CONNECT:
@@ -364,11 +410,14 @@ uint32_t USBHub::PortStatusChange(uint32_t port, HubEvent &evt) {
                         ClearPortFeature(HUB_FEATURE_C_PORT_RESET, port, 0);
                         ClearPortFeature(HUB_FEATURE_C_PORT_CONNECTION, port, 0);
 
-                        delay(20);
-
+                        // Configuring() waits for the reset recovery
                         a.devAddress = bAddress;
 
-                        pUsb->Configuring(a.bmAddress, port, (evt.bmStatus & bmHUB_PORT_STATUS_PORT_LOW_SPEED));
+                        if(pUsb->Configuring(a.bmAddress, port, (evt.bmStatus & bmHUB_PORT_STATUS_PORT_LOW_SPEED)) == USB_ERROR_ENUMERATION_BUSY) {
+                                // Another device is at address 0: reset the port again, and try once it is done
+                                SetPortFeature(HUB_FEATURE_PORT_RESET, port, 0);
+                                return HUB_ERROR_PORT_HAS_BEEN_RESET;
+                        }
                         bResetInitiated = false;
                         break;
 
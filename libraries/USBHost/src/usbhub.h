@@ -171,10 +171,21 @@ class USBHub : USBDeviceConfig {
         uint32_t bAddress; // address
         uint32_t bNbrPorts; // number of ports
         //        uint8_t bInitState; // initialization state variable
-        uint32_t qNextPollTime; // next poll time
+        uint32_t qNextPollTime; // next check of the disabled ports
+        uint32_t bResetPort; // port reset by ResetHubPort(), 0 for none
+        uint32_t qResetCheckTime; // next check of its status
+        uint32_t qResetTimeout; // the check gives up then
         uint32_t bPollEnable; // poll enable flag
+        uint32_t bInterval; // status change endpoint polling interval
+
+        // Status change bitmap from the periodic poll, handled by Poll()
+        __attribute__((__aligned__(4))) uint8_t statusChange[8];
+        volatile uint32_t statusLength;
 
         uint32_t CheckHubStatus();
+        uint32_t CheckDisabledPorts();
+        void CheckPortReset();
+        static void StatusReceived(uint32_t rcode, uint32_t nbytes, void *arg);
         uint32_t PortStatusChange(uint32_t port, HubEvent &evt);
 
 public:
@@ -0,0 +1,428 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Serial port on a USB device: reception and transmission run from the pipe interrupt */
+
+#include "usbserial.h"
+
+const uint32_t USBSerialHost::epDataInIndex  = 1;
+const uint32_t USBSerialHost::epDataOutIndex = 2;
+
+USBSerialHost::USBSerialHost(USBHost *p) :
+pUsb(p),
+bAddress(0),
+bConfNum(0),
+bIface(0),
+bNumEP(1),
+baud(115200),
+config(SERIAL_8N1),
+dtr(false),
+rts(false),
+rxRunning(false),
+rxError(0),
+txFill(0),
+txUsed(0),
+txBusy(false) {
+        // initialize endpoint data structures
+        for(uint32_t i = 0; i < USB_SERIAL_MAX_ENDPOINTS; i++) {
+                epInfo[i].epAddr        = 0;
+                epInfo[i].maxPktSize    = (i) ? 0 : 8;
+                epInfo[i].bmSndToggle   = 0;
+                epInfo[i].bmRcvToggle   = 0;
+                // The bulk IN transfer waits for data as long as it takes
+                epInfo[i].bmNakPower    = (i) ? USB_NAK_NONAK : USB_NAK_MAX_POWER;
+                // and is sent again at once, without the CPU: data is taken as soon as the device has it
+                epInfo[i].nakInterval   = 0;
+        }
+
+        // register in USB subsystem
+        if(pUsb) {
+                pUsb->RegisterDeviceClass(this); //set devConfig[] entry
+        }
+}
+
+uint32_t USBSerialHost::Init(uint32_t parent, uint32_t port, uint32_t lowspeed) {
+        uint8_t buf[sizeof (USB_DEVICE_DESCRIPTOR)];
+        USB_DEVICE_DESCRIPTOR * udd = reinterpret_cast<USB_DEVICE_DESCRIPTOR*>(buf);
+        uint32_t rcode;
+        UsbDeviceDefinition *p = NULL;
+        EpInfo *oldep_ptr = NULL;
+        bool match = false;
+
+        // get memory address of USB device address pool
+        AddressPool &addrPool = pUsb->GetAddressPool();
+
+        USBTRACE("\r\nUSBSerialHost Init");
+
+        // check if address has already been assigned to an instance
+        if(bAddress)
+                return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
+
+        // Get pointer to pseudo device with address 0 assigned
+        p = addrPool.GetUsbDevicePtr(0);
+
+        if(!p)
+                return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
+
+        if(!p->epinfo)
+                return USB_ERROR_EPINFO_IS_NULL;
+
+        // Save old pointer to EP_RECORD of address 0
+        oldep_ptr = p->epinfo;
+
+        // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
+        p->epinfo = epInfo;
+
+        p->lowspeed = lowspeed;
+
+        // Get device descriptor  GET_DESCRIPTOR
+        rcode = pUsb->getDevDescr(0, 0, sizeof(USB_DEVICE_DESCRIPTOR), (uint8_t*)buf);
+
+        // Look for the bulk endpoints while the device is still at address 0
+        if(!rcode) {
+                epInfo[0].maxPktSize = udd->bMaxPacketSize0;
+                match = Match(udd);
+        }
+
+        // Restore p->epinfo
+        p->epinfo = oldep_ptr;
+
+        if(rcode)
+                goto Fail;
+
+        if(!match || bNumEP != USB_SERIAL_MAX_ENDPOINTS) {
+                rcode = USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+                goto Fail;
+        }
+
+        // Allocate new address according to device class
+        bAddress = addrPool.AllocAddress(parent, false, port);
+        if(!bAddress) {
+                rcode = USB_ERROR_OUT_OF_ADDRESS_SPACE_IN_POOL;
+                goto Fail;
+        }
+
+        // Assign new address to the device  SET_ADDRESS
+        rcode = pUsb->setAddr(0, 0, bAddress);
+        if(rcode) {
+                p->lowspeed = false;
+                goto Fail;
+        }
+
+        p->lowspeed = false;
+
+        //get pointer to assigned address record
+        p = addrPool.GetUsbDevicePtr(bAddress);
+        if(!p) {
+                rcode = USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
+                goto Fail;
+        }
+
+        p->lowspeed = lowspeed;
+
+        // Assign epInfo to epinfo pointer - all 3 endpoints
+        rcode = pUsb->setEpInfoEntry(bAddress, USB_SERIAL_MAX_ENDPOINTS, epInfo);
+        if(rcode)
+                goto Fail;
+
+        // Set Configuration Value
+        rcode = pUsb->setConf(bAddress, 0, bConfNum);
+        if(rcode)
+                goto Fail;
+
+        rcode = Setup();
+        if(rcode)
+                goto Fail;
+
+        // Line settings asked for by begin() before the device was there
+        rcode = SetLineCoding(baud, config);
+        if(!rcode)
+                rcode = SetControlLines(dtr, rts);
+        if(rcode)
+                goto Fail;
+
+        txFill = 0;
+        txUsed = 0;
+        txBusy = false;
+        rxError = 0;
+        ResumeReceive();
+
+        USBTRACE("\r\nUSBSerialHost configured");
+        return 0;
+
+Fail:
+        USBTRACE2("\r\nUSBSerialHost Init Failed, error code: ", rcode);
+        Release();
+        return rcode;
+}
+
+/* Extracts bulk-IN and bulk-OUT endpoint information from config descriptor, of the first matching interface */
+void USBSerialHost::EndpointXtract(uint32_t conf, uint32_t iface, uint32_t /* alt */, uint32_t /* proto */, const USB_ENDPOINT_DESCRIPTOR *pep) {
+        if(bNumEP == USB_SERIAL_MAX_ENDPOINTS)
+                return;
+
+        if((pep->bmAttributes & 0x03) != 2)
+                return;
+
+        // Multi-port chips: stay on the interface of the first endpoint
+        if(bNumEP > 1 && (conf != bConfNum || iface != bIface))
+                return;
+
+        uint32_t index = ((pep->bEndpointAddress & 0x80) == 0x80) ? epDataInIndex : epDataOutIndex;
+
+        if(epInfo[index].epAddr)
+                return;
+
+        bConfNum = conf;
+        bIface = iface;
+
+        // Fill in the endpoint info structure
+        epInfo[index].epAddr = (pep->bEndpointAddress & 0x0F);
+        epInfo[index].maxPktSize = (uint8_t)pep->wMaxPacketSize;
+        epInfo[index].bmSndToggle = 0;
+        epInfo[index].bmRcvToggle = 0;
+
+        bNumEP++;
+}
+
+/* Performs a cleanup after failed Init() attempt, or once the device is gone */
+uint32_t USBSerialHost::Release() {
+        if(bAddress) {
+                pUsb->cancelTransfer(bAddress, epInfo[epDataInIndex].epAddr);
+                pUsb->cancelTransfer(bAddress, epInfo[epDataOutIndex].epAddr);
+        }
+
+        pUsb->GetAddressPool().FreeAddress(bAddress);
+
+        for(uint32_t i = 1; i < USB_SERIAL_MAX_ENDPOINTS; i++)
+                epInfo[i].epAddr = 0;
+
+        // Data received so far can still be read
+        rxRunning = false;
+        txBusy = false;
+        txUsed = 0;
+
+        bNumEP = 1; //must have to be reset to 1
+        bAddress = 0;
+        return 0;
+}
+
+/* Get reception going again after an error */
+uint32_t USBSerialHost::Poll() {
+        if(!bAddress || rxRunning || !rxError)
+                return 0;
+
+        if(rxError == USB_ERRORSTALL)
+                ClearEpHalt(epDataInIndex);
+        rxError = 0;
+        ResumeReceive();
+        return 0;
+}
+
+void USBSerialHost::begin(unsigned long baudrate) {
+        begin(baudrate, SERIAL_8N1);
+}
+
+void USBSerialHost::begin(unsigned long baudrate, uint16_t conf) {
+        baud = baudrate;
+        config = conf;
+        dtr = true;
+        rts = true;
+
+        if(bAddress) {
+                SetLineCoding(baud, config);
+                SetControlLines(dtr, rts);
+        }
+}
+
+void USBSerialHost::end() {
+        flush();
+
+        dtr = false;
+        rts = false;
+        if(bAddress)
+                SetControlLines(dtr, rts);
+}
+
+void USBSerialHost::setDTR(bool on) {
+        dtr = on;
+        if(bAddress)
+                SetControlLines(dtr, rts);
+}
+
+void USBSerialHost::setRTS(bool on) {
+        rts = on;
+        if(bAddress)
+                SetControlLines(dtr, rts);
+}
+
+int USBSerialHost::available(void) {
+        return rxBuffer.available();
+}
+
+int USBSerialHost::peek(void) {
+        return rxBuffer.peek();
+}
+
+int USBSerialHost::read(void) {
+        int c = rxBuffer.read_char();
+
+        // Reception stopped on a full buffer
+        if(!rxRunning)
+                ResumeReceive();
+        return c;
+}
+
+/* Bulk IN data: the device sends packets as they come, there is no framing */
+void USBSerialHost::Received(const uint8_t *data, uint32_t length) {
+        Store(data, length);
+}
+
+void USBSerialHost::Store(const uint8_t *data, uint32_t length) {
+        for(uint32_t i = 0; i < length; i++)
+                rxBuffer.store_char(data[i]);
+}
+
+/* Start a bulk IN transfer if the buffer can take all of it */
+void USBSerialHost::ResumeReceive() {
+        bool start = false;
+
+        noInterrupts();
+        if(bAddress && !rxRunning && !rxError && rxBuffer.availableForStore() >= USB_SERIAL_RX_TRANSFER) {
+                rxRunning = true;
+                start = true;
+        }
+        interrupts();
+
+        if(start)
+                StartReceive();
+}
+
+void USBSerialHost::StartReceive() {
+        uint32_t rcode = pUsb->inTransferAsync(bAddress, epInfo[epDataInIndex].epAddr, USB_SERIAL_RX_TRANSFER, rxTransfer, ReceiveDone, this);
+
+        if(rcode) {
+                rxError = rcode;
+                rxRunning = false;
+        }
+}
+
+/* The transfer is restarted from the interrupt: reception does not wait for Task() */
+void USBSerialHost::ReceiveDone(uint32_t rcode, uint32_t nbytes, void *arg) {
+        USBSerialHost *self = (USBSerialHost *)arg;
+
+        if(rcode) {
+                // Poll() clears a halt, a detach releases the device
+                self->rxError = rcode;
+                self->rxRunning = false;
+                return;
+        }
+
+        self->Received(self->rxTransfer, nbytes);
+
+        if(self->rxBuffer.availableForStore() >= USB_SERIAL_RX_TRANSFER)
+                self->StartReceive();
+        else
+                self->rxRunning = false; // read() resumes
+}
+
+int USBSerialHost::availableForWrite(void) {
+        return bAddress ? USB_SERIAL_TX_BUFFER_SIZE - txUsed : 0;
+}
+
+size_t USBSerialHost::write(uint8_t c) {
+        return write(&c, 1);
+}
+
+/* Data is copied to the buffer being filled, sent as soon as the other one is. */
+/* Waits up to the Stream timeout for room.                                      */
+size_t USBSerialHost::write(const uint8_t *buffer, size_t size) {
+        size_t written = 0;
+        uint32_t start = millis();
+
+        while(written < size && bAddress) {
+                uint32_t room, n;
+
+                noInterrupts();
+                room = USB_SERIAL_TX_BUFFER_SIZE - txUsed;
+                if(room) {
+                        n = (size - written < room) ? size - written : room;
+                        memcpy(txBuffer[txFill] + txUsed, buffer + written, n);
+                        txUsed += n;
+                        written += n;
+                        if(!txBusy)
+                                StartSend();
+                        start = millis();
+                }
+                interrupts();
+
+                if(!room && millis() - start >= _timeout) {
+                        setWriteError();
+                        break;
+                }
+        }
+        return written;
+}
+
+void USBSerialHost::flush(void) {
+        while(bAddress && (txBusy || txUsed))
+                ;
+}
+
+/* Send the buffer being filled, and fill the other one. Interrupts disabled. */
+void USBSerialHost::StartSend() {
+        uint32_t buffer = txFill;
+        uint32_t length = txUsed;
+        uint32_t rcode;
+
+        txFill = buffer ^ 1;
+        txUsed = 0;
+        txBusy = true;
+
+        rcode = pUsb->outTransferAsync(bAddress, epInfo[epDataOutIndex].epAddr, length, txBuffer[buffer], SendDone, this);
+        if(rcode)
+                txBusy = false;
+}
+
+void USBSerialHost::SendDone(uint32_t rcode, uint32_t /* nbytes */, void *arg) {
+        USBSerialHost *self = (USBSerialHost *)arg;
+
+        self->txBusy = false;
+        if(rcode == USB_ERROR_TRANSFER_ABORTED)
+                return;
+        if(self->txUsed)
+                self->StartSend();
+}
+
+uint32_t USBSerialHost::ClearEpHalt(uint32_t index) {
+        uint32_t ep = epInfo[index].epAddr | ((index == epDataInIndex) ? 0x80 : 0x00);
+        uint32_t rcode;
+
+        rcode = pUsb->ctrlReq(bAddress, 0, bmREQ_CLEAR_EP_FEATURE, USB_REQUEST_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, 0, ep, 0, 0, NULL, NULL);
+
+        // The endpoint starts over with DATA0. When IN and OUT share their
+        // number, the transfers of both go through the first entry.
+        EpInfo *pep = pUsb->getEpInfoEntry(bAddress, epInfo[index].epAddr);
+        if(pep) {
+                if(index == epDataInIndex)
+                        pep->bmRcvToggle = 0;
+                else
+                        pep->bmSndToggle = 0;
+        }
+        return rcode;
+}
@@ -0,0 +1,129 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Serial port on a USB device (modem, serial adapter): the part common to CDC-ACM and FTDI */
+
+#ifndef USBSERIAL_H_INCLUDED
+#define USBSERIAL_H_INCLUDED
+
+#include <stdint.h>
+#include "Usb.h"
+#include "Arduino.h"
+#include "SafeRingBuffer.h"
+
+#define USB_SERIAL_MAX_ENDPOINTS        3       // endpoint 0, bulk IN, bulk OUT
+
+#ifndef USB_SERIAL_RX_BUFFER_SIZE
+#define USB_SERIAL_RX_BUFFER_SIZE       1024
+#endif
+#ifndef USB_SERIAL_TX_BUFFER_SIZE
+#define USB_SERIAL_TX_BUFFER_SIZE       256     // two of them: one is sent while the other fills
+#endif
+#define USB_SERIAL_RX_TRANSFER          256     // bytes asked for by each bulk IN transfer
+
+class USBSerialHost : public USBDeviceConfig, public UsbConfigXtracter, public HardwareSerial {
+public:
+        USBSerialHost(USBHost *pUsb);
+
+        // HardwareSerial implementation. The line settings and the modem
+        // control lines are kept across detach and applied on the next attach.
+        virtual void begin(unsigned long baud);
+        virtual void begin(unsigned long baud, uint16_t config);
+        virtual void end();
+        virtual int available(void);
+        virtual int peek(void);
+        virtual int read(void);
+        virtual void flush(void);
+        virtual int availableForWrite(void);
+        virtual size_t write(uint8_t c);
+        virtual size_t write(const uint8_t *buffer, size_t size);
+        using Print::write; // pull in write(str) and write(buf, size) from Print
+        virtual operator bool() {
+                return bAddress != 0;
+        };
+
+        // Modem control lines
+        void setDTR(bool on);
+        void setRTS(bool on);
+
+        // USBDeviceConfig implementation
+        virtual uint32_t Init(uint32_t parent, uint32_t port, uint32_t lowspeed);
+        virtual uint32_t Release();
+        virtual uint32_t Poll();
+
+        virtual uint32_t GetAddress() {
+                return bAddress;
+        };
+
+        // UsbConfigXtracter implementation
+        virtual void EndpointXtract(uint32_t conf, uint32_t iface, uint32_t alt, uint32_t proto, const USB_ENDPOINT_DESCRIPTOR *ep);
+
+protected:
+        static const uint32_t epDataInIndex;    // DataIn endpoint index
+        static const uint32_t epDataOutIndex;   // DataOUT endpoint index
+
+        USBHost         *pUsb;
+        uint32_t        bAddress;
+        uint32_t        bConfNum;
+        uint32_t        bIface;                 // interface of the bulk endpoints
+        uint32_t        bNumEP;
+
+        EpInfo          epInfo[USB_SERIAL_MAX_ENDPOINTS];
+
+        uint32_t        baud;
+        uint16_t        config;                 // SERIAL_8N1, ...
+        bool            dtr;
+        bool            rts;
+
+        // Class specific part
+        // Called at address 0: parse the configurations for the bulk endpoints
+        virtual bool Match(const USB_DEVICE_DESCRIPTOR *udd) = 0;
+        // Called once configured, before the line settings
+        virtual uint32_t Setup() {
+                return 0;
+        };
+        virtual uint32_t SetLineCoding(uint32_t baud, uint16_t config) = 0;
+        virtual uint32_t SetControlLines(bool dtr, bool rts) = 0;
+        // Bulk IN data, from the USB interrupt
+        virtual void Received(const uint8_t *data, uint32_t length);
+
+        void Store(const uint8_t *data, uint32_t length);
+
+private:
+        SafeRingBufferN<USB_SERIAL_RX_BUFFER_SIZE> rxBuffer;
+        volatile bool rxRunning;
+        volatile uint32_t rxError;
+
+        volatile uint32_t txFill;               // buffer written to
+        volatile uint32_t txUsed;
+        volatile bool txBusy;
+
+        __attribute__((__aligned__(4))) uint8_t rxTransfer[USB_SERIAL_RX_TRANSFER];
+        __attribute__((__aligned__(4))) uint8_t txBuffer[2][USB_SERIAL_TX_BUFFER_SIZE];
+
+        void StartReceive();
+        void ResumeReceive();
+        void StartSend();
+        uint32_t ClearEpHalt(uint32_t index);
+
+        // Transfer callbacks, from the USB interrupt
+        static void ReceiveDone(uint32_t rcode, uint32_t nbytes, void *arg);
+        static void SendDone(uint32_t rcode, uint32_t nbytes, void *arg);
+};
+
+#endif /* USBSERIAL_H_INCLUDED */
@@ -0,0 +1,37 @@
+/*
+ This example shows up on the computer as a MIDI device. Every event
+ received from the host is sent back transposed by an octave, and a
+ potentiometer on A0 is sent as controller 1 (modulation wheel).
+
+ Circuit:
+ * Arduino/Genuino Zero, MKR family and Nano 33 IoT
+ * potentiometer on A0
+ */
+
+#include <USBMIDI.h>
+
+USBMIDI midi;
+
+int lastValue = -1;
+
+void setup() {
+}
+
+void loop() {
+  midiEventPacket_t event = midi.read();
+  if (event.header != 0) {
+    // note on / note off: transpose by an octave
+    if ((event.header & 0x0E) == 0x08 && event.byte2 < 116) {
+      event.byte2 += 12;
+    }
+    midi.sendEvent(event);
+  }
+
+  int value = analogRead(A0) >> 3;
+  if (value != lastValue) {
+    // queued, sent at the next USB frame at the latest
+    if (midi.controlChange(0, 1, value)) {
+      lastValue = value;
+    }
+  }
+}
@@ -0,0 +1,283 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "USBMIDI.h"
+
+#if defined(USBCON)
+
+extern USBDevice_SAMD21G18x usbd;
+extern USBDeviceClass USBDevice;
+
+#define FIFO_MASK          (USB_MIDI_FIFO_SIZE - 1)
+
+#define EMBEDDED_IN_JACK   1
+#define EXTERNAL_IN_JACK   2
+#define EMBEDDED_OUT_JACK  3
+#define EXTERNAL_OUT_JACK  4
+
+USBMIDI::USBMIDI() : PluggableUSBModule(1, 2, epType),
+	configured(false), sending(false), outPaused(false),
+	txHead(0), txTail(0), rxHead(0), rxTail(0)
+{
+	// Bulk OUT and IN on the same endpoint number, serviced by this object
+	epType[0] = USB_ENDPOINT_HANDLER(USB_ENDPOINT_PAIR(USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_OUT(0),
+	                                                   USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_IN(0)));
+	if (PluggableUSB().plug(this)) {
+		USBDevice.setHandler(pluggedEndpoint, this);
+	}
+}
+
+int USBMIDI::getInterface(uint8_t* interfaceCount)
+{
+	*interfaceCount += 2; // uses 2
+
+	uint8_t streamingInterface = pluggedInterface + 1;
+	MIDIDescriptor midiInterface = {
+		D_IAD(pluggedInterface, 2, 0x01, 0x01, 0),
+
+		// Audio control, no units
+		D_MIDI_INTERFACE(pluggedInterface, 0, 0x01),
+		{ 9, MIDI_CS_INTERFACE, MIDI_MS_HEADER, 0x0100, 9, 1, streamingInterface },
+
+		// MIDI streaming: one cable, USB OUT -> external OUT jack, external IN jack -> USB IN
+		D_MIDI_INTERFACE(streamingInterface, 2, MIDI_SUBCLASS_STREAMING),
+		{ 7, MIDI_CS_INTERFACE, MIDI_MS_HEADER, 0x0100,
+		  7 + 2 * sizeof(MIDIInJackDescriptor) + 2 * sizeof(MIDIOutJackDescriptor) +
+		  2 * (sizeof(MIDIEndpointDescriptor) + sizeof(MIDIDataEndpointDescriptor)) },
+		{ 6, MIDI_CS_INTERFACE, MIDI_IN_JACK, MIDI_JACK_EMBEDDED, EMBEDDED_IN_JACK, 0 },
+		{ 6, MIDI_CS_INTERFACE, MIDI_IN_JACK, MIDI_JACK_EXTERNAL, EXTERNAL_IN_JACK, 0 },
+		{ 9, MIDI_CS_INTERFACE, MIDI_OUT_JACK, MIDI_JACK_EMBEDDED, EMBEDDED_OUT_JACK, 1, EXTERNAL_IN_JACK, 1, 0 },
+		{ 9, MIDI_CS_INTERFACE, MIDI_OUT_JACK, MIDI_JACK_EXTERNAL, EXTERNAL_OUT_JACK, 1, EMBEDDED_IN_JACK, 1, 0 },
+
+		D_MIDI_ENDPOINT(USB_ENDPOINT_OUT(pluggedEndpoint), EPX_SIZE),
+		{ 5, MIDI_CS_ENDPOINT, MIDI_MS_GENERAL, 1, EMBEDDED_IN_JACK },
+		D_MIDI_ENDPOINT(USB_ENDPOINT_IN(pluggedEndpoint), EPX_SIZE),
+		{ 5, MIDI_CS_ENDPOINT, MIDI_MS_GENERAL, 1, EMBEDDED_OUT_JACK }
+	};
+	return USBDevice.sendControl(&midiInterface, sizeof(midiInterface));
+}
+
+int USBMIDI::getDescriptor(USBSetup& /* setup */)
+{
+	return 0;
+}
+
+bool USBMIDI::setup(USBSetup& /* setup */)
+{
+	// No class requests
+	return false;
+}
+
+void USBMIDI::init()
+{
+	uint8_t ep = pluggedEndpoint;
+	usbd.epBank0SetSize(ep, EPX_SIZE);
+	usbd.epBank0SetType(ep, 3); // BULK OUT
+	usbd.epBank1SetSize(ep, EPX_SIZE);
+	usbd.epBank1SetType(ep, 3); // BULK IN
+	usbd.epBank1SetAddress(ep, inPacket);
+
+	usbd.epBank0EnableTransferComplete(ep);
+	usbd.epBank1EnableTransferComplete(ep);
+
+	sending = false;
+	outPaused = false;
+	configured = true;
+	armOut();
+}
+
+// Called with the IN bank free, from the USB interrupt or with
+// interrupts disabled
+void USBMIDI::sendPacket()
+{
+	uint8_t ep = pluggedEndpoint;
+	uint32_t tail = txTail;
+	uint32_t count = txHead - tail;
+	if (count > USB_MIDI_EVENTS_PER_PACKET) {
+		count = USB_MIDI_EVENTS_PER_PACKET;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		inPacket[i] = txFifo[(tail + i) & FIFO_MASK];
+	}
+	txTail = tail + count;
+
+	sending = true;
+	usbd.epBank1SetMultiPacketSize(ep, 0);
+	usbd.epBank1SetByteCount(ep, count * 4);
+	usbd.epBank1AckTransferComplete(ep);
+	usbd.epBank1SetReady(ep);
+}
+
+void USBMIDI::armOut()
+{
+	uint8_t ep = pluggedEndpoint;
+	usbd.epBank0SetAddress(ep, outPacket);
+	usbd.epBank0AckTransferComplete(ep);
+	usbd.epReleaseOutBank0(ep, EPX_SIZE);
+}
+
+// Move the received packet into the FIFO and receive the next one.
+// Returns false, leaving the host NAKed, while the FIFO has no room.
+bool USBMIDI::storeOutPacket()
+{
+	uint32_t count = usbd.epBank0ByteCount(pluggedEndpoint) / 4;
+	uint32_t head = rxHead;
+	if (USB_MIDI_FIFO_SIZE - (head - rxTail) < count) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		// skip the padding some hosts add
+		if (outPacket[i] != 0) {
+			rxFifo[head++ & FIFO_MASK] = outPacket[i];
+		}
+	}
+	rxHead = head;
+	armOut();
+	return true;
+}
+
+void USBMIDI::handleEndpoint()
+{
+	uint8_t ep = pluggedEndpoint;
+
+	if (usbd.epBank0IsTransferComplete(ep))
+	{
+		usbd.epBank0AckTransferComplete(ep);
+		if (!storeOutPacket()) {
+			outPaused = true;
+		}
+	}
+
+	if (usbd.epBank1IsTransferComplete(ep))
+	{
+		usbd.epBank1AckTransferComplete(ep);
+		sending = false;
+		// Full packets go out right away, partial ones on the next SOF
+		if (txHead - txTail >= USB_MIDI_EVENTS_PER_PACKET) {
+			sendPacket();
+		}
+	}
+}
+
+void USBMIDI::startOfFrame()
+{
+	if (configured && !sending && txHead != txTail) {
+		sendPacket();
+	}
+}
+
+bool USBMIDI::sendEvent(const midiEventPacket_t &event)
+{
+	uint32_t head = txHead;
+	if (head - txTail >= USB_MIDI_FIFO_SIZE) {
+		return false;
+	}
+
+	uint32_t word;
+	memcpy(&word, &event, sizeof(word));
+	txFifo[head & FIFO_MASK] = word;
+	txHead = head + 1;
+
+	if (head + 1 - txTail >= USB_MIDI_EVENTS_PER_PACKET) {
+		synchronized {
+			if (configured && !sending && txHead - txTail >= USB_MIDI_EVENTS_PER_PACKET) {
+				sendPacket();
+			}
+		}
+	}
+	return true;
+}
+
+bool USBMIDI::noteOn(uint8_t channel, uint8_t pitch, uint8_t velocity)
+{
+	midiEventPacket_t event = { 0x09, uint8_t(0x90 | (channel & 0x0F)), pitch, velocity };
+	return sendEvent(event);
+}
+
+bool USBMIDI::noteOff(uint8_t channel, uint8_t pitch, uint8_t velocity)
+{
+	midiEventPacket_t event = { 0x08, uint8_t(0x80 | (channel & 0x0F)), pitch, velocity };
+	return sendEvent(event);
+}
+
+bool USBMIDI::controlChange(uint8_t channel, uint8_t control, uint8_t value)
+{
+	midiEventPacket_t event = { 0x0B, uint8_t(0xB0 | (channel & 0x0F)), control, value };
+	return sendEvent(event);
+}
+
+int USBMIDI::availableForWrite()
+{
+	return USB_MIDI_FIFO_SIZE - (txHead - txTail);
+}
+
+void USBMIDI::flush()
+{
+	synchronized {
+		if (configured && !sending && txHead != txTail) {
+			sendPacket();
+		}
+	}
+}
+
+midiEventPacket_t USBMIDI::read()
+{
+	midiEventPacket_t event = { 0, 0, 0, 0 };
+
+	uint32_t tail = rxTail;
+	if (rxHead != tail) {
+		uint32_t word = rxFifo[tail & FIFO_MASK];
+		memcpy(&event, &word, sizeof(event));
+		rxTail = tail + 1;
+	}
+
+	if (outPaused) {
+		synchronized {
+			if (outPaused && storeOutPacket()) {
+				outPaused = false;
+			}
+		}
+	}
+	return event;
+}
+
+uint32_t USBMIDI::recv(void *data, uint32_t len)
+{
+	uint8_t *buffer = (uint8_t *)data;
+	uint32_t count = 0;
+	while (count + 4 <= len && available()) {
+		midiEventPacket_t event = read();
+		memcpy(buffer + count, &event, 4);
+		count += 4;
+	}
+	return count;
+}
+
+uint32_t USBMIDI::available()
+{
+	return rxHead - rxTail;
+}
+
+int USBMIDI::peek()
+{
+	return -1;
+}
+
+#endif /* if defined(USBCON) */
@@ -0,0 +1,205 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _USB_MIDI_H_INCLUDED
+#define _USB_MIDI_H_INCLUDED
+
+#include <Arduino.h>
+#include "api/PluggableUSB.h"
+#include "USB/SAMD21_USBDevice.h"
+
+#if defined(USBCON)
+
+// Event packets queued in each direction, must be a power of 2
+#ifndef USB_MIDI_FIFO_SIZE
+#define USB_MIDI_FIFO_SIZE            64
+#endif
+
+// Event packets in a full bulk transfer
+#define USB_MIDI_EVENTS_PER_PACKET    (EPX_SIZE / 4)
+
+// MIDI Streaming class
+#define MIDI_SUBCLASS_STREAMING       0x03
+
+#define MIDI_CS_INTERFACE             0x24
+#define MIDI_CS_ENDPOINT              0x25
+
+#define MIDI_MS_HEADER                0x01
+#define MIDI_IN_JACK                  0x02
+#define MIDI_OUT_JACK                 0x03
+#define MIDI_MS_GENERAL               0x01
+
+#define MIDI_JACK_EMBEDDED            0x01
+#define MIDI_JACK_EXTERNAL            0x02
+
+// USB-MIDI event packet: cable number and code index in the header,
+// then the MIDI message
+typedef struct
+{
+  uint8_t header;
+  uint8_t byte1;
+  uint8_t byte2;
+  uint8_t byte3;
+} midiEventPacket_t;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  subtype;
+  uint16_t bcdADC;
+  uint16_t totalLength;
+  uint8_t  inCollection;
+  uint8_t  interfaceNr;
+} MIDIControlHeaderDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  subtype;
+  uint16_t bcdMSC;
+  uint16_t totalLength;
+} MIDIStreamingHeaderDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t subtype;
+  uint8_t jackType;
+  uint8_t jackID;
+  uint8_t jack;
+} MIDIInJackDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t subtype;
+  uint8_t jackType;
+  uint8_t jackID;
+  uint8_t nrInputPins;
+  uint8_t sourceID;
+  uint8_t sourcePin;
+  uint8_t jack;
+} MIDIOutJackDescriptor;
+
+// MIDI Streaming endpoints use the 9 byte audio endpoint descriptor
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;
+  uint8_t  dtype;
+  uint8_t  addr;
+  uint8_t  attr;
+  uint16_t packetSize;
+  uint8_t  interval;
+  uint8_t  refresh;
+  uint8_t  synchAddress;
+} MIDIEndpointDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t subtype;
+  uint8_t numEmbMIDIJack;
+  uint8_t assocJackID;
+} MIDIDataEndpointDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  IADDescriptor                 iad;
+  InterfaceDescriptor           control;
+  MIDIControlHeaderDescriptor   controlHeader;
+  InterfaceDescriptor           streaming;
+  MIDIStreamingHeaderDescriptor streamingHeader;
+  MIDIInJackDescriptor          embeddedIn;
+  MIDIInJackDescriptor          externalIn;
+  MIDIOutJackDescriptor         embeddedOut;
+  MIDIOutJackDescriptor         externalOut;
+  MIDIEndpointDescriptor        out;
+  MIDIDataEndpointDescriptor    outJack;
+  MIDIEndpointDescriptor        in;
+  MIDIDataEndpointDescriptor    inJack;
+} MIDIDescriptor;
+
+#define D_MIDI_INTERFACE(_n, _numEndpoints, _subClass) \
+  { 9, 4, _n, 0, _numEndpoints, 0x01, _subClass, 0, 0 }
+
+#define D_MIDI_ENDPOINT(_addr, _packetSize) \
+  { 9, 5, _addr, USB_ENDPOINT_TYPE_BULK, _packetSize, 0, 0, 0 }
+
+class USBMIDI : public PluggableUSBModule, public EPHandler
+{
+public:
+  USBMIDI();
+
+  // Queue an event for the host. Never blocks: returns false when the
+  // FIFO is full. Full 64 byte transfers leave as soon as 16 events are
+  // queued, the rest is sent on the next Start-Of-Frame (within 1 ms).
+  bool sendEvent(const midiEventPacket_t &event);
+  bool noteOn(uint8_t channel, uint8_t pitch, uint8_t velocity);
+  bool noteOff(uint8_t channel, uint8_t pitch, uint8_t velocity);
+  bool controlChange(uint8_t channel, uint8_t control, uint8_t value);
+  int availableForWrite();
+
+  // Send the queued events now instead of waiting for the next frame
+  void flush();
+
+  // Next event from the host, header is 0 when there is none
+  midiEventPacket_t read();
+
+  // EPHandler
+  virtual void init();
+  virtual void startOfFrame();
+  virtual void handleEndpoint();
+  virtual uint32_t recv(void *data, uint32_t len);
+  virtual uint32_t available();   // events from the host
+  virtual int peek();
+
+protected:
+  // Implementation of the PluggableUSBModule
+  int getInterface(uint8_t* interfaceCount);
+  int getDescriptor(USBSetup& setup);
+  bool setup(USBSetup& setup);
+
+private:
+  void sendPacket();
+  void armOut();
+  bool storeOutPacket();
+
+  unsigned int epType[1];
+
+  volatile bool configured;
+  volatile bool sending;    // IN bank owned by the USB peripheral
+  volatile bool outPaused;  // OUT data waits for room in the FIFO
+
+  // Event FIFOs, head and tail wrap around freely
+  volatile uint32_t txHead, txTail;
+  volatile uint32_t rxHead, rxTail;
+  volatile uint32_t txFifo[USB_MIDI_FIFO_SIZE];
+  volatile uint32_t rxFifo[USB_MIDI_FIFO_SIZE];
+
+  __attribute__((__aligned__(4))) uint32_t inPacket[USB_MIDI_EVENTS_PER_PACKET];
+  __attribute__((__aligned__(4))) uint32_t outPacket[USB_MIDI_EVENTS_PER_PACKET];
+};
+
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ This example exposes the upper 64 KB of the internal flash to the
+ host as a small USB drive. The first time it is plugged in the host
+ asks to format the drive; after that files copied to it survive
+ resets and sketch uploads that fit below the drive area.
+
+ Circuit:
+ * Arduino/Genuino Zero, MKR family and Nano 33 IoT
+ */
+
+#include <USBMassStorage.h>
+
+// Must not overlap the sketch, check the size reported by the upload
+FlashBlockDevice flash(0x30000, 0x10000);
+
+USBMassStorage MassStorage;
+
+void setup() {
+  MassStorage.begin(&flash);
+}
+
+void loop() {
+  // executes the SCSI commands sent by the host
+  MassStorage.task();
+}
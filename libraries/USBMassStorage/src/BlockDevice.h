@@ -0,0 +1,47 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _BLOCK_DEVICE_H_INCLUDED
+#define _BLOCK_DEVICE_H_INCLUDED
+
+#include <stdint.h>
+
+#define BLOCK_DEVICE_SECTOR_SIZE 512
+
+// Storage exposed through USBMassStorage, addressed in 512 byte sectors.
+// Implement this on top of internal flash, an SPI flash or an SD card.
+class BlockDevice
+{
+public:
+  virtual ~BlockDevice() { }
+
+  // Number of sectors, 0 when no medium is present
+  virtual uint32_t sectorCount() = 0;
+
+  // Read / write count consecutive sectors starting at sector.
+  // Return false on failure.
+  virtual bool readSectors(uint32_t sector, uint8_t *data, uint32_t count) = 0;
+  virtual bool writeSectors(uint32_t sector, const uint8_t *data, uint32_t count) = 0;
+
+  // Commit any cached write to the medium
+  virtual bool sync() { return true; }
+
+  virtual bool isWritable() { return true; }
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "FlashBlockDevice.h"
+
+#define PAGE_SIZE  (64)
+#define ROW_SIZE   (PAGE_SIZE * 4)
+
+FlashBlockDevice::FlashBlockDevice(uint32_t startAddress, uint32_t size) :
+	start(startAddress & ~(ROW_SIZE - 1)),
+	sectors(size / BLOCK_DEVICE_SECTOR_SIZE)
+{
+}
+
+uint32_t FlashBlockDevice::sectorCount()
+{
+	return sectors;
+}
+
+bool FlashBlockDevice::readSectors(uint32_t sector, uint8_t *data, uint32_t count)
+{
+	if (sector + count > sectors) {
+		return false;
+	}
+	memcpy(data, (const void *)(start + sector * BLOCK_DEVICE_SECTOR_SIZE), count * BLOCK_DEVICE_SECTOR_SIZE);
+	return true;
+}
+
+bool FlashBlockDevice::writeSectors(uint32_t sector, const uint8_t *data, uint32_t count)
+{
+	if (sector + count > sectors) {
+		return false;
+	}
+
+	uint32_t address = start + sector * BLOCK_DEVICE_SECTOR_SIZE;
+	uint32_t length = count * BLOCK_DEVICE_SECTOR_SIZE;
+
+	// automatic page write: a page is programmed once its last word is written
+	NVMCTRL->CTRLB.bit.MANW = 0;
+
+	for (uint32_t row = 0; row < length; row += ROW_SIZE) {
+		while (!NVMCTRL->INTFLAG.bit.READY);
+		NVMCTRL->STATUS.reg |= NVMCTRL_STATUS_MASK;
+		NVMCTRL->ADDR.reg = (address + row) / 2;
+		NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_ER;
+		while (!NVMCTRL->INTFLAG.bit.READY);
+
+		// clear the page buffer, then fill it one word at a time
+		NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_PBC;
+		while (!NVMCTRL->INTFLAG.bit.READY);
+
+		volatile uint32_t *d = (volatile uint32_t *)(address + row);
+		for (uint32_t i = 0; i < ROW_SIZE; i += 4) {
+			const uint8_t *s = &data[row + i];
+			*d++ = s[0] | (s[1] << 8) | (s[2] << 16) | ((uint32_t)s[3] << 24);
+			while (!NVMCTRL->INTFLAG.bit.READY);
+		}
+	}
+
+	return (NVMCTRL->STATUS.reg & (NVMCTRL_STATUS_LOCKE | NVMCTRL_STATUS_PROGE)) == 0;
+}
@@ -0,0 +1,41 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _FLASH_BLOCK_DEVICE_H_INCLUDED
+#define _FLASH_BLOCK_DEVICE_H_INCLUDED
+
+#include <Arduino.h>
+#include "BlockDevice.h"
+
+// Block device on a region of the internal flash. The region must start
+// on a row boundary (256 bytes) and must not overlap the sketch.
+class FlashBlockDevice : public BlockDevice
+{
+public:
+  FlashBlockDevice(uint32_t startAddress, uint32_t size);
+
+  virtual uint32_t sectorCount();
+  virtual bool readSectors(uint32_t sector, uint8_t *data, uint32_t count);
+  virtual bool writeSectors(uint32_t sector, const uint8_t *data, uint32_t count);
+
+private:
+  const uint32_t start;
+  const uint32_t sectors;
+};
+
+#endif
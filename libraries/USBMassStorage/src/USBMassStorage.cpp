@@ -0,0 +1,567 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "USBMassStorage.h"
+
+#if defined(USBCON)
+
+extern USBDevice_SAMD21G18x usbd;
+extern USBDeviceClass USBDevice;
+
+#define MSC_CBW_DIRECTION_IN 0x80
+
+static uint32_t getBE32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void putBE32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+USBMassStorage::USBMassStorage() : PluggableUSBModule(1, 1, epType),
+	device(NULL), state(STATE_CBW), resetRequested(false),
+	senseKey(SCSI_SENSE_NONE), senseASC(0), usbBusy(false)
+{
+	bufferState[0] = BUFFER_FREE;
+	bufferState[1] = BUFFER_FREE;
+
+	// Bulk OUT and IN on the same endpoint number, serviced by this object
+	epType[0] = USB_ENDPOINT_HANDLER(USB_ENDPOINT_PAIR(USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_OUT(0),
+	                                                   USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_IN(0)));
+	if (PluggableUSB().plug(this)) {
+		USBDevice.setHandler(pluggedEndpoint, this);
+	}
+}
+
+void USBMassStorage::begin(BlockDevice *blockDevice)
+{
+	device = blockDevice;
+}
+
+void USBMassStorage::end()
+{
+	if (device) {
+		device->sync();
+	}
+	device = NULL;
+}
+
+int USBMassStorage::getInterface(uint8_t* interfaceCount)
+{
+	*interfaceCount += 1; // uses 1
+	MSCDescriptor mscInterface = {
+		D_INTERFACE(pluggedInterface, 2, USB_DEVICE_CLASS_STORAGE, MSC_SUBCLASS_SCSI, MSC_PROTOCOL_BULK_ONLY),
+		D_ENDPOINT(USB_ENDPOINT_IN(pluggedEndpoint), USB_ENDPOINT_TYPE_BULK, EPX_SIZE, 0),
+		D_ENDPOINT(USB_ENDPOINT_OUT(pluggedEndpoint), USB_ENDPOINT_TYPE_BULK, EPX_SIZE, 0)
+	};
+	return USBDevice.sendControl(&mscInterface, sizeof(mscInterface));
+}
+
+int USBMassStorage::getDescriptor(USBSetup& /* setup */)
+{
+	return 0;
+}
+
+bool USBMassStorage::setup(USBSetup& setup)
+{
+	if (pluggedInterface != setup.wIndex) {
+		return false;
+	}
+
+	if (setup.bmRequestType == REQUEST_DEVICETOHOST_CLASS_INTERFACE && setup.bRequest == MSC_GET_MAX_LUN) {
+		uint8_t maxLun = 0;
+		USBDevice.sendControl(&maxLun, 1);
+		return true;
+	}
+
+	if (setup.bmRequestType == REQUEST_HOSTTODEVICE_CLASS_INTERFACE && setup.bRequest == MSC_RESET) {
+		// Bulk-Only Mass Storage Reset, completed by task()
+		resetRequested = true;
+		USBDevice.sendZlp(0);
+		return true;
+	}
+
+	return false;
+}
+
+// USB side
+// --------
+
+void USBMassStorage::armIn(const void *data, uint32_t len)
+{
+	usbd.epBank1SetAddress(pluggedEndpoint, const_cast<void *>(data));
+	usbd.epBank1SetMultiPacketSize(pluggedEndpoint, 0);
+	usbd.epBank1SetByteCount(pluggedEndpoint, len);
+	usbd.epBank1AckTransferComplete(pluggedEndpoint);
+	usbd.epBank1SetReady(pluggedEndpoint);
+}
+
+void USBMassStorage::armOut(void *data, uint32_t len)
+{
+	usbd.epBank0SetAddress(pluggedEndpoint, data);
+	usbd.epBank0SetMultiPacketSize(pluggedEndpoint, len);
+	usbd.epBank0SetByteCount(pluggedEndpoint, 0);
+	usbd.epBank0AckTransferComplete(pluggedEndpoint);
+	usbd.epBank0ResetReady(pluggedEndpoint);
+}
+
+void USBMassStorage::armCBW()
+{
+	state = STATE_CBW;
+	armOut(cbwBuffer, sizeof(cbwBuffer));
+}
+
+void USBMassStorage::sendCSW(uint8_t status)
+{
+	csw.signature = MSC_CSW_SIGNATURE;
+	csw.tag = cbw.tag;
+	csw.residue = residue;
+	csw.status = status;
+	memcpy(cswBuffer, &csw, MSC_CSW_LENGTH);
+
+	state = STATE_CSW;
+	usbd.epBank1DisableAutoZLP(pluggedEndpoint);
+	armIn(cswBuffer, MSC_CSW_LENGTH);
+}
+
+// Fail the command: the data phase the host expects is ended with a stall,
+// the CSW is armed behind it and goes out once the host clears the halt
+void USBMassStorage::fail(uint8_t key, uint8_t asc)
+{
+	senseKey = key;
+	senseASC = asc;
+
+	if (residue) {
+		if (cbw.flags & MSC_CBW_DIRECTION_IN) {
+			usbd.epBank1SetStallReq(pluggedEndpoint);
+		} else {
+			usbd.epBank0SetStallReq(pluggedEndpoint);
+		}
+	}
+	sendCSW(MSC_CSW_STATUS_FAILED);
+}
+
+void USBMassStorage::init()
+{
+	usbd.epBank0SetSize(pluggedEndpoint, EPX_SIZE);
+	usbd.epBank0SetType(pluggedEndpoint, 3); // BULK OUT
+	usbd.epBank1SetSize(pluggedEndpoint, EPX_SIZE);
+	usbd.epBank1SetType(pluggedEndpoint, 3); // BULK IN
+
+	usbd.epBank0EnableTransferComplete(pluggedEndpoint);
+	usbd.epBank1EnableTransferComplete(pluggedEndpoint);
+
+	usbBusy = false;
+	bufferState[0] = BUFFER_FREE;
+	bufferState[1] = BUFFER_FREE;
+	armCBW();
+}
+
+void USBMassStorage::handleEndpoint()
+{
+	if (usbd.epBank0IsTransferComplete(pluggedEndpoint))
+	{
+		usbd.epBank0AckTransferComplete(pluggedEndpoint);
+		uint32_t count = usbd.epBank0ByteCount(pluggedEndpoint);
+		if (state == STATE_CBW) {
+			received = count;
+			state = STATE_COMMAND;
+		} else if (state == STATE_DATA_OUT && usbBusy) {
+			bufferLength[usbBuffer] = count;
+			bufferState[usbBuffer] = BUFFER_READY;
+			usbBusy = false;
+		}
+	}
+
+	if (usbd.epBank1IsTransferComplete(pluggedEndpoint))
+	{
+		usbd.epBank1AckTransferComplete(pluggedEndpoint);
+		if (state == STATE_CSW) {
+			// Status sent, ready for the next command
+			armCBW();
+		} else if (state == STATE_DATA_IN && usbBusy) {
+			bufferState[usbBuffer] = BUFFER_FREE;
+			usbBusy = false;
+		}
+	}
+}
+
+// Data moves through the buffers handled by task(), the
+// USBDeviceClass stream API is not used on this endpoint
+uint32_t USBMassStorage::recv(void * /* data */, uint32_t /* len */)
+{
+	return 0;
+}
+
+uint32_t USBMassStorage::available()
+{
+	return 0;
+}
+
+int USBMassStorage::peek()
+{
+	return -1;
+}
+
+// SCSI side
+// ---------
+
+void USBMassStorage::task()
+{
+	if (resetRequested) {
+		synchronized {
+			resetRequested = false;
+			usbd.epBank1ResetReady(pluggedEndpoint);
+			usbBusy = false;
+			bufferState[0] = BUFFER_FREE;
+			bufferState[1] = BUFFER_FREE;
+			armCBW();
+		}
+		return;
+	}
+
+	switch (state) {
+	case STATE_COMMAND:
+		executeCommand();
+		break;
+	case STATE_DATA_IN:
+		continueRead();
+		break;
+	case STATE_DATA_OUT:
+		continueWrite();
+		break;
+	default:
+		break;
+	}
+}
+
+// Short reply to a command, sent from buffer 0
+void USBMassStorage::reply(const void *data, uint32_t len)
+{
+	if (len > residue) {
+		len = residue;
+	}
+	if (len == 0 || !(cbw.flags & MSC_CBW_DIRECTION_IN)) {
+		sendCSW(MSC_CSW_STATUS_PASSED);
+		return;
+	}
+
+	memcpy(buffers[0], data, len);
+	residue -= len;
+	deviceSectors = 0;
+
+	// Less than the host asked for: end the data phase with a short packet
+	if (residue) {
+		usbd.epBank1EnableAutoZLP(pluggedEndpoint);
+	} else {
+		usbd.epBank1DisableAutoZLP(pluggedEndpoint);
+	}
+
+	state = STATE_DATA_IN;
+	usbIndex = 1;
+	usbBuffer = 0;
+	bufferState[0] = BUFFER_USB;
+	usbBusy = true;
+	armIn(buffers[0], len);
+}
+
+void USBMassStorage::executeCommand()
+{
+	if (received != MSC_CBW_LENGTH || ((MSCCommandBlockWrapper *)cbwBuffer)->signature != MSC_CBW_SIGNATURE) {
+		// Invalid CBW: stall both directions until Reset Recovery
+		usbd.epBank0SetStallReq(pluggedEndpoint);
+		usbd.epBank1SetStallReq(pluggedEndpoint);
+		state = STATE_CBW;
+		return;
+	}
+
+	memcpy(&cbw, cbwBuffer, sizeof(cbw));
+	residue = cbw.dataLength;
+
+	uint8_t opcode = cbw.cb[0];
+	if (opcode != SCSI_REQUEST_SENSE) {
+		senseKey = SCSI_SENSE_NONE;
+		senseASC = 0;
+	}
+
+	bool present = device && device->sectorCount();
+	bool writable = present && device->isWritable();
+
+	switch (opcode) {
+	case SCSI_TEST_UNIT_READY:
+		if (!present) {
+			fail(SCSI_SENSE_NOT_READY, 0x3A); // medium not present
+		} else {
+			sendCSW(MSC_CSW_STATUS_PASSED);
+		}
+		break;
+
+	case SCSI_REQUEST_SENSE: {
+		uint8_t sense[18] = { 0x70, 0, senseKey, 0, 0, 0, 0, 10, 0, 0, 0, 0, senseASC, 0, 0, 0, 0, 0 };
+		senseKey = SCSI_SENSE_NONE;
+		senseASC = 0;
+		reply(sense, sizeof(sense));
+		break;
+	}
+
+	case SCSI_INQUIRY: {
+		uint8_t inquiry[36] = {
+			0x00,                   // direct access block device
+			0x80,                   // removable
+			0x04,                   // SPC-2
+			0x02,                   // response data format
+			31, 0, 0, 0,            // additional length, flags
+			'A', 'r', 'd', 'u', 'i', 'n', 'o', ' ',
+			'M', 'a', 's', 's', ' ', 'S', 't', 'o', 'r', 'a', 'g', 'e', ' ', ' ', ' ', ' ',
+			'1', '.', '0', ' '
+		};
+		reply(inquiry, sizeof(inquiry));
+		break;
+	}
+
+	case SCSI_MODE_SENSE6: {
+		uint8_t mode[4] = { 3, 0, (uint8_t)(writable ? 0x00 : 0x80), 0 };
+		reply(mode, sizeof(mode));
+		break;
+	}
+
+	case SCSI_MODE_SENSE10: {
+		uint8_t mode[8] = { 0, 6, 0, (uint8_t)(writable ? 0x00 : 0x80), 0, 0, 0, 0 };
+		reply(mode, sizeof(mode));
+		break;
+	}
+
+	case SCSI_START_STOP_UNIT:
+		// Eject: flush what the host wrote
+		if (present && (cbw.cb[4] & 0x03) == 0x02) {
+			device->sync();
+		}
+		sendCSW(MSC_CSW_STATUS_PASSED);
+		break;
+
+	case SCSI_PREVENT_ALLOW_REMOVAL:
+	case SCSI_VERIFY10:
+		sendCSW(MSC_CSW_STATUS_PASSED);
+		break;
+
+	case SCSI_SYNCHRONIZE_CACHE10:
+		if (present && !device->sync()) {
+			fail(SCSI_SENSE_MEDIUM_ERROR, 0x0C); // write error
+		} else {
+			sendCSW(MSC_CSW_STATUS_PASSED);
+		}
+		break;
+
+	case SCSI_READ_FORMAT_CAPACITIES: {
+		if (!present) {
+			fail(SCSI_SENSE_NOT_READY, 0x3A);
+			break;
+		}
+		uint8_t capacities[12] = { 0, 0, 0, 8, 0, 0, 0, 0, 0x02, 0, (BLOCK_DEVICE_SECTOR_SIZE >> 8), 0 };
+		putBE32(&capacities[4], device->sectorCount());
+		reply(capacities, sizeof(capacities));
+		break;
+	}
+
+	case SCSI_READ_CAPACITY10: {
+		if (!present) {
+			fail(SCSI_SENSE_NOT_READY, 0x3A);
+			break;
+		}
+		uint8_t capacity[8];
+		putBE32(&capacity[0], device->sectorCount() - 1);
+		putBE32(&capacity[4], BLOCK_DEVICE_SECTOR_SIZE);
+		reply(capacity, sizeof(capacity));
+		break;
+	}
+
+	case SCSI_READ10:
+		startRead();
+		break;
+
+	case SCSI_WRITE10:
+		startWrite();
+		break;
+
+	default:
+		fail(SCSI_SENSE_ILLEGAL_REQUEST, 0x20); // invalid command operation code
+		break;
+	}
+}
+
+void USBMassStorage::startRead()
+{
+	uint32_t lba = getBE32(&cbw.cb[2]);
+	uint32_t count = (cbw.cb[7] << 8) | cbw.cb[8];
+
+	if (!device || !device->sectorCount()) {
+		fail(SCSI_SENSE_NOT_READY, 0x3A);
+		return;
+	}
+	if (lba + count > device->sectorCount()) {
+		fail(SCSI_SENSE_ILLEGAL_REQUEST, 0x21); // LBA out of range
+		return;
+	}
+	if (!(cbw.flags & MSC_CBW_DIRECTION_IN) || count * BLOCK_DEVICE_SECTOR_SIZE > residue) {
+		fail(SCSI_SENSE_ILLEGAL_REQUEST, 0x24); // invalid field in CDB
+		return;
+	}
+	if (count == 0) {
+		sendCSW(MSC_CSW_STATUS_PASSED);
+		return;
+	}
+
+	sector = lba;
+	deviceSectors = count;
+	deviceIndex = 0;
+	usbIndex = 0;
+	state = STATE_DATA_IN;
+	usbd.epBank1DisableAutoZLP(pluggedEndpoint);
+	continueRead();
+}
+
+// READ(10): the block device fills one buffer while the other is sent
+void USBMassStorage::continueRead()
+{
+	for (int step = 0; step < 2; step++) {
+		synchronized {
+			if (!usbBusy && bufferState[usbIndex] == BUFFER_READY) {
+				bufferState[usbIndex] = BUFFER_USB;
+				usbBuffer = usbIndex;
+				usbBusy = true;
+				residue -= bufferLength[usbIndex];
+				armIn(buffers[usbIndex], bufferLength[usbIndex]);
+				usbIndex ^= 1;
+			}
+		}
+
+		if (step == 0 && deviceSectors && bufferState[deviceIndex] == BUFFER_FREE) {
+			uint32_t n = deviceSectors;
+			if (n > USB_MSC_BUFFER_SECTORS) {
+				n = USB_MSC_BUFFER_SECTORS;
+			}
+			if (device->readSectors(sector, buffers[deviceIndex], n)) {
+				bufferLength[deviceIndex] = n * BLOCK_DEVICE_SECTOR_SIZE;
+				bufferState[deviceIndex] = BUFFER_READY;
+				sector += n;
+				deviceSectors -= n;
+				deviceIndex ^= 1;
+			} else {
+				senseKey = SCSI_SENSE_MEDIUM_ERROR;
+				senseASC = 0x11; // unrecovered read error
+				deviceSectors = 0;
+			}
+		}
+	}
+
+	if (deviceSectors || usbBusy || bufferState[0] == BUFFER_READY || bufferState[1] == BUFFER_READY) {
+		return;
+	}
+
+	if (senseKey != SCSI_SENSE_NONE) {
+		fail(senseKey, senseASC);
+	} else {
+		sendCSW(MSC_CSW_STATUS_PASSED);
+	}
+}
+
+void USBMassStorage::startWrite()
+{
+	uint32_t lba = getBE32(&cbw.cb[2]);
+	uint32_t count = (cbw.cb[7] << 8) | cbw.cb[8];
+
+	if (!device || !device->sectorCount()) {
+		fail(SCSI_SENSE_NOT_READY, 0x3A);
+		return;
+	}
+	if (!device->isWritable()) {
+		fail(SCSI_SENSE_DATA_PROTECT, 0x27); // write protected
+		return;
+	}
+	if (lba + count > device->sectorCount()) {
+		fail(SCSI_SENSE_ILLEGAL_REQUEST, 0x21);
+		return;
+	}
+	if ((cbw.flags & MSC_CBW_DIRECTION_IN) || count * BLOCK_DEVICE_SECTOR_SIZE > residue) {
+		fail(SCSI_SENSE_ILLEGAL_REQUEST, 0x24);
+		return;
+	}
+	if (count == 0) {
+		sendCSW(MSC_CSW_STATUS_PASSED);
+		return;
+	}
+
+	sector = lba;
+	deviceSectors = count;
+	usbBytes = count * BLOCK_DEVICE_SECTOR_SIZE;
+	deviceIndex = 0;
+	usbIndex = 0;
+	state = STATE_DATA_OUT;
+	continueWrite();
+}
+
+// WRITE(10): the host fills one buffer while the other is written
+void USBMassStorage::continueWrite()
+{
+	synchronized {
+		if (usbBytes && !usbBusy && bufferState[usbIndex] == BUFFER_FREE) {
+			uint32_t len = usbBytes;
+			if (len > USB_MSC_BUFFER_SIZE) {
+				len = USB_MSC_BUFFER_SIZE;
+			}
+			bufferState[usbIndex] = BUFFER_USB;
+			usbBuffer = usbIndex;
+			usbBusy = true;
+			usbBytes -= len;
+			armOut(buffers[usbIndex], len);
+			usbIndex ^= 1;
+		}
+	}
+
+	if (bufferState[deviceIndex] == BUFFER_READY) {
+		uint32_t len = bufferLength[deviceIndex];
+		uint32_t n = len / BLOCK_DEVICE_SECTOR_SIZE;
+		if (n > deviceSectors) {
+			n = deviceSectors;
+		}
+		// After an error keep draining the host data, but stop writing
+		if (senseKey == SCSI_SENSE_NONE && n && !device->writeSectors(sector, buffers[deviceIndex], n)) {
+			senseKey = SCSI_SENSE_MEDIUM_ERROR;
+			senseASC = 0x0C; // write error
+		}
+		sector += n;
+		deviceSectors -= n;
+		residue -= len;
+		bufferState[deviceIndex] = BUFFER_FREE;
+		deviceIndex ^= 1;
+	}
+
+	if (usbBytes || usbBusy || bufferState[0] != BUFFER_FREE || bufferState[1] != BUFFER_FREE) {
+		return;
+	}
+
+	// All data received, no stall needed on failure
+	sendCSW(senseKey == SCSI_SENSE_NONE ? MSC_CSW_STATUS_PASSED : MSC_CSW_STATUS_FAILED);
+}
+
+#endif /* if defined(USBCON) */
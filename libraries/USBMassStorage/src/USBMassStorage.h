@@ -0,0 +1,176 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _USB_MASS_STORAGE_H_INCLUDED
+#define _USB_MASS_STORAGE_H_INCLUDED
+
+#include <Arduino.h>
+#include "api/PluggableUSB.h"
+#include "USB/SAMD21_USBDevice.h"
+
+#include "BlockDevice.h"
+#include "FlashBlockDevice.h"
+
+#if defined(USBCON)
+
+// Bulk-Only Transport
+#define MSC_CBW_SIGNATURE             0x43425355
+#define MSC_CSW_SIGNATURE             0x53425355
+#define MSC_CBW_LENGTH                31
+#define MSC_CSW_LENGTH                13
+
+#define MSC_CSW_STATUS_PASSED         0x00
+#define MSC_CSW_STATUS_FAILED         0x01
+#define MSC_CSW_STATUS_PHASE_ERROR    0x02
+
+// SCSI commands
+#define SCSI_TEST_UNIT_READY          0x00
+#define SCSI_REQUEST_SENSE            0x03
+#define SCSI_INQUIRY                  0x12
+#define SCSI_MODE_SENSE6              0x1A
+#define SCSI_START_STOP_UNIT          0x1B
+#define SCSI_PREVENT_ALLOW_REMOVAL    0x1E
+#define SCSI_READ_FORMAT_CAPACITIES   0x23
+#define SCSI_READ_CAPACITY10          0x25
+#define SCSI_READ10                   0x28
+#define SCSI_WRITE10                  0x2A
+#define SCSI_VERIFY10                 0x2F
+#define SCSI_SYNCHRONIZE_CACHE10      0x35
+#define SCSI_MODE_SENSE10             0x5A
+
+// SCSI sense keys
+#define SCSI_SENSE_NONE               0x00
+#define SCSI_SENSE_NOT_READY          0x02
+#define SCSI_SENSE_MEDIUM_ERROR       0x03
+#define SCSI_SENSE_ILLEGAL_REQUEST    0x05
+#define SCSI_SENSE_DATA_PROTECT       0x07
+
+// Sectors per transfer buffer. Two buffers are used so that the block
+// device works on one while the other is on the bus.
+#ifndef USB_MSC_BUFFER_SECTORS
+#define USB_MSC_BUFFER_SECTORS        2
+#endif
+#define USB_MSC_BUFFER_SIZE           (USB_MSC_BUFFER_SECTORS * BLOCK_DEVICE_SECTOR_SIZE)
+
+typedef struct __attribute__((packed))
+{
+  uint32_t signature;
+  uint32_t tag;
+  uint32_t dataLength;
+  uint8_t  flags;
+  uint8_t  lun;
+  uint8_t  cbLength;
+  uint8_t  cb[16];
+} MSCCommandBlockWrapper;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t signature;
+  uint32_t tag;
+  uint32_t residue;
+  uint8_t  status;
+} MSCCommandStatusWrapper;
+
+class USBMassStorage : public PluggableUSBModule, public EPHandler
+{
+public:
+  USBMassStorage();
+
+  // Expose device to the host; NULL reports "no medium"
+  void begin(BlockDevice *device);
+  void end();
+
+  // Runs SCSI commands and block device I/O, call it from loop().
+  // Block devices are never accessed from the USB interrupt.
+  void task();
+
+  // EPHandler
+  virtual void init();
+  virtual void handleEndpoint();
+  virtual uint32_t recv(void *data, uint32_t len);
+  virtual uint32_t available();
+  virtual int peek();
+
+protected:
+  // Implementation of the PluggableUSBModule
+  int getInterface(uint8_t* interfaceCount);
+  int getDescriptor(USBSetup& setup);
+  bool setup(USBSetup& setup);
+
+private:
+  enum State {
+    STATE_CBW,          // waiting for a command
+    STATE_COMMAND,      // command received, to be executed by task()
+    STATE_DATA_IN,
+    STATE_DATA_OUT,
+    STATE_CSW           // status armed on the IN endpoint
+  };
+
+  enum BufferState {
+    BUFFER_FREE,
+    BUFFER_USB,         // owned by the USB peripheral
+    BUFFER_READY        // holds data for the other side
+  };
+
+  void armCBW();
+  void armIn(const void *data, uint32_t len);
+  void armOut(void *data, uint32_t len);
+  void sendCSW(uint8_t status);
+  void fail(uint8_t senseKey, uint8_t asc);
+  void reply(const void *data, uint32_t len);
+
+  void executeCommand();
+  void startRead();
+  void startWrite();
+  void continueRead();
+  void continueWrite();
+
+  BlockDevice *device;
+  unsigned int epType[1];
+
+  volatile State state;
+  volatile bool resetRequested;
+
+  MSCCommandBlockWrapper cbw;
+  MSCCommandStatusWrapper csw;
+  uint32_t residue;
+
+  uint8_t senseKey;
+  uint8_t senseASC;
+
+  // READ(10) / WRITE(10) in progress
+  uint32_t sector;          // next sector for the block device
+  uint32_t deviceSectors;   // sectors the block device still has to move
+  uint32_t usbBytes;        // bytes the bus still has to move
+  uint8_t deviceIndex;      // next buffer for the block device
+  uint8_t usbIndex;         // next buffer for the bus
+  volatile uint8_t usbBuffer;  // buffer currently on the bus
+  volatile bool usbBusy;
+  volatile uint32_t received;
+
+  volatile BufferState bufferState[2];
+  uint32_t bufferLength[2];
+
+  __attribute__((__aligned__(4))) uint8_t cbwBuffer[EPX_SIZE];
+  __attribute__((__aligned__(4))) uint8_t cswBuffer[MSC_CSW_LENGTH];
+  __attribute__((__aligned__(4))) uint8_t buffers[2][USB_MSC_BUFFER_SIZE];
+};
+
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ This example streams analog samples to the host over a vendor-specific
+ bulk interface. Two buffers are used in ping-pong: while one is being
+ sent by the USB peripheral the other one is filled.
+
+ On Windows the interface binds to WinUSB without an INF file, on Linux
+ and macOS it can be opened with libusb.
+
+ Circuit:
+ * Arduino/Genuino Zero, MKR family and Nano 33 IoT
+ * analog signal on A1
+ */
+
+#include <USBVendor.h>
+
+#define SAMPLES 2048
+
+USBVendor vendor;
+
+uint16_t buffers[2][SAMPLES] __attribute__((aligned(4)));
+volatile bool busy[2];
+int current = 0;
+
+void sent(void *buffer, uint32_t length) {
+  // called from the USB interrupt when a buffer has been sent
+  busy[buffer == buffers[0] ? 0 : 1] = false;
+}
+
+void setup() {
+}
+
+void loop() {
+  // wait for the buffer to be sent
+  while (busy[current]);
+
+  for (int i = 0; i < SAMPLES; i++) {
+    buffers[current][i] = analogRead(A1);
+  }
+
+  busy[current] = true;
+  if (!vendor.queueWrite(buffers[current], sizeof(buffers[current]), sent)) {
+    busy[current] = false;
+  }
+  current = 1 - current;
+}
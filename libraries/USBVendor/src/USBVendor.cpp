@@ -0,0 +1,389 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "USBVendor.h"
+
+#if defined(USBCON)
+
+extern USBDevice_SAMD21G18x usbd;
+extern USBDeviceClass USBDevice;
+
+// {D8DD60DF-4589-4CC7-9CD2-659D9E648A9F}
+static const uint8_t MS_OS_20_PLATFORM_UUID[16] = {
+	0xDF, 0x60, 0xDD, 0xD8, 0x89, 0x45, 0xC7, 0x4C,
+	0x9C, 0xD2, 0x65, 0x9D, 0x9E, 0x64, 0x8A, 0x9F
+};
+
+USBVendor *USBVendor::rootVendor = NULL;
+
+USBVendor::USBVendor(const char *interfaceGUID) : PluggableUSBModule(1, 1, epType),
+	guid(interfaceGUID), nextVendor(NULL)
+{
+	memset(&in, 0, sizeof(in));
+	memset(&out, 0, sizeof(out));
+
+	// Bulk OUT and IN on the same endpoint number, serviced by this object
+	epType[0] = USB_ENDPOINT_HANDLER(USB_ENDPOINT_PAIR(USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_OUT(0),
+	                                                   USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_IN(0)));
+	if (!PluggableUSB().plug(this)) {
+		return;
+	}
+	USBDevice.setHandler(pluggedEndpoint, this);
+
+	if (!rootVendor) {
+		rootVendor = this;
+	} else {
+		USBVendor *current = rootVendor;
+		while (current->nextVendor) {
+			current = current->nextVendor;
+		}
+		current->nextVendor = this;
+	}
+}
+
+int USBVendor::getInterface(uint8_t* interfaceCount)
+{
+	*interfaceCount += 1; // uses 1
+	USBVendorDescriptor vendorInterface = {
+		D_INTERFACE(pluggedInterface, 2, USB_DEVICE_CLASS_VENDOR_SPECIFIC, 0, 0),
+		D_ENDPOINT(USB_ENDPOINT_OUT(pluggedEndpoint), USB_ENDPOINT_TYPE_BULK, EPX_SIZE, 0),
+		D_ENDPOINT(USB_ENDPOINT_IN(pluggedEndpoint), USB_ENDPOINT_TYPE_BULK, EPX_SIZE, 0)
+	};
+	return USBDevice.sendControl(&vendorInterface, sizeof(vendorInterface));
+}
+
+int USBVendor::getDescriptor(USBSetup& setup)
+{
+	// The first instance answers the BOS request for all of them
+	if (setup.wValueH != USB_BOS_DESCRIPTOR_TYPE || this != rootVendor) {
+		return 0;
+	}
+
+	USBVendorBOSDescriptor bos = {
+		5, USB_BOS_DESCRIPTOR_TYPE, sizeof(USBVendorBOSDescriptor), 1,
+		28, USB_DEVICE_CAPABILITY_TYPE, 5, 0,
+		{ 0 },
+		MS_OS_20_WINDOWS_VERSION,
+		descriptorSetLength(),
+		USB_VENDOR_MS_VENDOR_CODE,
+		0
+	};
+	memcpy(bos.platformUUID, MS_OS_20_PLATFORM_UUID, sizeof(bos.platformUUID));
+
+	uint32_t len = sizeof(bos);
+	if (len > setup.wLength) {
+		len = setup.wLength;
+	}
+	return USBDevice.sendControl(&bos, len);
+}
+
+bool USBVendor::setup(USBSetup& setup)
+{
+	if (this != rootVendor) {
+		return false;
+	}
+
+	if (setup.bmRequestType == (REQUEST_DEVICETOHOST | REQUEST_VENDOR | REQUEST_DEVICE) &&
+	    setup.bRequest == USB_VENDOR_MS_VENDOR_CODE &&
+	    setup.wIndex == MS_OS_20_DESCRIPTOR_INDEX)
+	{
+		return sendDescriptorSet(setup.wLength);
+	}
+	return false;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v & 0xFFFF);
+	put16(p + 2, v >> 16);
+}
+
+uint16_t USBVendor::descriptorSetLength()
+{
+	uint16_t len = MS_OS_20_SET_HEADER_LENGTH + MS_OS_20_CONFIGURATION_HEADER_LENGTH;
+	uint8_t n = 0;
+	for (USBVendor *v = rootVendor; v && n < USB_VENDOR_MAX_MSOS_FUNCTIONS; v = v->nextVendor, n++) {
+		len += MS_OS_20_FUNCTION_LENGTH;
+	}
+	return len;
+}
+
+// Function subset binding this interface to WinUSB, with its
+// DeviceInterfaceGUIDs registry property
+uint16_t USBVendor::appendFunction(uint8_t *p)
+{
+	static const char propertyName[] = "DeviceInterfaceGUIDs";
+	uint8_t *start = p;
+
+	// Function subset header
+	put16(p, 8);
+	put16(p + 2, MS_OS_20_SUBSET_HEADER_FUNCTION);
+	p[4] = pluggedInterface;
+	p[5] = 0;
+	put16(p + 6, MS_OS_20_FUNCTION_LENGTH);
+	p += 8;
+
+	// Compatible ID
+	put16(p, 20);
+	put16(p + 2, MS_OS_20_FEATURE_COMPATIBLE_ID);
+	memset(p + 4, 0, 16);
+	memcpy(p + 4, "WINUSB", 6);
+	p += 20;
+
+	// Registry property, REG_MULTI_SZ: name and GUID in UTF-16
+	put16(p, 132);
+	put16(p + 2, MS_OS_20_FEATURE_REG_PROPERTY);
+	put16(p + 4, 7);
+	put16(p + 6, 2 * sizeof(propertyName));
+	p += 8;
+	for (uint8_t i = 0; i < sizeof(propertyName); i++) {
+		put16(p, propertyName[i]);
+		p += 2;
+	}
+	put16(p, 80);
+	p += 2;
+	for (uint8_t i = 0; i < 40; i++) {
+		put16(p, i < 38 ? guid[i] : 0);
+		p += 2;
+	}
+
+	return p - start;
+}
+
+// The descriptor set is larger than a packet: the USB peripheral sends it
+// straight from here, in as many packets as needed
+static __attribute__((__aligned__(4)))
+uint8_t descriptorSet[MS_OS_20_SET_HEADER_LENGTH + MS_OS_20_CONFIGURATION_HEADER_LENGTH +
+                      USB_VENDOR_MAX_MSOS_FUNCTIONS * MS_OS_20_FUNCTION_LENGTH];
+
+bool USBVendor::sendDescriptorSet(uint16_t maxlen)
+{
+	uint8_t *set = descriptorSet;
+	uint16_t total = descriptorSetLength();
+	uint8_t *p = set;
+
+	// Set header
+	put16(p, MS_OS_20_SET_HEADER_LENGTH);
+	put16(p + 2, MS_OS_20_SET_HEADER_DESCRIPTOR);
+	put32(p + 4, MS_OS_20_WINDOWS_VERSION);
+	put16(p + 8, total);
+	p += MS_OS_20_SET_HEADER_LENGTH;
+
+	// Configuration subset header
+	put16(p, MS_OS_20_CONFIGURATION_HEADER_LENGTH);
+	put16(p + 2, MS_OS_20_SUBSET_HEADER_CONFIGURATION);
+	p[4] = 0;
+	p[5] = 0;
+	put16(p + 6, total - MS_OS_20_SET_HEADER_LENGTH);
+	p += MS_OS_20_CONFIGURATION_HEADER_LENGTH;
+
+	uint8_t n = 0;
+	for (USBVendor *v = rootVendor; v && n < USB_VENDOR_MAX_MSOS_FUNCTIONS; v = v->nextVendor, n++) {
+		p += v->appendFunction(p);
+	}
+
+	USBDevice.sendDescriptorBuffer(set, total, maxlen);
+	return true;
+}
+
+bool USBVendor::queue(TransferQueue &q, void *data, uint32_t length, USBVendorCallback callback)
+{
+	synchronized {
+		if (q.count == USB_VENDOR_QUEUE_SIZE) {
+			return false;
+		}
+
+		Transfer &t = q.transfers[(q.head + q.count) % USB_VENDOR_QUEUE_SIZE];
+		t.data = reinterpret_cast<uint8_t *>(data);
+		t.length = length;
+		t.done = 0;
+		t.callback = callback;
+		q.count++;
+
+		// Start right away if the endpoint is idle
+		if (!q.armed && USBDevice.configured()) {
+			if (&q == &in) {
+				armWrite();
+			} else {
+				armRead();
+			}
+		}
+	}
+	return true;
+}
+
+bool USBVendor::queueWrite(const void *data, uint32_t length, USBVendorCallback callback)
+{
+	return queue(in, const_cast<void *>(data), length, callback);
+}
+
+bool USBVendor::queueRead(void *buffer, uint32_t size, USBVendorCallback callback)
+{
+	if (size == 0 || (size % EPX_SIZE) != 0) {
+		return false;
+	}
+	return queue(out, buffer, size, callback);
+}
+
+uint32_t USBVendor::pendingWrites()
+{
+	return in.count;
+}
+
+uint32_t USBVendor::pendingReads()
+{
+	return out.count;
+}
+
+// Arm bank 1 with the next chunk of the head IN transfer: the hardware
+// splits it in packets and only interrupts when the whole chunk is sent
+void USBVendor::armWrite()
+{
+	Transfer &t = in.transfers[in.head];
+	uint32_t len = t.length - t.done;
+	if (len > USB_VENDOR_MAX_CHUNK) {
+		len = USB_VENDOR_MAX_CHUNK;
+	}
+	in.chunk = len;
+	in.armed = true;
+
+	usbd.epBank1SetAddress(pluggedEndpoint, t.data + t.done);
+	usbd.epBank1SetMultiPacketSize(pluggedEndpoint, 0);
+	usbd.epBank1SetByteCount(pluggedEndpoint, len);
+	if (t.done + len == t.length) {
+		usbd.epBank1EnableAutoZLP(pluggedEndpoint);
+	} else {
+		usbd.epBank1DisableAutoZLP(pluggedEndpoint);
+	}
+	usbd.epBank1AckTransferComplete(pluggedEndpoint);
+	usbd.epBank1SetReady(pluggedEndpoint);
+}
+
+// Arm bank 0 to receive up to the next chunk of the head OUT transfer
+void USBVendor::armRead()
+{
+	Transfer &t = out.transfers[out.head];
+	uint32_t len = t.length - t.done;
+	if (len > USB_VENDOR_MAX_CHUNK) {
+		len = USB_VENDOR_MAX_CHUNK;
+	}
+	out.chunk = len;
+	out.armed = true;
+
+	usbd.epBank0SetAddress(pluggedEndpoint, t.data + t.done);
+	usbd.epBank0SetMultiPacketSize(pluggedEndpoint, len);
+	usbd.epBank0SetByteCount(pluggedEndpoint, 0);
+	usbd.epBank0AckTransferComplete(pluggedEndpoint);
+	usbd.epBank0ResetReady(pluggedEndpoint);
+}
+
+void USBVendor::complete(TransferQueue &q)
+{
+	Transfer &t = q.transfers[q.head];
+	q.head = (q.head + 1) % USB_VENDOR_QUEUE_SIZE;
+	q.count--;
+	if (t.callback) {
+		t.callback(t.data, t.done);
+	}
+}
+
+void USBVendor::init()
+{
+	usbd.epBank0SetSize(pluggedEndpoint, EPX_SIZE);
+	usbd.epBank0SetType(pluggedEndpoint, 3); // BULK OUT
+	usbd.epBank1SetSize(pluggedEndpoint, EPX_SIZE);
+	usbd.epBank1SetType(pluggedEndpoint, 3); // BULK IN
+
+	usbd.epBank0EnableTransferComplete(pluggedEndpoint);
+	usbd.epBank1EnableTransferComplete(pluggedEndpoint);
+
+	// Resume whatever was queued before the host configured us
+	in.armed = false;
+	out.armed = false;
+	if (in.count) {
+		armWrite();
+	}
+	if (out.count) {
+		armRead();
+	} else {
+		// No buffer: NAK the host until one is queued
+		usbd.epBank0SetReady(pluggedEndpoint);
+	}
+}
+
+void USBVendor::handleEndpoint()
+{
+	if (usbd.epBank1IsTransferComplete(pluggedEndpoint))
+	{
+		usbd.epBank1AckTransferComplete(pluggedEndpoint);
+		in.armed = false;
+		if (in.count) {
+			in.transfers[in.head].done += in.chunk;
+			if (in.transfers[in.head].done >= in.transfers[in.head].length) {
+				complete(in);
+			}
+			// The callback may already have started the next one
+			if (in.count && !in.armed) {
+				armWrite();
+			}
+		}
+	}
+
+	if (usbd.epBank0IsTransferComplete(pluggedEndpoint))
+	{
+		usbd.epBank0AckTransferComplete(pluggedEndpoint);
+		out.armed = false;
+		if (out.count) {
+			uint32_t received = usbd.epBank0ByteCount(pluggedEndpoint);
+			Transfer &t = out.transfers[out.head];
+			t.done += received;
+			// A short packet ends the transfer
+			if (received < out.chunk || t.done >= t.length) {
+				complete(out);
+			}
+			if (out.count && !out.armed) {
+				armRead();
+			}
+		}
+	}
+}
+
+// Data is delivered to the buffers passed to queueRead(), the
+// USBDeviceClass stream API is not used on this endpoint
+uint32_t USBVendor::recv(void * /* data */, uint32_t /* len */)
+{
+	return 0;
+}
+
+uint32_t USBVendor::available()
+{
+	return 0;
+}
+
+int USBVendor::peek()
+{
+	return -1;
+}
+
+#endif /* if defined(USBCON) */
@@ -0,0 +1,163 @@
+/*
+  Copyright (c) 2016 Arduino LLC.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _USB_VENDOR_H_INCLUDED
+#define _USB_VENDOR_H_INCLUDED
+
+#include <Arduino.h>
+#include "api/PluggableUSB.h"
+#include "USB/SAMD21_USBDevice.h"
+
+#if defined(USBCON)
+
+// Microsoft OS 2.0 Descriptors
+#define MS_OS_20_SET_HEADER_DESCRIPTOR       0x00
+#define MS_OS_20_SUBSET_HEADER_CONFIGURATION 0x01
+#define MS_OS_20_SUBSET_HEADER_FUNCTION      0x02
+#define MS_OS_20_FEATURE_COMPATIBLE_ID       0x03
+#define MS_OS_20_FEATURE_REG_PROPERTY        0x04
+#define MS_OS_20_DESCRIPTOR_INDEX            0x07
+#define MS_OS_20_WINDOWS_VERSION             0x06030000 // Windows 8.1
+
+#define MS_OS_20_SET_HEADER_LENGTH           10
+#define MS_OS_20_CONFIGURATION_HEADER_LENGTH 8
+#define MS_OS_20_FUNCTION_LENGTH             160        // subset header + compatible ID + GUID
+
+// bRequest of the vendor request that returns the MS OS 2.0 descriptor set
+#ifndef USB_VENDOR_MS_VENDOR_CODE
+#define USB_VENDOR_MS_VENDOR_CODE            0x20
+#endif
+
+// Interfaces described to Windows. Each one takes an endpoint, so by
+// default all of them are; a lower value saves RAM for the descriptor set.
+#ifndef USB_VENDOR_MAX_MSOS_FUNCTIONS
+#define USB_VENDOR_MAX_MSOS_FUNCTIONS        USB_ENDPOINTS
+#endif
+
+// Transfers that can be queued in each direction
+#ifndef USB_VENDOR_QUEUE_SIZE
+#define USB_VENDOR_QUEUE_SIZE                4
+#endif
+
+// Largest chunk the endpoint moves in one multi-packet transfer
+// (BYTE_COUNT / MULTI_PACKET_SIZE are 14 bits wide)
+#define USB_VENDOR_MAX_CHUNK                 (16384 - EPX_SIZE)
+
+#define USB_VENDOR_DEFAULT_GUID              "{88BAE032-5A81-49F0-BC3D-A4FF138216D6}"
+
+typedef struct __attribute__((packed))
+{
+  InterfaceDescriptor vendor;
+  EndpointDescriptor  out;
+  EndpointDescriptor  in;
+} USBVendorDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t  len;           // 5
+  uint8_t  dtype;         // 0x0F
+  uint16_t totalLength;
+  uint8_t  numDeviceCaps;
+
+  // MS OS 2.0 platform capability
+  uint8_t  capLen;        // 28
+  uint8_t  capDtype;      // 0x10
+  uint8_t  capType;       // 5 PLATFORM
+  uint8_t  reserved;
+  uint8_t  platformUUID[16];
+  uint32_t windowsVersion;
+  uint16_t descriptorSetLength;
+  uint8_t  vendorCode;
+  uint8_t  altEnumCode;
+} USBVendorBOSDescriptor;
+
+// Called from the USB interrupt when a queued transfer completes, with the
+// buffer and the number of bytes actually transferred
+typedef void (*USBVendorCallback)(void *buffer, uint32_t length);
+
+class USBVendor : public PluggableUSBModule, public EPHandler
+{
+public:
+  USBVendor(const char *interfaceGUID = USB_VENDOR_DEFAULT_GUID);
+
+  // Queue a transfer to the host (bulk IN). The data must be in RAM,
+  // 4-byte aligned and left untouched until the callback is invoked.
+  // A transfer whose length is a multiple of 64 is terminated by a ZLP.
+  // Returns false when the queue is full.
+  bool queueWrite(const void *data, uint32_t length, USBVendorCallback callback = NULL);
+
+  // Queue a buffer for data from the host (bulk OUT). Size must be a
+  // multiple of 64; the transfer completes when the buffer is full or
+  // the host sends a short packet.
+  bool queueRead(void *buffer, uint32_t size, USBVendorCallback callback = NULL);
+
+  // Transfers queued and not yet completed
+  uint32_t pendingWrites();
+  uint32_t pendingReads();
+
+  // EPHandler
+  virtual void init();
+  virtual void handleEndpoint();
+  virtual uint32_t recv(void *data, uint32_t len);
+  virtual uint32_t available();
+  virtual int peek();
+
+protected:
+  // Implementation of the PluggableUSBModule
+  int getInterface(uint8_t* interfaceCount);
+  int getDescriptor(USBSetup& setup);
+  bool setup(USBSetup& setup);
+
+private:
+  typedef struct {
+    uint8_t *data;
+    uint32_t length;
+    uint32_t done;
+    USBVendorCallback callback;
+  } Transfer;
+
+  typedef struct {
+    Transfer transfers[USB_VENDOR_QUEUE_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t count;
+    uint32_t chunk;       // bytes of the head transfer armed on the endpoint
+    volatile bool armed;
+  } TransferQueue;
+
+  bool queue(TransferQueue &q, void *data, uint32_t length, USBVendorCallback callback);
+  void armWrite();
+  void armRead();
+  void complete(TransferQueue &q);
+
+  uint16_t descriptorSetLength();
+  uint16_t appendFunction(uint8_t *p);
+  bool sendDescriptorSet(uint16_t maxlen);
+
+  unsigned int epType[1];
+  const char *guid;
+
+  TransferQueue in;
+  TransferQueue out;
+
+  USBVendor *nextVendor;
+  static USBVendor *rootVendor;
+};
+
+#endif
+
+#endif